@@ -7,9 +7,7 @@
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
-#ifdef HAVE_PCRE_H
-# include <pcre.h>
-#endif
+#include "pcre-glue.h"
 #include "buffer.h"
 
 #define DATA_IS_STRING(x) (x->type == TYPE_STRING)
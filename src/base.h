@@ -189,6 +189,7 @@ typedef struct {
 	buffer *http_host;
 
 	array  *headers;
+	data_string *headers_by_id[HTTP_HEADER_LAST_ELEMENT]; /* the well-known ones of headers */
 
 	/* CONTENT */
 	off_t   content_length; /* returned by strtoul() */
@@ -257,6 +258,12 @@ typedef struct {
 #endif
 
 	buffer *content_type;
+
+	chunk_fd *fd;          /* the open file, the connections which send it share it (regular files only) */
+
+	/* the response-header values of mod_staticfile, built on the first request */
+	buffer *response_etag;
+	buffer *last_modified;
 } stat_cache_entry;
 
 typedef struct {
@@ -268,11 +275,23 @@ typedef struct {
 	buffer *dir_name;  /* for building the dirname from the filename */
 	buffer *hash_key;  /* tmp-buf for building the hash-key */
 
+	size_t open_fds;   /* the entries which keep their file open */
+
 #if defined(HAVE_SYS_INOTIFY_H)
 	iosocket *sock;    /* socket to the inotify fd (this should be in a backend struct */
 #endif
 } stat_cache;
 
+/**
+ * a token bucket for the traffic-shaper, see traffic_shaper.h
+ */
+typedef struct {
+	off_t tokens;  /* the bytes we may send now, negative if a write took more */
+	off_t burst;   /* the bucket is full at burst tokens */
+	off_t rate;    /* bytes per second */
+	uint64_t ts;   /* ms, the last refill */
+} traffic_bucket;
+
 typedef struct {
 	array *mimetypes;
 
@@ -330,21 +349,17 @@ typedef struct {
 	/* configside */
 	unsigned short global_kbytes_per_second; /*  */
 
-	off_t  global_bytes_per_second_cnt;
 	/* server-wide traffic-shaper
 	 *
-	 * each context has the counter which is inited once
-	 * per second by the global_kbytes_per_second config-var
-	 *
-	 * as soon as global_kbytes_per_second gets below 0
-	 * the connected conns are "offline" a little bit
-	 *
-	 * the problem:
-	 * we somehow have to lose our "we are writable" signal
-	 * on the way.
+	 * each context has a token bucket which is shared by all
+	 * connections in the context and is filled with
+	 * global_kbytes_per_second
 	 *
+	 * if it runs empty the connections wait in srv->pacing until
+	 * the bucket has enough tokens again
 	 */
-	off_t *global_bytes_per_second_cnt_ptr; /*  */
+	traffic_bucket global_traffic;
+	traffic_bucket *global_traffic_ptr; /* the bucket of the context */
 
 #ifdef USE_OPENSSL
 	SSL_CTX *ssl_ctx;
@@ -412,12 +427,18 @@ typedef struct {
 
 	chunkqueue *send;            /* the response-content before filters are applied */
 	chunkqueue *recv;            /* the request-content, without encoding */
+	int stream_request_content;  /* the handler takes the request-content as it arrives, set by the handler */
 
 	filter_chain *send_filters;  /* the chain of filters to apply to response-content. */
 	chunkqueue *send_raw;        /* the full response (HTTP-Header + compression + chunking ) */
 	chunkqueue *recv_raw;        /* the full request (HTTP-Header + chunking ) */
 
-	int traffic_limit_reached;
+	int traffic_limit_reached;    /* waiting in srv->pacing for tokens */
+	traffic_bucket traffic;       /* the connection.kbytes-per-second limit */
+	uint64_t pacing_wakeup;       /* ms, when the connection may write again */
+	int pacing_ndx;               /* the position in srv->pacing, -1 if not waiting */
+	unsigned int pacing_seq;      /* the order in which the connections started to wait */
+	unsigned int pacing_rate;     /* SO_MAX_PACING_RATE of the socket, 0 if unset */
 
 	off_t bytes_written;          /* used by mod_accesslog, mod_rrd */
 	off_t bytes_written_cur_second; /* used by mod_accesslog, mod_rrd */
@@ -455,6 +476,12 @@ typedef struct {
 	specific_config conf;        /* global connection specific config */
 	cond_cache_t *cond_cache;
 
+	/* the results of all conditionals as a bitmap, the key of the config_patch_cache */
+	unsigned char *cond_matched;
+	size_t cond_matched_hash;
+	unsigned int cond_gen;         /* bumped whenever a result might change */
+	unsigned int cond_matched_gen; /* cond_gen at the time cond_matched was built */
+
 	buffer *server_name;
 
 	/* error-handler */
@@ -552,6 +579,7 @@ typedef struct {
 	unsigned short log_request_header_on_error;
 	unsigned short log_state_handling;
 	unsigned short log_timing;
+	unsigned short plugin_timing;
 
 	enum { STAT_CACHE_ENGINE_UNSET,
 			STAT_CACHE_ENGINE_NONE,
@@ -676,6 +704,7 @@ typedef struct server {
 
 	array *config_context;
 	specific_config **config_storage;
+	struct config_cond_index *cond_index; /* the == conditionals by value */
 
 	server_config  srvconf;
 
@@ -686,6 +715,7 @@ typedef struct server {
 	connections *joblist;
 	connections *joblist_prev;
 	connections *fdwaitqueue;
+	connections *pacing;  /* the connections waiting for tokens, a heap by pacing_wakeup */
 
 	stat_cache  *stat_cache;
 
@@ -103,7 +103,8 @@ typedef enum {
 	ENCODING_REL_URI_PART, /* same as ENC_REL_URL plus encoding "/" as "%2F" */
 	ENCODING_HTML,    /* "&" becomes "&amp;" and so on */
 	ENCODING_MINIMAL_XML, /* minimal encoding for xml */
-	ENCODING_HEX      /* encode string as hex */
+	ENCODING_HEX,     /* encode string as hex */
+	ENCODING_JSON     /* for a JSON string: " becomes \u0022 and so on */
 } buffer_encoding_t;
 
 LI_API int buffer_append_string_encoded(buffer *b, const char *s, size_t s_len, buffer_encoding_t encoding);
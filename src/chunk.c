@@ -22,6 +22,11 @@
 
 #include "log.h"
 
+#ifdef USE_LINUX_SPLICE
+# include <sys/ioctl.h>
+# include <unistd.h>
+#endif
+
 /**
  * create a global pool for unused chunks
  *
@@ -36,6 +41,52 @@
 static chunk *chunkpool        = NULL;
 static size_t chunkpool_chunks = 0;
 
+#ifdef USE_LINUX_SPLICE
+/**
+ * creating a pipe costs two fds and a syscall, keep a few empty ones around
+ */
+#define PIPEPOOL_MAX 16
+
+static int pipepool[PIPEPOOL_MAX][2];
+static size_t pipepool_pipes = 0;
+
+static void pipepool_add_unused_pipe(int fd[2]) {
+	int avail = -1;
+
+	/* a pipe which still has data in it can't be used again */
+	if (pipepool_pipes < PIPEPOOL_MAX &&
+	    0 == ioctl(fd[0], FIONREAD, &avail) && avail == 0) {
+		pipepool[pipepool_pipes][0] = fd[0];
+		pipepool[pipepool_pipes][1] = fd[1];
+		pipepool_pipes++;
+	} else {
+		close(fd[0]);
+		close(fd[1]);
+	}
+}
+
+static int pipepool_get_unused_pipe(int fd[2]) {
+	if (pipepool_pipes > 0) {
+		pipepool_pipes--;
+		fd[0] = pipepool[pipepool_pipes][0];
+		fd[1] = pipepool[pipepool_pipes][1];
+
+		return 0;
+	}
+
+	if (-1 == pipe(fd)) return -1;
+
+	fcntl(fd[0], F_SETFL, O_NONBLOCK);
+	fcntl(fd[1], F_SETFL, O_NONBLOCK);
+#ifdef FD_CLOEXEC
+	fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+	return 0;
+}
+#endif
+
 chunkqueue *chunkqueue_init(void) {
 	chunkqueue *cq;
 
@@ -57,6 +108,8 @@ static chunk *chunk_init(void) {
 	c->file.fd = -1;
 	c->file.copy.fd = -1;
 	c->file.mmap.start = MAP_FAILED;
+	c->pipe.fd[0] = -1;
+	c->pipe.fd[1] = -1;
 	c->next = NULL;
 
 #ifdef MCPCHUNK
@@ -71,6 +124,15 @@ static chunk *chunk_init(void) {
 static void chunk_reset(chunk *c) {
 	if (!c) return;
 
+	if (c->shared.buf) {
+		/* hand the content back and take our buffer again */
+		chunk_buffer_release(c->shared.buf);
+		c->shared.buf = NULL;
+
+		c->mem = c->shared.mem;
+		c->shared.mem = NULL;
+	}
+
 	buffer_reset(c->mem);
 
 	if (c->file.is_temp && !buffer_is_empty(c->file.name)) {
@@ -80,10 +142,7 @@ static void chunk_reset(chunk *c) {
 
 	buffer_reset(c->file.name);
 
-	if (c->file.fd != -1) {
-		close(c->file.fd);
-		c->file.fd = -1;
-	}
+	chunk_file_close(c);
 
 	if (c->file.copy.fd != -1) {
 		close(c->file.copy.fd);
@@ -104,6 +163,15 @@ static void chunk_reset(chunk *c) {
 	c->file.copy.length = 0;
 	c->file.copy.offset = 0;
 
+#ifdef USE_LINUX_SPLICE
+	if (c->pipe.fd[0] != -1) {
+		pipepool_add_unused_pipe(c->pipe.fd);
+		c->pipe.fd[0] = -1;
+		c->pipe.fd[1] = -1;
+	}
+#endif
+	c->pipe.length = 0;
+
 	c->async.written = -1;
 	c->async.ret_val = 0;
 
@@ -142,6 +210,10 @@ void chunk_set_done(chunk *c) {
 	case FILE_CHUNK:
 		c->offset = c->file.length;
 
+		break;
+	case PIPE_CHUNK:
+		c->offset = c->pipe.length;
+
 		break;
 	default:
 		break;
@@ -160,6 +232,8 @@ int chunk_is_done(chunk *c) {
 		return ((c->mem->used == 0) || (c->offset == (off_t)c->mem->used - 1));
 	case FILE_CHUNK:
 		return ((c->file.length == 0) || (c->offset == c->file.length));
+	case PIPE_CHUNK:
+		return (c->offset == c->pipe.length);
 	case UNUSED_CHUNK:
 	default:
 		return 1;
@@ -173,6 +247,8 @@ off_t chunk_length(chunk *c) {
 		return (off_t)c->mem->used - 1 - c->offset;
 	case FILE_CHUNK:
 		return c->file.length - c->offset;
+	case PIPE_CHUNK:
+		return c->pipe.length - c->offset;
 	case UNUSED_CHUNK:
 		break;
 	}
@@ -189,6 +265,14 @@ void chunkpool_free(void) {
 		chunkpool = c;
 	}
 	chunkpool_chunks = 0;
+
+#ifdef USE_LINUX_SPLICE
+	while (pipepool_pipes > 0) {
+		pipepool_pipes--;
+		close(pipepool[pipepool_pipes][0]);
+		close(pipepool[pipepool_pipes][1]);
+	}
+#endif
 }
 
 static chunk *chunkpool_get_unused_chunk(void) {
@@ -306,6 +390,57 @@ int chunkqueue_append_file(chunkqueue *cq, buffer *fn, off_t offset, off_t len)
 	return 0;
 }
 
+int chunkqueue_append_shared_file(chunkqueue *cq, buffer *fn, chunk_fd *cfd, off_t offset, off_t len) {
+	if (len == 0) return 0;
+
+	chunkqueue_append_file(cq, fn, offset, len);
+
+	if (cfd) {
+		chunk_fd_ref(cfd);
+
+		cq->last->file.shared = cfd;
+		cq->last->file.fd = cfd->fd;
+	}
+
+	return 0;
+}
+
+chunk_fd *chunk_fd_init(int fd) {
+	chunk_fd *cfd = calloc(1, sizeof(*cfd));
+
+	cfd->fd = fd;
+	cfd->refcount = 1;
+
+	return cfd;
+}
+
+void chunk_fd_ref(chunk_fd *cfd) {
+	cfd->refcount++;
+}
+
+void chunk_fd_release(chunk_fd *cfd) {
+	if (!cfd) return;
+
+	if (--cfd->refcount > 0) return;
+
+	close(cfd->fd);
+	free(cfd);
+}
+
+/**
+ * close the fd of a file-chunk, a borrowed one is just handed back
+ */
+void chunk_file_close(chunk *c) {
+	if (c->file.shared) {
+		chunk_fd_release(c->file.shared);
+		c->file.shared = NULL;
+	} else if (c->file.fd != -1) {
+		close(c->file.fd);
+	}
+
+	c->file.fd = -1;
+}
+
 int chunkqueue_steal_tempfile(chunkqueue *cq, chunk *in) {
 	chunk *c;
 
@@ -334,6 +469,7 @@ off_t chunkqueue_steal_chunk(chunkqueue *cq, chunk *c) {
 	/* we are copying the whole buffer, just steal it */
 	off_t total = 0;
 	buffer *b, btmp;
+	chunk *nc;
 
 	if (!cq) return 0;
 	if (chunk_is_done(c)) return 0;
@@ -341,7 +477,11 @@ off_t chunkqueue_steal_chunk(chunkqueue *cq, chunk *c) {
 	switch (c->type) {
 	case MEM_CHUNK:
 		total = c->mem->used - c->offset - 1;
-		if (c->offset == 0) {
+		if (c->shared.buf) {
+			/* the content isn't ours to hand over, share it */
+			chunkqueue_append_shared_mem(cq, c->shared.buf, c->offset);
+			chunk_set_done(c);
+		} else if (c->offset == 0) {
 			b = chunkqueue_get_append_buffer(cq);
 			btmp = *b; *b = *(c->mem); *(c->mem) = btmp;
 		} else {
@@ -355,10 +495,29 @@ off_t chunkqueue_steal_chunk(chunkqueue *cq, chunk *c) {
 		if (c->file.is_temp) {
 			chunkqueue_steal_tempfile(cq, c);
 		} else {
-			chunkqueue_append_file(cq, c->file.name, c->file.start + c->offset, c->file.length - c->offset);
+			chunkqueue_append_shared_file(cq, c->file.name, c->file.shared, c->file.start + c->offset, c->file.length - c->offset);
 			chunk_set_done(c);
 		}
 
+		break;
+	case PIPE_CHUNK:
+		total = c->pipe.length - c->offset;
+
+		/* the data can't be copied, hand the pipe over */
+		nc = chunkpool_get_unused_chunk();
+
+		nc->type = PIPE_CHUNK;
+		nc->pipe.fd[0] = c->pipe.fd[0];
+		nc->pipe.fd[1] = c->pipe.fd[1];
+		nc->pipe.length = total;
+		nc->offset = 0;
+
+		c->pipe.fd[0] = -1;
+		c->pipe.fd[1] = -1;
+		chunk_set_done(c);
+
+		chunkqueue_append_chunk(cq, nc);
+
 		break;
 	case UNUSED_CHUNK:
 		return 0;
@@ -405,7 +564,7 @@ off_t chunkqueue_steal_chunks_len(chunkqueue *out, chunk *c, off_t max_len) {
 
 			if (we_have > max_len) we_have = max_len;
 
-			chunkqueue_append_file(out, c->file.name, c->offset, we_have);
+			chunkqueue_append_shared_file(out, c->file.name, c->file.shared, c->offset, we_have);
 
 			c->offset += we_have;
 			max_len -= we_have;
@@ -498,6 +657,56 @@ off_t chunkqueue_skip(chunkqueue *cq, off_t skip) {
 	return total;
 }
 
+chunk_buffer *chunk_buffer_init(void) {
+	chunk_buffer *cb = calloc(1, sizeof(*cb));
+
+	cb->mem = buffer_init();
+	cb->refcount = 1;
+
+	return cb;
+}
+
+void chunk_buffer_ref(chunk_buffer *cb) {
+	cb->refcount++;
+}
+
+void chunk_buffer_release(chunk_buffer *cb) {
+	if (!cb) return;
+
+	if (--cb->refcount > 0) return;
+
+	buffer_free(cb->mem);
+	free(cb);
+}
+
+/**
+ * append a mem-chunk which refers to the shared buffer, the content isn't copied
+ */
+int chunkqueue_append_shared_mem(chunkqueue *cq, chunk_buffer *cb, size_t offset) {
+	chunk *c;
+
+	if (cb->mem->used <= offset + 1) return 0;
+
+	c = chunkpool_get_unused_chunk();
+	c->type = MEM_CHUNK;
+	c->offset = offset;
+
+	chunk_buffer_ref(cb);
+	c->shared.buf = cb;
+
+	/* without a size the buffer functions allocate a new ptr instead of writing to this one */
+	c->shared.view.ptr = cb->mem->ptr;
+	c->shared.view.used = cb->mem->used;
+	c->shared.view.size = 0;
+
+	c->shared.mem = c->mem;
+	c->mem = &(c->shared.view);
+
+	chunkqueue_append_chunk(cq, c);
+
+	return 0;
+}
+
 int chunkqueue_append_buffer(chunkqueue *cq, buffer *mem) {
 	chunk *c;
 
@@ -623,6 +832,36 @@ chunk *chunkqueue_get_append_tempfile(chunkqueue *cq) {
 	return c;
 }
 
+/**
+ * get a chunk with an empty pipe the caller can splice() into
+ *
+ * @return NULL if pipes aren't supported or we are out of fds
+ */
+chunk *chunkqueue_get_append_pipe(chunkqueue *cq) {
+#ifdef USE_LINUX_SPLICE
+	chunk *c;
+	int fd[2];
+
+	if (-1 == pipepool_get_unused_pipe(fd)) return NULL;
+
+	c = chunkpool_get_unused_chunk();
+
+	c->type = PIPE_CHUNK;
+	c->offset = 0;
+	c->pipe.fd[0] = fd[0];
+	c->pipe.fd[1] = fd[1];
+	c->pipe.length = 0;
+
+	chunkqueue_append_chunk(cq, c);
+
+	return c;
+#else
+	UNUSED(cq);
+
+	return NULL;
+#endif
+}
+
 
 off_t chunkqueue_length(chunkqueue *cq) {
 	off_t len = 0;
@@ -636,6 +875,9 @@ off_t chunkqueue_length(chunkqueue *cq) {
 		case FILE_CHUNK:
 			len += c->file.length;
 			break;
+		case PIPE_CHUNK:
+			len += c->pipe.length;
+			break;
 		default:
 			break;
 		}
@@ -652,6 +894,7 @@ off_t chunkqueue_written(chunkqueue *cq) {
 		switch (c->type) {
 		case MEM_CHUNK:
 		case FILE_CHUNK:
+		case PIPE_CHUNK:
 			len += c->offset;
 			break;
 		default:
@@ -702,7 +945,16 @@ void chunkqueue_remove_empty_last_chunk(chunkqueue *cq) {
 	if (!cq->last) return;
 	if (!cq->first) return;
 
-	if (cq->last->type != MEM_CHUNK || cq->last->mem->used != 0) return;
+	switch (cq->last->type) {
+	case MEM_CHUNK:
+		if (cq->last->mem->used != 0) return;
+		break;
+	case PIPE_CHUNK:
+		if (cq->last->pipe.length != 0) return;
+		break;
+	default:
+		return;
+	}
 
 	if (cq->first == cq->last) {
 		c = cq->first;
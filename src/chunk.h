@@ -7,11 +7,38 @@
 
 #define MCPCHUNK
 
+/**
+ * an open file which is shared by the file-chunks of several connections
+ *
+ * the stat-cache keeps the static files open, the chunks only borrow the fd
+ */
+typedef struct {
+	int fd;
+	int refcount;
+} chunk_fd;
+
+/**
+ * an immutable buffer which is shared by the mem-chunks of several connections
+ *
+ * e.g. the small files in the memory-cache of mod_staticfile
+ */
+typedef struct {
+	buffer *mem;
+	int refcount;
+} chunk_buffer;
+
 typedef struct chunk {
-	enum { UNUSED_CHUNK, MEM_CHUNK, FILE_CHUNK } type;
+	enum { UNUSED_CHUNK, MEM_CHUNK, FILE_CHUNK, PIPE_CHUNK } type;
 
 	buffer *mem; /* either the storage of the mem-chunk or the read-ahead buffer */
 
+	struct {
+		/* mem-chunk: mem points to the view of buf->mem, the content isn't ours */
+		chunk_buffer *buf;
+		buffer view;
+		buffer *mem;       /* our own buffer while it is swapped out */
+	} shared;
+
 	struct {
 		/* filechunk */
 		buffer *name; /* name of the file */
@@ -19,6 +46,7 @@ typedef struct chunk {
 		off_t  length; /* octets to send from the starting offset */
 
 		int    fd;
+		chunk_fd *shared; /* the fd is borrowed from it and isn't ours to close */
 		struct {
 			char   *start; /* the start pointer of the mmap'ed area */
 			size_t length; /* size of the mmap'ed area */
@@ -34,10 +62,17 @@ typedef struct chunk {
 		} copy;
 	} file;
 
+	struct {
+		/* pipechunk: the data is in the kernel, it is splice()d in and out */
+		int    fd[2];  /* read- and write-end of the pipe */
+		off_t  length; /* octets spliced into the pipe */
+	} pipe;
+
 	off_t  offset; /* octets sent from this chunk
 			  the size of the chunk is either
 			  - mem-chunk: mem->used - 1
 			  - file-chunk: file.length
+			  - pipe-chunk: pipe.length
 			*/
 
 	struct {
@@ -68,13 +103,16 @@ LI_API void chunkpool_free(void);
 LI_API chunkqueue* chunkqueue_init(void);
 LI_API int chunkqueue_set_tempdirs(chunkqueue *c, array *tempdirs);
 LI_API int chunkqueue_append_file(chunkqueue *c, buffer *fn, off_t offset, off_t len);
+LI_API int chunkqueue_append_shared_file(chunkqueue *c, buffer *fn, chunk_fd *cfd, off_t offset, off_t len);
 LI_API int chunkqueue_append_mem(chunkqueue *c, const char *mem, size_t len);
+LI_API int chunkqueue_append_shared_mem(chunkqueue *c, chunk_buffer *cb, size_t offset);
 LI_API int chunkqueue_append_buffer(chunkqueue *c, buffer *mem);
 LI_API int chunkqueue_prepend_buffer(chunkqueue *c, buffer *mem);
 
 LI_API buffer * chunkqueue_get_append_buffer(chunkqueue *c);
 LI_API buffer * chunkqueue_get_prepend_buffer(chunkqueue *c);
 LI_API chunk * chunkqueue_get_append_tempfile(chunkqueue *cq);
+LI_API chunk * chunkqueue_get_append_pipe(chunkqueue *cq);
 LI_API int chunkqueue_steal_tempfile(chunkqueue *cq, chunk *in);
 LI_API off_t chunkqueue_steal_chunk(chunkqueue *cq, chunk *c);
 LI_API off_t chunkqueue_steal_chunks_len(chunkqueue *cq, chunk *c, off_t max_len);
@@ -93,6 +131,16 @@ LI_API int chunkqueue_is_empty(chunkqueue *c);
 
 LI_API void chunkqueue_print(chunkqueue *cq);
 
+LI_API chunk_fd *chunk_fd_init(int fd);
+LI_API void chunk_fd_ref(chunk_fd *cfd);
+LI_API void chunk_fd_release(chunk_fd *cfd);
+
+LI_API void chunk_file_close(chunk *c);
+
+LI_API chunk_buffer *chunk_buffer_init(void);
+LI_API void chunk_buffer_ref(chunk_buffer *cb);
+LI_API void chunk_buffer_release(chunk_buffer *cb);
+
 LI_API int chunk_is_done(chunk *c);
 LI_API void chunk_set_done(chunk *c);
 LI_API off_t chunk_length(chunk *c);
@@ -114,8 +114,10 @@
 #cmakedefine  HAVE_CRYPT
 #cmakedefine  HAVE_EPOLL_CTL
 #cmakedefine  HAVE_FORK
+#cmakedefine  HAVE_WORKING_VFORK
 #cmakedefine  HAVE_GETRLIMIT
 #cmakedefine  HAVE_GETUID
+#cmakedefine  HAVE_FSTATAT
 #cmakedefine  HAVE_GMTIME_R
 #cmakedefine  HAVE_INET_NTOP
 #cmakedefine  HAVE_KQUEUE
@@ -135,6 +137,7 @@
 #cmakedefine  HAVE_SENDFILE
 #cmakedefine  HAVE_SENDFILE64
 #cmakedefine  HAVE_SENDFILEV
+#cmakedefine  HAVE_SPLICE
 #cmakedefine  HAVE_SIGACTION
 #cmakedefine  HAVE_SIGNAL
 #cmakedefine  HAVE_SIGTIMEDWAIT
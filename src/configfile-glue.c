@@ -1,4 +1,5 @@
 #include <string.h>
+#include <stdlib.h>
 #include <ctype.h>
 
 #include "base.h"
@@ -7,6 +8,8 @@
 #include "log.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "response.h"
+#include "array-static.h"
 
 /**
  * like all glue code this file contains functions which
@@ -214,11 +217,72 @@ unsigned short sock_addr_get_port(sock_addr *addr) {
 	}
 }
 
+/**
+ * the value of the request a conditional compares against
+ *
+ * @return NULL if there is nothing to compare with
+ */
+static buffer *config_cond_get_value(server *srv, connection *con, comp_key_t comp) {
+	data_string *ds;
+
+	switch (comp) {
+	case COMP_HTTP_HOST:
+		if (!buffer_is_empty(con->uri.authority)) {
+			return con->uri.authority;
+#if defined USE_OPENSSL && ! defined OPENSSL_NO_TLSEXT
+		} else if (!buffer_is_empty(con->sock->tlsext_server_name)) {
+			return con->sock->tlsext_server_name;
+#endif
+		}
+		return srv->empty_string;
+	case COMP_HTTP_REMOTE_IP:
+		return con->dst_addr_buf;
+	case COMP_HTTP_SCHEME:
+		return con->uri.scheme;
+	case COMP_HTTP_URL:
+		return con->uri.path;
+	case COMP_HTTP_QUERY_STRING:
+		return con->uri.query;
+	case COMP_SERVER_SOCKET:
+		return ((server_socket *)con->srv_socket)->srv_token;
+	case COMP_HTTP_REFERER:
+		ds = http_request_get_header(con, HTTP_HEADER_REFERER);
+		return ds ? ds->value : srv->empty_string;
+	case COMP_HTTP_COOKIE:
+		ds = http_request_get_header(con, HTTP_HEADER_COOKIE);
+		return ds ? ds->value : srv->empty_string;
+	case COMP_HTTP_USER_AGENT:
+		ds = http_request_get_header(con, HTTP_HEADER_USER_AGENT);
+		return ds ? ds->value : srv->empty_string;
+	case COMP_HTTP_REQUEST_METHOD:
+		/* we only have the request method as const char but we need a buffer for comparing */
+		buffer_copy_string(srv->tmp_buf, get_http_method_name(con->request.http_method));
+		return srv->tmp_buf;
+	case COMP_PHYSICAL_PATH_EXISTS:
+	case COMP_PHYSICAL_PATH:
+		return con->physical.path;
+	default:
+		return NULL;
+	}
+}
+
+/**
+ * "host" as sent by the client plus the port of the server socket
+ */
+static buffer *config_cond_host_with_port(server *srv, connection *con, buffer *host) {
+	server_socket *srv_sock = con->srv_socket;
+
+	buffer_copy_string_buffer(srv->cond_check_buf, host);
+	buffer_append_string_len(srv->cond_check_buf, CONST_STR_LEN(":"));
+	buffer_append_long(srv->cond_check_buf, sock_addr_get_port(&(srv_sock->addr)));
+
+	return srv->cond_check_buf;
+}
+
 static cond_result_t config_check_cond_cached(server *srv, connection *con, data_config *dc);
 
 static cond_result_t config_check_cond_nocache(server *srv, connection *con, data_config *dc) {
 	buffer *l;
-	server_socket *srv_sock = con->srv_socket;
 	/* check parent first */
 	if (dc->parent && dc->parent->context_ndx) {
 		if (con->conf.log_condition_handling) {
@@ -268,53 +332,7 @@ static cond_result_t config_check_cond_nocache(server *srv, connection *con, dat
 
 	/* pass the rules */
 
-	switch (dc->comp) {
-	case COMP_HTTP_HOST: {
-		char *ck_colon = NULL, *val_colon = NULL;
-
-		if (!buffer_is_empty(con->uri.authority)) {
-
-			/*
-			 * append server-port to the HTTP_POST if necessary
-			 */
-
-			l = con->uri.authority;
-
-			switch(dc->cond) {
-			case CONFIG_COND_NE:
-			case CONFIG_COND_EQ:
-				ck_colon = strchr(dc->string->ptr, ':');
-				val_colon = strchr(l->ptr, ':');
-
-				if (ck_colon == val_colon) {
-					/* nothing to do with it */
-					break;
-				}
-				if (ck_colon) {
-					/* condition "host:port" but client send "host" */
-					buffer_copy_string_buffer(srv->cond_check_buf, l);
-					buffer_append_string_len(srv->cond_check_buf, CONST_STR_LEN(":"));
-					buffer_append_long(srv->cond_check_buf, sock_addr_get_port(&(srv_sock->addr)));
-					l = srv->cond_check_buf;
-				} else if (!ck_colon) {
-					/* condition "host" but client send "host:port" */
-					buffer_copy_string_len(srv->cond_check_buf, l->ptr, val_colon - l->ptr);
-					l = srv->cond_check_buf;
-				}
-				break;
-			default:
-				break;
-			}
-#if defined USE_OPENSSL && ! defined OPENSSL_NO_TLSEXT
-		} else if (!buffer_is_empty(con->sock->tlsext_server_name)) {
-			l = con->sock->tlsext_server_name;
-#endif
-		} else {
-			l = srv->empty_string;
-		}
-		break;
-	}
-	case COMP_HTTP_REMOTE_IP: {
+	if (dc->comp == COMP_HTTP_REMOTE_IP) {
 		char *nm_slash;
 		/* handle remoteip limitations
 		 *
@@ -380,72 +398,40 @@ static cond_result_t config_check_cond_nocache(server *srv, connection *con, dat
 			} else {
 				return (dc->cond == CONFIG_COND_EQ) ? COND_RESULT_FALSE : COND_RESULT_TRUE;
 			}
-		} else {
-			l = con->dst_addr_buf;
 		}
-		break;
 	}
-	case COMP_HTTP_SCHEME:
-		l = con->uri.scheme;
-		break;
 
-	case COMP_HTTP_URL:
-		l = con->uri.path;
-		break;
+	l = config_cond_get_value(srv, con, dc->comp);
 
-	case COMP_HTTP_QUERY_STRING:
-		l = con->uri.query;
-		break;
+	if (dc->comp == COMP_HTTP_HOST && !buffer_is_empty(con->uri.authority)) {
+		char *ck_colon = NULL, *val_colon = NULL;
 
-	case COMP_SERVER_SOCKET:
-		l = srv_sock->srv_token;
-		break;
+		/*
+		 * append server-port to the HTTP_POST if necessary
+		 */
 
-	case COMP_HTTP_REFERER: {
-		data_string *ds;
+		switch(dc->cond) {
+		case CONFIG_COND_NE:
+		case CONFIG_COND_EQ:
+			ck_colon = strchr(dc->string->ptr, ':');
+			val_colon = strchr(l->ptr, ':');
 
-		if (NULL != (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("Referer")))) {
-			l = ds->value;
-		} else {
-			l = srv->empty_string;
-		}
-		break;
-	}
-	case COMP_HTTP_COOKIE: {
-		data_string *ds;
-		if (NULL != (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("Cookie")))) {
-			l = ds->value;
-		} else {
-			l = srv->empty_string;
-		}
-		break;
-	}
-	case COMP_HTTP_USER_AGENT: {
-		data_string *ds;
-		if (NULL != (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("User-Agent")))) {
-			l = ds->value;
-		} else {
-			l = srv->empty_string;
+			if (ck_colon == val_colon) {
+				/* nothing to do with it */
+				break;
+			}
+			if (ck_colon) {
+				/* condition "host:port" but client send "host" */
+				l = config_cond_host_with_port(srv, con, l);
+			} else if (!ck_colon) {
+				/* condition "host" but client send "host:port" */
+				buffer_copy_string_len(srv->cond_check_buf, l->ptr, val_colon - l->ptr);
+				l = srv->cond_check_buf;
+			}
+			break;
+		default:
+			break;
 		}
-		break;
-	}
-	case COMP_HTTP_REQUEST_METHOD: {
-		const char *method = get_http_method_name(con->request.http_method);
-
-		/* we only have the request method as const char but we need a buffer for comparing */
-
-		buffer_copy_string(srv->tmp_buf, method);
-
-		l = srv->tmp_buf;
-
-		break;
-	}
-	case COMP_PHYSICAL_PATH_EXISTS: 
-	case COMP_PHYSICAL_PATH: 
-		l = con->physical.path;
-		break;
-	default:
-		return COND_RESULT_FALSE;
 	}
 
 	if (NULL == l) {
@@ -554,6 +540,8 @@ static cond_result_t config_check_cond_cached(server *srv, connection *con, data
 void config_cond_cache_reset_item(server *srv, connection *con, comp_key_t item) {
 	size_t i;
 
+	con->cond_gen++;
+
 	for (i = 0; i < srv->config_context->used; i++) {
 		if (item == COMP_LAST_ELEMENT || 
 		    con->cond_cache[i].comp_type == item) {
@@ -606,12 +594,16 @@ int config_exec_pcre_keyvalue_buffer(connection *con, pcre_keyvalue_buffer *kvb,
 	const char *pattern;
 	size_t pattern_len;
 	int n;
-	size_t i;
+	size_t i, j, candidates;
 	pcre_keyvalue *kv;
 # define N 10
 	int ovec[N * 3];
 
-	for (i = 0; i < kvb->used; i++) {
+	/* only the patterns whose literal prefix the subject has, in their order */
+	candidates = pcre_keyvalue_buffer_candidates(kvb, match_buf->ptr, match_buf->used - 1);
+
+	for (j = 0; j < candidates; j++) {
+		i = kvb->candidates[j];
 		kv = kvb->kv[i];
 
 		match       = kv->key;
@@ -677,3 +669,372 @@ int config_exec_pcre_keyvalue_buffer(connection *con, pcre_keyvalue_buffer *kvb,
 #endif
 }
 
+
+/* the buckets of a config_patch_cache */
+#define CONFIG_PATCH_CACHE_BUCKETS 128
+/* max. combinations we remember per plugin, all are forgotten if there are more */
+#define CONFIG_PATCH_CACHE_MAX 1024
+
+typedef struct config_patch_entry {
+	struct config_patch_entry *next;
+	size_t hash;
+
+	/* followed by the plugin_config and the con->cond_matched it belongs to */
+} config_patch_entry;
+
+#define CONFIG_PATCH_ENTRY_CONF(e) \
+	((unsigned char *)(e) + sizeof(config_patch_entry))
+#define CONFIG_PATCH_ENTRY_KEY(pc, e) \
+	(CONFIG_PATCH_ENTRY_CONF(e) + (pc)->conf_size)
+
+config_patch_cache *config_patch_cache_init(server *srv, const config_values_t *cv, size_t conf_size) {
+	config_patch_cache *pc;
+	size_t i, j, k;
+
+	for (k = 0; cv[k].key; k++);
+
+	if (k > sizeof(pc->contexts->opts) * 8) {
+		ERROR("can't cache the config of a plugin with %zu options", k);
+		return NULL;
+	}
+
+	pc = calloc(1, sizeof(*pc));
+	pc->conf_size = conf_size;
+	pc->key_len = (srv->config_context->used + 7) / 8;
+	pc->contexts = calloc(srv->config_context->used, sizeof(*pc->contexts));
+	pc->hash = calloc(CONFIG_PATCH_CACHE_BUCKETS, sizeof(*pc->hash));
+
+	/* skip the first, the global context */
+	for (i = 1; i < srv->config_context->used; i++) {
+		data_config *dc = (data_config *)srv->config_context->data[i];
+		unsigned int opts = 0;
+
+		for (j = 0; j < dc->value->used; j++) {
+			data_unset *du = dc->value->data[j];
+
+			for (k = 0; cv[k].key; k++) {
+				if (buffer_is_equal_string(du->key, cv[k].key, strlen(cv[k].key))) {
+					opts |= 1U << k;
+					break;
+				}
+			}
+		}
+
+		if (!opts) continue;
+
+		pc->contexts[pc->used].context_ndx = i;
+		pc->contexts[pc->used].opts = opts;
+		pc->used++;
+	}
+
+	return pc;
+}
+
+static void config_patch_cache_flush(config_patch_cache *pc) {
+	size_t i;
+
+	for (i = 0; i < CONFIG_PATCH_CACHE_BUCKETS; i++) {
+		config_patch_entry *e, *next;
+
+		for (e = pc->hash[i]; e; e = next) {
+			next = e->next;
+			free(e);
+		}
+
+		pc->hash[i] = NULL;
+	}
+
+	pc->entries = 0;
+}
+
+void config_patch_cache_free(config_patch_cache *pc) {
+	if (!pc) return;
+
+	config_patch_cache_flush(pc);
+
+	free(pc->hash);
+	free(pc->contexts);
+
+	free(pc);
+}
+
+/* all contexts with the same == conditional */
+typedef struct config_cond_index_entry {
+	struct config_cond_index_entry *next;
+
+	comp_key_t comp;
+	buffer *string; /* of the first data_config */
+
+	size_t *ptr;
+	size_t used;
+	size_t size;
+} config_cond_index_entry;
+
+typedef struct config_cond_index {
+	config_cond_index_entry **hash;
+	size_t size; /* a power of 2 */
+
+	/* the contexts which can't be looked up */
+	size_t *others;
+	size_t others_used;
+
+	/* there is at least one entry for this comp */
+	unsigned char comp_used[COMP_LAST_ELEMENT];
+} config_cond_index;
+
+static size_t config_cond_index_hash(comp_key_t comp, const char *s, size_t len) {
+	size_t h = 2166136261U ^ comp;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h = (h ^ (unsigned char)s[i]) * 16777619U;
+	}
+
+	return h;
+}
+
+static config_cond_index_entry *config_cond_index_lookup(config_cond_index *idx, comp_key_t comp, const char *s, size_t len) {
+	config_cond_index_entry *e;
+
+	for (e = idx->hash[config_cond_index_hash(comp, s, len) & (idx->size - 1)]; e; e = e->next) {
+		if (e->comp == comp &&
+		    e->string->used - 1 == len &&
+		    0 == memcmp(e->string->ptr, s, len)) {
+			return e;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * can the conditional be answered by a lookup of the value ?
+ */
+static int config_cond_index_can_lookup(data_config *dc) {
+	if (dc->cond != CONFIG_COND_EQ || NULL == dc->string || 0 == dc->string->used) return 0;
+
+	switch (dc->comp) {
+	case COMP_HTTP_REMOTE_IP:
+		/* a netmask has to be checked bit by bit */
+		return NULL == strchr(dc->string->ptr, '/');
+	case COMP_SERVER_SOCKET:
+	case COMP_HTTP_URL:
+	case COMP_HTTP_HOST:
+	case COMP_HTTP_REFERER:
+	case COMP_HTTP_USER_AGENT:
+	case COMP_HTTP_COOKIE:
+	case COMP_HTTP_SCHEME:
+	case COMP_HTTP_QUERY_STRING:
+	case COMP_HTTP_REQUEST_METHOD:
+	case COMP_PHYSICAL_PATH:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * group the == conditionals by the value they compare against
+ *
+ * A request then finds the matching contexts of a field with one or two
+ * lookups instead of comparing against each of them.
+ */
+void config_cond_index_build(server *srv) {
+	config_cond_index *idx;
+	size_t i;
+
+	config_cond_index_free(srv);
+
+	idx = calloc(1, sizeof(*idx));
+	for (idx->size = 16; idx->size < srv->config_context->used * 2; idx->size *= 2);
+	idx->hash = calloc(idx->size, sizeof(*idx->hash));
+	idx->others = calloc(srv->config_context->used, sizeof(*idx->others));
+
+	/* skip the first, the global context */
+	for (i = 1; i < srv->config_context->used; i++) {
+		data_config *dc = (data_config *)srv->config_context->data[i];
+		config_cond_index_entry *e;
+
+		if (!config_cond_index_can_lookup(dc)) {
+			idx->others[idx->others_used++] = i;
+			continue;
+		}
+
+		if (NULL == (e = config_cond_index_lookup(idx, dc->comp, CONST_BUF_LEN(dc->string)))) {
+			size_t h = config_cond_index_hash(dc->comp, CONST_BUF_LEN(dc->string)) & (idx->size - 1);
+
+			e = calloc(1, sizeof(*e));
+			e->comp = dc->comp;
+			e->string = dc->string;
+
+			e->next = idx->hash[h];
+			idx->hash[h] = e;
+		}
+
+		ARRAY_STATIC_PREPARE_APPEND(e);
+		e->ptr[e->used++] = i;
+
+		idx->comp_used[dc->comp] = 1;
+	}
+
+	srv->cond_index = idx;
+}
+
+void config_cond_index_free(server *srv) {
+	config_cond_index *idx = srv->cond_index;
+	size_t i;
+
+	if (!idx) return;
+
+	for (i = 0; i < idx->size; i++) {
+		config_cond_index_entry *e, *next;
+
+		for (e = idx->hash[i]; e; e = next) {
+			next = e->next;
+
+			free(e->ptr);
+			free(e);
+		}
+	}
+
+	free(idx->hash);
+	free(idx->others);
+	free(idx);
+
+	srv->cond_index = NULL;
+}
+
+static void config_cond_matched_set(server *srv, connection *con, config_cond_index_entry *e) {
+	size_t i;
+
+	if (!e) return;
+
+	for (i = 0; i < e->used; i++) {
+		data_config *dc = (data_config *)srv->config_context->data[e->ptr[i]];
+
+		/* the parent and the else-chain still have to agree */
+		if (config_check_cond(srv, con, dc)) {
+			con->cond_matched[e->ptr[i] >> 3] |= 1 << (e->ptr[i] & 7);
+		}
+	}
+}
+
+/**
+ * mark the == conditionals of a field which match the request
+ *
+ * all others of the field can't be true, they are left alone
+ */
+static void config_cond_matched_lookup(server *srv, connection *con, comp_key_t comp) {
+	config_cond_index *idx = srv->cond_index;
+	config_cond_index_entry *e, *alt = NULL;
+	buffer *l;
+
+	if (NULL == (l = config_cond_get_value(srv, con, comp)) || 0 == l->used) return;
+
+	e = config_cond_index_lookup(idx, comp, CONST_BUF_LEN(l));
+
+	if (comp == COMP_HTTP_HOST && !buffer_is_empty(con->uri.authority)) {
+		char *colon;
+
+		/* the same rules as in config_check_cond_nocache(): host and host:port match */
+		if (NULL != (colon = strchr(l->ptr, ':'))) {
+			alt = config_cond_index_lookup(idx, comp, l->ptr, colon - l->ptr);
+		} else {
+			l = config_cond_host_with_port(srv, con, l);
+			alt = config_cond_index_lookup(idx, comp, CONST_BUF_LEN(l));
+		}
+	}
+
+	config_cond_matched_set(srv, con, e);
+	config_cond_matched_set(srv, con, alt);
+}
+
+/**
+ * evaluate all conditionals once after something changed, the plugins share the result
+ */
+static void config_cond_matched_update(server *srv, connection *con) {
+	size_t i, len = (srv->config_context->used + 7) / 8;
+	size_t h = 2166136261U;
+
+	if (con->cond_matched_gen == con->cond_gen) return;
+
+	memset(con->cond_matched, 0, len);
+
+	if (srv->cond_index) {
+		config_cond_index *idx = srv->cond_index;
+		comp_key_t comp;
+
+		for (i = 0; i < idx->others_used; i++) {
+			data_config *dc = (data_config *)srv->config_context->data[idx->others[i]];
+
+			if (config_check_cond(srv, con, dc)) {
+				con->cond_matched[idx->others[i] >> 3] |= 1 << (idx->others[i] & 7);
+			}
+		}
+
+		for (comp = COMP_UNSET; comp < COMP_LAST_ELEMENT; comp++) {
+			if (idx->comp_used[comp] && con->conditional_is_valid[comp]) {
+				config_cond_matched_lookup(srv, con, comp);
+			}
+		}
+	} else {
+		/* skip the first, the global context */
+		for (i = 1; i < srv->config_context->used; i++) {
+			data_config *dc = (data_config *)srv->config_context->data[i];
+
+			if (config_check_cond(srv, con, dc)) {
+				con->cond_matched[i >> 3] |= 1 << (i & 7);
+			}
+		}
+	}
+
+	for (i = 0; i < len; i++) {
+		h = (h ^ con->cond_matched[i]) * 16777619U;
+	}
+
+	con->cond_matched_hash = h;
+	con->cond_matched_gen = con->cond_gen;
+}
+
+/**
+ * like config_check_cond(), but looks the == conditionals up instead of comparing them one by one
+ */
+int config_check_cond_matched(server *srv, connection *con, data_config *dc) {
+	config_cond_matched_update(srv, con);
+
+	return 0 != (con->cond_matched[dc->context_ndx >> 3] & (1 << (dc->context_ndx & 7)));
+}
+
+const void *config_patch_cache_get(server *srv, connection *con, config_patch_cache *pc) {
+	config_patch_entry *e;
+	size_t h;
+
+	config_cond_matched_update(srv, con);
+
+	h = con->cond_matched_hash;
+
+	for (e = pc->hash[h % CONFIG_PATCH_CACHE_BUCKETS]; e; e = e->next) {
+		if (e->hash == h &&
+		    0 == memcmp(CONFIG_PATCH_ENTRY_KEY(pc, e), con->cond_matched, pc->key_len)) {
+			return CONFIG_PATCH_ENTRY_CONF(e);
+		}
+	}
+
+	return NULL;
+}
+
+void config_patch_cache_insert(connection *con, config_patch_cache *pc, const void *conf) {
+	config_patch_entry *e;
+	size_t h = con->cond_matched_hash;
+
+	if (pc->entries >= CONFIG_PATCH_CACHE_MAX) config_patch_cache_flush(pc);
+
+	e = malloc(sizeof(*e) + pc->conf_size + pc->key_len);
+	e->hash = h;
+	memcpy(CONFIG_PATCH_ENTRY_CONF(e), conf, pc->conf_size);
+	memcpy(CONFIG_PATCH_ENTRY_KEY(pc, e), con->cond_matched, pc->key_len);
+
+	e->next = pc->hash[h % CONFIG_PATCH_CACHE_BUCKETS];
+	pc->hash[h % CONFIG_PATCH_CACHE_BUCKETS] = e;
+	pc->entries++;
+}
@@ -110,6 +110,7 @@ static int config_insert(server *srv) {
 		{ "ssl.verifyclient.depth",      NULL, T_CONFIG_SHORT,   T_CONFIG_SCOPE_SERVER },     /* 62 */
 		{ "ssl.verifyclient.username",   NULL, T_CONFIG_STRING,  T_CONFIG_SCOPE_SERVER },     /* 63 */
 		{ "ssl.verifyclient.exportcert", NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_SERVER },     /* 64 */
+		{ "debug.plugin-timing",         NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_SERVER },     /* 65 */
 
 		{ "server.host",                 "use server.bind instead", T_CONFIG_DEPRECATED, T_CONFIG_SCOPE_UNSET },
 		{ "server.docroot",              "use server.document-root instead", T_CONFIG_DEPRECATED, T_CONFIG_SCOPE_UNSET },
@@ -158,6 +159,7 @@ static int config_insert(server *srv) {
 	
 	cv[51].destination = &(srv->srvconf.log_timing);
 	cv[57].destination = srv->srvconf.breakagelog_file;
+	cv[65].destination = &(srv->srvconf.plugin_timing);
 
 	srv->config_storage = calloc(1, srv->config_context->used * sizeof(specific_config *));
 
@@ -202,8 +204,7 @@ static int config_insert(server *srv) {
 		s->etag_use_size  = 1;
 		s->force_lowercase_filenames = 0;
 		s->global_kbytes_per_second = 0;
-		s->global_bytes_per_second_cnt = 0;
-		s->global_bytes_per_second_cnt_ptr = &s->global_bytes_per_second_cnt;
+		s->global_traffic_ptr = &s->global_traffic;
 
 		cv[2].destination = s->errorfile_prefix;
 
@@ -310,9 +311,8 @@ int config_setup_connection(server *srv, connection *con) {
 	PATCH(server_tag);
 	PATCH(kbytes_per_second);
 	PATCH(global_kbytes_per_second);
-	PATCH(global_bytes_per_second_cnt);
+	PATCH(global_traffic_ptr);
 
-	con->conf.global_bytes_per_second_cnt_ptr = &s->global_bytes_per_second_cnt;
 	buffer_copy_string_buffer(con->server_name, s->server_name);
 
 	PATCH(log_request_header);
@@ -352,6 +352,7 @@ int config_patch_connection(server *srv, connection *con, comp_key_t comp) {
 	size_t i, j;
 
 	con->conditional_is_valid[comp] = 1;
+	con->cond_gen++;
 
 	/* skip the first, the global context */
 	for (i = 1; i < srv->config_context->used; i++) {
@@ -362,7 +363,7 @@ int config_patch_connection(server *srv, connection *con, comp_key_t comp) {
 		if (comp != dc->comp) continue;
 
 		/* condition didn't match */
-		if (!config_check_cond(srv, con, dc)) continue;
+		if (!config_check_cond_matched(srv, con, dc)) continue;
 
 		/* merge config */
 		for (j = 0; j < dc->value->used; j++) {
@@ -441,8 +442,7 @@ int config_patch_connection(server *srv, connection *con, comp_key_t comp) {
 				PATCH(force_lowercase_filenames);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("server.kbytes-per-second"))) {
 				PATCH(global_kbytes_per_second);
-				PATCH(global_bytes_per_second_cnt);
-				con->conf.global_bytes_per_second_cnt_ptr = &s->global_bytes_per_second_cnt;
+				PATCH(global_traffic_ptr);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("ssl.verifyclient.activate"))) {
 				PATCH(ssl_verifyclient);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("ssl.verifyclient.enforce"))) {
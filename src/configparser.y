@@ -475,7 +475,7 @@ context ::= DOLLAR SRVVARNAME(B) LBRACKET stringop(C) RBRACKET cond(E) expressio
       int erroff;
       
       if (NULL == (dc->regex = 
-          pcre_compile(rvalue->ptr, 0, &errptr, &erroff, NULL))) {
+          pcre_glue_compile(rvalue->ptr, 0, &(dc->regex_study), &errptr, &erroff))) {
         dc->string = buffer_init_string(errptr);
         dc->cond = CONFIG_COND_UNSET;
 
@@ -483,12 +483,6 @@ context ::= DOLLAR SRVVARNAME(B) LBRACKET stringop(C) RBRACKET cond(E) expressio
             rvalue->ptr, errptr, erroff);
 
         ctx->ok = 0;
-      } else if (NULL == (dc->regex_study =
-          pcre_study(dc->regex, 0, &errptr)) &&  
-                 errptr != NULL) {
-        fprintf(stderr, "studying regex failed: %s -> %s\n", 
-            rvalue->ptr, errptr);
-        ctx->ok = 0;
       } else {
         dc->string = buffer_init_buffer(rvalue);
       }
@@ -19,6 +19,7 @@
 #include "network.h"
 #include "stat_cache.h"
 #include "joblist.h"
+#include "traffic_shaper.h"
 
 #include "plugin.h"
 
@@ -150,6 +151,10 @@ int connection_close(server *srv, connection *con) {
 	fdevent_event_del(srv->ev, con->sock);
 	fdevent_unregister(srv->ev, con->sock);
 
+	traffic_shaper_remove(srv, con);
+	memset(&(con->traffic), 0, sizeof(con->traffic));
+	con->pacing_rate = 0;
+
 	if (closesocket(con->sock->fd)) {
 		ERROR("close failed (%i): %s", con->sock->fd, strerror(errno));
 	}
@@ -390,6 +395,7 @@ connection *connection_init(server *srv) {
 
 	con->sock = iosocket_init();
 	con->ndx = -1;
+	con->pacing_ndx = -1;
 	con->bytes_written = 0;
 	con->bytes_read = 0;
 	con->bytes_header = 0;
@@ -444,6 +450,8 @@ connection *connection_init(server *srv) {
 	con->plugin_ctx = calloc(1, (srv->plugins.used + 1) * sizeof(void *));
 
 	con->cond_cache = calloc(srv->config_context->used, sizeof(cond_cache_t));
+	con->cond_matched = calloc((srv->config_context->used + 7) / 8, 1);
+	con->cond_gen = 1;
 	config_setup_connection(srv, con);
 
 	return con;
@@ -498,6 +506,7 @@ void connections_free(server *srv) {
 #undef CLEAN
 		free(con->plugin_ctx);
 		free(con->cond_cache);
+		free(con->cond_matched);
 
 		http_request_free(con->http_req);
 
@@ -518,6 +527,7 @@ int connection_reset(server *srv, connection *con) {
 	con->http_status = 0;
 	con->file_started = 0;
 	con->got_response = 0;
+	con->stream_request_content = 0;
 
 	con->bytes_written = 0;
 	con->bytes_written_cur_second = 0;
@@ -525,6 +535,8 @@ int connection_reset(server *srv, connection *con) {
 	con->bytes_header = 0;
 	con->loops_per_request = 0;
 
+	traffic_shaper_remove(srv, con);
+
 	con->request.http_method = HTTP_METHOD_UNSET;
 	con->request.http_version = HTTP_VERSION_UNSET;
 	con->request.content_length = -1;
@@ -573,6 +585,7 @@ int connection_reset(server *srv, connection *con) {
 #undef CLEAN
 
 	array_reset(con->request.headers);
+	memset(con->request.headers_by_id, 0, sizeof(con->request.headers_by_id));
 	array_reset(con->response.headers);
 	array_reset(con->environment);
 
@@ -678,6 +691,10 @@ static handler_t connection_handle_read_request_content(server *srv, connection
 
 	if (con->request.content_length == -1) return HANDLER_GO_ON;
 
+	/* the handler hasn't taken what we have, it wakes us up when it did */
+	if (con->stream_request_content &&
+	    out->bytes_in - out->bytes_out >= MAX_REQUEST_CONTENT_STREAM_BUFFER) return HANDLER_GO_ON;
+
 	/* if the content was short enough, it might be read already */
 	if (in->first &&
 	    chunkqueue_length(in) - in->first->offset > 0) {
@@ -696,9 +713,10 @@ static handler_t connection_handle_read_request_content(server *srv, connection
 			fdevent_event_add(srv->ev, con->sock, FDEVENT_IN);
 			return HANDLER_WAIT_FOR_EVENT;
 		case NETWORK_STATUS_CONNECTION_CLOSE:
-			/* the connection went away before we got something back */
-			con->close_timeout_ts = srv->cur_ts - 2;
-			connection_set_state(srv, con, CON_STATE_CLOSE);
+			/* the client went away in the middle of the content,
+			 * the handler might already talk to a backend: let it clean up */
+			con->keep_alive = 0;
+			connection_set_state(srv, con, CON_STATE_ERROR);
 
 			return HANDLER_GO_ON;
 		default:
@@ -719,8 +737,15 @@ static handler_t connection_handle_read_request_content(server *srv, connection
 
 		toRead = weHave > weWant ? weWant : weHave;
 
+		if (con->stream_request_content) {
+			off_t room = MAX_REQUEST_CONTENT_STREAM_BUFFER - (out->bytes_in - out->bytes_out);
+
+			if (room <= 0) break;
+			if (toRead > room) toRead = room;
+		}
+
 		/* the new way, copy everything into a chunkqueue whcih might use tempfiles */
-		if (con->request.content_length > 64 * 1024) {
+		if (con->request.content_length > 64 * 1024 && !con->stream_request_content) {
 			chunk *dst_c = NULL;
 			/* copy everything to max 1Mb sized tempfiles */
 
@@ -802,11 +827,18 @@ static handler_t connection_handle_read_request_content(server *srv, connection
 		} else {
 			buffer *b;
 
-			b = (out->last) ? out->last->mem : NULL;
+			b = (out->last && out->last->type == MEM_CHUNK) ? out->last->mem : NULL;
 
 			if (NULL == b) {
+				off_t size = con->request.content_length - out->bytes_in;
+
+				/* the handler takes the content in pieces, don't allocate it all upfront */
+				if (con->stream_request_content && size > MAX_REQUEST_CONTENT_STREAM_BUFFER) {
+					size = MAX_REQUEST_CONTENT_STREAM_BUFFER;
+				}
+
 				b = chunkqueue_get_append_buffer(out);
-				buffer_prepare_copy(b, con->request.content_length - out->bytes_in + 1);
+				buffer_prepare_copy(b, size + 1);
 			}
 
 			buffer_append_string_len(b, c->mem->ptr + c->offset, toRead);
@@ -818,7 +850,9 @@ static handler_t connection_handle_read_request_content(server *srv, connection
 		in->bytes_out += toRead;
 	}
 
-	if (out->bytes_in < con->request.content_length) {
+	if (out->bytes_in < con->request.content_length &&
+	    !(con->stream_request_content &&
+	      out->bytes_in - out->bytes_out >= MAX_REQUEST_CONTENT_STREAM_BUFFER)) {
 		/* we have to read more content */
 		fdevent_event_add(srv->ev, con->sock, FDEVENT_IN);
 	}
@@ -1095,7 +1129,7 @@ void connection_state_machine(server *srv, connection *con) {
 				con->send->is_closed = 1; /* there is no content */
 
 				connection_set_state(srv, con, CON_STATE_HANDLE_RESPONSE_HEADER);
-			} else if (array_get_element(con->request.headers, CONST_STR_LEN("Expect"))) {
+			} else if (http_request_get_header(con, HTTP_HEADER_EXPECT)) {
 				/* write */
 				con->http_status = 100;
 				con->send->is_closed = 1;
@@ -1217,6 +1251,9 @@ void connection_state_machine(server *srv, connection *con) {
 					ERROR("%s", "oops, unknown return value: ...");
 				}
 
+				/* the client is gone, don't feed the handler anymore */
+				if (con->state != CON_STATE_READ_REQUEST_CONTENT) break;
+
 				if (con->recv->bytes_in == con->request.content_length) {
 					/* we read everything */
 					fdevent_event_del(srv->ev, con->sock);
@@ -0,0 +1,270 @@
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+
+#include "log.h"
+#include "array-static.h"
+#include "helper_process.h"
+
+#include "sys-files.h"
+#include "sys-socket.h"
+#include "sys-process.h"
+
+#ifdef HAVE_HELPER_PROCESS
+# include <sys/wait.h>
+# include <sys/uio.h>
+# include <unistd.h>
+# include <poll.h>
+#endif
+
+helper_process *helper_process_init(void) {
+	STRUCT_INIT(helper_process, helper);
+
+	helper->fd = -1;
+
+	return helper;
+}
+
+void helper_process_free(helper_process *helper) {
+	if (!helper) return;
+
+	if (helper->fd != -1) close(helper->fd);
+
+#ifdef HAVE_HELPER_PROCESS
+	/* only the process which forked the helper may stop it, the workers share it */
+	if (helper->pid > 0 && helper->owner == getpid()) {
+		kill(helper->pid, SIGTERM);
+		waitpid(helper->pid, NULL, 0);
+	}
+#endif
+
+	free(helper);
+}
+
+#ifdef HAVE_HELPER_PROCESS
+static void helper_process_main(helper_process *helper, int fd) {
+	pid_t ppid = getppid();
+	char *query = malloc(helper->query_max + 1);
+	int i;
+
+	/* drop everything we inherited from the server */
+	for (i = 3; i < 256; i++) {
+		if (i != fd) close(i);
+	}
+
+	/* keep 0, 1 and 2 busy, the received fds have to be > 2 */
+	for (i = 0; i < 3; i++) {
+		if (-1 == fcntl(i, F_GETFD) && -1 == open("/dev/null", O_RDWR)) _exit(1);
+	}
+
+	/* the answer might fork() and waitpid() for its children */
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGHUP, SIG_IGN);
+	signal(SIGPIPE, SIG_IGN);
+
+	while (1) {
+		struct msghdr mh;
+		struct iovec iov;
+		struct cmsghdr *cmsg;
+		char cbuf[CMSG_SPACE(sizeof(int) * (HELPER_PROCESS_QUERY_FDS_MAX + 1))];
+		struct pollfd pfd;
+		int fds[HELPER_PROCESS_QUERY_FDS_MAX + 1];
+		size_t nfds;
+		ssize_t r;
+
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		r = poll(&pfd, 1, 1000);
+
+		if (helper->tick) helper->tick();
+
+		switch (r) {
+		case -1:
+			if (errno == EINTR) continue;
+			_exit(1);
+		case 0:
+			/* the server is gone, we are gone too */
+			if (getppid() != ppid) _exit(0);
+			continue;
+		default:
+			break;
+		}
+
+		memset(&mh, 0, sizeof(mh));
+		iov.iov_base = query;
+		iov.iov_len = helper->query_max;
+		mh.msg_iov = &iov;
+		mh.msg_iovlen = 1;
+		mh.msg_control = cbuf;
+		mh.msg_controllen = sizeof(cbuf);
+
+		if (-1 == (r = recvmsg(fd, &mh, 0))) {
+			if (errno == EINTR || errno == EAGAIN) continue;
+			_exit(1);
+		}
+
+		cmsg = CMSG_FIRSTHDR(&mh);
+
+		if (NULL == cmsg ||
+		    cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS ||
+		    cmsg->cmsg_len < CMSG_LEN(sizeof(int))) {
+			continue;
+		}
+
+		/* the answer fd comes first, the fds of the query follow */
+		nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+
+		/* a truncated query gets an empty answer */
+		if (0 == (mh.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) &&
+		    (nfds == 1 || nfds == helper->query_fds + 1)) {
+			query[r] = '\0';
+
+			helper->answer(query, r, nfds > 1 ? fds + 1 : NULL, fds[0]);
+		}
+
+		while (nfds > 0) close(fds[--nfds]);
+	}
+}
+#endif
+
+int helper_process_start(helper_process *helper, size_t query_max, helper_process_answer_t answer) {
+#ifdef HAVE_HELPER_PROCESS
+	int fds[2];
+	int bufsize;
+	socklen_t bufsize_len = sizeof(bufsize);
+
+	helper->query_max = query_max;
+	helper->answer = answer;
+
+	if (helper->query_fds > HELPER_PROCESS_QUERY_FDS_MAX) {
+		ERROR("a query can't pass more than %d fds", HELPER_PROCESS_QUERY_FDS_MAX);
+		return -1;
+	}
+
+	/* a datagram per query, the workers share the socket */
+	if (-1 == socketpair(AF_UNIX, SOCK_DGRAM, 0, fds)) {
+		ERROR("socketpair() failed: %s", strerror(errno));
+		return -1;
+	}
+
+	/* the largest query has to fit into the socket buffers */
+	if (0 == getsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &bufsize, &bufsize_len) &&
+	    (size_t)bufsize < query_max) {
+		bufsize = query_max;
+
+		setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+		setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+	}
+
+	switch (helper->pid = fork()) {
+	case 0:
+		close(fds[0]);
+		helper_process_main(helper, fds[1]);
+		_exit(0);
+	case -1:
+		ERROR("fork() failed: %s", strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	default:
+		break;
+	}
+
+	close(fds[1]);
+
+	helper->fd = fds[0];
+	helper->owner = getpid();
+
+	/* a busy helper must not block the server */
+	fcntl(helper->fd, F_SETFL, fcntl(helper->fd, F_GETFL) | O_NONBLOCK);
+#ifdef FD_CLOEXEC
+	fcntl(helper->fd, F_SETFD, FD_CLOEXEC);
+#endif
+
+	return 0;
+#else
+	UNUSED(helper);
+	UNUSED(query_max);
+	UNUSED(answer);
+
+	ERROR("%s", "helper processes aren't supported on this platform");
+
+	return -1;
+#endif
+}
+
+int helper_process_query(helper_process *helper, buffer *query) {
+	if (buffer_is_empty(query)) return -1;
+
+	return helper_process_query_fds(helper, query->ptr, query->used - 1, NULL);
+}
+
+int helper_process_query_fds(helper_process *helper, const char *query, size_t query_len, int *fds) {
+#ifdef HAVE_HELPER_PROCESS
+	struct msghdr mh;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cbuf[CMSG_SPACE(sizeof(int) * (HELPER_PROCESS_QUERY_FDS_MAX + 1))];
+	int send_fds[HELPER_PROCESS_QUERY_FDS_MAX + 1];
+	size_t nfds = fds ? helper->query_fds + 1 : 1;
+	int answer_fds[2];
+	ssize_t r;
+
+	if (helper->fd == -1) return -1;
+	if (query_len == 0 || query_len > helper->query_max) return -1;
+
+	if (-1 == pipe(answer_fds)) {
+		ERROR("pipe() failed: %s", strerror(errno));
+		return -1;
+	}
+
+	send_fds[0] = answer_fds[1];
+	if (fds) memcpy(send_fds + 1, fds, helper->query_fds * sizeof(int));
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = (char *)query;
+	iov.iov_len = query_len;
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = cbuf;
+	mh.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+	cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+	memcpy(CMSG_DATA(cmsg), send_fds, sizeof(int) * nfds);
+
+	while (-1 == (r = sendmsg(helper->fd, &mh, 0)) && errno == EINTR);
+
+	/* a full queue means the helper is busy, the query just fails */
+	if (r == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		ERROR("sending the query failed: %s", strerror(errno));
+	}
+
+	/* the helper has its own copy now, we only wait for the EOF */
+	close(answer_fds[1]);
+
+	if (r == -1) {
+		close(answer_fds[0]);
+		return -1;
+	}
+
+	return answer_fds[0];
+#else
+	UNUSED(helper);
+	UNUSED(query);
+	UNUSED(query_len);
+	UNUSED(fds);
+
+	return -1;
+#endif
+}
@@ -0,0 +1,81 @@
+#ifndef _HELPER_PROCESS_H_
+#define _HELPER_PROCESS_H_
+
+#include <sys/types.h>
+
+#include "settings.h"
+#include "buffer.h"
+#include "sys-socket.h"
+
+#if defined(HAVE_FORK) && defined(HAVE_SYS_UN_H) && defined(SCM_RIGHTS)
+# define HAVE_HELPER_PROCESS
+#endif
+
+/**
+ * run blocking work (getaddrinfo(), getpwnam(), fork(), ...) in a helper process
+ *
+ * The helper is forked at startup and shares a datagram socket with the
+ * server and its workers. Each query is one datagram and carries the
+ * write-end of a pipe the answer is written to; the read-end is handled by
+ * the event-loop of the server and the EOF marks the end of the answer.
+ * A query can pass up to query_fds more fds to the helper, like the pipes
+ * of a process it should start.
+ *
+ * Our end of the socket is non-blocking: if the helper falls behind the
+ * query fails instead of stalling the server.
+ */
+
+/**
+ * write the answer for the query to fd, called in the helper
+ *
+ * @param query the query, \0 terminated but it may contain \0 itself
+ * @param fds the query_fds fds sent with the query, NULL if it came without them.
+ *            They are closed after the call.
+ */
+typedef void (*helper_process_answer_t)(char *query, size_t query_len, int *fds, int fd);
+
+/**
+ * called in the helper after each wakeup, at least once a second
+ */
+typedef void (*helper_process_tick_t)(void);
+
+/* the max. number of fds a query can pass along */
+#define HELPER_PROCESS_QUERY_FDS_MAX 3
+
+typedef struct {
+	pid_t pid;   /* the helper */
+	pid_t owner; /* the process which started the helper */
+
+	int fd;      /* our end of the socketpair */
+
+	size_t query_max; /* max. length of a query */
+	size_t query_fds; /* the fds a query passes along, set before helper_process_start() */
+	helper_process_answer_t answer;
+	helper_process_tick_t tick; /* NULL if the helper has nothing to do in between, set before helper_process_start() */
+} helper_process;
+
+LI_API helper_process *helper_process_init(void);
+LI_API void helper_process_free(helper_process *helper);
+
+/**
+ * fork the helper process
+ *
+ * @return 0 on success, -1 if the helper isn't available on this platform or fork() failed
+ */
+LI_API int helper_process_start(helper_process *helper, size_t query_max, helper_process_answer_t answer);
+
+/**
+ * send a query to the helper
+ *
+ * @return the fd the answer can be read from, -1 if the helper is busy or the query failed
+ */
+LI_API int helper_process_query(helper_process *helper, buffer *query);
+
+/**
+ * send a query and the query_fds fds to the helper, see helper_process_query()
+ *
+ * @param fds NULL to send the query without them
+ */
+LI_API int helper_process_query_fds(helper_process *helper, const char *query, size_t query_len, int *fds);
+
+#endif
@@ -109,6 +109,21 @@ int response_header_overwrite(server *srv, connection *con, const char *key, siz
 	return response_header_insert(srv, con, key, keylen, value, vallen);
 }
 
+data_string *http_request_get_header(connection *con, http_header_t id) {
+	return con->request.headers_by_id[id];
+}
+
+void http_request_insert_header(connection *con, data_string *ds) {
+	http_header_t id = get_http_header_key(CONST_BUF_LEN(ds->key));
+
+	/* a duplicate is merged into the first one, that one stays in the index */
+	if (id != HTTP_HEADER_UNSET && NULL == con->request.headers_by_id[id]) {
+		con->request.headers_by_id[id] = ds;
+	}
+
+	array_insert_unique(con->request.headers, (data_unset *)ds);
+}
+
 int http_response_redirect_to_directory(server *srv, connection *con) {
 	buffer *o;
 
@@ -204,34 +219,6 @@ int http_response_redirect_to_directory(server *srv, connection *con) {
 	return 0;
 }
 
-buffer * strftime_cache_get(server *srv, time_t last_mod) {
-	struct tm *tm;
-	size_t i;
-
-	for (i = 0; i < FILE_CACHE_MAX; i++) {
-		/* found cache-entry */
-		if (srv->mtime_cache[i].mtime == last_mod) return srv->mtime_cache[i].str;
-
-		/* found empty slot */
-		if (srv->mtime_cache[i].mtime == 0) break;
-	}
-
-	if (i == FILE_CACHE_MAX) {
-		i = 0;
-	}
-
-	srv->mtime_cache[i].mtime = last_mod;
-	buffer_prepare_copy(srv->mtime_cache[i].str, 1024);
-	tm = gmtime(&(srv->mtime_cache[i].mtime));
-	srv->mtime_cache[i].str->used = strftime(srv->mtime_cache[i].str->ptr,
-						 srv->mtime_cache[i].str->size - 1,
-						 "%a, %d %b %Y %H:%M:%S GMT", tm);
-	srv->mtime_cache[i].str->used++;
-
-	return srv->mtime_cache[i].str;
-}
-
-
 int http_response_handle_cachable(server *srv, connection *con, buffer *mtime) {
 	data_string *http_if_none_match;
 	data_string *http_if_modified_since;
@@ -248,8 +235,8 @@ int http_response_handle_cachable(server *srv, connection *con, buffer *mtime) {
 	 *    return a 304 (Not Modified) response.
 	 */
 
-	http_if_none_match = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("if-none-match"));
-	http_if_modified_since = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("if-modified-since"));
+	http_if_none_match = http_request_get_header(con, HTTP_HEADER_IF_NONE_MATCH);
+	http_if_modified_since = http_request_get_header(con, HTTP_HEADER_IF_MODIFIED_SINCE);
 
 	/* last-modified handling */
 	if (http_if_none_match) {
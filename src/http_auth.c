@@ -29,7 +29,6 @@
 #include "http_auth_digest.h"
 #include "stream.h"
 
-#include "inet_ntop_cache.h"
 
 #include "sys-strings.h"
 #include "sys-files.h"
@@ -914,14 +913,14 @@ int http_auth_basic_check(server *srv, connection *con, mod_auth_plugin_data *p,
 		buffer_free(username);
 		buffer_free(password);
 
-		log_error_write(srv, __FILE__, __LINE__, "ss", "get_password failed, IP:", inet_ntop_cache_get_ip(srv, &(con->dst_addr)));
+		log_error_write(srv, __FILE__, __LINE__, "ss", "get_password failed, IP:", BUF_STR(con->dst_addr_buf));
 
 		return 0;
 	}
 
 	/* password doesn't match */
 	if (http_auth_basic_password_compare(srv, p, req, username, realm->value, password, pw)) {
-		log_error_write(srv, __FILE__, __LINE__, "sbsBss", "password doesn't match for", con->uri.path, "username:", username, ", IP:", inet_ntop_cache_get_ip(srv, &(con->dst_addr)));
+		log_error_write(srv, __FILE__, __LINE__, "sbsBss", "password doesn't match for", con->uri.path, "username:", username, ", IP:", BUF_STR(con->dst_addr_buf));
 
 		buffer_free(username);
 		buffer_free(password);
@@ -1189,7 +1188,7 @@ int http_auth_digest_check(server *srv, connection *con, mod_auth_plugin_data *p
 		}
 
 		log_error_write(srv, __FILE__, __LINE__, "ssss",
-				"digest: auth failed for ", username, ": wrong password, IP:", inet_ntop_cache_get_ip(srv, &(con->dst_addr)));
+				"digest: auth failed for ", username, ": wrong password, IP:", BUF_STR(con->dst_addr_buf));
 
 		buffer_free(b);
 		return 0;
@@ -4,320 +4,396 @@
 #include <assert.h>
 
 #include "log.h"
+#include "keyvalue.h"
 #include "http_req.h"
-#include "http_req_parser.h"
 
-typedef struct {
-	chunkqueue *cq;
+/**
+ * the request header is parsed line by line
+ *
+ * The line-ends are found with memchr() which scans a word or a vector at
+ * a time. Lines which are in one chunk are parsed in place, only the keys
+ * and values end up in the headers. If a line isn't complete yet we
+ * remember how much we handled already and continue there with the next
+ * call.
+ */
 
-	chunk *c; /* current chunk in the chunkqueue */
-	size_t offset; /* current offset in current chunk */
-
-	chunk *lookup_c;
-	size_t lookup_offset;
-
-	int last_token_id;
-
-	int is_key;
-	int is_statusline;
-} http_req_tokenizer_t;
+/* longer methods are unknown anyway */
+#define HTTP_REQ_METHOD_MAX 32
 
 http_req *http_request_init(void) {
 	http_req *req = calloc(1, sizeof(*req));
 
 	req->uri_raw = buffer_init();
 	req->headers = array_init();
+	req->line = buffer_init();
 
 	return req;
 }
 
+static void http_request_reset_state(http_req *req) {
+	req->state = HTTP_REQ_STATE_REQUEST_LINE;
+	req->parsed = 0;
+
+	if (req->hdr) {
+		req->hdr->free((data_unset *)req->hdr);
+		req->hdr = NULL;
+	}
+}
+
 void http_request_reset(http_req *req) {
 	if (!req) return;
 
 	buffer_reset(req->uri_raw);
 	array_reset(req->headers);
 
+	http_request_reset_state(req);
 }
 
 void http_request_free(http_req *req) {
 	if (!req) return;
 
+	http_request_reset_state(req);
+
 	buffer_free(req->uri_raw);
 	array_free(req->headers);
+	buffer_free(req->line);
 
 	free(req);
 }
 
-static int http_req_get_next_char(http_req_tokenizer_t *t, unsigned char *c) {
-	if (t->c->mem->used == 0) {
-		TRACE("chunk-len: %zd", t->c->mem->used);
-	}
+/* the chars we accept in a token: no CTLs, no DEL */
+#define HTTP_REQ_IS_TOKEN_CHAR(c) ((c) >= 32 && (c) != 127 && (c) != 255)
 
-	if (t->offset == t->c->mem->used - 1) {
-		/* end of chunk, open next chunk */
+static int http_req_is_ws(unsigned char c) {
+	return c == ' ' || c == '\t';
+}
 
-		if (!t->c->next) return -1;
+/**
+ * @return the length of the token at s, stops at WS and at the first invalid char
+ */
+static size_t http_req_token_len(const char *s, size_t len, int stop_at_colon) {
+	size_t i;
 
-		t->c = t->c->next;
-		/* skip empty chunks */
-		while (t->c && t->c->mem->used == 0) t->c = t->c->next;
-		if (!t->c) return -1;
+	for (i = 0; i < len; i++) {
+		unsigned char c = s[i];
 
-		t->offset = 0;
+		if (!HTTP_REQ_IS_TOKEN_CHAR(c) || c == ' ') break;
+		if (stop_at_colon && c == ':') break;
 	}
 
-	*c = t->c->mem->ptr[t->offset++];
+	return i;
+}
 
-	t->lookup_offset = t->offset;
-	t->lookup_c = t->c;
+static size_t http_req_skip_ws(const char *s, size_t len) {
+	size_t i;
 
-#if 0
-	fprintf(stderr, "%s.%d: get: %c (%d) at offset: %d\r\n", __FILE__, __LINE__, *c > 31 ? *c : ' ', *c, t->offset - 1);
-#endif
+	for (i = 0; i < len && http_req_is_ws(s[i]); i++);
 
-	return 0;
+	return i;
 }
 
-static int http_req_lookup_next_char(http_req_tokenizer_t *t, unsigned char *c) {
-	if (t->lookup_c->mem->used == 0) {
-		TRACE("chunk-len: %zd", t->lookup_c->mem->used);
+/**
+ * @return the length of s without the trailing WS
+ */
+static size_t http_req_trim_ws(const char *s, size_t len) {
+	while (len > 0 && http_req_is_ws(s[len - 1])) len--;
+
+	return len;
+}
+
+/**
+ * HTTP/1.0 or HTTP/1.1, the version is allowed to have leading zeros
+ */
+static http_version_t http_req_parse_protocol(const char *s, size_t len) {
+	size_t i;
+	int hi = 0, lo = 0;
+
+	if (len < sizeof("HTTP/1.1") - 1 || 0 != strncmp(s, "HTTP/", 5)) return HTTP_VERSION_UNSET;
+
+	for (i = 5; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+		if (hi > 1) return HTTP_VERSION_UNSET;
+		hi = hi * 10 + s[i] - '0';
 	}
-	if (t->lookup_offset == t->lookup_c->mem->used - 1) {
-		/* end of chunk, open next chunk */
 
-		if (!t->lookup_c->next) return -1;
+	if (i == 5 || i == len || s[i] != '.') return HTTP_VERSION_UNSET;
+
+	if (++i == len) return HTTP_VERSION_UNSET;
 
-		t->lookup_c = t->lookup_c->next;
+	for (; i < len; i++) {
+		if (s[i] < '0' || s[i] > '9') return HTTP_VERSION_UNSET;
+		if (lo > 1) return HTTP_VERSION_UNSET;
+		lo = lo * 10 + s[i] - '0';
+	}
 
-		/* skip empty chunks */
-		while (t->lookup_c && t->lookup_c->mem->used == 0) t->lookup_c = t->lookup_c->next;
-		if (!t->lookup_c) return -1;
+	if (hi == 1 && lo == 1) return HTTP_VERSION_1_1;
+	if (hi == 1 && lo == 0) return HTTP_VERSION_1_0;
+
+	return HTTP_VERSION_UNSET;
+}
 
-		t->lookup_offset = 0;
+/**
+ * GET /foo HTTP/1.0
+ */
+static parse_status_t http_req_parse_request_line(http_req *req, const char *s, size_t len) {
+	const char *tok[3];
+	size_t tok_len[3];
+	char method[HTTP_REQ_METHOD_MAX];
+	size_t i, n;
+
+	for (i = http_req_skip_ws(s, len), n = 0; i < len; i += http_req_skip_ws(s + i, len - i), n++) {
+		if (n == 3) {
+			ERROR("too many tokens in the request-line: %.*s", (int)len, s);
+			return PARSE_ERROR;
+		}
+
+		tok[n] = s + i;
+		tok_len[n] = http_req_token_len(s + i, len - i, 0);
+
+		if (tok_len[n] == 0) {
+			ERROR("invalid char (%d) at pos: %zu", (unsigned char)s[i], i);
+			return PARSE_ERROR;
+		}
+
+		i += tok_len[n];
+	}
+
+	if (n != 3) {
+		ERROR("the request-line is incomplete: %.*s", (int)len, s);
+		return PARSE_ERROR;
+	}
+
+	if (tok_len[0] < sizeof(method)) {
+		memcpy(method, tok[0], tok_len[0]);
+		method[tok_len[0]] = '\0';
+
+		req->method = get_http_method_key(method);
+	} else {
+		req->method = HTTP_METHOD_UNSET;
 	}
 
-	*c = t->lookup_c->mem->ptr[t->lookup_offset++];
-#if 0
-	fprintf(stderr, "%s.%d: lookup: %c (%d) at offset: %d\r\n", __FILE__, __LINE__, *c > 31 ? *c : ' ', *c, t->lookup_offset - 1);
-#endif
+	buffer_copy_string_len(req->uri_raw, tok[1], tok_len[1]);
+
+	req->protocol = http_req_parse_protocol(tok[2], tok_len[2]);
+
+	return PARSE_SUCCESS;
+}
+
+/**
+ * a value runs till the end of the line
+ */
+static int http_req_check_value(const char *s, size_t len) {
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		unsigned char c = s[i];
+
+		if (!HTTP_REQ_IS_TOKEN_CHAR(c) && c != '\t') {
+			ERROR("invalid char (%d) at pos: %zu", c, i);
+			return -1;
+		}
+	}
 
 	return 0;
 }
 
-typedef enum {
-	PARSER_UNSET,
-	PARSER_OK,
-	PARSER_ERROR,
-	PARSER_EOF
-} http_req_parser_t;
+/**
+ * the previous header is complete
+ */
+static void http_req_insert_header(http_req *req) {
+	if (!req->hdr) return;
+
+	array_insert_unique(req->headers, (data_unset *)req->hdr);
+	req->hdr = NULL;
+}
 
-static http_req_parser_t http_req_tokenizer(
-	http_req_tokenizer_t *t,
-	int *token_id,
-	buffer *token
-) {
-	unsigned char c;
-	int tid = 0;
+/**
+ * Key: value
+ *   continued value
+ */
+static parse_status_t http_req_parse_header_line(http_req *req, const char *s, size_t len) {
+	size_t key_len, i;
+
+	if (http_req_is_ws(s[0])) {
+		/* the value continues in this line */
+		len = http_req_trim_ws(s, len);
+		i = http_req_skip_ws(s, len);
+
+		if (!req->hdr || i == len) {
+			ERROR("unexpected continuation line: %.*s", (int)len, s);
+			return PARSE_ERROR;
+		}
 
-	/* push the token to the parser */
+		if (0 != http_req_check_value(s + i, len - i)) return PARSE_ERROR;
 
-	while (tid == 0 && 0 == http_req_get_next_char(t, &c)) {
-		switch (c) {
-		case ':':
-			tid = TK_COLON;
+		/* the line-break and the WS around it become a single SP */
+		buffer_append_string_len(req->hdr->value, CONST_STR_LEN(" "));
+		buffer_append_string_len(req->hdr->value, s + i, len - i);
 
-			t->is_key = 0;
+		return PARSE_SUCCESS;
+	}
 
-			break;
-		case ' ':
-		case '\t':
-			if (t->last_token_id == TK_CRLF) {
-				/* WS as the start of a line */
+	http_req_insert_header(req);
 
-				tid = TK_TAB;
-				t->is_key = 0;
-			}
-			/* ignore the rest of the WS-chars */
-			break;
-		case '\r':
-			if (0 != http_req_lookup_next_char(t, &c)) return PARSER_EOF;
+	key_len = http_req_token_len(s, len, 1);
 
-			if (c == '\n') {
-				tid = TK_CRLF;
+	/* the key might be followed by WS, but not by anything else before the : */
+	i = key_len + http_req_skip_ws(s + key_len, len - key_len);
 
-				t->c = t->lookup_c;
-				t->offset = t->lookup_offset;
+	if (key_len == 0 || i == len || s[i] != ':') {
+		ERROR("invalid header key at pos: %zu: %.*s", i, (int)len, s);
+		return PARSE_ERROR;
+	}
 
-				t->is_statusline = 0;
-				t->is_key = 1;
-			} else {
-				ERROR("CR with out LF at pos: %zu", t->offset);
-				return PARSER_ERROR;
-			}
-			break;
-		case '\n':
-			tid = TK_CRLF;
+	len = http_req_trim_ws(s, len);
+	i++;
+	i += http_req_skip_ws(s + i, len - i);
 
-			t->is_statusline = 0;
-			t->is_key = 1;
+	/* headers without a value are ignored */
+	if (i == len) return PARSE_SUCCESS;
 
-			break;
-		default:
-			while (c >= 32 && c != 127 && c != 255) {
-				if (t->is_statusline) {
-					if (c == 32) break; /* the space is a splitter in the statusline */
-				} else {
-					if (t->is_key) {
-						if (c == ':') break; /* the : is the splitter between key and value */
-						if (c == ' ') break; /* no spaces in keys */
-					}
-				}
-				if (0 != http_req_lookup_next_char(t, &c)) return PARSER_EOF;
-			}
+	if (0 != http_req_check_value(s + i, len - i)) return PARSE_ERROR;
 
-			if (t->c == t->lookup_c &&
-				t->offset == t->lookup_offset + 1) {
+	if (NULL == (req->hdr = (data_string *)array_get_unused_element(req->headers, TYPE_STRING))) {
+		req->hdr = data_string_init();
+	}
 
-				ERROR("invalid char (%d) at pos: %zu", c, t->offset);
-				return PARSER_ERROR;
-			}
+	buffer_copy_string_len(req->hdr->key, s, key_len);
+	buffer_copy_string_len(req->hdr->value, s + i, len - i);
 
-			tid = TK_STRING;
+	return PARSE_SUCCESS;
+}
 
-			/* the lookup points to the first invalid char */
-			t->lookup_offset--;
+/**
+ * handle a line without the line-end
+ *
+ * @return PARSE_SUCCESS if the header is complete, PARSE_NEED_MORE if more lines have to follow
+ */
+static parse_status_t http_req_parse_line(http_req *req, const char *s, size_t len) {
+	/* CRLF and LF are both fine as line-end */
+	if (len > 0 && s[len - 1] == '\r') len--;
+
+	if (len > 0 && memchr(s, '\r', len)) {
+		ERROR("CR without LF in: %.*s", (int)len, s);
+		return PARSE_ERROR;
+	}
 
-			/* no overlapping string */
-			if (t->c == t->lookup_c) {
-				buffer_copy_string_len(token, t->c->mem->ptr + t->offset - 1, t->lookup_offset - t->offset + 1);
-			} else {
-				/* first chunk */
-				buffer_copy_string_len(token, t->c->mem->ptr + t->offset - 1, t->c->mem->used - t->offset);
+	switch (req->state) {
+	case HTTP_REQ_STATE_REQUEST_LINE:
+		/* empty lines before the request-line are ignored */
+		if (len == 0) return PARSE_NEED_MORE;
 
-				/* chunks in the middle */
-				for (t->c = t->c->next; t->c != t->lookup_c; t->c = t->c->next) {
-					buffer_append_string_buffer(token, t->c->mem);
-					t->offset = t->c->mem->used - 1;
-				}
+		if (PARSE_SUCCESS != http_req_parse_request_line(req, s, len)) return PARSE_ERROR;
 
-				/* last chunk */
-				buffer_append_string_len(token, t->c->mem->ptr, t->lookup_offset);
-			}
+		req->state = HTTP_REQ_STATE_HEADERS;
 
-			t->offset = t->lookup_offset;
+		return PARSE_NEED_MORE;
+	case HTTP_REQ_STATE_HEADERS:
+		/* CRLF CRLF ... the header end sequence */
+		if (len == 0) {
+			http_req_insert_header(req);
 
-			break;
+			return PARSE_SUCCESS;
 		}
-	}
 
-	if (tid) {
-		*token_id = tid;
+		if (PARSE_SUCCESS != http_req_parse_header_line(req, s, len)) return PARSE_ERROR;
 
-		return PARSER_OK;
+		return PARSE_NEED_MORE;
 	}
 
-	return PARSER_EOF;
+	return PARSE_ERROR;
 }
 
 parse_status_t http_request_parse_cq(chunkqueue *cq, http_req *req) {
-	http_req_tokenizer_t t;
-	void *pParser = NULL;
-	int token_id = 0;
-	buffer *token = NULL;
-	http_req_ctx_t context;
-	parse_status_t ret = PARSE_UNSET;
-	http_req_parser_t parser_ret;
-
-	t.cq = cq;
-	t.c = cq->first;
-	t.offset = t.c->offset;
-	t.is_key = 0;
-	t.is_statusline = 1;
-	t.last_token_id = 0;
-
-	context.ok = 1;
-	context.errmsg = buffer_init();
-	context.req = req;
-	context.unused_buffers = buffer_pool_init();
-
-	pParser = http_req_parserAlloc( malloc );
-	token = buffer_init();
+	parse_status_t ret = PARSE_NEED_MORE;
+	size_t skip;
+	chunk *c;
 
-	array_reset(req->headers);
+	if (req->state == HTTP_REQ_STATE_REQUEST_LINE && req->parsed == 0) {
+		array_reset(req->headers);
+	}
 
-	while((PARSER_OK == (parser_ret = http_req_tokenizer(&t, &token_id, token))) && context.ok) {
-		http_req_parser(pParser, token_id, token, &context);
+	/* go to the first byte we haven't seen yet */
+	skip = req->parsed;
 
-		token = buffer_pool_get(context.unused_buffers);
+	for (c = cq->first; c; c = c->next) {
+		size_t start = (c == cq->first) ? c->offset : 0;
+		size_t len = c->mem->used ? c->mem->used - 1 - start : 0;
 
-		/* CRLF CRLF ... the header end sequence */
-		if (t.last_token_id == TK_CRLF &&
-		    token_id == TK_CRLF) break;
+		if (skip < len) {
+			skip += start;
+			break;
+		}
 
-		t.last_token_id = token_id;
+		skip -= len;
 	}
 
-	// Tokenizer failed
-	if (parser_ret == PARSER_ERROR) {
-		ret = PARSE_ERROR;
-	}
+	while (c && ret == PARSE_NEED_MORE) {
+		const char *s = c->mem->ptr + skip;
+		size_t avail = c->mem->used ? c->mem->used - 1 - skip : 0;
+		const char *nl;
+		chunk *end_c;
+		size_t line_len;
+
+		if (avail == 0) {
+			c = c->next;
+			skip = 0;
+			continue;
+		}
 
-	/* oops, the parser failed */
-	if (context.ok == 0) {
-		ret = PARSE_ERROR;
+		if (NULL != (nl = memchr(s, '\n', avail))) {
+			/* the line is in the chunk, parse it in place */
+			line_len = nl - s;
 
-		if (!buffer_is_empty(context.errmsg)) {
-			TRACE("parsing failed: %s", SAFE_BUF_STR(context.errmsg));
+			ret = http_req_parse_line(req, s, line_len);
+
+			skip += line_len + 1;
 		} else {
-			chunk *c;
-			buffer *hdr = buffer_init();
-			
-			for (c = cq->first; c; c = c->next) {
-				if (c == cq->first) {
-					buffer_append_string_len(hdr, c->mem->ptr + c->offset, c->mem->used - 1 - c->offset);
-				} else {
-					buffer_append_string_buffer(hdr, c->mem);
-				}
-			}
+			/* collect the line from the following chunks */
+			buffer_copy_string_len(req->line, s, avail);
 
-			TRACE("parsing failed at token (%s [%d]), header: %s", SAFE_BUF_STR(token), token_id, SAFE_BUF_STR(hdr));
+			for (end_c = c->next; end_c; end_c = end_c->next) {
+				if (end_c->mem->used == 0) continue;
 
-			buffer_free(hdr);
-		}
-	}
+				if (NULL != (nl = memchr(end_c->mem->ptr, '\n', end_c->mem->used - 1))) break;
+
+				buffer_append_string_len(req->line, end_c->mem->ptr, end_c->mem->used - 1);
+			}
 
-	http_req_parser(pParser, 0, token, &context);
-	http_req_parserFree(pParser, free);
+			/* the line isn't complete yet */
+			if (!end_c) break;
 
-	if (context.ok == 0) {
-		/* we are missing the some tokens */
+			buffer_append_string_len(req->line, end_c->mem->ptr, nl - end_c->mem->ptr);
+			line_len = req->line->used - 1;
 
-		if (!buffer_is_empty(context.errmsg)) {
-			TRACE("parsing failed: %s", SAFE_BUF_STR(context.errmsg));
-		}
+			ret = http_req_parse_line(req, req->line->ptr, line_len);
 
-		if (ret == PARSE_UNSET) {
-			ret = buffer_is_empty(context.errmsg) ? PARSE_NEED_MORE : PARSE_ERROR;
+			c = end_c;
+			skip = nl - end_c->mem->ptr + 1;
 		}
-	} else if (parser_ret == PARSER_EOF) { // didn't see CRLF CRLF, no other error till now
-		ret = PARSE_NEED_MORE;
-	} else {
-		chunk *c;
 
-		for (c = cq->first; c != t.c; c = c->next) {
-			c->offset = c->mem->used - 1;
+		req->parsed += line_len + 1;
+	}
+
+	switch (ret) {
+	case PARSE_SUCCESS: {
+		chunk *rc;
+
+		/* mark the header as read, c and skip point behind the final line-end */
+		for (rc = cq->first; rc != c; rc = rc->next) {
+			rc->offset = rc->mem->used ? rc->mem->used - 1 : 0;
 		}
 
-		c->offset = t.offset;
+		c->offset = skip;
 
-		ret = PARSE_SUCCESS;
+		http_request_reset_state(req);
+		break;
+	}
+	case PARSE_ERROR:
+		http_request_reset_state(req);
+		break;
+	default:
+		break;
 	}
-
-	buffer_pool_append(context.unused_buffers, token);
-	buffer_pool_free(context.unused_buffers);
-	buffer_free(context.errmsg);
 
 	return ret;
 }
-
-
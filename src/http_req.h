@@ -1,26 +1,27 @@
 #ifndef _HTTP_REQ_H_
 #define _HTTP_REQ_H_
 
-#include <stdio.h>
-
 #include "array.h"
 #include "chunk.h"
 #include "http_parser.h"
 
+typedef enum {
+	HTTP_REQ_STATE_REQUEST_LINE,
+	HTTP_REQ_STATE_HEADERS
+} http_req_state_t;
+
 typedef struct {
 	int protocol;   /* http/1.0, http/1.1 */
 	int method;     /* e.g. GET */
 	buffer *uri_raw; /* e.g. /foobar/ */
 	array *headers;
-} http_req;
 
-typedef struct {
-	int     ok;
-	buffer *errmsg;
-
-	http_req *req;
-	buffer_pool *unused_buffers;
-} http_req_ctx_t;
+	/* the parser continues where it stopped on PARSE_NEED_MORE */
+	http_req_state_t state;
+	size_t parsed;      /* bytes of the complete lines we already handled */
+	data_string *hdr;   /* the last header, the next line might continue it */
+	buffer *line;       /* a line which is spread over several chunks */
+} http_req;
 
 LI_API http_req * http_request_init(void);
 LI_API void http_request_free(http_req *req);
@@ -28,10 +29,4 @@ LI_API void http_request_reset(http_req *req);
 
 LI_API parse_status_t http_request_parse_cq(chunkqueue *cq, http_req *http_request);
 
-/* declare prototypes for the parser */
-void *http_req_parserAlloc(void *(*mallocProc)(size_t));
-void http_req_parserFree(void *p,  void (*freeProc)(void*));
-void http_req_parserTrace(FILE *TraceFILE, char *zTracePrompt);
-void http_req_parser(void *, int, buffer *, http_req_ctx_t *);
-
 #endif
@@ -26,7 +26,7 @@ int main(void) {
 	const char *body;
 
 	log_init();
-	plan_tests(8);
+	plan_tests(17);
 
 	/* basic request header + CRLF */
 	b = chunkqueue_get_append_buffer(cq);
@@ -132,6 +132,83 @@ int main(void) {
 	body = chunkqueue_to_buffer(cq, content);
 	ok(0 == strcmp("ABC", body), "content is ABC, got %s", body);
 
+	http_request_free(req);
+
+	/* the header arrives in several reads */
+
+	chunkqueue_reset(cq);
+	req = http_request_init();
+
+	b = chunkqueue_get_append_buffer(cq);
+	buffer_copy_string(b,
+		"GET /foo HTTP/1.1\r\n"
+		"Host: www.exa");
+	ok(PARSE_NEED_MORE == http_request_parse_cq(cq, req), "incomplete header");
+
+	b = chunkqueue_get_append_buffer(cq);
+	buffer_copy_string(b, "mple.org\r\n"
+		"User-Agent: foo\r\n"
+		"  bar\r");
+	ok(PARSE_NEED_MORE == http_request_parse_cq(cq, req), "incomplete header, continued");
+
+	b = chunkqueue_get_append_buffer(cq);
+	buffer_copy_string(b, "\n"
+		"\r\nABC");
+	ok(PARSE_SUCCESS == http_request_parse_cq(cq, req), "header complete");
+
+	{
+		data_string *ds = (data_string *)array_get_element(req->headers, CONST_STR_LEN("Host"));
+
+		ok(ds && 0 == strcmp("www.example.org", ds->value->ptr), "Host is www.example.org, got %s", ds ? ds->value->ptr : "(null)");
+	}
+
+	chunkqueue_remove_finished_chunks(cq);
+	body = chunkqueue_to_buffer(cq, content);
+	ok(0 == strcmp("ABC", body), "content is ABC, got %s", body);
+
+	http_request_free(req);
+
+	/* a continuation line is joined with a single SP */
+
+	chunkqueue_reset(cq);
+	req = http_request_init();
+
+	b = chunkqueue_get_append_buffer(cq);
+	buffer_copy_string(b,
+		"GET / HTTP/1.0\r\n"
+		"X-Foo: a \r\n"
+		"\t  b\r\n"
+		"\r\n"
+	);
+	ok(PARSE_SUCCESS == http_request_parse_cq(cq, req), "continued header");
+
+	{
+		data_string *ds = (data_string *)array_get_element(req->headers, CONST_STR_LEN("X-Foo"));
+
+		ok(ds && 0 == strcmp("a b", ds->value->ptr), "X-Foo is 'a b', got %s", ds ? ds->value->ptr : "(null)");
+	}
+
+	http_request_free(req);
+
+	/* WS between the key and the : is dropped */
+
+	chunkqueue_reset(cq);
+	req = http_request_init();
+
+	b = chunkqueue_get_append_buffer(cq);
+	buffer_copy_string(b,
+		"GET / HTTP/1.0\r\n"
+		"Host : www.example.org\r\n"
+		"\r\n"
+	);
+	ok(PARSE_SUCCESS == http_request_parse_cq(cq, req), "WS before the colon");
+
+	{
+		data_string *ds = (data_string *)array_get_element(req->headers, CONST_STR_LEN("Host"));
+
+		ok(ds && 0 == strcmp("www.example.org", ds->value->ptr), "Host is www.example.org, got %s", ds ? ds->value->ptr : "(null)");
+	}
+
 	http_request_free(req);
 	chunkqueue_free(cq);
 	buffer_free(content);
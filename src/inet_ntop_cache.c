@@ -7,45 +7,67 @@
 #include "inet_ntop_cache.h"
 #include "sys-socket.h"
 
-const char * inet_ntop_cache_get_ip(server *srv, sock_addr *addr) {
 #ifdef HAVE_IPV6
-	size_t ndx = 0, i;
-	for (i = 0; i < INET_NTOP_CACHE_MAX; i++) {
-		if (srv->inet_ntop_cache[i].ts != 0 && srv->inet_ntop_cache[i].family == addr->plain.sa_family) {
-			if (srv->inet_ntop_cache[i].family == AF_INET6 &&
-			    0 == memcmp(srv->inet_ntop_cache[i].addr.ipv6.s6_addr, addr->ipv6.sin6_addr.s6_addr, 16)) {
-				/* IPv6 found in cache */
-				break;
-			} else if (srv->inet_ntop_cache[i].family == AF_INET &&
-				   srv->inet_ntop_cache[i].addr.ipv4.s_addr == addr->ipv4.sin_addr.s_addr) {
-				/* IPv4 found in cache */
-				break;
-
-			}
-		}
+/* the slot of an address, the cache is direct mapped */
+static size_t inet_ntop_cache_ndx(sock_addr *addr) {
+	uint32_t h;
+
+	if (addr->plain.sa_family == AF_INET6) {
+		const uint32_t *w = (const uint32_t *)addr->ipv6.sin6_addr.s6_addr;
+
+		h = ntohl(w[0] ^ w[1] ^ w[2] ^ w[3]);
+	} else {
+		h = ntohl(addr->ipv4.sin_addr.s_addr);
 	}
 
-	if (i == INET_NTOP_CACHE_MAX) {
-		/* not found in cache */
+	/* the clients of a network differ in the last byte, spread it over all bits */
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+
+	return h % INET_NTOP_CACHE_MAX;
+}
+#endif
+
+const char * inet_ntop_cache_get_ip(server *srv, sock_addr *addr) {
+#ifdef HAVE_IPV6
+	inet_ntop_cache_type *e;
 
-		i = ndx;
-		inet_ntop(addr->plain.sa_family,
-			  addr->plain.sa_family == AF_INET6 ?
-			  (const void *) &(addr->ipv6.sin6_addr) :
-			  (const void *) &(addr->ipv4.sin_addr),
-			  srv->inet_ntop_cache[i].b2, INET6_ADDRSTRLEN);
+	if (addr->plain.sa_family != AF_INET && addr->plain.sa_family != AF_INET6) return "";
 
-		srv->inet_ntop_cache[i].ts = srv->cur_ts;
-		srv->inet_ntop_cache[i].family = addr->plain.sa_family;
+	e = &(srv->inet_ntop_cache[inet_ntop_cache_ndx(addr)]);
 
-		if (srv->inet_ntop_cache[i].family == AF_INET) {
-			srv->inet_ntop_cache[i].addr.ipv4.s_addr = addr->ipv4.sin_addr.s_addr;
-		} else if (srv->inet_ntop_cache[i].family == AF_INET6) {
-			memcpy(srv->inet_ntop_cache[i].addr.ipv6.s6_addr, addr->ipv6.sin6_addr.s6_addr, 16);
+	if (e->ts != 0 && e->family == addr->plain.sa_family) {
+		if (e->family == AF_INET6 &&
+		    0 == memcmp(e->addr.ipv6.s6_addr, addr->ipv6.sin6_addr.s6_addr, 16)) {
+			/* IPv6 found in cache */
+			return e->b2;
+		} else if (e->family == AF_INET &&
+			   e->addr.ipv4.s_addr == addr->ipv4.sin_addr.s_addr) {
+			/* IPv4 found in cache */
+			return e->b2;
 		}
 	}
 
-	return srv->inet_ntop_cache[i].b2;
+	/* not found in cache, replace the slot */
+	inet_ntop(addr->plain.sa_family,
+		  addr->plain.sa_family == AF_INET6 ?
+		  (const void *) &(addr->ipv6.sin6_addr) :
+		  (const void *) &(addr->ipv4.sin_addr),
+		  e->b2, INET6_ADDRSTRLEN);
+
+	e->ts = srv->cur_ts;
+	e->family = addr->plain.sa_family;
+
+	if (e->family == AF_INET) {
+		e->addr.ipv4.s_addr = addr->ipv4.sin_addr.s_addr;
+	} else {
+		memcpy(e->addr.ipv6.s6_addr, addr->ipv6.sin6_addr.s6_addr, 16);
+	}
+
+	return e->b2;
 #else
 	UNUSED(srv);
 	return inet_ntoa(addr->ipv4.sin_addr);
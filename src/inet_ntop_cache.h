@@ -2,6 +2,15 @@
 #define _INET_NTOP_CACHE_H_
 
 #include "base.h"
+
+/**
+ * the string of an IPv4 or IPv6 address
+ *
+ * the address of the client is formatted once when the connection is
+ * accepted, use con->dst_addr_buf for it
+ *
+ * @return a string which is valid until the next call, "" if addr isn't an ip
+ */
 LI_API const char * inet_ntop_cache_get_ip(server *srv, sock_addr *addr);
 
 #endif
@@ -12,6 +12,7 @@ iosocket *iosocket_init(void) {
 	sock->fd = -1;
 
 	sock->type = IOSOCKET_TYPE_SOCKET;
+	sock->max_write = -1;
 
 #if defined USE_OPENSSL && ! defined OPENSSL_NO_TLSEXT
 	sock->tlsext_server_name = buffer_init();
@@ -42,6 +42,8 @@ typedef struct {
 #endif
 
 	iosocket_t type; /**< sendfile on solaris doesn't work on pipes */
+
+	off_t max_write; /**< the traffic-shaper allows the network-backend to write this many bytes, -1 for no limit */
 } iosocket;
 
 LI_API iosocket * iosocket_init(void);
@@ -1,17 +1,46 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <ctype.h>
 
 #include "base.h"
 #include "server.h"
 #include "keyvalue.h"
 
+#include "sys-strings.h"
+
 static keyvalue http_versions[] = {
 	{ HTTP_VERSION_1_1, "HTTP/1.1" },
 	{ HTTP_VERSION_1_0, "HTTP/1.0" },
 	{ HTTP_VERSION_UNSET, NULL }
 };
 
+static struct {
+	http_header_t key;
+	const char *name;
+	size_t len;
+} http_headers[] = {
+	{ HTTP_HEADER_ACCEPT_ENCODING, CONST_STR_LEN("Accept-Encoding") },
+	{ HTTP_HEADER_AUTHORIZATION, CONST_STR_LEN("Authorization") },
+	{ HTTP_HEADER_CONNECTION, CONST_STR_LEN("Connection") },
+	{ HTTP_HEADER_CONTENT_LENGTH, CONST_STR_LEN("Content-Length") },
+	{ HTTP_HEADER_CONTENT_TYPE, CONST_STR_LEN("Content-Type") },
+	{ HTTP_HEADER_COOKIE, CONST_STR_LEN("Cookie") },
+	{ HTTP_HEADER_EXPECT, CONST_STR_LEN("Expect") },
+	{ HTTP_HEADER_HOST, CONST_STR_LEN("Host") },
+	{ HTTP_HEADER_IF_MODIFIED_SINCE, CONST_STR_LEN("If-Modified-Since") },
+	{ HTTP_HEADER_IF_NONE_MATCH, CONST_STR_LEN("If-None-Match") },
+	{ HTTP_HEADER_IF_RANGE, CONST_STR_LEN("If-Range") },
+	{ HTTP_HEADER_RANGE, CONST_STR_LEN("Range") },
+	{ HTTP_HEADER_REFERER, CONST_STR_LEN("Referer") },
+	{ HTTP_HEADER_TRANSFER_ENCODING, CONST_STR_LEN("Transfer-Encoding") },
+	{ HTTP_HEADER_USER_AGENT, CONST_STR_LEN("User-Agent") },
+	{ HTTP_HEADER_X_FORWARDED_FOR, CONST_STR_LEN("X-Forwarded-For") },
+	{ HTTP_HEADER_X_FORWARDED_PROTO, CONST_STR_LEN("X-Forwarded-Proto") },
+
+	{ HTTP_HEADER_UNSET, NULL, 0 }
+};
+
 static keyvalue http_methods[] = {
 	{ HTTP_METHOD_GET,  "GET" },
 	{ HTTP_METHOD_POST, "POST" },
@@ -303,8 +332,234 @@ http_method_t get_http_method_key(const char *s) {
 	return (http_method_t)keyvalue_get_key(http_methods, s);
 }
 
+http_header_t get_http_header_key(const char *s, size_t len) {
+	size_t i;
+
+	for (i = 0; http_headers[i].name; i++) {
+		/* the length and the first char sort out nearly all of them */
+		if (http_headers[i].len == len &&
+		    (s[0] | 0x20) == (http_headers[i].name[0] | 0x20) &&
+		    0 == strncasecmp(s, http_headers[i].name, len)) {
+			return http_headers[i].key;
+		}
+	}
+
+	return HTTP_HEADER_UNSET;
+}
+
+
+
+
+/**
+ * skip the escape sequence at s, \Q...\E quotes everything up to the \E
+ *
+ * @return the last char of the sequence
+ */
+static const char *pcre_keyvalue_skip_escape(const char *s) {
+	if (s[1] == '\0') return s;
+	if (s[1] != 'Q') return s + 1;
+
+	for (s += 2; *s; s++) {
+		if (s[0] == '\\' && s[1] == 'E') return s + 1;
+	}
+
+	/* quoted till the end */
+	return s - 1;
+}
+
+size_t pcre_keyvalue_literal_prefix(const char *pattern, buffer *prefix) {
+	const char *s;
+	int depth = 0;
+
+	buffer_reset(prefix);
+
+	if (pattern[0] != '^') return 0;
+
+	/* a | outside of a group ends the anchored branch */
+	for (s = pattern; *s; s++) {
+		switch (*s) {
+		case '\\':
+			s = pcre_keyvalue_skip_escape(s);
+			break;
+		case '[':
+			/* a ] right after the [ or [^ is part of the class */
+			if (s[1] == '^') s++;
+			if (s[1] == ']') s++;
+			for (s++; *s && *s != ']'; s++) {
+				if (*s == '\\') s = pcre_keyvalue_skip_escape(s);
+			}
+			if (*s == '\0') return 0;
+			break;
+		case '(':
+			depth++;
+			break;
+		case ')':
+			if (depth > 0) depth--;
+			break;
+		case '|':
+			if (depth == 0) return 0;
+			break;
+		}
+	}
+
+	for (s = pattern + 1; *s; s++) {
+		char c = *s;
+
+		if (c == '\\') {
+			/* \d, \w, \Q, \1, \x41, ... aren't plain chars */
+			if (s[1] == '\0' || isalnum((unsigned char)s[1])) break;
+
+			c = *(++s);
+		} else if (NULL != strchr("^$.[|()?*+{", c)) {
+			break;
+		}
+
+		/* the char might not be there at all */
+		if (s[1] == '?' || s[1] == '*' || s[1] == '{') break;
+
+		buffer_append_string_len(prefix, &c, 1);
+
+		if (s[1] == '+') break;
+	}
+
+	return prefix->used ? prefix->used - 1 : 0;
+}
+
+static pcre_keyvalue_trie *pcre_keyvalue_trie_find(pcre_keyvalue_trie *node, unsigned char c, size_t *ndx) {
+	size_t lo = 0, hi = node->children_used;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
 
+		if (node->children[mid]->c == c) return node->children[mid];
+
+		if (node->children[mid]->c < c) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
 
+	if (ndx) *ndx = lo;
+
+	return NULL;
+}
+
+#ifdef HAVE_PCRE_H
+static void pcre_keyvalue_trie_insert(pcre_keyvalue_trie *root, const char *prefix, size_t len, size_t rule) {
+	pcre_keyvalue_trie *node = root;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		unsigned char c = prefix[i];
+		pcre_keyvalue_trie *child;
+		size_t ndx;
+
+		if (NULL == (child = pcre_keyvalue_trie_find(node, c, &ndx))) {
+			child = calloc(1, sizeof(*child));
+			child->c = c;
+
+			node->children = realloc(node->children, (node->children_used + 1) * sizeof(*node->children));
+			memmove(node->children + ndx + 1, node->children + ndx, (node->children_used - ndx) * sizeof(*node->children));
+			node->children[ndx] = child;
+			node->children_used++;
+		}
+
+		node = child;
+	}
+
+	/* the rules are appended in order, the list stays sorted */
+	node->rules = realloc(node->rules, (node->rules_used + 1) * sizeof(*node->rules));
+	node->rules[node->rules_used++] = rule;
+}
+
+#endif
+
+static void pcre_keyvalue_trie_free(pcre_keyvalue_trie *node) {
+	size_t i;
+
+	if (!node) return;
+
+	for (i = 0; i < node->children_used; i++) {
+		pcre_keyvalue_trie_free(node->children[i]);
+	}
+
+	free(node->children);
+	free(node->rules);
+	free(node);
+}
+
+#ifdef HAVE_PCRE_H
+/**
+ * remember where the pattern might match
+ */
+static void pcre_keyvalue_buffer_index(pcre_keyvalue_buffer *kvb, const char *key, size_t rule) {
+	buffer *prefix = buffer_init();
+	size_t len;
+
+	if (!kvb->trie) kvb->trie = calloc(1, sizeof(*kvb->trie));
+
+	if (0 == (len = pcre_keyvalue_literal_prefix(key, prefix))) {
+		kvb->unanchored = realloc(kvb->unanchored, (kvb->unanchored_used + 1) * sizeof(*kvb->unanchored));
+		kvb->unanchored[kvb->unanchored_used++] = rule;
+	} else {
+		pcre_keyvalue_trie_insert(kvb->trie, prefix->ptr, len, rule);
+	}
+
+	kvb->candidates = realloc(kvb->candidates, (rule + 1) * sizeof(*kvb->candidates));
+
+	buffer_free(prefix);
+}
+#endif
+
+static int pcre_keyvalue_rule_cmp(const void *a, const void *b) {
+	size_t x = *(const size_t *)a, y = *(const size_t *)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+size_t pcre_keyvalue_buffer_candidates(pcre_keyvalue_buffer *kvb, const char *s, size_t len) {
+	pcre_keyvalue_trie *node;
+	size_t *found = kvb->candidates;
+	size_t found_used = 0, n = 0, i, j;
+
+	if (!kvb->trie) return 0;
+
+	/* the prefixes of the subject, the root has no rules */
+	for (node = kvb->trie, i = 0; node; i++) {
+		for (j = 0; j < node->rules_used; j++) {
+			found[found_used++] = node->rules[j];
+		}
+
+		if (i == len) break;
+
+		node = pcre_keyvalue_trie_find(node, s[i], NULL);
+	}
+
+	if (found_used == 0) {
+		memcpy(kvb->candidates, kvb->unanchored, kvb->unanchored_used * sizeof(*kvb->candidates));
+
+		return kvb->unanchored_used;
+	}
+
+	if (found_used > 1) qsort(found, found_used, sizeof(*found), pcre_keyvalue_rule_cmp);
+
+	if (kvb->unanchored_used == 0) return found_used;
+
+	/* merge them with the unanchored ones, the found ones are moved to the end first */
+	memmove(kvb->candidates + kvb->unanchored_used, found, found_used * sizeof(*found));
+	found = kvb->candidates + kvb->unanchored_used;
+
+	for (i = 0, j = 0; i < kvb->unanchored_used || j < found_used; ) {
+		if (j == found_used || (i < kvb->unanchored_used && kvb->unanchored[i] < found[j])) {
+			kvb->candidates[n++] = kvb->unanchored[i++];
+		} else {
+			kvb->candidates[n++] = found[j++];
+		}
+	}
+
+	return n;
+}
 
 pcre_keyvalue_buffer *pcre_keyvalue_buffer_init(void) {
 	pcre_keyvalue_buffer *kvb;
@@ -345,20 +600,16 @@ int pcre_keyvalue_buffer_append(pcre_keyvalue_buffer *kvb, const char *key, cons
 	}
 
 	kv = kvb->kv[kvb->used];
-	if (NULL == (kv->key = pcre_compile(key,
-					  0, &errptr, &erroff, NULL))) {
+	if (NULL == (kv->key = pcre_glue_compile(key, 0, &(kv->key_extra), &errptr, &erroff))) {
 
 		fprintf(stderr, "%s.%d: rexexp compilation error at %s\n", __FILE__, __LINE__, errptr);
 		return -1;
 	}
 
-	if (NULL == (kv->key_extra = pcre_study(kv->key, 0, &errptr)) &&
-			errptr != NULL) {
-		return -1;
-	}
-
 	kv->value = buffer_init_string(value);
 
+	pcre_keyvalue_buffer_index(kvb, key, kvb->used);
+
 	kvb->used++;
 
 	return 0;
@@ -377,8 +628,7 @@ void pcre_keyvalue_buffer_free(pcre_keyvalue_buffer *kvb) {
 
 	for (i = 0; i < kvb->size; i++) {
 		kv = kvb->kv[i];
-		if (kv->key) pcre_free(kv->key);
-		if (kv->key_extra) pcre_free(kv->key_extra);
+		pcre_glue_free(kv->key, kv->key_extra);
 		if (kv->value) buffer_free(kv->value);
 		free(kv);
 	}
@@ -386,5 +636,9 @@ void pcre_keyvalue_buffer_free(pcre_keyvalue_buffer *kvb) {
 	if (kvb->kv) free(kvb->kv);
 #endif
 
+	pcre_keyvalue_trie_free(kvb->trie);
+	free(kvb->unanchored);
+	free(kvb->candidates);
+
 	free(kvb);
 }
@@ -5,9 +5,7 @@
 #include "config.h"
 #endif
 
-#ifdef HAVE_PCRE_H
-# include <pcre.h>
-#endif
+#include "pcre-glue.h"
 
 typedef enum {
 	HTTP_METHOD_UNSET = -1,
@@ -41,6 +39,32 @@ typedef enum {
 	HTTP_VERSION_1_1
 } http_version_t;
 
+/**
+ * the request headers we look up by id instead of by name
+ */
+typedef enum {
+	HTTP_HEADER_UNSET = -1,
+	HTTP_HEADER_ACCEPT_ENCODING,
+	HTTP_HEADER_AUTHORIZATION,
+	HTTP_HEADER_CONNECTION,
+	HTTP_HEADER_CONTENT_LENGTH,
+	HTTP_HEADER_CONTENT_TYPE,
+	HTTP_HEADER_COOKIE,
+	HTTP_HEADER_EXPECT,
+	HTTP_HEADER_HOST,
+	HTTP_HEADER_IF_MODIFIED_SINCE,
+	HTTP_HEADER_IF_NONE_MATCH,
+	HTTP_HEADER_IF_RANGE,
+	HTTP_HEADER_RANGE,
+	HTTP_HEADER_REFERER,
+	HTTP_HEADER_TRANSFER_ENCODING,
+	HTTP_HEADER_USER_AGENT,
+	HTTP_HEADER_X_FORWARDED_FOR,
+	HTTP_HEADER_X_FORWARDED_PROTO,
+
+	HTTP_HEADER_LAST_ELEMENT
+} http_header_t;
+
 typedef struct {
 	int key;
 
@@ -81,7 +105,36 @@ typedef struct {\
 KVB(keyvalue);
 KVB(s_keyvalue);
 KVB(httpauth_keyvalue);
-KVB(pcre_keyvalue);
+
+/**
+ * the anchored literal prefixes of the patterns, char by char
+ *
+ * a pattern like ^/old/ can only match a subject which starts with
+ * "/old/". One walk over the subject finds all the patterns whose prefix
+ * it has, the others don't have to be executed at all.
+ */
+typedef struct pcre_keyvalue_trie {
+	unsigned char c;
+
+	struct pcre_keyvalue_trie **children; /* sorted by c */
+	size_t children_used;
+
+	size_t *rules; /* the patterns whose prefix ends here, ascending */
+	size_t rules_used;
+} pcre_keyvalue_trie;
+
+typedef struct {
+	pcre_keyvalue **kv;
+	size_t used;
+	size_t size;
+
+	pcre_keyvalue_trie *trie;
+
+	size_t *unanchored; /* the patterns without a literal prefix, ascending */
+	size_t unanchored_used;
+
+	size_t *candidates; /* filled by pcre_keyvalue_buffer_candidates() */
+} pcre_keyvalue_buffer;
 
 LI_API const char * get_http_status_name(int i);
 LI_API const char * get_http_version_name(int i);
@@ -89,6 +142,7 @@ LI_API const char * get_http_method_name(http_method_t i);
 LI_API const char * get_http_status_body_name(int i);
 LI_API int get_http_version_key(const char *s);
 LI_API http_method_t get_http_method_key(const char *s);
+LI_API http_header_t get_http_header_key(const char *s, size_t len);
 
 LI_API const char * keyvalue_get_value(keyvalue *kv, int k);
 LI_API int keyvalue_get_key(keyvalue *kv, const char *s);
@@ -109,4 +163,18 @@ LI_API pcre_keyvalue_buffer * pcre_keyvalue_buffer_init(void);
 LI_API int pcre_keyvalue_buffer_append(pcre_keyvalue_buffer *kvb, const char *key, const char *value);
 LI_API void pcre_keyvalue_buffer_free(pcre_keyvalue_buffer *kvb);
 
+/**
+ * collect the patterns which might match the subject
+ *
+ * @return the number of patterns in kvb->candidates, in the order they were appended
+ */
+LI_API size_t pcre_keyvalue_buffer_candidates(pcre_keyvalue_buffer *kvb, const char *s, size_t len);
+
+/**
+ * the literal prefix every subject a pattern matches has to start with
+ *
+ * @return the length of the prefix, 0 if the pattern isn't anchored or starts with a meta-char
+ */
+LI_API size_t pcre_keyvalue_literal_prefix(const char *pattern, buffer *prefix);
+
 #endif
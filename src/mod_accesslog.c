@@ -23,7 +23,6 @@
 
 #include "plugin.h"
 
-#include "inet_ntop_cache.h"
 
 #include "sys-socket.h"
 #include "sys-files.h"
@@ -150,6 +149,7 @@ typedef struct {
 	PLUGIN_DATA;
 
 	plugin_config **config_storage;
+	config_patch_cache *patch_cache;
 	plugin_config conf;
 } plugin_data;
 
@@ -419,6 +419,8 @@ FREE_FUNC(mod_accesslog_free) {
 		free(p->config_storage);
 	}
 
+	config_patch_cache_free(p->patch_cache);
+
 	free(p);
 
 	return HANDLER_GO_ON;
@@ -429,9 +431,9 @@ SETDEFAULTS_FUNC(log_access_open) {
 	size_t i = 0;
 
 	config_values_t cv[] = {
-		{ "accesslog.filename",             NULL, T_CONFIG_STRING, T_CONFIG_SCOPE_CONNECTION },
-		{ "accesslog.use-syslog",           NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION },
-		{ "accesslog.format",               NULL, T_CONFIG_STRING, T_CONFIG_SCOPE_CONNECTION },
+		{ "accesslog.filename",             NULL, T_CONFIG_STRING, T_CONFIG_SCOPE_CONNECTION },  /* 0 */
+		{ "accesslog.use-syslog",           NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION }, /* 1 */
+		{ "accesslog.format",               NULL, T_CONFIG_STRING, T_CONFIG_SCOPE_CONNECTION },  /* 2 */
 		{ NULL,                             NULL, T_CONFIG_UNSET, T_CONFIG_SCOPE_UNSET }
 	};
 
@@ -575,6 +577,10 @@ SETDEFAULTS_FUNC(log_access_open) {
 #endif
 	}
 
+	if (NULL == (p->patch_cache = config_patch_cache_init(srv, cv, sizeof(plugin_config)))) {
+		return HANDLER_ERROR;
+	}
+
 	return HANDLER_GO_ON;
 }
 
@@ -622,8 +628,15 @@ SIGHUP_FUNC(log_access_cycle) {
 }
 
 static int mod_accesslog_patch_connection(server *srv, connection *con, plugin_data *p) {
-	size_t i, j;
+	config_patch_cache *pc = p->patch_cache;
+	const plugin_config *cached;
 	plugin_config *s = p->config_storage[0];
+	size_t i;
+
+	if (NULL != (cached = config_patch_cache_get(srv, con, pc))) {
+		p->conf = *cached;
+		return 0;
+	}
 
 	PATCH_OPTION(access_logfile);
 	PATCH_OPTION(format);
@@ -634,33 +647,28 @@ static int mod_accesslog_patch_connection(server *srv, connection *con, plugin_d
 	PATCH_OPTION(parsed_format);
 	PATCH_OPTION(use_syslog);
 
-	/* skip the first, the global context */
-	for (i = 1; i < srv->config_context->used; i++) {
-		data_config *dc = (data_config *)srv->config_context->data[i];
-		s = p->config_storage[i];
-
-		/* condition didn't match */
-		if (!config_check_cond(srv, con, dc)) continue;
-
-		/* merge config */
-		for (j = 0; j < dc->value->used; j++) {
-			data_unset *du = dc->value->data[j];
-
-			if (buffer_is_equal_string(du->key, CONST_STR_LEN("accesslog.filename"))) {
-				PATCH_OPTION(access_logfile);
-				PATCH_OPTION(log_access_fd);
-				PATCH_OPTION(last_generated_accesslog_ts_ptr);
-				PATCH_OPTION(access_logbuffer);
-				PATCH_OPTION(ts_accesslog_str);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("accesslog.format"))) {
-				PATCH_OPTION(format);
-				PATCH_OPTION(parsed_format);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("accesslog.use-syslog"))) {
-				PATCH_OPTION(use_syslog);
-			}
+	/* the conditionals which set one of our options */
+	for (i = 0; i < pc->used; i++) {
+		if (!CONFIG_PATCH_MATCHED(con, pc, i)) continue;
+
+		s = p->config_storage[pc->contexts[i].context_ndx];
+
+		if (CONFIG_PATCH_OPT(pc, i, 0)) {
+			PATCH_OPTION(access_logfile);
+			PATCH_OPTION(log_access_fd);
+			PATCH_OPTION(last_generated_accesslog_ts_ptr);
+			PATCH_OPTION(access_logbuffer);
+			PATCH_OPTION(ts_accesslog_str);
+		}
+		if (CONFIG_PATCH_OPT(pc, i, 1)) PATCH_OPTION(use_syslog);
+		if (CONFIG_PATCH_OPT(pc, i, 2)) {
+			PATCH_OPTION(format);
+			PATCH_OPTION(parsed_format);
 		}
 	}
 
+	config_patch_cache_insert(con, pc, &p->conf);
+
 	return 0;
 }
 
@@ -737,9 +745,9 @@ REQUESTDONE_FUNC(log_access_write) {
 				break;
 			case FORMAT_REMOTE_HOST:
 
-				/* handle inet_ntop cache */
+				/* formatted when the connection was accepted */
 
-				buffer_append_string(b, inet_ntop_cache_get_ip(srv, &(con->dst_addr)));
+				buffer_append_string_buffer(b, con->dst_addr_buf);
 
 				break;
 			case FORMAT_REMOTE_IDENT:
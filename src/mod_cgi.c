@@ -30,6 +30,8 @@
 
 #include "network_backends.h"
 
+#include "mod_cgi_spawner.h"
+
 #ifdef HAVE_SYS_FILIO_H
 # include <sys/filio.h>
 #endif
@@ -54,13 +56,17 @@ typedef struct {
 	array *cgi;
 	unsigned short execute_all;
 	unsigned short execute_x_only;
+	unsigned short use_spawner;
 } plugin_config;
 
 typedef struct {
 	PLUGIN_DATA;
 	buffer_pid_t cgi_pid;
 
+	cgi_spawner *spawner; /* NULL if cgi.spawner is disabled */
+
 	buffer *tmp_buf;
+	buffer *cgi_dir;
 
 	http_resp *resp;
 
@@ -82,6 +88,7 @@ typedef struct {
 	iosocket *sock;
 	iosocket *sock_err;
 	iosocket *wb_sock;
+	iosocket *spawn_sock; /* the spawner sends the pid of the CGI on it */
 
 	chunkqueue *rb;
 	chunkqueue *rb_err;
@@ -89,6 +96,9 @@ typedef struct {
 
 	cgi_state_t state;
 
+	unsigned short is_spawned; /* a child of the spawner, we can't waitpid() for it */
+	unsigned short is_reaped;  /* exited, the rest of its output might still be in the pipe */
+
 	connection *remote_con;  /* dumb pointer */
 } cgi_session;
 
@@ -99,6 +109,7 @@ static cgi_session * cgi_session_init() {
 	sess->sock = iosocket_init();
 	sess->sock_err = iosocket_init();
 	sess->wb_sock = iosocket_init();
+	sess->spawn_sock = iosocket_init();
 	sess->wb = chunkqueue_init();
 	sess->rb = chunkqueue_init();
 	sess->rb_err = chunkqueue_init();
@@ -112,6 +123,7 @@ static void cgi_session_free(cgi_session *sess) {
 	iosocket_free(sess->sock);
 	iosocket_free(sess->sock_err);
 	iosocket_free(sess->wb_sock);
+	iosocket_free(sess->spawn_sock);
 
 	chunkqueue_free(sess->wb);
 	chunkqueue_free(sess->rb);
@@ -130,6 +142,7 @@ INIT_FUNC(mod_cgi_init) {
 	assert(p);
 
 	p->tmp_buf = buffer_init();
+	p->cgi_dir = buffer_init();
 	p->resp = http_response_init();
 
 	return p;
@@ -157,7 +170,10 @@ FREE_FUNC(mod_cgi_free) {
 
 	if (r->ptr) free(r->ptr);
 
+	cgi_spawner_free(p->spawner);
+
 	buffer_free(p->tmp_buf);
+	buffer_free(p->cgi_dir);
 	http_response_free(p->resp);
 
 	free(p);
@@ -169,6 +185,7 @@ FREE_FUNC(mod_cgi_free) {
 #define CONFIG_ASSIGN      PLUGIN_NAME ".assign"
 #define CONFIG_EXECUTE_ALL PLUGIN_NAME ".execute-all"
 #define CONFIG_EXECUTE_X_ONLY PLUGIN_NAME ".execute-x-only"
+#define CONFIG_SPAWNER     PLUGIN_NAME ".spawner"
 
 SETDEFAULTS_FUNC(mod_cgi_set_defaults) {
 	plugin_data *p = p_d;
@@ -178,6 +195,7 @@ SETDEFAULTS_FUNC(mod_cgi_set_defaults) {
 		{ CONFIG_ASSIGN,                 NULL, T_CONFIG_ARRAY,   T_CONFIG_SCOPE_CONNECTION },       /* 0 */
 		{ CONFIG_EXECUTE_ALL,            NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION },       /* 1 */
 		{ CONFIG_EXECUTE_X_ONLY,         NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION },       /* 2 */
+		{ CONFIG_SPAWNER,                NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_SERVER },           /* 3 */
 		{ NULL,                          NULL, T_CONFIG_UNSET,   T_CONFIG_SCOPE_UNSET}
 	};
 
@@ -194,10 +212,12 @@ SETDEFAULTS_FUNC(mod_cgi_set_defaults) {
 		s->cgi    = array_init();
 		s->execute_all = 0;
 		s->execute_x_only = 0;
+		s->use_spawner = 0;
 
 		cv[0].destination = s->cgi;
 		cv[1].destination = &(s->execute_all);
 		cv[2].destination = &(s->execute_x_only);
+		cv[3].destination = &(s->use_spawner);
 
 		p->config_storage[i] = s;
 
@@ -206,6 +226,17 @@ SETDEFAULTS_FUNC(mod_cgi_set_defaults) {
 		}
 	}
 
+	/* start the helper now, while we are still small */
+	if (p->config_storage[0]->use_spawner) {
+		p->spawner = cgi_spawner_init();
+
+		if (0 != cgi_spawner_start(srv, p->spawner)) {
+			/* fall back to fork() */
+			cgi_spawner_free(p->spawner);
+			p->spawner = NULL;
+		}
+	}
+
 	return HANDLER_GO_ON;
 }
 
@@ -401,6 +432,7 @@ static handler_t cgi_connection_close(server *srv, connection *con, plugin_data
 	cgi_session *sess = con->plugin_ctx[p->id];
 	int status;
 	pid_t pid;
+	int is_spawned;
 
 	if (NULL == sess) return HANDLER_GO_ON;
 	if (con->mode != p->id) return HANDLER_GO_ON;
@@ -430,7 +462,14 @@ static handler_t cgi_connection_close(server *srv, connection *con, plugin_data
 		sess->wb_sock->fd = -1;
 	}
 
-	pid = sess->pid;
+	if (sess->spawn_sock->fd != -1) {
+		/* the CGI might still be started, it won't find anyone to talk to */
+		fdevent_event_del(srv->ev, sess->spawn_sock);
+		fdevent_unregister(srv->ev, sess->spawn_sock);
+	}
+
+	pid = sess->is_reaped ? 0 : sess->pid;
+	is_spawned = sess->is_spawned;
 
 	con->plugin_ctx[p->id] = NULL;
 
@@ -438,6 +477,12 @@ static handler_t cgi_connection_close(server *srv, connection *con, plugin_data
 	cgi_session_free(sess);
 	sess = NULL;
 
+	if (pid && is_spawned) {
+		/* not our child, the spawner reaps and kills it */
+		if (p->spawner) cgi_spawner_kill_child(srv, p->spawner, pid);
+		pid = 0;
+	}
+
 	/* if waitpid hasn't been called by response.c yet, do it here */
 	if (pid) {
 		/* check if the CGI-script is already gone */
@@ -509,7 +554,9 @@ static handler_t cgi_handle_fdevent(void *s, void *ctx, int revents) {
 	cgi_session *sess = ctx;
 	connection  *con  = sess->remote_con;
 
-	if (revents & FDEVENT_IN) {
+	/* the cgi might have exited right after its last write, read the pipe
+	 * until the EOF before we close the response */
+	if (revents & (FDEVENT_IN | FDEVENT_HUP)) {
 		switch (sess->state) {
 		case CGI_STATE_READ_RESPONSE_HEADER:
 			/* parse the header and set file-started, the demuxer will care about it */
@@ -545,6 +592,10 @@ static handler_t cgi_handle_fdevent(void *s, void *ctx, int revents) {
 			break;
 		default:
 			TRACE("unexpected state for a FDEVENT_IN: %d", sess->state);
+
+			con->send->is_closed = 1;
+			fdevent_event_del(srv->ev, sess->sock);
+			joblist_append(srv, con);
 			break;
 		}
 	}
@@ -553,14 +604,7 @@ static handler_t cgi_handle_fdevent(void *s, void *ctx, int revents) {
 		/* nothing to do */
 	}
 
-	/* perhaps this issue is already handled */
-	if (revents & FDEVENT_HUP) {
-		con->send->is_closed = 1;
-
-		fdevent_event_del(srv->ev, sess->sock);
-
-		joblist_append(srv, con);
-	} else if (revents & FDEVENT_ERR) {
+	if (revents & FDEVENT_ERR) {
 		con->send->is_closed = 1;
 
 		/* kill all connections to the cgi process */
@@ -647,6 +691,49 @@ static handler_t cgi_handle_err_fdevent(void *s, void *ctx, int revents) {
 }
 
 
+/**
+ * the CGI is running, wait for its output
+ */
+static void cgi_session_watch_output(server *srv, cgi_session *sess) {
+	fdevent_register(srv->ev, sess->sock, cgi_handle_fdevent, sess);
+	fdevent_event_add(srv->ev, sess->sock, FDEVENT_IN);
+
+	fdevent_register(srv->ev, sess->sock_err, cgi_handle_err_fdevent, sess);
+	fdevent_event_add(srv->ev, sess->sock_err, FDEVENT_IN);
+
+	sess->state = CGI_STATE_READ_RESPONSE_HEADER;
+}
+
+/**
+ * the spawner answered with the pid of the CGI
+ */
+static handler_t cgi_handle_spawn_fdevent(void *s, void *ctx, int revents) {
+	server      *srv  = (server *)s;
+	cgi_session *sess = ctx;
+	pid_t pid;
+
+	if (!(revents & (FDEVENT_IN | FDEVENT_HUP | FDEVENT_ERR))) return HANDLER_GO_ON;
+
+	if (0 == (pid = cgi_spawner_read_pid(sess->spawn_sock->fd))) return HANDLER_GO_ON;
+
+	fdevent_event_del(srv->ev, sess->spawn_sock);
+	fdevent_unregister(srv->ev, sess->spawn_sock);
+	close(sess->spawn_sock->fd);
+	sess->spawn_sock->fd = -1;
+
+	/* without a pid the subrequest handler sends a 500 */
+	if (pid > 0) {
+		sess->pid = pid;
+
+		cgi_session_watch_output(srv, sess);
+	}
+
+	joblist_append(srv, sess->remote_con);
+
+	return HANDLER_GO_ON;
+}
+
+
 static int cgi_env_add(char_array *env, const char *key, size_t key_len, const char *val, size_t val_len) {
 	char *dst;
 
@@ -687,8 +774,190 @@ static const char *sock_addr_to_p(server *srv, sock_addr *addr) {
 	return "";
 }
 
+/**
+ * build the environment of the CGI
+ *
+ * env->ptr is NULL terminated
+ */
+static void cgi_create_env_array(server *srv, connection *con, plugin_data *p, char_array *env) {
+	char buf[32];
+	size_t n;
+	const char *s;
+	server_socket *srv_sock = con->srv_socket;
+
+	env->ptr = NULL;
+	env->size = 0;
+	env->used = 0;
+
+	cgi_env_add(env, CONST_STR_LEN("SERVER_SOFTWARE"), CONST_STR_LEN(PACKAGE_NAME"/"PACKAGE_VERSION));
+
+	s = sock_addr_to_p(srv, &srv_sock->addr);
+	cgi_env_add(env, CONST_STR_LEN("SERVER_ADDR"), s, strlen(s));
+	/* !!! careful: s maybe reused for SERVER_NAME !!! */
+
+	if (!buffer_is_empty(con->server_name)) {
+		size_t len = con->server_name->used - 1;
+		char *colon = strchr(con->server_name->ptr, ':');
+		if (colon) len = colon - con->server_name->ptr;
+
+		cgi_env_add(env, CONST_STR_LEN("SERVER_NAME"), con->server_name->ptr, len);
+	} else {
+		/* use SERVER_ADDR */
+		cgi_env_add(env, CONST_STR_LEN("SERVER_NAME"), s, strlen(s));
+	}
+	cgi_env_add(env, CONST_STR_LEN("GATEWAY_INTERFACE"), CONST_STR_LEN("CGI/1.1"));
+
+	s = get_http_version_name(con->request.http_version);
+
+	cgi_env_add(env, CONST_STR_LEN("SERVER_PROTOCOL"), s, strlen(s));
+
+	LI_ltostr(buf, sock_addr_get_port(&srv_sock->addr));
+	cgi_env_add(env, CONST_STR_LEN("SERVER_PORT"), buf, strlen(buf));
+
+	s = get_http_method_name(con->request.http_method);
+	cgi_env_add(env, CONST_STR_LEN("REQUEST_METHOD"), s, strlen(s));
+
+	if (!buffer_is_empty(con->request.pathinfo)) {
+		cgi_env_add(env, CONST_STR_LEN("PATH_INFO"), CONST_BUF_LEN(con->request.pathinfo));
+	}
+	cgi_env_add(env, CONST_STR_LEN("REDIRECT_STATUS"), CONST_STR_LEN("200"));
+	if (!buffer_is_empty(con->uri.query)) {
+		cgi_env_add(env, CONST_STR_LEN("QUERY_STRING"), CONST_BUF_LEN(con->uri.query));
+	} else {
+		/* set a empty QUERY_STRING */
+		cgi_env_add(env, CONST_STR_LEN("QUERY_STRING"), CONST_STR_LEN(""));
+	}
+	if (!buffer_is_empty(con->request.orig_uri)) {
+		cgi_env_add(env, CONST_STR_LEN("REQUEST_URI"), CONST_BUF_LEN(con->request.orig_uri));
+	}
+
+	cgi_env_add(env, CONST_STR_LEN("REMOTE_ADDR"), CONST_BUF_LEN(con->dst_addr_buf));
+
+	LI_ltostr(buf, sock_addr_get_port(&con->dst_addr));
+	cgi_env_add(env, CONST_STR_LEN("REMOTE_PORT"), buf, strlen(buf));
+
+	if (!buffer_is_empty(con->authed_user)) {
+		cgi_env_add(env, CONST_STR_LEN("REMOTE_USER"),
+			    CONST_BUF_LEN(con->authed_user));
+	}
+
+#ifdef USE_OPENSSL
+	if (srv_sock->is_ssl) {
+		cgi_env_add(env, CONST_STR_LEN("HTTPS"), CONST_STR_LEN("on"));
+	}
+#endif
+
+	/* request.content_length < SSIZE_MAX, see request.c */
+	if (con->request.content_length > 0) {
+		LI_ltostr(buf, con->request.content_length);
+		cgi_env_add(env, CONST_STR_LEN("CONTENT_LENGTH"), buf, strlen(buf));
+	}
+	cgi_env_add(env, CONST_STR_LEN("SCRIPT_FILENAME"), CONST_BUF_LEN(con->physical.path));
+	cgi_env_add(env, CONST_STR_LEN("SCRIPT_NAME"), CONST_BUF_LEN(con->uri.path));
+	cgi_env_add(env, CONST_STR_LEN("DOCUMENT_ROOT"), CONST_BUF_LEN(con->physical.doc_root));
+
+	/* for valgrind */
+	if (NULL != (s = getenv("LD_PRELOAD"))) {
+		cgi_env_add(env, CONST_STR_LEN("LD_PRELOAD"), s, strlen(s));
+	}
+
+	if (NULL != (s = getenv("LD_LIBRARY_PATH"))) {
+		cgi_env_add(env, CONST_STR_LEN("LD_LIBRARY_PATH"), s, strlen(s));
+	}
+#ifdef __CYGWIN__
+	/* CYGWIN needs SYSTEMROOT */
+	if (NULL != (s = getenv("SYSTEMROOT"))) {
+		cgi_env_add(env, CONST_STR_LEN("SYSTEMROOT"), s, strlen(s));
+	}
+#endif
+
+	for (n = 0; n < con->request.headers->used; n++) {
+		data_string *ds;
+
+		ds = (data_string *)con->request.headers->data[n];
+
+		if (ds->value->used && ds->key->used) {
+			size_t j;
+
+			buffer_reset(p->tmp_buf);
+
+			if (0 != strcasecmp(ds->key->ptr, "CONTENT-TYPE")) {
+				buffer_copy_string_len(p->tmp_buf, CONST_STR_LEN("HTTP_"));
+				p->tmp_buf->used--; /* strip \0 after HTTP_ */
+			}
+
+			buffer_prepare_append(p->tmp_buf, ds->key->used + 2);
+
+			for (j = 0; j < ds->key->used - 1; j++) {
+				char cr = '_';
+				if (light_isalpha(ds->key->ptr[j])) {
+					/* upper-case */
+					cr = ds->key->ptr[j] & ~32;
+				} else if (light_isdigit(ds->key->ptr[j])) {
+					/* copy */
+					cr = ds->key->ptr[j];
+				}
+				p->tmp_buf->ptr[p->tmp_buf->used++] = cr;
+			}
+			p->tmp_buf->ptr[p->tmp_buf->used++] = '\0';
+
+			cgi_env_add(env, CONST_BUF_LEN(p->tmp_buf), CONST_BUF_LEN(ds->value));
+		}
+	}
+
+	for (n = 0; n < con->environment->used; n++) {
+		data_string *ds;
+
+		ds = (data_string *)con->environment->data[n];
+
+		if (ds->value->used && ds->key->used) {
+			size_t j;
+
+			buffer_reset(p->tmp_buf);
+
+			buffer_prepare_append(p->tmp_buf, ds->key->used + 2);
+
+			for (j = 0; j < ds->key->used - 1; j++) {
+				char cr = '_';
+				if (light_isalpha(ds->key->ptr[j])) {
+					/* upper-case */
+					cr = ds->key->ptr[j] & ~32;
+				} else if (light_isdigit(ds->key->ptr[j])) {
+					/* copy */
+					cr = ds->key->ptr[j];
+				}
+				p->tmp_buf->ptr[p->tmp_buf->used++] = cr;
+			}
+			p->tmp_buf->ptr[p->tmp_buf->used++] = '\0';
+
+			cgi_env_add(env, CONST_BUF_LEN(p->tmp_buf), CONST_BUF_LEN(ds->value));
+		}
+	}
+
+	if (env->size == env->used) {
+		env->size += 16;
+		env->ptr = realloc(env->ptr, env->size * sizeof(*env->ptr));
+	}
+
+	env->ptr[env->used] = NULL;
+}
+
+static void cgi_free_env_array(char_array *env) {
+	size_t i;
+
+	for (i = 0; i < env->used; i++) {
+		free(env->ptr[i]);
+	}
+	free(env->ptr);
+}
+
 static int cgi_create_env(server *srv, connection *con, plugin_data *p, buffer *cgi_handler) {
-	pid_t pid;
+	pid_t pid = -1;
+	char_array env;
+	char *args[3];
+	int i;
+	int is_spawned = 0;
+	int spawn_fd = -1;
 
 	int to_cgi_fds[2];
 	int from_cgi_fds[2];
@@ -725,19 +994,47 @@ static int cgi_create_env(server *srv, connection *con, plugin_data *p, buffer *
 		return -1;
 	}
 
+	/* the environment and the args are the same for fork() and the spawner */
+	cgi_create_env_array(srv, con, p, &env);
+
+	i = 0;
+	if (cgi_handler && cgi_handler->used > 1) {
+		args[i++] = cgi_handler->ptr;
+	}
+	args[i++] = con->physical.path->ptr;
+	args[i++] = NULL;
+
+	if (p->spawner) {
+		int fds[3];
+		char *c;
+
+		/* the CGI runs in the directory of the script */
+		buffer_copy_string_buffer(p->cgi_dir, con->physical.path);
+		if (NULL != (c = strrchr(p->cgi_dir->ptr, '/'))) {
+			*c = '\0';
+			p->cgi_dir->used = c - p->cgi_dir->ptr + 1;
+		} else {
+			buffer_reset(p->cgi_dir);
+		}
+
+		fds[0] = to_cgi_fds[0];
+		fds[1] = from_cgi_fds[1];
+		fds[2] = from_cgi_err_fds[1];
+
+		if (-1 != (spawn_fd = cgi_spawner_spawn(srv, p->spawner, p->cgi_dir->used ? p->cgi_dir->ptr : "", args, env.ptr, fds))) {
+			/* the pid arrives on spawn_fd */
+			is_spawned = 1;
+			pid = 0;
+		} else {
+			ERROR("the cgi spawner is busy for '%s', falling back to fork()", SAFE_BUF_STR(con->physical.path));
+		}
+	}
+
 	/* fork, execve */
-	switch (pid = fork()) {
+	switch (is_spawned ? 1 : (pid = fork())) {
 	case 0: {
 		/* child */
-		char **args;
-		int argc;
-		int i = 0;
-		char buf[32];
-		size_t n;
-		char_array env;
 		char *c;
-		const char *s;
-		server_socket *srv_sock = con->srv_socket;
 
 		/* move stdout to from_cgi_fd[1] */
 		close(STDOUT_FILENO);
@@ -760,175 +1057,6 @@ static int cgi_create_env(server *srv, connection *con, plugin_data *p, buffer *
 		/* not needed */
 		close(to_cgi_fds[1]);
 
-		/* create environment */
-		env.ptr = NULL;
-		env.size = 0;
-		env.used = 0;
-
-		cgi_env_add(&env, CONST_STR_LEN("SERVER_SOFTWARE"), CONST_STR_LEN(PACKAGE_NAME"/"PACKAGE_VERSION));
-
-		s = sock_addr_to_p(srv, &srv_sock->addr);
-		cgi_env_add(&env, CONST_STR_LEN("SERVER_ADDR"), s, strlen(s));
-		/* !!! careful: s maybe reused for SERVER_NAME !!! */
-
-		if (!buffer_is_empty(con->server_name)) {
-			size_t len = con->server_name->used - 1;
-			char *colon = strchr(con->server_name->ptr, ':');
-			if (colon) len = colon - con->server_name->ptr;
-
-			cgi_env_add(&env, CONST_STR_LEN("SERVER_NAME"), con->server_name->ptr, len);
-		} else {
-			/* use SERVER_ADDR */
-			cgi_env_add(&env, CONST_STR_LEN("SERVER_NAME"), s, strlen(s));
-		}
-		cgi_env_add(&env, CONST_STR_LEN("GATEWAY_INTERFACE"), CONST_STR_LEN("CGI/1.1"));
-
-		s = get_http_version_name(con->request.http_version);
-
-		cgi_env_add(&env, CONST_STR_LEN("SERVER_PROTOCOL"), s, strlen(s));
-
-		LI_ltostr(buf, sock_addr_get_port(&srv_sock->addr));
-		cgi_env_add(&env, CONST_STR_LEN("SERVER_PORT"), buf, strlen(buf));
-
-		s = get_http_method_name(con->request.http_method);
-		cgi_env_add(&env, CONST_STR_LEN("REQUEST_METHOD"), s, strlen(s));
-
-		if (!buffer_is_empty(con->request.pathinfo)) {
-			cgi_env_add(&env, CONST_STR_LEN("PATH_INFO"), CONST_BUF_LEN(con->request.pathinfo));
-		}
-		cgi_env_add(&env, CONST_STR_LEN("REDIRECT_STATUS"), CONST_STR_LEN("200"));
-		if (!buffer_is_empty(con->uri.query)) {
-			cgi_env_add(&env, CONST_STR_LEN("QUERY_STRING"), CONST_BUF_LEN(con->uri.query));
-		} else {
-			/* set a empty QUERY_STRING */
-			cgi_env_add(&env, CONST_STR_LEN("QUERY_STRING"), CONST_STR_LEN(""));
-		}
-		if (!buffer_is_empty(con->request.orig_uri)) {
-			cgi_env_add(&env, CONST_STR_LEN("REQUEST_URI"), CONST_BUF_LEN(con->request.orig_uri));
-		}
-
-		s = sock_addr_to_p(srv, &con->dst_addr);
-		cgi_env_add(&env, CONST_STR_LEN("REMOTE_ADDR"), s, strlen(s));
-
-		LI_ltostr(buf, sock_addr_get_port(&con->dst_addr));
-		cgi_env_add(&env, CONST_STR_LEN("REMOTE_PORT"), buf, strlen(buf));
-
-		if (!buffer_is_empty(con->authed_user)) {
-			cgi_env_add(&env, CONST_STR_LEN("REMOTE_USER"),
-				    CONST_BUF_LEN(con->authed_user));
-		}
-
-#ifdef USE_OPENSSL
-		if (srv_sock->is_ssl) {
-			cgi_env_add(&env, CONST_STR_LEN("HTTPS"), CONST_STR_LEN("on"));
-		}
-#endif
-
-		/* request.content_length < SSIZE_MAX, see request.c */
-		if (con->request.content_length > 0) {
-			LI_ltostr(buf, con->request.content_length);
-			cgi_env_add(&env, CONST_STR_LEN("CONTENT_LENGTH"), buf, strlen(buf));
-		}
-		cgi_env_add(&env, CONST_STR_LEN("SCRIPT_FILENAME"), CONST_BUF_LEN(con->physical.path));
-		cgi_env_add(&env, CONST_STR_LEN("SCRIPT_NAME"), CONST_BUF_LEN(con->uri.path));
-		cgi_env_add(&env, CONST_STR_LEN("DOCUMENT_ROOT"), CONST_BUF_LEN(con->physical.doc_root));
-
-		/* for valgrind */
-		if (NULL != (s = getenv("LD_PRELOAD"))) {
-			cgi_env_add(&env, CONST_STR_LEN("LD_PRELOAD"), s, strlen(s));
-		}
-
-		if (NULL != (s = getenv("LD_LIBRARY_PATH"))) {
-			cgi_env_add(&env, CONST_STR_LEN("LD_LIBRARY_PATH"), s, strlen(s));
-		}
-#ifdef __CYGWIN__
-		/* CYGWIN needs SYSTEMROOT */
-		if (NULL != (s = getenv("SYSTEMROOT"))) {
-			cgi_env_add(&env, CONST_STR_LEN("SYSTEMROOT"), s, strlen(s));
-		}
-#endif
-
-		for (n = 0; n < con->request.headers->used; n++) {
-			data_string *ds;
-
-			ds = (data_string *)con->request.headers->data[n];
-
-			if (ds->value->used && ds->key->used) {
-				size_t j;
-
-				buffer_reset(p->tmp_buf);
-
-				if (0 != strcasecmp(ds->key->ptr, "CONTENT-TYPE")) {
-					buffer_copy_string_len(p->tmp_buf, CONST_STR_LEN("HTTP_"));
-					p->tmp_buf->used--; /* strip \0 after HTTP_ */
-				}
-
-				buffer_prepare_append(p->tmp_buf, ds->key->used + 2);
-
-				for (j = 0; j < ds->key->used - 1; j++) {
-					char cr = '_';
-					if (light_isalpha(ds->key->ptr[j])) {
-						/* upper-case */
-						cr = ds->key->ptr[j] & ~32;
-					} else if (light_isdigit(ds->key->ptr[j])) {
-						/* copy */
-						cr = ds->key->ptr[j];
-					}
-					p->tmp_buf->ptr[p->tmp_buf->used++] = cr;
-				}
-				p->tmp_buf->ptr[p->tmp_buf->used++] = '\0';
-
-				cgi_env_add(&env, CONST_BUF_LEN(p->tmp_buf), CONST_BUF_LEN(ds->value));
-			}
-		}
-
-		for (n = 0; n < con->environment->used; n++) {
-			data_string *ds;
-
-			ds = (data_string *)con->environment->data[n];
-
-			if (ds->value->used && ds->key->used) {
-				size_t j;
-
-				buffer_reset(p->tmp_buf);
-
-				buffer_prepare_append(p->tmp_buf, ds->key->used + 2);
-
-				for (j = 0; j < ds->key->used - 1; j++) {
-					char cr = '_';
-					if (light_isalpha(ds->key->ptr[j])) {
-						/* upper-case */
-						cr = ds->key->ptr[j] & ~32;
-					} else if (light_isdigit(ds->key->ptr[j])) {
-						/* copy */
-						cr = ds->key->ptr[j];
-					}
-					p->tmp_buf->ptr[p->tmp_buf->used++] = cr;
-				}
-				p->tmp_buf->ptr[p->tmp_buf->used++] = '\0';
-
-				cgi_env_add(&env, CONST_BUF_LEN(p->tmp_buf), CONST_BUF_LEN(ds->value));
-			}
-		}
-
-		if (env.size == env.used) {
-			env.size += 16;
-			env.ptr = realloc(env.ptr, env.size * sizeof(*env.ptr));
-		}
-
-		env.ptr[env.used] = NULL;
-
-		/* set up args */
-		argc = 3;
-		args = malloc(sizeof(*args) * argc);
-		i = 0;
-
-		if (cgi_handler && cgi_handler->used > 1) {
-			args[i++] = cgi_handler->ptr;
-		}
-		args[i++] = con->physical.path->ptr;
-		args[i++] = NULL;
-
 		/* search for the last / */
 		if (NULL != (c = strrchr(con->physical.path->ptr, '/'))) {
 			*c = '\0';
@@ -955,6 +1083,7 @@ static int cgi_create_env(server *srv, connection *con, plugin_data *p, buffer *
 	case -1:
 		/* error */
 		ERROR("fork() failed: %s", strerror(errno));
+		cgi_free_env_array(&env);
 		close(to_cgi_fds[0]); close(to_cgi_fds[1]);
 		close(from_cgi_fds[0]); close(from_cgi_fds[1]);
 		close(from_cgi_err_fds[0]); close(from_cgi_err_fds[1]);
@@ -964,6 +1093,8 @@ static int cgi_create_env(server *srv, connection *con, plugin_data *p, buffer *
 		cgi_session *sess;
 		/* father */
 
+		cgi_free_env_array(&env);
+
 		close(from_cgi_fds[1]);
 		close(from_cgi_err_fds[1]);
 		close(to_cgi_fds[0]);
@@ -976,6 +1107,7 @@ static int cgi_create_env(server *srv, connection *con, plugin_data *p, buffer *
 
 		sess->remote_con = con;
 		sess->pid = pid;
+		sess->is_spawned = is_spawned;
 
 		assert(sess->sock);
 
@@ -985,6 +1117,8 @@ static int cgi_create_env(server *srv, connection *con, plugin_data *p, buffer *
 		sess->sock_err->type = IOSOCKET_TYPE_PIPE;
 		sess->wb_sock->fd = to_cgi_fds[1];
 		sess->wb_sock->type = IOSOCKET_TYPE_PIPE;
+		sess->spawn_sock->fd = spawn_fd;
+		sess->spawn_sock->type = IOSOCKET_TYPE_PIPE;
 
 		if (-1 == fdevent_fcntl_set(srv->ev, sess->sock)) {
 			log_error_write(srv, __FILE__, __LINE__, "ss", "fcntl failed: ", strerror(errno));
@@ -1004,13 +1138,16 @@ static int cgi_create_env(server *srv, connection *con, plugin_data *p, buffer *
 
 		con->plugin_ctx[p->id] = sess;
 
-		fdevent_register(srv->ev, sess->sock, cgi_handle_fdevent, sess);
-		fdevent_event_add(srv->ev, sess->sock, FDEVENT_IN);
+		if (is_spawned) {
+			/* wait for the pid, the spawner might need a while */
+			fdevent_fcntl_set(srv->ev, sess->spawn_sock);
+			fdevent_register(srv->ev, sess->spawn_sock, cgi_handle_spawn_fdevent, sess);
+			fdevent_event_add(srv->ev, sess->spawn_sock, FDEVENT_IN);
 
-		fdevent_register(srv->ev, sess->sock_err, cgi_handle_err_fdevent, sess);
-		fdevent_event_add(srv->ev, sess->sock_err, FDEVENT_IN);
-
-		sess->state = CGI_STATE_READ_RESPONSE_HEADER;
+			sess->state = CGI_STATE_CONNECTING;
+		} else {
+			cgi_session_watch_output(srv, sess);
+		}
 
 		break;
 	}
@@ -1162,6 +1299,20 @@ SUBREQUEST_FUNC(mod_cgi_read_response_content) {
 	if (con->mode != p->id) return HANDLER_GO_ON;
 	if (NULL == sess) return HANDLER_GO_ON;
 
+	if (sess->state == CGI_STATE_CONNECTING) {
+		if (sess->spawn_sock->fd != -1) return HANDLER_WAIT_FOR_EVENT;
+
+		/* the spawner answered without a pid */
+		ERROR("the cgi spawner couldn't start '%s'", SAFE_BUF_STR(con->uri.path));
+
+		cgi_connection_close(srv, con, p);
+
+		con->http_status = 500;
+		con->mode = DIRECT;
+
+		return HANDLER_FINISHED;
+	}
+
 	switch (cgi_demux_response(srv, con, p)) {
 	case 0:
 		break;
@@ -1184,6 +1335,26 @@ SUBREQUEST_FUNC(mod_cgi_read_response_content) {
 #endif
 	if (sess->pid == 0) return HANDLER_FINISHED;
 #ifndef _WIN32
+	if (sess->is_spawned || sess->is_reaped) {
+		/* the spawner reaps the CGI or we did already, the end of stdout is the end of the response */
+		if (!con->file_started) return HANDLER_WAIT_FOR_EVENT;
+		if (!con->send->is_closed) return HANDLER_GO_ON;
+
+		sess->pid = 0;
+
+		fdevent_event_del(srv->ev, sess->sock);
+		fdevent_unregister(srv->ev, sess->sock);
+
+		fdevent_event_del(srv->ev, sess->sock_err);
+		fdevent_unregister(srv->ev, sess->sock_err);
+
+		cgi_session_free(sess);
+		sess = NULL;
+
+		con->plugin_ctx[p->id] = NULL;
+		return HANDLER_FINISHED;
+	}
+
 	switch(waitpid(sess->pid, &status, WNOHANG)) {
 	case 0:
 		/* we only have for events here if we don't have the header yet,
@@ -1222,18 +1393,22 @@ SUBREQUEST_FUNC(mod_cgi_read_response_content) {
 
 		return HANDLER_FINISHED;
 	default:
-		con->send->is_closed = 1;
-
 		if (WIFEXITED(status)) {
-			/* nothing */
-		} else {
-			log_error_write(srv, __FILE__, __LINE__, "s", "cgi died ?");
+			/* the end of stdout is the end of the response */
+			sess->is_reaped = 1;
 
-			con->mode = DIRECT;
-			con->http_status = 500;
+			if (!con->file_started) return HANDLER_WAIT_FOR_EVENT;
+			if (con->send->is_closed) return HANDLER_FINISHED;
 
+			return HANDLER_GO_ON;
 		}
 
+		log_error_write(srv, __FILE__, __LINE__, "s", "cgi died ?");
+
+		con->send->is_closed = 1;
+		con->mode = DIRECT;
+		con->http_status = 500;
+
 		sess->pid = 0;
 
 		fdevent_event_del(srv->ev, sess->sock);
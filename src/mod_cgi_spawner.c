@@ -0,0 +1,306 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+
+#include "log.h"
+#include "array-static.h"
+#include "mod_cgi_spawner.h"
+
+#include "sys-files.h"
+#include "sys-socket.h"
+#include "sys-process.h"
+
+#ifdef HAVE_HELPER_PROCESS
+# include <sys/wait.h>
+# include <unistd.h>
+#endif
+
+/* the max. size of a spawn request: argv + env + cwd */
+#define CGI_SPAWNER_MSG_MAX (256 * 1024)
+
+/* stdin, stdout and stderr of the CGI */
+#define CGI_SPAWNER_FDS 3
+
+/* a request with argc == 0 is a kill request, the pid is behind the header */
+typedef struct {
+	unsigned int argc;
+	unsigned int envc;
+	unsigned int len; /* length of the strings behind the header */
+} cgi_spawner_hdr;
+
+/* the CGIs the helper hasn't reaped yet, their pids can't be reused */
+typedef struct {
+	pid_t *ptr;
+
+	size_t used;
+	size_t size;
+} cgi_spawner_children;
+
+cgi_spawner *cgi_spawner_init(void) {
+	STRUCT_INIT(cgi_spawner, sp);
+
+	sp->helper = helper_process_init();
+	sp->msg = buffer_init();
+
+	return sp;
+}
+
+void cgi_spawner_free(cgi_spawner *sp) {
+	if (!sp) return;
+
+	helper_process_free(sp->helper);
+	buffer_free(sp->msg);
+
+	free(sp);
+}
+
+#ifdef HAVE_HELPER_PROCESS
+/* in the helper: the CGIs we haven't reaped yet, their pids can't be reused */
+static cgi_spawner_children cgi_spawner_running = { NULL, 0, 0 };
+
+static pid_t cgi_spawner_exec(char *cwd, char **args, char **env, int *fds, int answer_fd) {
+	sigset_t mask;
+	pid_t pid;
+	int i;
+
+#ifdef HAVE_WORKING_VFORK
+	pid = vfork();
+#else
+	pid = fork();
+#endif
+
+	switch (pid) {
+	case 0:
+		/* the received fds are always > 2, see helper_process.c */
+		for (i = 0; i < 3; i++) {
+			dup2(fds[i], i);
+		}
+
+		if (*cwd && -1 == chdir(cwd)) _exit(255);
+
+		for (i = 3; i < 256; i++) {
+			close(i);
+		}
+
+		/* the ignored signals and the mask survive the execve(), the CGI
+		 * has to be able to waitpid() and to get a SIGPIPE */
+		signal(SIGCHLD, SIG_DFL);
+		signal(SIGHUP, SIG_DFL);
+		signal(SIGPIPE, SIG_DFL);
+
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+
+		execve(args[0], args, env);
+
+		_exit(255);
+	case -1:
+		break;
+	default:
+		break;
+	}
+
+	/* tell the server the pid, -1 on error */
+	if (sizeof(pid) != write(answer_fd, &pid, sizeof(pid))) {
+		/* the server went away, nothing we can do */
+	}
+
+	return pid;
+}
+
+static void cgi_spawner_children_add(cgi_spawner_children *children, pid_t pid) {
+	if (children->size == 0) {
+		children->size = 16;
+		children->ptr = malloc(sizeof(*children->ptr) * children->size);
+	} else if (children->used == children->size) {
+		children->size += 16;
+		children->ptr = realloc(children->ptr, sizeof(*children->ptr) * children->size);
+	}
+
+	children->ptr[children->used++] = pid;
+}
+
+static void cgi_spawner_reap(void) {
+	cgi_spawner_children *children = &cgi_spawner_running;
+	pid_t pid;
+	size_t i;
+
+	while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+		for (i = 0; i < children->used; i++) {
+			if (children->ptr[i] != pid) continue;
+
+			children->ptr[i] = children->ptr[--children->used];
+			break;
+		}
+	}
+}
+
+/**
+ * kill a CGI for the server
+ *
+ * only a child we haven't reaped yet, the pid of a reaped one might
+ * belong to someone else already
+ */
+static void cgi_spawner_kill(cgi_spawner_children *children, pid_t pid) {
+	size_t i;
+
+	for (i = 0; i < children->used; i++) {
+		if (children->ptr[i] == pid) {
+			kill(pid, SIGTERM);
+			return;
+		}
+	}
+}
+
+/**
+ * split the strings of a spawn request into cwd, argv and env and start it
+ */
+static int cgi_spawner_handle_msg(cgi_spawner_children *children, char *msg, size_t len, int *fds, int answer_fd) {
+	cgi_spawner_hdr hdr;
+	char **args, **env;
+	char *s, *end;
+	unsigned int i;
+	pid_t pid;
+
+	if (len < sizeof(hdr)) return -1;
+
+	memcpy(&hdr, msg, sizeof(hdr));
+
+	if (hdr.len != len - sizeof(hdr)) return -1;
+	if (hdr.argc == 0 || hdr.argc + hdr.envc + 1 > hdr.len) return -1;
+
+	s = msg + sizeof(hdr);
+	end = s + hdr.len;
+
+	/* the last string has to be terminated */
+	if (end[-1] != '\0') return -1;
+
+	args = malloc((hdr.argc + 1) * sizeof(*args));
+	env = malloc((hdr.envc + 1) * sizeof(*env));
+
+	/* the first string is the cwd */
+	s += strlen(s) + 1;
+
+	for (i = 0; i < hdr.argc && s < end; i++, s += strlen(s) + 1) args[i] = s;
+	args[i] = NULL;
+
+	for (i = 0; i < hdr.envc && s < end; i++, s += strlen(s) + 1) env[i] = s;
+	env[i] = NULL;
+
+	if ((pid = cgi_spawner_exec(msg + sizeof(hdr), args, env, fds, answer_fd)) > 0) {
+		cgi_spawner_children_add(children, pid);
+	}
+
+	free(args);
+	free(env);
+
+	return 0;
+}
+
+/**
+ * a spawn or a kill request, called in the helper
+ */
+static void cgi_spawner_answer(char *msg, size_t len, int *fds, int answer_fd) {
+	if (len == sizeof(cgi_spawner_hdr) + sizeof(pid_t) && 0 == ((cgi_spawner_hdr *)msg)->argc) {
+		pid_t pid;
+
+		memcpy(&pid, msg + sizeof(cgi_spawner_hdr), sizeof(pid));
+		cgi_spawner_kill(&cgi_spawner_running, pid);
+
+		return;
+	}
+
+	if (NULL == fds || 0 != cgi_spawner_handle_msg(&cgi_spawner_running, msg, len, fds, answer_fd)) {
+		pid_t pid = -1;
+
+		if (sizeof(pid) != write(answer_fd, &pid, sizeof(pid))) {
+			/* ignore */
+		}
+	}
+}
+#endif
+
+int cgi_spawner_start(server *srv, cgi_spawner *sp) {
+	UNUSED(srv);
+
+#ifdef HAVE_HELPER_PROCESS
+	/* the helper reaps the CGIs in between the requests */
+	sp->helper->query_fds = CGI_SPAWNER_FDS;
+	sp->helper->tick = cgi_spawner_reap;
+
+	return helper_process_start(sp->helper, CGI_SPAWNER_MSG_MAX, cgi_spawner_answer);
+#else
+	UNUSED(sp);
+
+	ERROR("%s", "the cgi spawner isn't supported on this platform");
+
+	return -1;
+#endif
+}
+
+void cgi_spawner_kill_child(server *srv, cgi_spawner *sp, pid_t pid) {
+	cgi_spawner_hdr hdr;
+	char msg[sizeof(hdr) + sizeof(pid)];
+	int fd;
+
+	UNUSED(srv);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.len = sizeof(pid);
+
+	memcpy(msg, &hdr, sizeof(hdr));
+	memcpy(msg + sizeof(hdr), &pid, sizeof(pid));
+
+	/* there is no answer to wait for, the helper reaps the CGI in any case */
+	if (-1 == (fd = helper_process_query_fds(sp->helper, msg, sizeof(msg), NULL))) {
+		ERROR("sending the kill request for pid %d failed", (int)pid);
+		return;
+	}
+
+	close(fd);
+}
+
+int cgi_spawner_spawn(server *srv, cgi_spawner *sp, const char *cwd, char **args, char **env, int fds[3]) {
+	cgi_spawner_hdr hdr;
+	size_t i;
+
+	UNUSED(srv);
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	buffer_copy_string_len(sp->msg, (char *)&hdr, sizeof(hdr));
+	buffer_append_string_len(sp->msg, cwd, strlen(cwd) + 1);
+
+	for (i = 0; args[i]; i++, hdr.argc++) {
+		buffer_append_string_len(sp->msg, args[i], strlen(args[i]) + 1);
+	}
+	for (i = 0; env[i]; i++, hdr.envc++) {
+		buffer_append_string_len(sp->msg, env[i], strlen(env[i]) + 1);
+	}
+
+	/* buffer_append_string_len() adds a trailing \0 we don't send */
+	hdr.len = sp->msg->used - 1 - sizeof(hdr);
+	memcpy(sp->msg->ptr, &hdr, sizeof(hdr));
+
+	return helper_process_query_fds(sp->helper, sp->msg->ptr, sp->msg->used - 1, fds);
+}
+
+pid_t cgi_spawner_read_pid(int fd) {
+	pid_t pid;
+	ssize_t r;
+
+	/* the helper writes the pid at once, we get it completely or not at all */
+	while (-1 == (r = read(fd, &pid, sizeof(pid))) && errno == EINTR);
+
+	if (r == -1 && errno == EAGAIN) return 0;
+
+	/* EOF: the helper couldn't even answer */
+	if (r != sizeof(pid) || pid <= 0) return -1;
+
+	return pid;
+}
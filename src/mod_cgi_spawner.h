@@ -0,0 +1,58 @@
+#ifndef _MOD_CGI_SPAWNER_H_
+#define _MOD_CGI_SPAWNER_H_
+
+#include <sys/types.h>
+
+#include "base.h"
+#include "buffer.h"
+#include "helper_process.h"
+
+/**
+ * a small helper process which starts the CGIs for us
+ *
+ * forking the server itself gets more expensive the more memory it has
+ * mapped. The helper (see helper_process.h) is forked while the server is
+ * still small and only does the fork()/exec() for us. The pipes are passed
+ * to it with the spawn request, the pid comes back as the answer.
+ *
+ * the CGIs are children of the helper, not of the server. The helper
+ * reaps them, the server only sees the pipes. To stop a CGI the server
+ * asks the helper, only the helper knows if the pid is still the CGI.
+ */
+typedef struct {
+	helper_process *helper;
+
+	buffer *msg; /* the spawn request */
+} cgi_spawner;
+
+cgi_spawner *cgi_spawner_init(void);
+void cgi_spawner_free(cgi_spawner *sp);
+
+/**
+ * fork the helper process
+ *
+ * @return 0 on success, -1 if the helper isn't available on this platform or fork() failed
+ */
+int cgi_spawner_start(server *srv, cgi_spawner *sp);
+
+/**
+ * ask the helper to start args[0]
+ *
+ * @param fds stdin, stdout and stderr of the new process
+ * @return the fd the pid arrives on (see cgi_spawner_read_pid()), -1 if the helper is busy or the request failed
+ */
+int cgi_spawner_spawn(server *srv, cgi_spawner *sp, const char *cwd, char **args, char **env, int fds[3]);
+
+/**
+ * read the answer to cgi_spawner_spawn() from the non-blocking fd
+ *
+ * @return the pid of the new process, 0 if it isn't there yet, -1 if the spawn failed
+ */
+pid_t cgi_spawner_read_pid(int fd);
+
+/**
+ * let the helper send a SIGTERM to the CGI 'pid' if it is still running
+ */
+void cgi_spawner_kill_child(server *srv, cgi_spawner *sp, pid_t pid);
+
+#endif
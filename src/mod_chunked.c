@@ -334,6 +334,11 @@ URIHANDLER_FUNC(mod_chunked_encode_response_content) {
 			chunk_set_done(c);
 
 			break;
+		case PIPE_CHUNK:
+			/* pipe-chunks are only used if no filter is active */
+			ERROR("type not supported: %d", c->type);
+
+			return HANDLER_ERROR;
 		case UNUSED_CHUNK:
 			break;
 		}
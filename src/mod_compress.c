@@ -12,6 +12,7 @@
 #include "log.h"
 #include "buffer.h"
 #include "response.h"
+#include "strftime_cache.h"
 #include "stat_cache.h"
 
 #include "plugin.h"
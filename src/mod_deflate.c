@@ -30,7 +30,6 @@
 
 #include "crc32.h"
 #include "etag.h"
-#include "inet_ntop_cache.h"
 
 #if defined HAVE_ZLIB_H && defined HAVE_LIBZ
 # define USE_ZLIB
@@ -97,6 +96,7 @@ typedef struct {
 	array  *encodings_arr;
 	
 	plugin_config **config_storage;
+	config_patch_cache *patch_cache;
 	plugin_config conf; 
 } plugin_data;
 
@@ -167,6 +167,8 @@ FREE_FUNC(mod_deflate_free) {
 		free(p->config_storage);
 	}
 
+	config_patch_cache_free(p->patch_cache);
+
 	buffer_free(p->tmp_buf);
 	array_free(p->encodings_arr);
 	
@@ -180,17 +182,17 @@ SETDEFAULTS_FUNC(mod_deflate_setdefaults) {
 	size_t i = 0;
 	
 	config_values_t cv[] = { 
-		{ CONFIG_DEFLATE_OUTPUT_BUFFER_SIZE,    NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },
-		{ CONFIG_DEFLATE_MIMETYPES,             NULL, T_CONFIG_ARRAY, T_CONFIG_SCOPE_CONNECTION },
-		{ CONFIG_DEFLATE_COMPRESSION_LEVEL,     NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },
-		{ CONFIG_DEFLATE_MEM_LEVEL,             NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },
-		{ CONFIG_DEFLATE_WINDOW_SIZE,           NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },
-		{ CONFIG_DEFLATE_MIN_COMPRESS_SIZE,     NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },
-		{ CONFIG_DEFLATE_WORK_BLOCK_SIZE,       NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },
-		{ CONFIG_DEFLATE_ENABLED,               NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION },
-		{ CONFIG_DEFLATE_DEBUG,                 NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION },
-		{ CONFIG_DEFLATE_SYNC_FLUSH,            NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION },
-		{ CONFIG_DEFLATE_ALLOWED_ENCODINGS,     NULL, T_CONFIG_ARRAY, T_CONFIG_SCOPE_CONNECTION },
+		{ CONFIG_DEFLATE_OUTPUT_BUFFER_SIZE,    NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },   /* 0 */
+		{ CONFIG_DEFLATE_MIMETYPES,             NULL, T_CONFIG_ARRAY, T_CONFIG_SCOPE_CONNECTION },   /* 1 */
+		{ CONFIG_DEFLATE_COMPRESSION_LEVEL,     NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },   /* 2 */
+		{ CONFIG_DEFLATE_MEM_LEVEL,             NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },   /* 3 */
+		{ CONFIG_DEFLATE_WINDOW_SIZE,           NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },   /* 4 */
+		{ CONFIG_DEFLATE_MIN_COMPRESS_SIZE,     NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },   /* 5 */
+		{ CONFIG_DEFLATE_WORK_BLOCK_SIZE,       NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },   /* 6 */
+		{ CONFIG_DEFLATE_ENABLED,               NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION }, /* 7 */
+		{ CONFIG_DEFLATE_DEBUG,                 NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION }, /* 8 */
+		{ CONFIG_DEFLATE_SYNC_FLUSH,            NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION }, /* 9 */
+		{ CONFIG_DEFLATE_ALLOWED_ENCODINGS,     NULL, T_CONFIG_ARRAY, T_CONFIG_SCOPE_CONNECTION },   /* 10 */
 		{ NULL,                                 NULL, T_CONFIG_UNSET, T_CONFIG_SCOPE_UNSET }
 	};
 	
@@ -278,6 +280,10 @@ SETDEFAULTS_FUNC(mod_deflate_setdefaults) {
 			s->output_buffer_size = 0;
 		}
 	}
+
+	if (NULL == (p->patch_cache = config_patch_cache_init(srv, cv, sizeof(plugin_config)))) {
+		return HANDLER_ERROR;
+	}
 	
 	return HANDLER_GO_ON;
 	
@@ -1042,8 +1048,15 @@ static handler_t deflate_compress_response(server *srv, connection *con, handler
 }
 
 static int mod_deflate_patch_connection(server *srv, connection *con, plugin_data *p) {
-	size_t i, j;
+	config_patch_cache *pc = p->patch_cache;
+	const plugin_config *cached;
 	plugin_config *s = p->config_storage[0];
+	size_t i;
+
+	if (NULL != (cached = config_patch_cache_get(srv, con, pc))) {
+		p->conf = *cached;
+		return 0;
+	}
 
 	PATCH_OPTION(output_buffer_size);
 	PATCH_OPTION(mimetypes);
@@ -1057,44 +1070,27 @@ static int mod_deflate_patch_connection(server *srv, connection *con, plugin_dat
 	PATCH_OPTION(allowed_encodings);
 	PATCH_OPTION(sync_flush);
 	
-	/* skip the first, the global context */
-	for (i = 1; i < srv->config_context->used; i++) {
-		data_config *dc = (data_config *)srv->config_context->data[i];
-		s = p->config_storage[i];
-		
-		/* condition didn't match */
-		if (!config_check_cond(srv, con, dc)) continue;
-		
-		/* merge config */
-		for (j = 0; j < dc->value->used; j++) {
-			data_unset *du = dc->value->data[j];
-			
-			if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_DEFLATE_OUTPUT_BUFFER_SIZE))) {
-				PATCH_OPTION(output_buffer_size);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_DEFLATE_MIMETYPES))) {
-				PATCH_OPTION(mimetypes);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_DEFLATE_COMPRESSION_LEVEL))) {
-				PATCH_OPTION(compression_level);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_DEFLATE_MEM_LEVEL))) {
-				PATCH_OPTION(mem_level);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_DEFLATE_WINDOW_SIZE))) {
-				PATCH_OPTION(window_size);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_DEFLATE_MIN_COMPRESS_SIZE))) {
-				PATCH_OPTION(min_compress_size);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_DEFLATE_WORK_BLOCK_SIZE))) {
-				PATCH_OPTION(work_block_size);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_DEFLATE_ENABLED))) {
-				PATCH_OPTION(enabled);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_DEFLATE_DEBUG))) {
-				PATCH_OPTION(debug);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_DEFLATE_ALLOWED_ENCODINGS))) {
-				PATCH_OPTION(allowed_encodings);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_DEFLATE_SYNC_FLUSH))) {
-				PATCH_OPTION(sync_flush);
-			}
-		}
+	/* the conditionals which set one of our options */
+	for (i = 0; i < pc->used; i++) {
+		if (!CONFIG_PATCH_MATCHED(con, pc, i)) continue;
+
+		s = p->config_storage[pc->contexts[i].context_ndx];
+
+		if (CONFIG_PATCH_OPT(pc, i, 0)) PATCH_OPTION(output_buffer_size);
+		if (CONFIG_PATCH_OPT(pc, i, 1)) PATCH_OPTION(mimetypes);
+		if (CONFIG_PATCH_OPT(pc, i, 2)) PATCH_OPTION(compression_level);
+		if (CONFIG_PATCH_OPT(pc, i, 3)) PATCH_OPTION(mem_level);
+		if (CONFIG_PATCH_OPT(pc, i, 4)) PATCH_OPTION(window_size);
+		if (CONFIG_PATCH_OPT(pc, i, 5)) PATCH_OPTION(min_compress_size);
+		if (CONFIG_PATCH_OPT(pc, i, 6)) PATCH_OPTION(work_block_size);
+		if (CONFIG_PATCH_OPT(pc, i, 7)) PATCH_OPTION(enabled);
+		if (CONFIG_PATCH_OPT(pc, i, 8)) PATCH_OPTION(debug);
+		if (CONFIG_PATCH_OPT(pc, i, 9)) PATCH_OPTION(sync_flush);
+		if (CONFIG_PATCH_OPT(pc, i, 10)) PATCH_OPTION(allowed_encodings);
 	}
-	
+
+	config_patch_cache_insert(con, pc, &p->conf);
+
 	return 0;
 }
 
@@ -1142,7 +1138,7 @@ PHYSICALPATH_FUNC(mod_deflate_handle_response_header) {
 	}
 
 	/* Check Accept-Encoding for supported encoding. */
-	if (NULL == (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("Accept-Encoding")))) {
+	if (NULL == (ds = http_request_get_header(con, HTTP_HEADER_ACCEPT_ENCODING))) {
 		return HANDLER_GO_ON;
 	}
 		
@@ -1171,8 +1167,8 @@ PHYSICALPATH_FUNC(mod_deflate_handle_response_header) {
 		 * maybe old buggy proxy server
 		 */
 		/* most of buggy clients are Yahoo Slurp;) */
-		if (p->conf.debug) TRACE("Buggy HTTP 1.0 client sending 'Accept Encoding: gzip, deflate': %i",
-				(char *) inet_ntop_cache_get_ip(srv, &(con->dst_addr)));
+		if (p->conf.debug) TRACE("Buggy HTTP 1.0 client sending 'Accept Encoding: gzip, deflate': %s",
+				BUF_STR(con->dst_addr_buf));
 		return HANDLER_GO_ON;
 	}
 #endif
@@ -13,6 +13,7 @@
 #include "plugin.h"
 
 #include "response.h"
+#include "strftime_cache.h"
 #include "stat_cache.h"
 #include "stream.h"
 #include "etag.h"
@@ -40,6 +41,7 @@
 typedef struct {
 #ifdef HAVE_PCRE_H
 	pcre *regex;
+	pcre_extra *regex_extra;
 #endif
 	buffer *string;
 } excludes;
@@ -58,6 +60,7 @@ typedef struct {
 	unsigned short hide_readme_file;
 	unsigned short show_header;
 	unsigned short hide_header_file;
+	unsigned short cache_ttl;
 
 	excludes_buffer *excludes;
 
@@ -66,12 +69,48 @@ typedef struct {
 	buffer *set_footer;
 } plugin_config;
 
+/**
+ * the rendered rows of a directory if dir-listing.cache-ttl is set
+ *
+ * an entry is only valid for the directory as it was stat()ed and for the
+ * options the rows depend on
+ */
+typedef struct {
+	buffer *path;
+	buffer *rows;
+
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	off_t size;
+
+	unsigned short hide_dot_files;
+	unsigned short hide_readme_file;
+	unsigned short hide_header_file;
+	unsigned short use_xattr;
+	excludes_buffer *excludes;
+	array *mimetypes;
+
+	time_t ts;        /* when the rows were rendered */
+	time_t last_used; /* LRU */
+} dirls_cache_entry;
+
+ARRAY_STATIC_DEF(dirls_cache, dirls_cache_entry, size_t max_size;);
+
+#define DIRLS_CACHE_MAX 32
+
+/* the rows of larger directories aren't cached */
+#define DIRLS_CACHE_ROWS_MAX (256 * 1024)
+
 typedef struct {
 	PLUGIN_DATA;
 
 	buffer *tmp_buf;
 	buffer *content_charset;
 	buffer *path;
+	buffer *rows;
+
+	dirls_cache *cache;
 
 	plugin_config **config_storage;
 
@@ -114,8 +153,8 @@ static int excludes_buffer_append(excludes_buffer *exb, buffer *string) {
 	}
 
 
-	if (NULL == (exb->ptr[exb->used]->regex = pcre_compile(string->ptr, 0,
-						    &errptr, &erroff, NULL))) {
+	if (NULL == (exb->ptr[exb->used]->regex = pcre_glue_compile(string->ptr, 0,
+						    &(exb->ptr[exb->used]->regex_extra), &errptr, &erroff))) {
 		return -1;
 	}
 
@@ -138,7 +177,7 @@ static void excludes_buffer_free(excludes_buffer *exb) {
 	size_t i;
 
 	for (i = 0; i < exb->size; i++) {
-		if (exb->ptr[i]->regex) pcre_free(exb->ptr[i]->regex);
+		pcre_glue_free(exb->ptr[i]->regex, exb->ptr[i]->regex_extra);
 		if (exb->ptr[i]->string) buffer_free(exb->ptr[i]->string);
 		free(exb->ptr[i]);
 	}
@@ -149,6 +188,40 @@ static void excludes_buffer_free(excludes_buffer *exb) {
 	free(exb);
 }
 
+static dirls_cache_entry *dirls_cache_entry_init(void) {
+	STRUCT_INIT(dirls_cache_entry, entry);
+
+	entry->path = buffer_init();
+	entry->rows = buffer_init();
+
+	return entry;
+}
+
+static void dirls_cache_entry_free(dirls_cache_entry *entry) {
+	if (!entry) return;
+
+	buffer_free(entry->path);
+	buffer_free(entry->rows);
+
+	free(entry);
+}
+
+static dirls_cache *dirls_cache_init(void) {
+	STRUCT_INIT(dirls_cache, cache);
+
+	cache->max_size = DIRLS_CACHE_MAX;
+
+	return cache;
+}
+
+static void dirls_cache_free(dirls_cache *cache) {
+	if (!cache) return;
+
+	ARRAY_STATIC_FREE(cache, dirls_cache_entry, entry, dirls_cache_entry_free(entry));
+
+	free(cache);
+}
+
 /* init the plugin data */
 INIT_FUNC(mod_dirlisting_init) {
 	plugin_data *p;
@@ -160,6 +233,8 @@ INIT_FUNC(mod_dirlisting_init) {
 	p->tmp_buf = buffer_init();
 	p->content_charset = buffer_init();
 	p->path = buffer_init();
+	p->rows = buffer_init();
+	p->cache = dirls_cache_init();
 
 	return p;
 }
@@ -191,7 +266,9 @@ FREE_FUNC(mod_dirlisting_free) {
 
 	buffer_free(p->tmp_buf);
 	buffer_free(p->path);
+	buffer_free(p->rows);
 	buffer_free(p->content_charset);
+	dirls_cache_free(p->cache);
 
 	free(p);
 
@@ -252,6 +329,7 @@ static int parse_config_entry(server *srv, plugin_config *s, array *ca, const ch
 #define CONFIG_HIDE_HEADER_FILE "dir-listing.hide-header-file"
 #define CONFIG_DIR_LISTING      "server.dir-listing"
 #define CONFIG_SET_FOOTER       "dir-listing.set-footer"
+#define CONFIG_CACHE_TTL        "dir-listing.cache-ttl"
 
 
 SETDEFAULTS_FUNC(mod_dirlisting_set_defaults) {
@@ -270,6 +348,7 @@ SETDEFAULTS_FUNC(mod_dirlisting_set_defaults) {
 		{ CONFIG_HIDE_HEADER_FILE, NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION }, /* 8 */
 		{ CONFIG_DIR_LISTING,      NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION }, /* 9 */
 		{ CONFIG_SET_FOOTER,       NULL, T_CONFIG_STRING, T_CONFIG_SCOPE_CONNECTION }, /* 10 */
+		{ CONFIG_CACHE_TTL,        NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },   /* 11 */
 
 		{ NULL,                          NULL, T_CONFIG_UNSET, T_CONFIG_SCOPE_UNSET }
 	};
@@ -293,6 +372,7 @@ SETDEFAULTS_FUNC(mod_dirlisting_set_defaults) {
 		s->hide_header_file = 0;
 		s->encoding = buffer_init();
 		s->set_footer = buffer_init();
+		s->cache_ttl = 0;
 
 		cv[0].destination = s->excludes;
 		cv[1].destination = &(s->dir_listing);
@@ -305,6 +385,7 @@ SETDEFAULTS_FUNC(mod_dirlisting_set_defaults) {
 		cv[8].destination = &(s->hide_header_file);
 		cv[9].destination = &(s->dir_listing); /* old name */
 		cv[10].destination = s->set_footer;
+		cv[11].destination = &(s->cache_ttl);
 
 		p->config_storage[i] = s;
 		ca = ((data_config *)srv->config_context->data[i])->value;
@@ -333,6 +414,7 @@ static int mod_dirlisting_patch_connection(server *srv, connection *con, plugin_
 	PATCH_OPTION(hide_header_file);
 	PATCH_OPTION(excludes);
 	PATCH_OPTION(set_footer);
+	PATCH_OPTION(cache_ttl);
 
 	/* skip the first, the global context */
 	for (i = 1; i < srv->config_context->used; i++) {
@@ -367,6 +449,8 @@ static int mod_dirlisting_patch_connection(server *srv, connection *con, plugin_
 				PATCH_OPTION(set_footer);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_EXCLUDE))) {
 				PATCH_OPTION(excludes);
+			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_CACHE_TTL))) {
+				PATCH_OPTION(cache_ttl);
 			}
 		}
 	}
@@ -389,32 +473,15 @@ typedef struct {
 #define DIRLIST_ENT_NAME(ent)	((char*)(ent) + sizeof(dirls_entry_t))
 #define DIRLIST_BLOB_SIZE		16
 
-/* simple combsort algorithm */
-static void http_dirls_sort(dirls_entry_t **ent, int num) {
-	int gap = num;
-	int i, j;
-	int swapped;
-	dirls_entry_t *tmp;
+static int http_dirls_cmp(const void *a, const void *b) {
+	const dirls_entry_t *ea = *(dirls_entry_t * const *)a;
+	const dirls_entry_t *eb = *(dirls_entry_t * const *)b;
 
-	do {
-		gap = (gap * 10) / 13;
-		if (gap == 9 || gap == 10)
-			gap = 11;
-		if (gap < 1)
-			gap = 1;
-		swapped = 0;
-
-		for (i = 0; i < num - gap; i++) {
-			j = i + gap;
-			if (strcmp(DIRLIST_ENT_NAME(ent[i]), DIRLIST_ENT_NAME(ent[j])) > 0) {
-				tmp = ent[i];
-				ent[i] = ent[j];
-				ent[j] = tmp;
-				swapped = 1;
-			}
-		}
+	return strcmp(DIRLIST_ENT_NAME(ea), DIRLIST_ENT_NAME(eb));
+}
 
-	} while (gap > 1 || swapped);
+static void http_dirls_sort(dirls_entry_t **ent, size_t num) {
+	qsort(ent, num, sizeof(*ent), http_dirls_cmp);
 }
 
 /* buffer must be able to hold "999.9K"
@@ -597,9 +664,9 @@ static void http_list_directory_footer(server *srv, connection *con, plugin_data
 	));
 }
 
-static int http_list_directory(server *srv, connection *con, plugin_data *p, buffer *dir) {
+/* the <tr>s of the directories and files */
+static int http_list_directory_rows(server *srv, connection *con, plugin_data *p, buffer *dir, buffer *out) {
 	DIR *dp;
-	buffer *out;
 	struct dirent *dent;
 	struct stat st;
 	size_t i;
@@ -689,12 +756,11 @@ static int http_list_directory(server *srv, connection *con, plugin_data *p, buf
 #ifdef HAVE_PCRE_H
 		for(i = 0; i < p->conf.excludes->used; i++) {
 			int n;
-#define N 10
-			int ovec[N * 3];
-			pcre *regex = p->conf.excludes->ptr[i]->regex;
+			excludes *exclude = p->conf.excludes->ptr[i];
 
-			if ((n = pcre_exec(regex, NULL, dent->d_name,
-				    strlen(dent->d_name), 0, 0, ovec, 3 * N)) < 0) {
+			/* we only want to know if it matches, the captures aren't needed */
+			if ((n = pcre_exec(exclude->regex, exclude->regex_extra, dent->d_name,
+				    strlen(dent->d_name), 0, 0, NULL, 0)) < 0) {
 				if (n != PCRE_ERROR_NOMATCH) {
 					log_error_write(srv, __FILE__, __LINE__, "sd",
 						"execution error while matching:", n);
@@ -720,15 +786,17 @@ static int http_list_directory(server *srv, connection *con, plugin_data *p, buf
 		 */
 		if (i > (size_t)name_max) continue;
 
+#ifdef HAVE_FSTATAT
+		/* relative to the open directory, no path to build and resolve */
+		if (0 != fstatat(dirfd(dp), dent->d_name, &st, 0)) continue;
+#else
 		/* build the dirname */
 		buffer_copy_string_buffer(p->path, dir);
 		PATHNAME_APPEND_SLASH(p->path);
 		buffer_append_string(p->path, dent->d_name);
 
-		if (stat(p->path->ptr, &st) != 0) {
-			fprintf(stderr, "%s.%d: %s, %s\r\n", __FILE__, __LINE__, p->path->ptr, strerror(errno));
-			continue;
-		}
+		if (0 != stat(p->path->ptr, &st)) continue;
+#endif
 
 		list = &files;
 		if (S_ISDIR(st.st_mode))
@@ -754,15 +822,8 @@ static int http_list_directory(server *srv, connection *con, plugin_data *p, buf
 
 	if (files.used) http_dirls_sort(files.ent, files.used);
 
-	out = chunkqueue_get_append_buffer(con->send);
-	buffer_copy_string_len(out, CONST_STR_LEN("<?xml version=\"1.0\" encoding=\""));
-	if (buffer_is_empty(p->conf.encoding)) {
-		buffer_append_string_len(out, CONST_STR_LEN("iso-8859-1"));
-	} else {
-		buffer_append_string_buffer(out, p->conf.encoding);
-	}
-	buffer_append_string_len(out, CONST_STR_LEN("\"?>\n"));
-	http_list_directory_header(srv, con, p, out);
+	/* a row is about 150 bytes, don't grow the buffer row by row */
+	buffer_prepare_append(out, (dirs.used + files.used) * 160);
 
 	/* directories */
 	for (i = 0; i < dirs.used; i++) {
@@ -853,6 +914,127 @@ static int http_list_directory(server *srv, connection *con, plugin_data *p, buf
 	free(files.ent);
 	free(dirs.ent);
 
+	return 0;
+}
+
+static dirls_cache_entry *dirls_cache_get(server *srv, connection *con, plugin_data *p, buffer *dir, stat_cache_entry *sce) {
+	dirls_cache *cache = p->cache;
+	size_t i;
+
+	for (i = 0; i < cache->used; i++) {
+		dirls_cache_entry *entry = cache->ptr[i];
+
+		if (!buffer_is_equal(entry->path, dir)) continue;
+
+		if (srv->cur_ts - entry->ts >= p->conf.cache_ttl) return NULL;
+
+		/* the directory or the options have changed */
+		if (entry->dev != sce->st.st_dev ||
+		    entry->ino != sce->st.st_ino ||
+		    entry->mtime != sce->st.st_mtime ||
+		    entry->size != sce->st.st_size ||
+		    entry->hide_dot_files != p->conf.hide_dot_files ||
+		    entry->hide_readme_file != p->conf.hide_readme_file ||
+		    entry->hide_header_file != p->conf.hide_header_file ||
+		    entry->use_xattr != con->conf.use_xattr ||
+		    entry->excludes != p->conf.excludes ||
+		    entry->mimetypes != con->conf.mimetypes) return NULL;
+
+		entry->last_used = srv->cur_ts;
+
+		return entry;
+	}
+
+	return NULL;
+}
+
+static dirls_cache_entry *dirls_cache_insert(server *srv, connection *con, plugin_data *p, buffer *dir, stat_cache_entry *sce) {
+	dirls_cache *cache = p->cache;
+	dirls_cache_entry *entry = NULL;
+	size_t i;
+
+	for (i = 0; i < cache->used; i++) {
+		if (buffer_is_equal(cache->ptr[i]->path, dir)) {
+			entry = cache->ptr[i];
+			break;
+		}
+	}
+
+	if (!entry) {
+		if (cache->used < cache->max_size) {
+			entry = dirls_cache_entry_init();
+
+			ARRAY_STATIC_PREPARE_APPEND(cache);
+			cache->ptr[cache->used++] = entry;
+		} else {
+			/* replace the least recently used entry */
+			size_t lru = 0;
+
+			for (i = 1; i < cache->used; i++) {
+				if (cache->ptr[i]->last_used < cache->ptr[lru]->last_used) lru = i;
+			}
+
+			entry = cache->ptr[lru];
+		}
+
+		buffer_copy_string_buffer(entry->path, dir);
+	}
+
+	entry->dev = sce->st.st_dev;
+	entry->ino = sce->st.st_ino;
+	entry->mtime = sce->st.st_mtime;
+	entry->size = sce->st.st_size;
+
+	entry->hide_dot_files = p->conf.hide_dot_files;
+	entry->hide_readme_file = p->conf.hide_readme_file;
+	entry->hide_header_file = p->conf.hide_header_file;
+	entry->use_xattr = con->conf.use_xattr;
+	entry->excludes = p->conf.excludes;
+	entry->mimetypes = con->conf.mimetypes;
+
+	entry->ts = srv->cur_ts;
+	entry->last_used = srv->cur_ts;
+
+	return entry;
+}
+
+static int http_list_directory(server *srv, connection *con, plugin_data *p, buffer *dir, stat_cache_entry *sce) {
+	dirls_cache_entry *entry = NULL;
+	buffer *out, *rows;
+
+	if (p->conf.cache_ttl &&
+	    NULL != (entry = dirls_cache_get(srv, con, p, dir, sce))) {
+		rows = entry->rows;
+	} else {
+		rows = p->rows;
+		buffer_reset(rows);
+
+		if (0 != http_list_directory_rows(srv, con, p, dir, rows)) return -1;
+
+		/* a directory which was changed in this second might change
+		 * again without a new mtime, don't cache it yet */
+		if (p->conf.cache_ttl && sce->st.st_mtime < srv->cur_ts &&
+		    rows->used <= DIRLS_CACHE_ROWS_MAX) {
+			entry = dirls_cache_insert(srv, con, p, dir, sce);
+
+			/* the rows move into the cache, the old ones of the entry are the next scratch buffer */
+			p->rows = entry->rows;
+			entry->rows = rows;
+		}
+	}
+
+	out = chunkqueue_get_append_buffer(con->send);
+	buffer_copy_string_len(out, CONST_STR_LEN("<?xml version=\"1.0\" encoding=\""));
+	if (buffer_is_empty(p->conf.encoding)) {
+		buffer_append_string_len(out, CONST_STR_LEN("iso-8859-1"));
+	} else {
+		buffer_append_string_buffer(out, p->conf.encoding);
+	}
+	buffer_append_string_len(out, CONST_STR_LEN("\"?>\n"));
+	http_list_directory_header(srv, con, p, out);
+
+	buffer_append_string_buffer(out, rows);
+
 	http_list_directory_footer(srv, con, p, out);
 
 	/* Insert possible charset to Content-Type */
@@ -928,7 +1110,7 @@ URIHANDLER_FUNC(mod_dirlisting_subrequest) {
 		return HANDLER_FINISHED;
 	}
 
-	if (http_list_directory(srv, con, p, con->physical.path)) {
+	if (http_list_directory(srv, con, p, con->physical.path, sce)) {
 		/* dirlisting failed */
 		con->http_status = 403;
 	}
@@ -8,7 +8,6 @@
 
 #include "plugin.h"
 
-#include "inet_ntop_cache.h"
 
 /**
  * mod_evasive
@@ -172,7 +171,7 @@ URIHANDLER_FUNC(mod_evasive_uri_handler) {
 
 		if (conns_by_ip > p->conf.max_conns) {
 			log_error_write(srv, __FILE__, __LINE__, "ss",
-				inet_ntop_cache_get_ip(srv, &(con->dst_addr)),
+				BUF_STR(con->dst_addr_buf),
 				"turned away. Too many connections.");
 
 			con->http_status = 403;
@@ -7,6 +7,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "base.h"
 #include "log.h"
@@ -14,7 +15,6 @@
 
 #include "plugin.h"
 
-#include "inet_ntop_cache.h"
 #include "configfile.h"
 
 /**
@@ -29,6 +29,10 @@
  *       extforward.forwarder = ( "10.0.0.232" => "trust",
  *                                "10.0.0.233" => "trust" )
  *
+ *       Trust the proxies in a network
+ *       extforward.forwarder = ( "10.0.0.0/24" => "trust",
+ *                                "2001:db8::/32" => "trust" )
+ *
  *       Trust all proxies  (NOT RECOMMENDED!)
  *       extforward.forwarder = ( "all" => "trust")
  *
@@ -39,6 +43,14 @@
  *       config. However "all" has effect only on connecting IP, as the
  *       X-Forwarded-For header can not be trusted.
  *
+ *       The headers which carry the client address, the first one the
+ *       request has is used. The default is
+ *       extforward.headers = ( "X-Forwarded-For", "Forwarded-For" )
+ *
+ *       Use the RFC 7239 header only if all your proxies set it, otherwise
+ *       a client can send it through them
+ *       extforward.headers = ( "Forwarded" )
+ *
  * Note: The effect of this module is variable on $HTTP["remotip"] directives and
  *       other module's remote ip dependent actions.
  *  Things done by modules before we change the remoteip or after we reset it will match on the proxy's IP.
@@ -74,21 +86,67 @@
  *     2006.05.26   LEM: Run at uri_raw time, as we don't need to see the URI
  *                       In this manner, we run before mod_access and $HTTP["remoteip"] directives work!
  *     2006.05.26   LEM: Clean config_cond cache of tests whose result we probably change.
+ *                  Networks in extforward.forwarder, extforward.headers and the Forwarded header
  */
 
 
+/**
+ * the trusted proxies as a binary trie over the 128 bits of an address,
+ * IPv4 addresses are stored as IPv4-mapped IPv6 addresses (::ffff:a.b.c.d)
+ *
+ * the nodes are kept in one array and refer to each other by index, the
+ * root is node 0 and a child of 0 means there is none
+ */
+typedef struct {
+	unsigned int child[2];
+	int trusted; /* a forwarder ends here, all addresses below are trusted */
+} forwarder_node;
+
+typedef struct {
+	forwarder_node *nodes;
+	size_t used;
+	size_t size;
+} forwarder_trie;
+
+/* the addresses are compared as IPv6 addresses */
+typedef unsigned char forwarder_key[16];
+
+#define FORWARDER_KEY_BIT(key, n) (((key)[(n) / 8] >> (7 - (n) % 8)) & 1)
+
+/* trust by "all", not set if the config has no "all" */
+typedef enum { FORWARD_ALL_UNSET, FORWARD_ALL_TRUST, FORWARD_ALL_UNTRUST } forward_all_t;
+
 /* plugin config for all request/connections */
 
 typedef struct {
 	array *forwarder;
+	array *headers;
+
+	forwarder_trie *trie;
+	forward_all_t forward_all;
 } plugin_config;
 
+/**
+ * a hop of the X-Forwarded-For or Forwarded header
+ */
+typedef struct {
+	const char *node;  /* NULL if the Forwarded element has no for= */
+	size_t node_len;
+	const char *proto; /* only set by Forwarded */
+	size_t proto_len;
+} forwarded_hop;
+
 typedef struct {
 	PLUGIN_DATA;
 
 	plugin_config **config_storage;
 
 	plugin_config conf;
+
+	/* the hops of the current request, reused */
+	forwarded_hop *hops;
+	size_t hops_used;
+	size_t hops_size;
 } plugin_data;
 
 
@@ -112,9 +170,147 @@ static void handler_ctx_free(handler_ctx *hctx) {
 	free(hctx);
 }
 
+static forwarder_trie *forwarder_trie_init(void) {
+	STRUCT_INIT(forwarder_trie, trie);
+
+	trie->size = 16;
+	trie->nodes = calloc(trie->size, sizeof(*trie->nodes));
+	trie->used = 1; /* the root */
+
+	return trie;
+}
+
+static void forwarder_trie_free(forwarder_trie *trie) {
+	if (!trie) return;
+
+	free(trie->nodes);
+	free(trie);
+}
+
+/**
+ * trust all addresses which start with the first 'bits' bits of the key
+ */
+static void forwarder_trie_insert(forwarder_trie *trie, forwarder_key key, int bits) {
+	unsigned int ndx = 0;
+	int i;
+
+	for (i = 0; i < bits; i++) {
+		int bit = FORWARDER_KEY_BIT(key, i);
+
+		/* a shorter prefix trusts us already */
+		if (trie->nodes[ndx].trusted) return;
+
+		if (0 == trie->nodes[ndx].child[bit]) {
+			if (trie->used == trie->size) {
+				trie->size += 16;
+				trie->nodes = realloc(trie->nodes, trie->size * sizeof(*trie->nodes));
+				memset(trie->nodes + trie->used, 0, (trie->size - trie->used) * sizeof(*trie->nodes));
+			}
+
+			trie->nodes[ndx].child[bit] = trie->used++;
+		}
+
+		ndx = trie->nodes[ndx].child[bit];
+	}
+
+	trie->nodes[ndx].trusted = 1;
+}
+
+/**
+ * @return 1 if the address is in one of the trusted networks
+ */
+static int forwarder_trie_lookup(forwarder_trie *trie, forwarder_key key) {
+	unsigned int ndx = 0;
+	int i;
+
+	for (i = 0; ; i++) {
+		if (trie->nodes[ndx].trusted) return 1;
+
+		if (i == 128) return 0;
+
+		if (0 == (ndx = trie->nodes[ndx].child[FORWARDER_KEY_BIT(key, i)])) return 0;
+	}
+}
+
+/**
+ * parse an IPv4 or IPv6 address
+ *
+ * @return 0 on success, -1 if it is no address (e.g. "unknown" or "_hidden" in Forwarded)
+ */
+static int forwarder_key_from_string(forwarder_key key, const char *s, size_t len) {
+	char buf[64]; /* > INET6_ADDRSTRLEN */
+
+	if (len == 0 || len >= sizeof(buf)) return -1;
+
+	memcpy(buf, s, len);
+	buf[len] = '\0';
+
+	memset(key, 0, sizeof(forwarder_key));
+
+#ifdef HAVE_IPV6
+	if (NULL != memchr(s, ':', len)) {
+		return 1 == inet_pton(AF_INET6, buf, key) ? 0 : -1;
+	}
+
+	key[10] = key[11] = 0xff;
+
+	return 1 == inet_pton(AF_INET, buf, key + 12) ? 0 : -1;
+#else
+	{
+		in_addr_t a;
+
+		if (INADDR_NONE == (a = inet_addr(buf))) return -1;
+
+		key[10] = key[11] = 0xff;
+		memcpy(key + 12, &a, 4);
+
+		return 0;
+	}
+#endif
+}
+
+static int forwarder_key_from_sock(forwarder_key key, sock_addr *addr) {
+	memset(key, 0, sizeof(forwarder_key));
+
+	switch (addr->plain.sa_family) {
+	case AF_INET:
+		key[10] = key[11] = 0xff;
+		memcpy(key + 12, &(addr->ipv4.sin_addr), 4);
+
+		return 0;
+#ifdef HAVE_IPV6
+	case AF_INET6:
+		memcpy(key, &(addr->ipv6.sin6_addr), 16);
+
+		return 0;
+#endif
+	default:
+		return -1;
+	}
+}
+
+static void forwarder_key_to_sock(forwarder_key key, sock_addr *addr) {
+	static const unsigned char v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+	memset(addr, 0, sizeof(*addr));
+
+	if (0 == memcmp(key, v4mapped, sizeof(v4mapped))) {
+		addr->ipv4.sin_family = AF_INET;
+		memcpy(&(addr->ipv4.sin_addr), key + 12, 4);
+	} else {
+#ifdef HAVE_IPV6
+		addr->ipv6.sin6_family = AF_INET6;
+		memcpy(&(addr->ipv6.sin6_addr), key, 16);
+#else
+		addr->plain.sa_family = AF_UNSPEC;
+#endif
+	}
+}
+
 /* init the plugin data */
 INIT_FUNC(mod_extforward_init) {
 	plugin_data *p;
+	UNUSED(srv);
 	p = calloc(1, sizeof(*p));
 	return p;
 }
@@ -136,18 +332,71 @@ FREE_FUNC(mod_extforward_free) {
 			if (!s) continue;
 
 			array_free(s->forwarder);
+			array_free(s->headers);
+			forwarder_trie_free(s->trie);
 
 			free(s);
 		}
 		free(p->config_storage);
 	}
 
+	free(p->hops);
 
 	free(p);
 
 	return HANDLER_GO_ON;
 }
 
+/**
+ * build the trie from the "<address>[/<bits>]" => "trust" entries
+ */
+static int mod_extforward_parse_forwarder(plugin_config *s) {
+	size_t j;
+
+	for (j = 0; j < s->forwarder->used; j++) {
+		data_string *ds = (data_string *)s->forwarder->data[j];
+		forwarder_key key;
+		const char *slash;
+		size_t addr_len;
+		int bits, is_ipv4;
+
+		if (buffer_is_equal_string(ds->key, CONST_STR_LEN("all"))) {
+			s->forward_all = (0 == strcasecmp(ds->value->ptr, "trust")) ? FORWARD_ALL_TRUST : FORWARD_ALL_UNTRUST;
+
+			continue;
+		}
+
+		slash = strchr(ds->key->ptr, '/');
+		addr_len = slash ? (size_t)(slash - ds->key->ptr) : ds->key->used - 1;
+
+		if (0 != forwarder_key_from_string(key, ds->key->ptr, addr_len)) {
+			ERROR("extforward.forwarder: '%s' isn't an IPv4 or IPv6 address", SAFE_BUF_STR(ds->key));
+
+			return -1;
+		}
+
+		is_ipv4 = (NULL == memchr(ds->key->ptr, ':', addr_len));
+		bits = is_ipv4 ? 32 : 128;
+
+		if (slash) {
+			char *err;
+			long nm_bits = strtol(slash + 1, &err, 10);
+
+			if (slash[1] == '\0' || *err != '\0' || nm_bits < 0 || nm_bits > bits) {
+				ERROR("extforward.forwarder: '%s' has no valid netmask", SAFE_BUF_STR(ds->key));
+
+				return -1;
+			}
+
+			bits = nm_bits;
+		}
+
+		forwarder_trie_insert(s->trie, key, is_ipv4 ? 96 + bits : bits);
+	}
+
+	return 0;
+}
+
 /* handle plugin config and check values */
 
 SETDEFAULTS_FUNC(mod_extforward_set_defaults) {
@@ -156,6 +405,7 @@ SETDEFAULTS_FUNC(mod_extforward_set_defaults) {
 
 	config_values_t cv[] = {
 		{ "extforward.forwarder",             NULL, T_CONFIG_ARRAY, T_CONFIG_SCOPE_CONNECTION },       /* 0 */
+		{ "extforward.headers",               NULL, T_CONFIG_ARRAY, T_CONFIG_SCOPE_CONNECTION },       /* 1 */
 		{ NULL,                         NULL, T_CONFIG_UNSET, T_CONFIG_SCOPE_UNSET }
 	};
 
@@ -168,14 +418,34 @@ SETDEFAULTS_FUNC(mod_extforward_set_defaults) {
 
 		s = calloc(1, sizeof(plugin_config));
 		s->forwarder    = array_init();
+		s->headers      = array_init();
+		s->trie         = forwarder_trie_init();
+		s->forward_all  = FORWARD_ALL_UNSET;
 
 		cv[0].destination = s->forwarder;
+		cv[1].destination = s->headers;
 
 		p->config_storage[i] = s;
 
 		if (0 != config_insert_values_global(srv, ((data_config *)srv->config_context->data[i])->value, cv)) {
 			return HANDLER_ERROR;
 		}
+
+		if (0 != mod_extforward_parse_forwarder(s)) {
+			return HANDLER_ERROR;
+		}
+
+		if (i == 0 && s->headers->used == 0) {
+			data_string *ds;
+
+			ds = data_string_init();
+			buffer_copy_string_len(ds->value, CONST_STR_LEN("X-Forwarded-For"));
+			array_insert_unique(s->headers, (data_unset *)ds);
+
+			ds = data_string_init();
+			buffer_copy_string_len(ds->value, CONST_STR_LEN("Forwarded-For"));
+			array_insert_unique(s->headers, (data_unset *)ds);
+		}
 	}
 
 	return HANDLER_GO_ON;
@@ -188,6 +458,9 @@ static int mod_extforward_patch_connection(server *srv, connection *con, plugin_
 	plugin_config *s = p->config_storage[0];
 
 	PATCH(forwarder);
+	PATCH(trie);
+	PATCH(forward_all);
+	PATCH(headers);
 
 	/* skip the first, the global context */
 	for (i = 1; i < srv->config_context->used; i++) {
@@ -203,6 +476,10 @@ static int mod_extforward_patch_connection(server *srv, connection *con, plugin_
 
 			if (buffer_is_equal_string(du->key, CONST_STR_LEN("extforward.forwarder"))) {
 				PATCH(forwarder);
+				PATCH(trie);
+				PATCH(forward_all);
+			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("extforward.headers"))) {
+				PATCH(headers);
 			}
 		}
 	}
@@ -211,135 +488,169 @@ static int mod_extforward_patch_connection(server *srv, connection *con, plugin_
 }
 #undef PATCH
 
+static forwarded_hop *forwarded_hop_append(plugin_data *p) {
+	forwarded_hop *hop;
 
-static void put_string_into_array_len(array *ary, const char *str, int len)
-{
-	data_string *tempdata;
-	if (len == 0)
-		return;
-	tempdata = data_string_init();
-	buffer_copy_string_len(tempdata->value,str,len);
-	array_insert_unique(ary,(data_unset *)tempdata);
+	if (p->hops_used == p->hops_size) {
+		p->hops_size += 8;
+		p->hops = realloc(p->hops, p->hops_size * sizeof(*p->hops));
+	}
+
+	hop = &(p->hops[p->hops_used++]);
+	memset(hop, 0, sizeof(*hop));
+
+	return hop;
 }
+
 /*
-   extract a forward array from the environment
-*/
-static array *extract_forward_array(buffer *pbuffer)
-{
-	array *result = array_init();
-	if (pbuffer->used > 0) {
-		char *base, *curr;
-		/* state variable, 0 means not in string, 1 means in string */
-		int in_str = 0;
-		for (base = pbuffer->ptr, curr = pbuffer->ptr; *curr; curr++) {
-			if (in_str) {
-				if ((*curr > '9' || *curr < '0') && *curr != '.' && *curr != ':') {
-					/* found an separator , insert value into result array */
-					put_string_into_array_len(result, base, curr - base);
-					/* change state to not in string */
-					in_str = 0;
-				}
-			} else {
-				if (*curr >= '0' && *curr <= '9') {
-					/* found leading char of an IP address, move base pointer and change state */
-					base = curr;
-					in_str = 1;
-				}
-			}
-		}
-		/* if breaking out while in str, we got to the end of string, so add it */
-		if (in_str) {
-			put_string_into_array_len(result, base, curr - base);
+ * split "X-Forwarded-For: client, proxy1, proxy2" into the hops
+ */
+static void extract_forwarded_for(plugin_data *p, buffer *value) {
+	const char *s, *end;
+
+	p->hops_used = 0;
+
+	if (value->used == 0) return;
+
+	for (s = value->ptr, end = value->ptr + value->used - 1; s < end; ) {
+		const char *start, *stop;
+
+		while (s < end && (*s == ' ' || *s == '\t' || *s == ',')) s++;
+
+		for (start = s; s < end && *s != ','; s++);
+
+		for (stop = s; stop > start && (stop[-1] == ' ' || stop[-1] == '\t'); stop--);
+
+		if (stop > start) {
+			forwarded_hop *hop = forwarded_hop_append(p);
+
+			hop->node = start;
+			hop->node_len = stop - start;
 		}
 	}
-	return result;
 }
 
-#define IP_TRUSTED 1
-#define IP_UNTRUSTED 0
 /*
- * check whether ip is trusted, return 1 for trusted , 0 for untrusted
+ * split the RFC 7239 header into the hops
+ *
+ *   Forwarded: for=192.0.2.60;proto=http;by=203.0.113.43, for="[2001:db8:cafe::17]:4711"
+ *
+ * each element is a hop, we only need the for= and proto= pairs
  */
-static int is_proxy_trusted(const char *ipstr, plugin_data *p)
-{
-	data_string* allds = (data_string *)array_get_element(p->conf.forwarder, CONST_STR_LEN("all"));
+static void extract_forwarded(plugin_data *p, buffer *value) {
+	forwarded_hop *hop = NULL;
+	const char *s, *end;
+
+	p->hops_used = 0;
+
+	if (value->used == 0) return;
+
+	for (s = value->ptr, end = value->ptr + value->used - 1; s < end; ) {
+		const char *name, *val;
+		size_t name_len, val_len;
+
+		switch (*s) {
+		case ' ':
+		case '\t':
+		case ';':
+			s++;
+			continue;
+		case ',':
+			/* the next element */
+			hop = NULL;
+			s++;
+			continue;
+		}
+
+		if (!hop) hop = forwarded_hop_append(p);
+
+		for (name = s; s < end && *s != '=' && *s != ';' && *s != ',' && *s != ' ' && *s != '\t'; s++);
+		name_len = s - name;
+
+		/* a pair without a value */
+		if (s == end || *s != '=') continue;
+		s++;
 
-	if (allds) {
-		if (strcasecmp(allds->value->ptr, "trust") == 0) {
-			return IP_TRUSTED;
+		if (s < end && *s == '"') {
+			/* quoted-string */
+			for (val = ++s; s < end && *s != '"'; s++) {
+				if (*s == '\\' && s + 1 < end) s++;
+			}
+			val_len = s - val;
+
+			if (s < end) s++;
 		} else {
-			return IP_UNTRUSTED;
+			for (val = s; s < end && *s != ';' && *s != ',' && *s != ' ' && *s != '\t'; s++);
+			val_len = s - val;
 		}
-	}
 
-	return (data_string *)array_get_element(p->conf.forwarder, ipstr, strlen(ipstr)) ? IP_TRUSTED : IP_UNTRUSTED;
+		if (name_len == 3 && 0 == strncasecmp(name, "for", 3)) {
+			hop->node = val;
+			hop->node_len = val_len;
+		} else if (name_len == 5 && 0 == strncasecmp(name, "proto", 5)) {
+			hop->proto = val;
+			hop->proto_len = val_len;
+		}
+	}
 }
 
-/*
- * Return char *ip of last address of proxy that is not trusted.
- * Do not accept "all" keyword here.
+/**
+ * strip the brackets and the port of "[2001:db8::17]:4711" and "192.0.2.60:4711"
  */
-static const char *last_not_in_array(array *a, plugin_data *p)
-{
-	array *forwarder = p->conf.forwarder;
-
-	for (int i = a->used - 1; i >= 0; i--) {
-		data_string *ds = (data_string *)a->data[i];
-		const char *ip = ds->value->ptr;
+static void forwarded_node_addr(const char **node, size_t *len) {
+	const char *s = *node, *colon, *bracket;
 
-		if (!array_get_element(forwarder, ip, strlen(ip))) {
-			return ip;
+	if (*len > 0 && s[0] == '[') {
+		if (NULL != (bracket = memchr(s, ']', *len))) {
+			*node = s + 1;
+			*len = bracket - s - 1;
 		}
+
+		return;
 	}
-	return NULL;
-}
 
-struct addrinfo *ipstr_to_sockaddr(server *srv, const char *host)
-{
-	struct addrinfo hints, *res0;
-	int result;
+	/* a single colon is the port of an IPv4 address */
+	if (NULL != (colon = memchr(s, ':', *len)) &&
+	    NULL == memchr(colon + 1, ':', *len - (colon + 1 - s))) {
+		*len = colon - s;
+	}
+}
 
-	memset(&hints, 0, sizeof(hints));
-#ifndef AI_NUMERICSERV
-/** 
- * quoting $ man getaddrinfo
- *
- * NOTES
- *        AI_ADDRCONFIG, AI_ALL, and AI_V4MAPPED are available since glibc 2.3.3.  
- *        AI_NUMERICSERV is available since glibc 2.3.4.
+/*
+ * check whether the connecting ip is trusted, "all" counts here
  */
-#define AI_NUMERICSERV 0
-#endif
-	hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
-
-	result = getaddrinfo(host, NULL, &hints, &res0);
-	if ( result != 0 ) {
-		log_error_write(srv, __FILE__, __LINE__, "ssss",
-				 "could not resolve hostname ", host, " because ", gai_strerror(result));
-		return NULL;
-	} else if (res0==0) {
-		log_error_write(srv, __FILE__, __LINE__, "sss", 
-				"Problem in resolving hostname ", host, ": succeeded, but no information returned");
+static int is_proxy_trusted(connection *con, plugin_data *p) {
+	forwarder_key key;
+
+	switch (p->conf.forward_all) {
+	case FORWARD_ALL_TRUST:
+		return 1;
+	case FORWARD_ALL_UNTRUST:
+		return 0;
+	case FORWARD_ALL_UNSET:
+		break;
 	}
-	return res0;
+
+	if (0 != forwarder_key_from_sock(key, &(con->dst_addr))) return 0;
+
+	return forwarder_trie_lookup(p->conf.trie, key);
 }
 
 static void clean_cond_cache(server *srv, connection *con) {
 	config_cond_cache_reset_item(srv, con, COMP_HTTP_REMOTE_IP);
+	config_cond_cache_reset_item(srv, con, COMP_HTTP_SCHEME);
 }
 
 URIHANDLER_FUNC(mod_extforward_uri_handler) {
 	plugin_data *p = p_d;
 	data_string *forwarded = NULL;
-#ifdef HAVE_IPV6
-	char b2[INET6_ADDRSTRLEN + 1];
-	struct addrinfo *addrlist = NULL;
-#endif
-	const char *dst_addr_str = NULL;
-	array *forward_array = NULL;
-	const char *real_remote_addr = NULL;
-#ifdef HAVE_IPV6
-#endif
+	forwarded_hop *client = NULL;
+	int is_rfc7239 = 0;
+	forwarder_key key;
+	const char *addr = NULL;
+	size_t addr_len = 0;
+	size_t i;
+	server_socket *srv_sock = con->srv_socket;
 
 	if (!con->request.headers) return HANDLER_GO_ON;
 
@@ -350,30 +661,26 @@ URIHANDLER_FUNC(mod_extforward_uri_handler) {
 				"-- mod_extforward_uri_handler called");
 	}
 
-	if ((NULL == (forwarded = (data_string *) array_get_element(con->request.headers, CONST_STR_LEN("X-Forwarded-For"))) &&
-	     NULL == (forwarded = (data_string *) array_get_element(con->request.headers, CONST_STR_LEN("Forwarded-For"))))) {
+	for (i = 0; i < p->conf.headers->used; i++) {
+		data_string *ds = (data_string *)p->conf.headers->data[i];
+
+		if (NULL != (forwarded = (data_string *)array_get_element(con->request.headers, CONST_BUF_LEN(ds->value)))) {
+			is_rfc7239 = (0 == strcasecmp(ds->value->ptr, "Forwarded"));
+			break;
+		}
+	}
 
+	if (NULL == forwarded) {
 		if (con->conf.log_request_handling) {
 			log_error_write(srv, __FILE__, __LINE__, "s", 
-					"no X-Forwarded-For|Forwarded-For: found, skipping");
+					"none of extforward.headers found, skipping");
 		}
 
 		return HANDLER_GO_ON;
 	}
 
-#ifdef HAVE_IPV6
-	dst_addr_str = inet_ntop(con->dst_addr.plain.sa_family,
-		      con->dst_addr.plain.sa_family == AF_INET6 ?
-		       (struct sockaddr *)&(con->dst_addr.ipv6.sin6_addr) :
-		       (struct sockaddr *)&(con->dst_addr.ipv4.sin_addr),
-		      b2,
-		      (sizeof b2) - 1);
-#else
-	dst_addr_str = inet_ntoa(con->dst_addr.ipv4.sin_addr);
-#endif
-
 	/* if the remote ip itself is not trusted, then do nothing */
-	if (IP_UNTRUSTED == is_proxy_trusted(dst_addr_str, p)) {
+	if (!is_proxy_trusted(con, p)) {
 		if (con->conf.log_request_handling) {
 			log_error_write(srv, __FILE__, __LINE__, "s",
 					"remote address is NOT a trusted proxy, skipping");
@@ -382,71 +689,74 @@ URIHANDLER_FUNC(mod_extforward_uri_handler) {
 		return HANDLER_GO_ON;
 	}
 
-	/* build forward_array from forwarded data_string */
-	forward_array = extract_forward_array(forwarded->value);
-	real_remote_addr = last_not_in_array(forward_array, p);
+	if (is_rfc7239) {
+		extract_forwarded(p, forwarded->value);
+	} else {
+		extract_forwarded_for(p, forwarded->value);
+	}
 
-	if (real_remote_addr != NULL) { /* parsed */
-		sock_addr sock;
-		struct addrinfo *addrs_left;
-		server_socket *srv_sock = con->srv_socket;
-		data_string *forwarded_proto = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("X-Forwarded-Proto"));
+	/* the last hop we don't trust is the client, "all" doesn't count here */
+	for (i = p->hops_used; i > 0; i--) {
+		forwarded_hop *hop = &(p->hops[i - 1]);
 
-		if (forwarded_proto && !strcmp(forwarded_proto->value->ptr, "https")) {
-			srv_sock->is_proxy_ssl = 1;
-		} else {
-			srv_sock->is_proxy_ssl = 0;
+		/* we can't follow the chain past a hop we can't parse */
+		if (NULL == hop->node) break;
+
+		addr = hop->node;
+		addr_len = hop->node_len;
+		forwarded_node_addr(&addr, &addr_len);
+
+		if (0 != forwarder_key_from_string(key, addr, addr_len)) break;
+
+		if (!forwarder_trie_lookup(p->conf.trie, key)) {
+			client = hop;
+			break;
 		}
+	}
 
+	if (NULL == client) {
 		if (con->conf.log_request_handling) {
- 			log_error_write(srv, __FILE__, __LINE__, "ss", "using address:", real_remote_addr);
+			log_error_write(srv, __FILE__, __LINE__, "sb",
+					"no client address found in:", forwarded->value);
 		}
-#ifdef HAVE_IPV6
-		addrlist = ipstr_to_sockaddr(srv, real_remote_addr);
-		sock.plain.sa_family = AF_UNSPEC;
-		for (addrs_left = addrlist; addrs_left != NULL; addrs_left = addrs_left -> ai_next) {
-			sock.plain.sa_family = addrs_left->ai_family;
-			if (sock.plain.sa_family == AF_INET) {
-				sock.ipv4.sin_addr = ((struct sockaddr_in*)addrs_left->ai_addr)->sin_addr;
-				break;
-			} else if (sock.plain.sa_family == AF_INET6) {
-				sock.ipv6.sin6_addr = ((struct sockaddr_in6*)addrs_left->ai_addr)->sin6_addr;
-				break;
-			}
-		}
-#else
-		sock.ipv4.sin_addr.s_addr = inet_addr(real_remote_addr);
-		sock.plain.sa_family = (sock.ipv4.sin_addr.s_addr == 0xFFFFFFFF) ? AF_UNSPEC : AF_INET;
-#endif
-		if (sock.plain.sa_family != AF_UNSPEC) {
-			/* we found the remote address, modify current connection and save the old address */
-			if (con->plugin_ctx[p->id]) {
-				log_error_write(srv, __FILE__, __LINE__, "s", 
-						"patching an already patched connection!");
-				handler_ctx_free(con->plugin_ctx[p->id]);
-				con->plugin_ctx[p->id] = NULL;
-			}
-			/* save old address */
-			con->plugin_ctx[p->id] = handler_ctx_init(con->dst_addr, con->dst_addr_buf);
-			/* patch connection address */
-			con->dst_addr = sock;
-			con->dst_addr_buf = buffer_init();
-			buffer_copy_string(con->dst_addr_buf, real_remote_addr);
-		
-			if (con->conf.log_request_handling) {
- 				log_error_write(srv, __FILE__, __LINE__, "ss",
-						"patching con->dst_addr_buf for the accesslog:", real_remote_addr);
-			}
-			/* Now, clean the conf_cond cache, because we may have changed the results of tests */
-			clean_cond_cache(srv, con);
-		}
-#ifdef HAVE_IPV6
-		if (addrlist != NULL ) freeaddrinfo(addrlist);
-#endif
+
+		return HANDLER_GO_ON;
+	}
+
+	if (is_rfc7239) {
+		srv_sock->is_proxy_ssl = (client->proto_len == 5 && 0 == strncasecmp(client->proto, "https", 5));
+	} else {
+		data_string *forwarded_proto = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("X-Forwarded-Proto"));
+
+		srv_sock->is_proxy_ssl = (forwarded_proto && 0 == strcmp(forwarded_proto->value->ptr, "https"));
+	}
+
+	/* $HTTP["scheme"] and the backends should see what the client talked to the proxy */
+	if (srv_sock->is_proxy_ssl) {
+		buffer_copy_string_len(con->uri.scheme, CONST_STR_LEN("https"));
+	}
+
+	/* we found the remote address, modify current connection and save the old address */
+	if (con->plugin_ctx[p->id]) {
+		log_error_write(srv, __FILE__, __LINE__, "s", 
+				"patching an already patched connection!");
+		handler_ctx_free(con->plugin_ctx[p->id]);
+		con->plugin_ctx[p->id] = NULL;
+	}
+	/* save old address */
+	con->plugin_ctx[p->id] = handler_ctx_init(con->dst_addr, con->dst_addr_buf);
+	/* patch connection address */
+	forwarder_key_to_sock(key, &(con->dst_addr));
+	con->dst_addr_buf = buffer_init();
+	buffer_copy_string_len(con->dst_addr_buf, addr, addr_len);
+
+	if (con->conf.log_request_handling) {
+		log_error_write(srv, __FILE__, __LINE__, "sb",
+				"patching con->dst_addr_buf for the accesslog:", con->dst_addr_buf);
 	}
-	array_free(forward_array);
+	/* Now, clean the conf_cond cache, because we may have changed the results of tests */
+	clean_cond_cache(srv, con);
 
-	/* not found */
 	return HANDLER_GO_ON;
 }
 
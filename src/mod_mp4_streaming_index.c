@@ -0,0 +1,1140 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "log.h"
+#include "stat_cache.h"
+#include "mod_mp4_streaming_index.h"
+
+#include "sys-files.h"
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+#define MP4_TYPE(a, b, c, d) \
+	(((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
+
+#define MP4_FTYP MP4_TYPE('f', 't', 'y', 'p')
+#define MP4_MOOV MP4_TYPE('m', 'o', 'o', 'v')
+#define MP4_MDAT MP4_TYPE('m', 'd', 'a', 't')
+#define MP4_MVHD MP4_TYPE('m', 'v', 'h', 'd')
+#define MP4_TRAK MP4_TYPE('t', 'r', 'a', 'k')
+#define MP4_TKHD MP4_TYPE('t', 'k', 'h', 'd')
+#define MP4_EDTS MP4_TYPE('e', 'd', 't', 's')
+#define MP4_MDIA MP4_TYPE('m', 'd', 'i', 'a')
+#define MP4_MDHD MP4_TYPE('m', 'd', 'h', 'd')
+#define MP4_HDLR MP4_TYPE('h', 'd', 'l', 'r')
+#define MP4_VIDE MP4_TYPE('v', 'i', 'd', 'e')
+#define MP4_MINF MP4_TYPE('m', 'i', 'n', 'f')
+#define MP4_STBL MP4_TYPE('s', 't', 'b', 'l')
+#define MP4_STTS MP4_TYPE('s', 't', 't', 's')
+#define MP4_CTTS MP4_TYPE('c', 't', 't', 's')
+#define MP4_STSS MP4_TYPE('s', 't', 's', 's')
+#define MP4_STSC MP4_TYPE('s', 't', 's', 'c')
+#define MP4_STSZ MP4_TYPE('s', 't', 's', 'z')
+#define MP4_STZ2 MP4_TYPE('s', 't', 'z', '2')
+#define MP4_STCO MP4_TYPE('s', 't', 'c', 'o')
+#define MP4_CO64 MP4_TYPE('c', 'o', '6', '4')
+#define MP4_SDTP MP4_TYPE('s', 'd', 't', 'p')
+#define MP4_STPS MP4_TYPE('s', 't', 'p', 's')
+#define MP4_SBGP MP4_TYPE('s', 'b', 'g', 'p')
+#define MP4_SUBS MP4_TYPE('s', 'u', 'b', 's')
+
+/* the ftyp only lists a few brands */
+#define MP4_FTYP_MAX 4096
+
+static uint32_t mp4_get32(const unsigned char *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static uint64_t mp4_get64(const unsigned char *p) {
+	return ((uint64_t)mp4_get32(p) << 32) | mp4_get32(p + 4);
+}
+
+static void mp4_put32(unsigned char *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void mp4_put64(unsigned char *p, uint64_t v) {
+	mp4_put32(p, v >> 32);
+	mp4_put32(p + 4, v);
+}
+
+/**
+ * the atom at the start of p
+ *
+ * @param hdr the length of the size and type fields
+ * @return -1 if the atom doesn't fit into len
+ */
+static int mp4_atom_parse(const unsigned char *p, size_t len, uint32_t *type, size_t *hdr, size_t *size) {
+	uint64_t sz;
+
+	if (len < 8) return -1;
+
+	sz = mp4_get32(p);
+	*type = mp4_get32(p + 4);
+	*hdr = 8;
+
+	if (sz == 1) {
+		if (len < 16) return -1;
+
+		sz = mp4_get64(p + 8);
+		*hdr = 16;
+	} else if (sz == 0) {
+		/* up to the end of the parent */
+		sz = len;
+	}
+
+	if (sz < *hdr || sz > len) return -1;
+
+	*size = sz;
+
+	return 0;
+}
+
+static mp4_track *mp4_track_init(void) {
+	STRUCT_INIT(mp4_track, track);
+
+	return track;
+}
+
+static void mp4_track_free(mp4_track *track) {
+	if (!track) return;
+
+	free(track->stts);
+	free(track->ctts);
+	free(track->stss);
+	free(track->stsc);
+	free(track->sizes);
+	free(track->chunks);
+
+	free(track);
+}
+
+static mp4_index *mp4_index_init(void) {
+	STRUCT_INIT(mp4_index, idx);
+
+	idx->name = buffer_init();
+	idx->etag = buffer_init();
+	idx->ftyp = buffer_init();
+	idx->moov = buffer_init();
+
+	idx->tracks = calloc(1, sizeof(*idx->tracks));
+
+	return idx;
+}
+
+static void mp4_index_reset(mp4_index *idx) {
+	ARRAY_STATIC_FREE(idx->tracks, mp4_track, track, mp4_track_free(track));
+	idx->tracks->used = 0;
+	idx->tracks->size = 0;
+
+	buffer_reset(idx->etag);
+	buffer_reset(idx->ftyp);
+	buffer_reset(idx->moov);
+
+	idx->mtime = 0;
+	idx->size = 0;
+	idx->mdat_start = 0;
+	idx->mdat_end = 0;
+	idx->timescale = 0;
+}
+
+static void mp4_index_free(mp4_index *idx) {
+	if (!idx) return;
+
+	mp4_index_reset(idx);
+	free(idx->tracks);
+
+	buffer_free(idx->name);
+	buffer_free(idx->etag);
+	buffer_free(idx->ftyp);
+	buffer_free(idx->moov);
+
+	free(idx);
+}
+
+mp4_index_cache *mp4_index_cache_init(void) {
+	STRUCT_INIT(mp4_index_cache, cache);
+
+	cache->max_size = MP4_INDEX_CACHE_MAX;
+
+	return cache;
+}
+
+void mp4_index_cache_free(mp4_index_cache *cache) {
+	if (!cache) return;
+
+	ARRAY_STATIC_FREE(cache, mp4_index, idx, mp4_index_free(idx));
+
+	free(cache);
+}
+
+/**
+ * a full-box with a 32bit entry-count
+ *
+ * @param skip the bytes between the version/flags and the entry-count
+ * @return the first entry, NULL if the entries don't fit into the atom
+ */
+static const unsigned char *mp4_table(const unsigned char *p, size_t len, size_t skip, size_t entry_size, size_t *count) {
+	uint32_t n;
+
+	if (len < 4 + skip + 4) return NULL;
+
+	n = mp4_get32(p + 4 + skip);
+
+	if ((len - 4 - skip - 4) / entry_size < n) return NULL;
+
+	*count = n;
+
+	return p + 4 + skip + 4;
+}
+
+static int mp4_parse_runs(const unsigned char *p, size_t len, mp4_run **runs, size_t *used) {
+	const unsigned char *e;
+	size_t i, n;
+
+	if (*runs) return -1;
+	if (NULL == (e = mp4_table(p, len, 0, 8, &n))) return -1;
+
+	*runs = malloc((n ? n : 1) * sizeof(**runs));
+	*used = n;
+
+	for (i = 0; i < n; i++, e += 8) {
+		(*runs)[i].count = mp4_get32(e);
+		(*runs)[i].value = mp4_get32(e + 4);
+	}
+
+	return 0;
+}
+
+static int mp4_parse_sample_table(mp4_track *track, uint32_t type, const unsigned char *p, size_t len) {
+	const unsigned char *e;
+	size_t i, n;
+
+	switch (type) {
+	case MP4_STTS:
+		return mp4_parse_runs(p, len, &(track->stts), &(track->stts_used));
+	case MP4_CTTS:
+		if (len > 0) track->ctts_version = p[0];
+
+		return mp4_parse_runs(p, len, &(track->ctts), &(track->ctts_used));
+	case MP4_STSS:
+		if (track->stss) return -1;
+		if (NULL == (e = mp4_table(p, len, 0, 4, &n))) return -1;
+
+		track->stss = malloc((n ? n : 1) * sizeof(*track->stss));
+		track->stss_used = n;
+
+		for (i = 0; i < n; i++, e += 4) {
+			track->stss[i] = mp4_get32(e);
+		}
+
+		return 0;
+	case MP4_STSC:
+		if (track->stsc) return -1;
+		if (NULL == (e = mp4_table(p, len, 0, 12, &n))) return -1;
+
+		track->stsc = malloc((n ? n : 1) * sizeof(*track->stsc));
+		track->stsc_used = n;
+
+		for (i = 0; i < n; i++, e += 12) {
+			track->stsc[i].first_chunk = mp4_get32(e);
+			track->stsc[i].samples = mp4_get32(e + 4);
+			track->stsc[i].desc = mp4_get32(e + 8);
+		}
+
+		return 0;
+	case MP4_STSZ:
+		if (track->sizes || len < 12) return -1;
+
+		track->sample_size = mp4_get32(p + 4);
+		track->samples = mp4_get32(p + 8);
+
+		if (track->sample_size) return 0;
+
+		if ((len - 12) / 4 < track->samples) return -1;
+
+		track->sizes = malloc((track->samples ? track->samples : 1) * sizeof(*track->sizes));
+
+		for (i = 0, e = p + 12; i < track->samples; i++, e += 4) {
+			track->sizes[i] = mp4_get32(e);
+		}
+
+		return 0;
+	case MP4_STCO:
+	case MP4_CO64:
+		if (track->chunks) return -1;
+		if (NULL == (e = mp4_table(p, len, 0, type == MP4_STCO ? 4 : 8, &n))) return -1;
+
+		track->chunks = malloc((n ? n : 1) * sizeof(*track->chunks));
+		track->chunks_used = n;
+
+		for (i = 0; i < n; i++) {
+			if (type == MP4_STCO) {
+				track->chunks[i] = mp4_get32(e);
+				e += 4;
+			} else {
+				track->chunks[i] = mp4_get64(e);
+				e += 8;
+			}
+		}
+
+		return 0;
+	case MP4_STZ2:
+		/* compact sample sizes are rare, we don't rewrite them */
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * the tables have to agree on the number of samples and chunks
+ */
+static int mp4_track_check(mp4_track *track) {
+	uint64_t n = 0;
+	size_t i;
+
+	for (i = 0; i < track->stts_used; i++) {
+		n += track->stts[i].count;
+	}
+
+	if (n != track->samples) return -1;
+
+	if (track->samples == 0) return 0;
+
+	if (track->timescale == 0 || track->stsc_used == 0 || track->chunks_used == 0) return -1;
+
+	if (track->stsc[0].first_chunk != 1) return -1;
+
+	for (i = 0, n = 0; i < track->stsc_used; i++) {
+		size_t next = (i + 1 < track->stsc_used) ? track->stsc[i + 1].first_chunk : track->chunks_used + 1;
+
+		if (track->stsc[i].first_chunk > next || next > track->chunks_used + 1) return -1;
+
+		n += (uint64_t)(next - track->stsc[i].first_chunk) * track->stsc[i].samples;
+	}
+
+	if (n < track->samples) return -1;
+
+	for (i = 0; i < track->stss_used; i++) {
+		if (track->stss[i] == 0 || track->stss[i] > track->samples) return -1;
+		if (i > 0 && track->stss[i] <= track->stss[i - 1]) return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * the container atoms we walk into, each only below its own parent:
+ * moov/trak/mdia/minf/stbl
+ *
+ * a trak anywhere else is copied like any other atom, a file of nested
+ * containers can't make us recurse deeper than that
+ */
+static int mp4_is_container(uint32_t parent, uint32_t type) {
+	switch (type) {
+	case MP4_TRAK: return parent == MP4_MOOV;
+	case MP4_MDIA: return parent == MP4_TRAK;
+	case MP4_MINF: return parent == MP4_MDIA;
+	case MP4_STBL: return parent == MP4_MINF;
+	}
+
+	return 0;
+}
+
+/**
+ * walk the children of moov, we only look into the atoms which lead to the sample tables
+ */
+static int mp4_parse_atoms(mp4_index *idx, mp4_track *track, uint32_t parent, const unsigned char *p, size_t len) {
+	size_t off, hdr, size;
+	uint32_t type;
+
+	for (off = 0; off < len; off += size) {
+		const unsigned char *pl;
+		size_t pl_len;
+
+		if (0 != mp4_atom_parse(p + off, len - off, &type, &hdr, &size)) return -1;
+
+		pl = p + off + hdr;
+		pl_len = size - hdr;
+
+		switch (type) {
+		case MP4_MVHD:
+			if (parent != MP4_MOOV) break;
+			if (pl_len < 24) return -1;
+
+			idx->timescale = mp4_get32(pl + (pl[0] == 1 ? 20 : 12));
+			break;
+		case MP4_TRAK: {
+			mp4_track *t;
+
+			if (!mp4_is_container(parent, type)) break;
+
+			t = mp4_track_init();
+
+			if (0 != mp4_parse_atoms(idx, t, type, pl, pl_len) ||
+			    0 != mp4_track_check(t)) {
+				mp4_track_free(t);
+
+				return -1;
+			}
+
+			ARRAY_STATIC_PREPARE_APPEND(idx->tracks);
+			idx->tracks->ptr[idx->tracks->used++] = t;
+			break;
+		}
+		case MP4_MDIA:
+		case MP4_MINF:
+		case MP4_STBL:
+			if (!track || !mp4_is_container(parent, type)) break;
+			if (0 != mp4_parse_atoms(idx, track, type, pl, pl_len)) return -1;
+			break;
+		case MP4_MDHD:
+			if (!track || parent != MP4_MDIA) break;
+			if (pl_len < 24) return -1;
+
+			track->timescale = mp4_get32(pl + (pl[0] == 1 ? 20 : 12));
+			break;
+		case MP4_HDLR:
+			/* the minf of a QuickTime file has a hdlr for the data too */
+			if (!track || parent != MP4_MDIA) break;
+			if (pl_len < 12) return -1;
+
+			track->is_video = (mp4_get32(pl + 8) == MP4_VIDE);
+			break;
+		default:
+			if (!track || parent != MP4_STBL) break;
+			if (0 != mp4_parse_sample_table(track, type, pl, pl_len)) return -1;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int mp4_pread(int fd, void *buf, size_t len, off_t off) {
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t r;
+
+		if (-1 == (r = pread(fd, (char *)buf + done, len - done, off + done))) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+
+		if (r == 0) return -1;
+
+		done += r;
+	}
+
+	return 0;
+}
+
+static int mp4_read_atom(int fd, buffer *b, off_t off, size_t size) {
+	buffer_prepare_copy(b, size + 1);
+
+	if (0 != mp4_pread(fd, b->ptr, size, off)) return -1;
+
+	b->used = size + 1;
+	b->ptr[size] = '\0';
+
+	return 0;
+}
+
+/**
+ * find ftyp, moov and mdat in the file and parse the moov
+ */
+static int mp4_index_parse(server *srv, mp4_index *idx, stat_cache_entry *sce) {
+	unsigned char hdr[16];
+	off_t off;
+	int fd, ret = -1, mdats = 0;
+	size_t i, j;
+
+	/* the stat-cache might have the file open already */
+	if (sce->fd) {
+		fd = sce->fd->fd;
+	} else if (-1 == (fd = open(idx->name->ptr, O_RDONLY | O_BINARY | (srv->srvconf.use_noatime ? O_NOATIME : 0)))) {
+		ERROR("opening %s failed: %s", SAFE_BUF_STR(idx->name), strerror(errno));
+
+		return -1;
+	}
+
+	for (off = 0; off < sce->st.st_size; ) {
+		uint64_t size;
+		uint32_t type;
+		size_t hlen = 8;
+
+		if (sce->st.st_size - off < 8 || 0 != mp4_pread(fd, hdr, 8, off)) goto out;
+
+		size = mp4_get32(hdr);
+		type = mp4_get32(hdr + 4);
+
+		if (size == 1) {
+			if (sce->st.st_size - off < 16 || 0 != mp4_pread(fd, hdr + 8, 8, off + 8)) goto out;
+
+			size = mp4_get64(hdr + 8);
+			hlen = 16;
+		} else if (size == 0) {
+			size = sce->st.st_size - off;
+		}
+
+		if (size < hlen || size > (uint64_t)(sce->st.st_size - off)) goto out;
+
+		switch (type) {
+		case MP4_FTYP:
+			if (size > MP4_FTYP_MAX || 0 != mp4_read_atom(fd, idx->ftyp, off, size)) goto out;
+			break;
+		case MP4_MOOV:
+			if (size > MP4_MOOV_MAX || 0 != mp4_read_atom(fd, idx->moov, off, size)) goto out;
+			break;
+		case MP4_MDAT:
+			/* the chunks of several mdats can't be sent as one range */
+			if (mdats++) goto out;
+
+			idx->mdat_start = off + hlen;
+			idx->mdat_end = off + size;
+			break;
+		}
+
+		off += size;
+	}
+
+	if (buffer_is_empty(idx->moov) || mdats == 0) goto out;
+
+	if (0 != mp4_parse_atoms(idx, NULL, MP4_MOOV, (unsigned char *)idx->moov->ptr + 8, idx->moov->used - 1 - 8)) goto out;
+
+	if (idx->timescale == 0) goto out;
+
+	for (i = 0; i < idx->tracks->used; i++) {
+		mp4_track *track = idx->tracks->ptr[i];
+
+		for (j = 0; j < track->chunks_used; j++) {
+			if (track->chunks[j] < (uint64_t)idx->mdat_start ||
+			    track->chunks[j] > (uint64_t)idx->mdat_end) goto out;
+		}
+	}
+
+	ret = 0;
+out:
+	if (!sce->fd) close(fd);
+
+	return ret;
+}
+
+mp4_index *mp4_index_cache_get(server *srv, connection *con, mp4_index_cache *cache, buffer *name) {
+	size_t i;
+	mp4_index *idx = NULL;
+	stat_cache_entry *sce;
+
+	if (HANDLER_ERROR == stat_cache_get_entry(srv, con, name, &sce)) {
+		return NULL;
+	}
+
+	for (i = 0; i < cache->used; i++) {
+		idx = cache->ptr[i];
+
+		if (buffer_is_equal(name, idx->name)) break;
+
+		idx = NULL;
+	}
+
+	if (idx) {
+		idx->last_used = srv->cur_ts;
+
+		if (buffer_is_equal(sce->etag, idx->etag) &&
+		    sce->st.st_mtime == idx->mtime &&
+		    sce->st.st_size == idx->size) {
+			return idx;
+		}
+
+		/* the file changed, parse it again */
+		mp4_index_reset(idx);
+	} else if (cache->used < cache->max_size) {
+		idx = mp4_index_init();
+
+		ARRAY_STATIC_PREPARE_APPEND(cache);
+		cache->ptr[cache->used++] = idx;
+
+		buffer_copy_string_buffer(idx->name, name);
+	} else {
+		/* cache is full, recycle the least recently used index */
+		size_t lru = 0;
+
+		for (i = 1; i < cache->used; i++) {
+			if (cache->ptr[i]->last_used < cache->ptr[lru]->last_used) lru = i;
+		}
+
+		idx = cache->ptr[lru];
+
+		mp4_index_reset(idx);
+		buffer_copy_string_buffer(idx->name, name);
+	}
+
+	idx->last_used = srv->cur_ts;
+
+	if (0 != mp4_index_parse(srv, idx, sce)) {
+		/* forget the name, the next request has to try again */
+		mp4_index_reset(idx);
+		buffer_reset(idx->name);
+		idx->last_used = 0;
+
+		return NULL;
+	}
+
+	buffer_copy_string_buffer(idx->etag, sce->etag);
+	idx->mtime = sce->st.st_mtime;
+	idx->size = sce->st.st_size;
+
+	return idx;
+}
+
+/**
+ * where a track is cut
+ */
+typedef struct {
+	size_t sample;        /* the first sample we keep */
+	size_t chunk;         /* the chunk of that sample */
+	size_t chunk_skip;    /* the samples of the chunk before it */
+	uint64_t skip_bytes;  /* ... and their size */
+	uint64_t time;        /* the decode time of the sample */
+
+	size_t offsets_pos;   /* where the chunk offsets are in the output, 0 if the trak has none */
+} mp4_cut;
+
+static uint32_t mp4_track_sample_size(mp4_track *track, size_t sample) {
+	return track->sizes ? track->sizes[sample] : track->sample_size;
+}
+
+/**
+ * the sample which is played at time t
+ *
+ * @param round_up the first sample which starts at t or later instead
+ */
+static size_t mp4_track_sample_at(mp4_track *track, uint64_t t, int round_up) {
+	uint64_t time = 0;
+	size_t sample = 0, i;
+
+	for (i = 0; i < track->stts_used; i++) {
+		mp4_run *r = &(track->stts[i]);
+		uint64_t run = (uint64_t)r->count * r->value;
+
+		if (t < time + run) {
+			uint64_t d = t - time;
+
+			sample += d / r->value;
+			if (round_up && (d % r->value)) sample++;
+
+			return sample;
+		}
+
+		time += run;
+		sample += r->count;
+	}
+
+	return track->samples;
+}
+
+static uint64_t mp4_track_sample_time(mp4_track *track, size_t sample) {
+	uint64_t time = 0;
+	size_t i;
+
+	for (i = 0; i < track->stts_used; i++) {
+		mp4_run *r = &(track->stts[i]);
+
+		if (sample < r->count) return time + (uint64_t)sample * r->value;
+
+		time += (uint64_t)r->count * r->value;
+		sample -= r->count;
+	}
+
+	return time;
+}
+
+/**
+ * the last sync sample before or at sample
+ */
+static size_t mp4_track_sync_sample(mp4_track *track, size_t sample) {
+	size_t lo = 0, hi = track->stss_used;
+
+	if (!track->stss) return sample;
+
+	/* the numbers in stss start at 1 */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (track->stss[mid] <= sample + 1) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo ? track->stss[lo - 1] - 1 : 0;
+}
+
+static void mp4_track_cut(mp4_track *track, size_t sample, mp4_cut *cut) {
+	size_t i, s = 0;
+
+	cut->sample = sample;
+	cut->time = mp4_track_sample_time(track, sample);
+	cut->chunk = track->chunks_used;
+	cut->chunk_skip = 0;
+	cut->skip_bytes = 0;
+
+	if (sample >= track->samples) return;
+
+	for (i = 0; i < track->stsc_used; i++) {
+		size_t first = track->stsc[i].first_chunk - 1;
+		size_t next = (i + 1 < track->stsc_used) ? track->stsc[i + 1].first_chunk - 1 : track->chunks_used;
+		size_t n = (next - first) * track->stsc[i].samples;
+
+		if (sample < s + n) {
+			cut->chunk = first + (sample - s) / track->stsc[i].samples;
+			cut->chunk_skip = (sample - s) % track->stsc[i].samples;
+			break;
+		}
+
+		s += n;
+	}
+
+	for (i = sample - cut->chunk_skip; i < sample; i++) {
+		cut->skip_bytes += mp4_track_sample_size(track, i);
+	}
+}
+
+typedef struct {
+	mp4_index *idx;
+	mp4_cut *cuts;
+	buffer *out;
+
+	double start;       /* in seconds */
+	int use_co64;
+
+	int in_trak;
+	size_t track;       /* the trak we are in */
+} mp4_writer;
+
+/**
+ * make room for n bytes at the end of out
+ */
+static unsigned char *mp4_out_append(buffer *out, size_t n) {
+	unsigned char *p;
+
+	if (out->used == 0) {
+		buffer_prepare_copy(out, n + 1);
+		out->used = 1;
+	} else {
+		buffer_prepare_append(out, n);
+	}
+
+	p = (unsigned char *)out->ptr + out->used - 1;
+
+	out->used += n;
+	out->ptr[out->used - 1] = '\0';
+
+	return p;
+}
+
+static size_t mp4_out_begin(buffer *out, uint32_t type) {
+	unsigned char *p = mp4_out_append(out, 8);
+
+	mp4_put32(p + 4, type);
+
+	return out->used - 1 - 8;
+}
+
+static void mp4_out_end(buffer *out, size_t pos) {
+	mp4_put32((unsigned char *)out->ptr + pos, out->used - 1 - pos);
+}
+
+static void mp4_write_runs(buffer *out, uint32_t type, uint32_t version, mp4_run *runs, size_t runs_used, size_t skip) {
+	size_t pos = mp4_out_begin(out, type), count_pos, n = 0, i;
+
+	mp4_put32(mp4_out_append(out, 4), version << 24);
+
+	count_pos = out->used - 1;
+	mp4_out_append(out, 4);
+
+	for (i = 0; i < runs_used; i++) {
+		unsigned char *p;
+
+		if (skip >= runs[i].count) {
+			skip -= runs[i].count;
+			continue;
+		}
+
+		p = mp4_out_append(out, 8);
+		mp4_put32(p, runs[i].count - skip);
+		mp4_put32(p + 4, runs[i].value);
+
+		skip = 0;
+		n++;
+	}
+
+	mp4_put32((unsigned char *)out->ptr + count_pos, n);
+	mp4_out_end(out, pos);
+}
+
+static void mp4_write_stss(buffer *out, mp4_track *track, mp4_cut *cut) {
+	size_t pos = mp4_out_begin(out, MP4_STSS), count_pos, n = 0, i;
+
+	mp4_put32(mp4_out_append(out, 4), 0);
+
+	count_pos = out->used - 1;
+	mp4_out_append(out, 4);
+
+	for (i = 0; i < track->stss_used; i++) {
+		if (track->stss[i] <= cut->sample) continue;
+
+		mp4_put32(mp4_out_append(out, 4), track->stss[i] - cut->sample);
+		n++;
+	}
+
+	mp4_put32((unsigned char *)out->ptr + count_pos, n);
+	mp4_out_end(out, pos);
+}
+
+static void mp4_write_stsz(buffer *out, mp4_track *track, mp4_cut *cut) {
+	size_t pos = mp4_out_begin(out, MP4_STSZ), i;
+	size_t samples = track->samples - (cut->sample < track->samples ? cut->sample : track->samples);
+	unsigned char *p = mp4_out_append(out, 12);
+
+	mp4_put32(p, 0);
+	mp4_put32(p + 4, track->sample_size);
+	mp4_put32(p + 8, samples);
+
+	if (track->sizes && samples) {
+		p = mp4_out_append(out, samples * 4);
+
+		for (i = cut->sample; i < track->samples; i++, p += 4) {
+			mp4_put32(p, track->sizes[i]);
+		}
+	}
+
+	mp4_out_end(out, pos);
+}
+
+static void mp4_write_stsc_entry(buffer *out, uint32_t first_chunk, uint32_t samples, uint32_t desc) {
+	unsigned char *p = mp4_out_append(out, 12);
+
+	mp4_put32(p, first_chunk);
+	mp4_put32(p + 4, samples);
+	mp4_put32(p + 8, desc);
+}
+
+/**
+ * the chunk we cut into keeps only the samples from the cut on, the
+ * chunks behind it are numbered from 2 on
+ */
+static void mp4_write_stsc(buffer *out, mp4_track *track, mp4_cut *cut) {
+	size_t pos = mp4_out_begin(out, MP4_STSC), count_pos, n = 0, i;
+
+	mp4_put32(mp4_out_append(out, 4), 0);
+
+	count_pos = out->used - 1;
+	mp4_out_append(out, 4);
+
+	for (i = 0; i < track->stsc_used && cut->chunk < track->chunks_used; i++) {
+		mp4_stsc *e = &(track->stsc[i]);
+		size_t first = e->first_chunk - 1;
+		size_t next = (i + 1 < track->stsc_used) ? track->stsc[i + 1].first_chunk - 1 : track->chunks_used;
+
+		if (next <= cut->chunk) continue;
+
+		if (first <= cut->chunk) {
+			/* the entry of the chunk we cut into */
+			mp4_write_stsc_entry(out, 1, e->samples - cut->chunk_skip, e->desc);
+			n++;
+
+			if (cut->chunk + 1 < next) {
+				mp4_write_stsc_entry(out, 2, e->samples, e->desc);
+				n++;
+			}
+		} else {
+			mp4_write_stsc_entry(out, first - cut->chunk + 1, e->samples, e->desc);
+			n++;
+		}
+	}
+
+	mp4_put32((unsigned char *)out->ptr + count_pos, n);
+	mp4_out_end(out, pos);
+}
+
+/**
+ * the offsets are filled in when we know how large the header is
+ */
+static void mp4_write_chunk_offsets(mp4_writer *w, mp4_track *track, mp4_cut *cut) {
+	buffer *out = w->out;
+	size_t pos = mp4_out_begin(out, w->use_co64 ? MP4_CO64 : MP4_STCO);
+	size_t chunks = track->chunks_used - cut->chunk;
+	unsigned char *p = mp4_out_append(out, 8);
+
+	mp4_put32(p, 0);
+	mp4_put32(p + 4, chunks);
+
+	cut->offsets_pos = out->used - 1;
+
+	if (chunks) {
+		p = mp4_out_append(out, chunks * (w->use_co64 ? 8 : 4));
+		memset(p, 0, chunks * (w->use_co64 ? 8 : 4));
+	}
+
+	mp4_out_end(out, pos);
+}
+
+/**
+ * copy a mvhd, tkhd or mdhd and shorten its duration by cut
+ */
+static void mp4_write_header(buffer *out, const unsigned char *atom, size_t hdr, size_t size, size_t v0_off, size_t v1_off, uint64_t cut) {
+	unsigned char *p = mp4_out_append(out, size);
+	unsigned char *pl = p + hdr;
+
+	memcpy(p, atom, size);
+
+	if (size - hdr < 1) return;
+
+	if (pl[0] == 1) {
+		uint64_t d;
+
+		if (size - hdr < v1_off + 8) return;
+
+		d = mp4_get64(pl + v1_off);
+		mp4_put64(pl + v1_off, d > cut ? d - cut : 0);
+	} else {
+		uint32_t d;
+
+		if (size - hdr < v0_off + 4) return;
+
+		d = mp4_get32(pl + v0_off);
+		mp4_put32(pl + v0_off, d > cut ? d - cut : 0);
+	}
+}
+
+static void mp4_write_atoms(mp4_writer *w, uint32_t parent, const unsigned char *p, size_t len) {
+	mp4_index *idx = w->idx;
+	buffer *out = w->out;
+	size_t off, hdr, size, pos;
+	uint32_t type;
+
+	/* the moov was checked by mp4_parse_atoms() already */
+	for (off = 0; off < len && 0 == mp4_atom_parse(p + off, len - off, &type, &hdr, &size); off += size) {
+		mp4_track *track = (w->in_trak && w->track < idx->tracks->used) ? idx->tracks->ptr[w->track] : NULL;
+		mp4_cut *cut = track ? &(w->cuts[w->track]) : NULL;
+
+		switch (type) {
+		case MP4_TRAK:
+			/* the same atoms as mp4_parse_atoms() looked into */
+			if (!mp4_is_container(parent, type)) break;
+
+			pos = mp4_out_begin(out, type);
+			w->in_trak = 1;
+			mp4_write_atoms(w, type, p + off + hdr, size - hdr);
+			w->in_trak = 0;
+			mp4_out_end(out, pos);
+
+			w->track++;
+			continue;
+		case MP4_MDIA:
+		case MP4_MINF:
+		case MP4_STBL:
+			if (!mp4_is_container(parent, type)) break;
+
+			pos = mp4_out_begin(out, type);
+			mp4_write_atoms(w, type, p + off + hdr, size - hdr);
+			mp4_out_end(out, pos);
+			continue;
+		case MP4_EDTS:
+		case MP4_SDTP:
+		case MP4_STPS:
+		case MP4_SBGP:
+		case MP4_SUBS:
+			/* the edit-list and the per-sample tables we don't rewrite don't fit anymore */
+			continue;
+		case MP4_MVHD:
+			if (parent != MP4_MOOV) break;
+
+			mp4_write_header(out, p + off, hdr, size, 16, 24, (uint64_t)(w->start * idx->timescale));
+			continue;
+		}
+
+		/* only the atoms mp4_parse_atoms() has read are rewritten */
+		if (!track ||
+		    (type == MP4_TKHD && parent != MP4_TRAK) ||
+		    (type == MP4_MDHD && parent != MP4_MDIA) ||
+		    (type != MP4_TKHD && type != MP4_MDHD && parent != MP4_STBL)) {
+			memcpy(mp4_out_append(out, size), p + off, size);
+			continue;
+		}
+
+		switch (type) {
+		case MP4_TKHD:
+			mp4_write_header(out, p + off, hdr, size, 20, 28, track->timescale ? cut->time * idx->timescale / track->timescale : 0);
+			break;
+		case MP4_MDHD:
+			mp4_write_header(out, p + off, hdr, size, 16, 24, cut->time);
+			break;
+		case MP4_STTS:
+			mp4_write_runs(out, type, 0, track->stts, track->stts_used, cut->sample);
+			break;
+		case MP4_CTTS:
+			mp4_write_runs(out, type, track->ctts_version, track->ctts, track->ctts_used, cut->sample);
+			break;
+		case MP4_STSS:
+			mp4_write_stss(out, track, cut);
+			break;
+		case MP4_STSZ:
+			mp4_write_stsz(out, track, cut);
+			break;
+		case MP4_STSC:
+			mp4_write_stsc(out, track, cut);
+			break;
+		case MP4_STCO:
+		case MP4_CO64:
+			mp4_write_chunk_offsets(w, track, cut);
+			break;
+		default:
+			memcpy(mp4_out_append(out, size), p + off, size);
+			break;
+		}
+	}
+}
+
+int mp4_index_seek(mp4_index *idx, double start, buffer *out, off_t *data_offset, off_t *data_len) {
+	mp4_track *video = NULL;
+	mp4_writer w;
+	uint64_t first = idx->mdat_end;
+	size_t i, j, estimate;
+	size_t video_sample = 0;
+	int overflow;
+
+	/* NaN and inf fail here too */
+	if (!(start > 0 && start <= MP4_START_MAX)) return -1;
+
+	for (i = 0; i < idx->tracks->used; i++) {
+		mp4_track *track = idx->tracks->ptr[i];
+
+		if (track->is_video && track->samples) {
+			video = track;
+			break;
+		}
+	}
+
+	/* the video has to start with a sync sample, the other tracks follow it */
+	if (video) {
+		video_sample = mp4_track_sample_at(video, (uint64_t)(start * video->timescale), 0);
+
+		if (video_sample >= video->samples) return -1;
+
+		video_sample = mp4_track_sync_sample(video, video_sample);
+		start = (double)mp4_track_sample_time(video, video_sample) / video->timescale;
+	}
+
+	memset(&w, 0, sizeof(w));
+	w.idx = idx;
+	w.out = out;
+	w.start = start;
+	w.cuts = calloc(idx->tracks->used ? idx->tracks->used : 1, sizeof(*w.cuts));
+
+	estimate = idx->ftyp->used + idx->moov->used + 16;
+
+	for (i = 0; i < idx->tracks->used; i++) {
+		mp4_track *track = idx->tracks->ptr[i];
+		mp4_cut *cut = &(w.cuts[i]);
+
+		if (track == video) {
+			mp4_track_cut(track, video_sample, cut);
+		} else {
+			mp4_track_cut(track, mp4_track_sample_at(track, (uint64_t)(start * track->timescale), 1), cut);
+		}
+
+		/* the media data starts with the first chunk we keep */
+		for (j = cut->chunk; j < track->chunks_used; j++) {
+			uint64_t o = track->chunks[j] + (j == cut->chunk ? cut->skip_bytes : 0);
+
+			if (o < first) first = o;
+		}
+
+		/* co64 and the extra stsc-entry */
+		estimate += track->chunks_used * 4 + 32;
+	}
+
+	if (first >= (uint64_t)idx->mdat_end) {
+		free(w.cuts);
+
+		return -1;
+	}
+
+	*data_offset = first;
+	*data_len = idx->mdat_end - first;
+
+	do {
+		uint64_t hdr_len;
+
+		buffer_prepare_copy(out, estimate);
+		w.track = 0;
+
+		if (idx->ftyp->used) {
+			memcpy(mp4_out_append(out, idx->ftyp->used - 1), idx->ftyp->ptr, idx->ftyp->used - 1);
+		}
+
+		i = mp4_out_begin(out, MP4_MOOV);
+		mp4_write_atoms(&w, MP4_MOOV, (unsigned char *)idx->moov->ptr + 8, idx->moov->used - 1 - 8);
+		mp4_out_end(out, i);
+
+		if ((uint64_t)*data_len + 8 > 0xffffffffULL) {
+			unsigned char *p = mp4_out_append(out, 16);
+
+			mp4_put32(p, 1);
+			mp4_put32(p + 4, MP4_MDAT);
+			mp4_put64(p + 8, *data_len + 16);
+		} else {
+			unsigned char *p = mp4_out_append(out, 8);
+
+			mp4_put32(p, *data_len + 8);
+			mp4_put32(p + 4, MP4_MDAT);
+		}
+
+		hdr_len = out->used - 1;
+
+		/* the chunks move to the end of the new header */
+		overflow = 0;
+
+		for (i = 0; i < idx->tracks->used && !overflow; i++) {
+			mp4_track *track = idx->tracks->ptr[i];
+			mp4_cut *cut = &(w.cuts[i]);
+			unsigned char *p = (unsigned char *)out->ptr + cut->offsets_pos;
+
+			if (cut->offsets_pos == 0) continue;
+
+			for (j = cut->chunk; j < track->chunks_used; j++) {
+				uint64_t o = track->chunks[j] + (j == cut->chunk ? cut->skip_bytes : 0) - first + hdr_len;
+
+				if (w.use_co64) {
+					mp4_put64(p, o);
+					p += 8;
+				} else if (o > 0xffffffffULL) {
+					overflow = 1;
+					break;
+				} else {
+					mp4_put32(p, o);
+					p += 4;
+				}
+			}
+		}
+
+		/* the new header moved the chunks behind 4G, try again with co64 */
+		if (overflow) w.use_co64 = 1;
+	} while (overflow);
+
+	free(w.cuts);
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+#ifndef _MOD_MP4_STREAMING_INDEX_H_
+#define _MOD_MP4_STREAMING_INDEX_H_
+
+#include <time.h>
+
+#include "base.h"
+#include "buffer.h"
+#include "array-static.h"
+
+/**
+ * a run of samples with the same value (stts: duration, ctts: composition offset)
+ */
+typedef struct {
+	uint32_t count;
+	uint32_t value;
+} mp4_run;
+
+typedef struct {
+	uint32_t first_chunk; /* 1-based, like in the file */
+	uint32_t samples;
+	uint32_t desc;
+} mp4_stsc;
+
+/**
+ * the sample tables of a trak, in host byte order
+ */
+typedef struct {
+	int is_video;
+	uint32_t timescale;
+
+	mp4_run *stts;
+	size_t stts_used;
+
+	mp4_run *ctts;    /* NULL if the trak has no ctts */
+	size_t ctts_used;
+	uint32_t ctts_version;
+
+	uint32_t *stss;   /* NULL if all samples are sync samples */
+	size_t stss_used;
+
+	mp4_stsc *stsc;
+	size_t stsc_used;
+
+	uint32_t sample_size; /* if all samples have the same size */
+	uint32_t *sizes;      /* otherwise */
+	size_t samples;
+
+	uint64_t *chunks;     /* the file offsets from stco or co64 */
+	size_t chunks_used;
+} mp4_track;
+
+ARRAY_STATIC_DEF(mp4_tracks, mp4_track, );
+
+/**
+ * the header of a .mp4 file
+ *
+ * the moov is kept as it is in the file, the sample tables are parsed to
+ * find the samples for a seek quickly
+ */
+typedef struct {
+	buffer *name;
+	buffer *etag;
+
+	/* etag might be disabled by config, keep the raw values too */
+	time_t mtime;
+	off_t size;
+
+	buffer *ftyp;
+	buffer *moov;
+
+	off_t mdat_start; /* the first byte of the media data */
+	off_t mdat_end;
+
+	uint32_t timescale; /* of the movie (mvhd) */
+	mp4_tracks *tracks; /* in the order of the trak atoms */
+
+	time_t last_used; /* LRU */
+} mp4_index;
+
+ARRAY_STATIC_DEF(mp4_index_cache, mp4_index, size_t max_size;);
+
+#define MP4_INDEX_CACHE_MAX 64
+
+/* the moov of a movie of a few hours has a few MByte */
+#define MP4_MOOV_MAX (64 * 1024 * 1024)
+
+mp4_index_cache *mp4_index_cache_init(void);
+void mp4_index_cache_free(mp4_index_cache *cache);
+
+/**
+ * get the parsed header of the file 'name'
+ *
+ * the file is only parsed if it isn't known yet or if the stat-cache
+ * reports a different etag/mtime/size
+ *
+ * @return NULL if the file can't be read or isn't a .mp4 we can seek in
+ */
+mp4_index *mp4_index_cache_get(server *srv, connection *con, mp4_index_cache *cache, buffer *name);
+
+/* start * timescale has to fit into 64bit, a timescale has 32bit */
+#define MP4_START_MAX 1e9
+
+/**
+ * build the header of a movie which starts at the sync sample before 'start'
+ *
+ * the media data before the sync sample is cut away, the chunk offsets
+ * of the new moov point into the range of the file which follows the
+ * header
+ *
+ * @param out ftyp, moov and the header of the mdat
+ * @param data_offset the file range which follows out
+ * @return -1 if start is behind the end of the movie or not in (0, MP4_START_MAX]
+ */
+int mp4_index_seek(mp4_index *idx, double start, buffer *out, off_t *data_offset, off_t *data_len);
+
+#endif
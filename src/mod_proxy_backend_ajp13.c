@@ -4,7 +4,6 @@
 #include <ctype.h>
 #include <stdio.h>
 
-#include "inet_ntop_cache.h"
 #include "mod_proxy_core.h"
 #include "mod_proxy_core_protocol.h"
 #include "buffer.h"
@@ -408,6 +407,8 @@ static int proxy_ajp13_forward_request(server *srv, connection *con, proxy_sessi
 	int len = 0,port = 0;
 	size_t i;
 
+	UNUSED(srv);
+
 	/* prefix_code */
 	len += ajp13_encode_byte(packet, AJP13_TYPE_FORWARD_REQUEST);
 
@@ -425,8 +426,7 @@ static int proxy_ajp13_forward_request(server *srv, connection *con, proxy_sessi
 	len += ajp13_encode_string(packet, CONST_BUF_LEN(con->uri.path));
 
 	/* remote address */
-	str = inet_ntop_cache_get_ip(srv, &(con->dst_addr));
-	len += ajp13_encode_string(packet, str, strlen(str));
+	len += ajp13_encode_string(packet, CONST_BUF_LEN(con->dst_addr_buf));
 
 	/* remote host */
 	len += ajp13_encode_string(packet, CONST_STR_LEN(""));
@@ -738,6 +738,11 @@ PROXY_STREAM_ENCODER_FUNC(proxy_ajp13_stream_encoder) {
 		return HANDLER_GO_ON;
 	}
 
+	if (in->bytes_in == in->bytes_out && !in->is_closed) {
+		/* the content is streamed and the next part isn't there yet, don't send the EOF packet */
+		return HANDLER_GO_ON;
+	}
+
 	/* calculate how many bytes we can encode. */
 	if (in->bytes_in > in->bytes_out) {
 		we_need = in->bytes_in - in->bytes_out;
@@ -154,8 +154,7 @@ static int proxy_fastcgi_get_env_fastcgi(server *srv, connection *con, plugin_da
 
 	array_set_key_value(sess->env_headers, CONST_STR_LEN("REMOTE_PORT"), buf, strlen(buf));
 
-	s = inet_ntop_cache_get_ip(srv, &(con->dst_addr));
-	array_set_key_value(sess->env_headers, CONST_STR_LEN("REMOTE_ADDR"), s, strlen(s));
+	array_set_key_value(sess->env_headers, CONST_STR_LEN("REMOTE_ADDR"), CONST_BUF_LEN(con->dst_addr_buf));
 
 	if (!buffer_is_empty(con->authed_user)) {
 		array_set_key_value(sess->env_headers, CONST_STR_LEN("REMOTE_USER"),
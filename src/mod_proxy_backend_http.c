@@ -292,6 +292,15 @@ PROXY_STREAM_DECODER_FUNC(proxy_http_stream_decoder) {
 	return HANDLER_GO_ON;
 }
 
+/**
+ * without chunked-encoding the content is passed through AS IS and can be splice()d
+ */
+PROXY_STREAM_IS_RAW_FUNC(proxy_http_stream_is_raw) {
+	UNUSED(srv);
+
+	return !sess->is_chunked;
+}
+
 /**
  * transform the content-stream into a valid HTTP-content-stream
  *
@@ -385,6 +394,7 @@ INIT_FUNC(mod_proxy_backend_http_init) {
 	p->protocol->proxy_stream_decoder = proxy_http_stream_decoder;
 	p->protocol->proxy_stream_encoder = proxy_http_stream_encoder;
 	p->protocol->proxy_encode_request_headers = proxy_http_encode_request_headers;
+	p->protocol->proxy_stream_is_raw = proxy_http_stream_is_raw;
 
 	return p;
 }
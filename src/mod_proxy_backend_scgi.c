@@ -130,8 +130,7 @@ static int proxy_scgi_get_env_scgi(server *srv, proxy_session *sess, buffer *env
 
 	scgi_env_add(env_headers, CONST_STR_LEN("REMOTE_PORT"), buf, len);
 
-	s = inet_ntop_cache_get_ip(srv, &(con->dst_addr));
-	scgi_env_add(env_headers, CONST_STR_LEN("REMOTE_ADDR"), s, strlen(s));
+	scgi_env_add(env_headers, CONST_STR_LEN("REMOTE_ADDR"), CONST_BUF_LEN(con->dst_addr_buf));
 
 	if (!buffer_is_empty(con->authed_user)) {
 		scgi_env_add(env_headers, CONST_STR_LEN("REMOTE_USER"),
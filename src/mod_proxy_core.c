@@ -15,7 +15,6 @@
 #include "plugin.h"
 #include "joblist.h"
 #include "sys-files.h"
-#include "inet_ntop_cache.h"
 #include "crc32.h"
 #include "configfile.h"
 #include "stat_cache.h"
@@ -23,6 +22,9 @@
 #include "array.h"
 #include "log.h"
 #include "status_counter.h"
+#include "response.h"
+#include "network.h"
+#include "etag.h"
 
 #include "mod_proxy_core.h"
 #include "mod_proxy_core_protocol.h"
@@ -42,6 +44,58 @@
 #define CONFIG_PROXY_CORE_SPLIT_HOSTNAMES  PROXY_CORE ".split-hostnames"
 #define CONFIG_PROXY_CORE_DISABLE_TIME     PROXY_CORE ".disable-time"
 #define CONFIG_PROXY_CORE_MAX_BACKLOG_SIZE PROXY_CORE ".max-backlog-size"
+#define CONFIG_PROXY_CORE_RESOLVE_INTERVAL PROXY_CORE ".resolve-interval"
+#define CONFIG_PROXY_CORE_HEALTH_CHECK_INTERVAL PROXY_CORE ".health-check-interval"
+#define CONFIG_PROXY_CORE_HEALTH_CHECK_URI PROXY_CORE ".health-check-uri"
+#define CONFIG_PROXY_CORE_HEALTH_CHECK_RISE PROXY_CORE ".health-check-rise"
+#define CONFIG_PROXY_CORE_HEALTH_CHECK_FALL PROXY_CORE ".health-check-fall"
+#define CONFIG_PROXY_CORE_STREAM_REQUEST_CONTENT PROXY_CORE ".stream-request-content"
+#define CONFIG_PROXY_CORE_CACHE            PROXY_CORE ".cache"
+#define CONFIG_PROXY_CORE_CACHE_MEMORY_SIZE PROXY_CORE ".cache-memory-size"
+#define CONFIG_PROXY_CORE_CACHE_DIR        PROXY_CORE ".cache-dir"
+#define CONFIG_PROXY_CORE_CACHE_DISK_SIZE  PROXY_CORE ".cache-disk-size"
+#define CONFIG_PROXY_CORE_BACKLOG_FAIRNESS PROXY_CORE ".backlog-fairness"
+#define CONFIG_PROXY_CORE_BACKLOG_PRIORITY PROXY_CORE ".backlog-priority"
+#define CONFIG_PROXY_CORE_BACKLOG_DEADLINE PROXY_CORE ".backlog-deadline"
+
+/* the index of each option in the cv[] of mod_proxy_core_set_defaults() */
+typedef enum {
+	PROXY_CORE_OPT_BACKENDS,                /* 0 */
+	PROXY_CORE_OPT_DEBUG,                   /* 1 */
+	PROXY_CORE_OPT_BALANCER,                /* 2 */
+	PROXY_CORE_OPT_PROTOCOL,                /* 3 */
+	PROXY_CORE_OPT_REWRITE_REQUEST,         /* 4 */
+	PROXY_CORE_OPT_REWRITE_RESPONSE,        /* 5 */
+	PROXY_CORE_OPT_ALLOW_X_SENDFILE,        /* 6 */
+	PROXY_CORE_OPT_ALLOW_X_REWRITE,         /* 7 */
+	PROXY_CORE_OPT_MAX_POOL_SIZE,           /* 8 */
+	PROXY_CORE_OPT_CHECK_LOCAL,             /* 9 */
+	PROXY_CORE_OPT_MAX_KEEP_ALIVE,          /* 10 */
+	PROXY_CORE_OPT_SPLIT_HOSTNAMES,         /* 11 */
+	PROXY_CORE_OPT_DISABLE_TIME,            /* 12 */
+	PROXY_CORE_OPT_MAX_BACKLOG_SIZE,        /* 13 */
+	PROXY_CORE_OPT_RESOLVE_INTERVAL,        /* 14 */
+	PROXY_CORE_OPT_HEALTH_CHECK_INTERVAL,   /* 15 */
+	PROXY_CORE_OPT_HEALTH_CHECK_URI,        /* 16 */
+	PROXY_CORE_OPT_HEALTH_CHECK_RISE,       /* 17 */
+	PROXY_CORE_OPT_HEALTH_CHECK_FALL,       /* 18 */
+	PROXY_CORE_OPT_STREAM_REQUEST_CONTENT,  /* 19 */
+	PROXY_CORE_OPT_CACHE,                   /* 20 */
+	PROXY_CORE_OPT_CACHE_MEMORY_SIZE,       /* 21 */
+	PROXY_CORE_OPT_CACHE_DIR,               /* 22 */
+	PROXY_CORE_OPT_CACHE_DISK_SIZE,         /* 23 */
+	PROXY_CORE_OPT_BACKLOG_FAIRNESS,        /* 24 */
+	PROXY_CORE_OPT_BACKLOG_PRIORITY,        /* 25 */
+	PROXY_CORE_OPT_BACKLOG_DEADLINE         /* 26 */
+} proxy_core_option_t;
+
+#define PROXY_RESOLVE_TIMEOUT 30
+
+/* don't collapse the requests for an uncacheable resource for a while */
+#define PROXY_CACHE_PASS_TTL 30
+
+/* max. bytes we splice() per round, a pipe usually takes 64kb */
+#define PROXY_SPLICE_MAX (1024 * 1024)
 
 static int mod_proxy_wakeup_connections(server *srv, plugin_data *p, plugin_config *p_conf);
 
@@ -85,6 +139,11 @@ INIT_FUNC(mod_proxy_core_init) {
 	array_insert_int(p->possible_balancers, "round-robin", PROXY_BALANCE_RR);
 	array_insert_int(p->possible_balancers, "static", PROXY_BALANCE_STATIC);
 
+	p->possible_fairness = array_init();
+	array_insert_int(p->possible_fairness, "none", PROXY_BACKLOG_FAIR_NONE);
+	array_insert_int(p->possible_fairness, "client", PROXY_BACKLOG_FAIR_CLIENT);
+	array_insert_int(p->possible_fairness, "host", PROXY_BACKLOG_FAIR_HOST);
+
 	p->proxy_register_protocol = mod_proxy_core_register_protocol;
 
 	/* statistics counters. */
@@ -92,10 +151,12 @@ INIT_FUNC(mod_proxy_core_init) {
 
 	p->balance_buf = buffer_init();
 	p->protocol_buf = buffer_init();
+	p->fairness_buf = buffer_init();
 	p->replace_buf = buffer_init();
 	p->backends_arr = array_init();
 
 	p->tmp_buf = buffer_init();
+	p->cache_key = buffer_init();
 
 #if 0
 	/**
@@ -118,30 +179,44 @@ FREE_FUNC(mod_proxy_core_free) {
 	if (!p) return HANDLER_GO_ON;
 
 	if (p->config_storage) {
-		size_t i;
+		size_t i, j;
 		for (i = 0; i < srv->config_context->used; i++) {
 			plugin_config *s = p->config_storage[i];
 
 			if (!s) continue;
 
+			for (j = 0; j < s->backends->used; j++) {
+				proxy_health_check_stop(srv, s->backends->ptr[j]);
+			}
+
 			proxy_backends_free(s->backends);
 			proxy_backlog_free(s->backlog);
 
 			proxy_rewrites_free(s->request_rewrites);
 			proxy_rewrites_free(s->response_rewrites);
 
+			buffer_free(s->health_check_uri);
+			buffer_free(s->cache_dir);
+
 			free(s);
 		}
 		free(p->config_storage);
 	}
 
+	helper_process_free(p->resolver);
+	proxy_cache_free(p->cache);
+	config_patch_cache_free(p->patch_cache);
+
 	array_free(p->possible_balancers);
+	array_free(p->possible_fairness);
 	array_free(p->backends_arr);
 
 	buffer_free(p->balance_buf);
 	buffer_free(p->protocol_buf);
+	buffer_free(p->fairness_buf);
 	buffer_free(p->replace_buf);
 	buffer_free(p->tmp_buf);
+	buffer_free(p->cache_key);
 
 #if 0
 	proxy_session_pool_free(p->session_pool);
@@ -248,6 +323,9 @@ static void mod_proxy_core_create_backend_stats(plugin_data *p, buffer *stat_bas
 	
 	COUNTER_NAME(p->tmp_buf, "requests_failed");
 	backend->requests_failed = status_counter_get_counter(CONST_BUF_LEN(p->tmp_buf));
+
+	/* the health checks add the counters of the addresses */
+	COUNTER_NAME(backend->stat_basename, "");
 #undef COUNTER_NAME
 }
 
@@ -273,6 +351,19 @@ SETDEFAULTS_FUNC(mod_proxy_core_set_defaults) {
 		{ CONFIG_PROXY_CORE_SPLIT_HOSTNAMES, NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION },    /* 11 */
 		{ CONFIG_PROXY_CORE_DISABLE_TIME, NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },         /* 12 */
 		{ CONFIG_PROXY_CORE_MAX_BACKLOG_SIZE, NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },     /* 13 */
+		{ CONFIG_PROXY_CORE_RESOLVE_INTERVAL, NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },     /* 14 */
+		{ CONFIG_PROXY_CORE_HEALTH_CHECK_INTERVAL, NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION }, /* 15 */
+		{ CONFIG_PROXY_CORE_HEALTH_CHECK_URI, NULL, T_CONFIG_STRING, T_CONFIG_SCOPE_CONNECTION },    /* 16 */
+		{ CONFIG_PROXY_CORE_HEALTH_CHECK_RISE, NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },    /* 17 */
+		{ CONFIG_PROXY_CORE_HEALTH_CHECK_FALL, NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },    /* 18 */
+		{ CONFIG_PROXY_CORE_STREAM_REQUEST_CONTENT, NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION }, /* 19 */
+		{ CONFIG_PROXY_CORE_CACHE, NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION },              /* 20 */
+		{ CONFIG_PROXY_CORE_CACHE_MEMORY_SIZE, NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },        /* 21 */
+		{ CONFIG_PROXY_CORE_CACHE_DIR, NULL, T_CONFIG_STRING, T_CONFIG_SCOPE_SERVER },               /* 22 */
+		{ CONFIG_PROXY_CORE_CACHE_DISK_SIZE, NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },          /* 23 */
+		{ CONFIG_PROXY_CORE_BACKLOG_FAIRNESS, NULL, T_CONFIG_STRING, T_CONFIG_SCOPE_CONNECTION },    /* 24 */
+		{ CONFIG_PROXY_CORE_BACKLOG_PRIORITY, NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },     /* 25 */
+		{ CONFIG_PROXY_CORE_BACKLOG_DEADLINE, NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },     /* 26 */
 		{ NULL,                        NULL, T_CONFIG_UNSET, T_CONFIG_SCOPE_UNSET }
 	};
 
@@ -288,6 +379,7 @@ SETDEFAULTS_FUNC(mod_proxy_core_set_defaults) {
 		array_reset(p->backends_arr);
 		buffer_reset(p->balance_buf);
 		buffer_reset(p->protocol_buf);
+		buffer_reset(p->fairness_buf);
 
 		s = calloc(1, sizeof(plugin_config));
 		s->debug     = 0;
@@ -302,18 +394,44 @@ SETDEFAULTS_FUNC(mod_proxy_core_set_defaults) {
 		s->max_keep_alive_requests = 0;
 		s->disable_time = 1;
 		s->max_backlog_size = 4;
-
-		cv[0].destination = p->backends_arr;
-		cv[1].destination = &(s->debug);
-		cv[2].destination = p->balance_buf;         /* parse into a constant */
-		cv[3].destination = p->protocol_buf;        /* parse into a constant */
-		cv[6].destination = &(s->allow_x_sendfile);
-		cv[7].destination = &(s->allow_x_rewrite);
-		cv[8].destination = &(s->max_pool_size);
-		cv[10].destination = &(s->max_keep_alive_requests);
-		cv[11].destination = &(s->split_hostnames);
-		cv[12].destination = &(s->disable_time);
-		cv[13].destination = &(s->max_backlog_size);
+		s->resolve_interval = 0;
+		s->health_check_interval = 0;
+		s->health_check_uri = buffer_init_string("/");
+		s->health_check_rise = 2;
+		s->health_check_fall = 3;
+		s->stream_request_content = 0;
+		s->cache = 0;
+		s->cache_memory_size = 16;
+		s->cache_dir = buffer_init();
+		s->cache_disk_size = 256;
+		s->backlog_fairness = PROXY_BACKLOG_FAIR_NONE;
+		s->backlog_priority = 1;
+		s->backlog_deadline = 0;
+
+		cv[PROXY_CORE_OPT_BACKENDS].destination = p->backends_arr;
+		cv[PROXY_CORE_OPT_DEBUG].destination = &(s->debug);
+		cv[PROXY_CORE_OPT_BALANCER].destination = p->balance_buf;         /* parse into a constant */
+		cv[PROXY_CORE_OPT_PROTOCOL].destination = p->protocol_buf;        /* parse into a constant */
+		cv[PROXY_CORE_OPT_ALLOW_X_SENDFILE].destination = &(s->allow_x_sendfile);
+		cv[PROXY_CORE_OPT_ALLOW_X_REWRITE].destination = &(s->allow_x_rewrite);
+		cv[PROXY_CORE_OPT_MAX_POOL_SIZE].destination = &(s->max_pool_size);
+		cv[PROXY_CORE_OPT_MAX_KEEP_ALIVE].destination = &(s->max_keep_alive_requests);
+		cv[PROXY_CORE_OPT_SPLIT_HOSTNAMES].destination = &(s->split_hostnames);
+		cv[PROXY_CORE_OPT_DISABLE_TIME].destination = &(s->disable_time);
+		cv[PROXY_CORE_OPT_MAX_BACKLOG_SIZE].destination = &(s->max_backlog_size);
+		cv[PROXY_CORE_OPT_RESOLVE_INTERVAL].destination = &(s->resolve_interval);
+		cv[PROXY_CORE_OPT_HEALTH_CHECK_INTERVAL].destination = &(s->health_check_interval);
+		cv[PROXY_CORE_OPT_HEALTH_CHECK_URI].destination = s->health_check_uri;
+		cv[PROXY_CORE_OPT_HEALTH_CHECK_RISE].destination = &(s->health_check_rise);
+		cv[PROXY_CORE_OPT_HEALTH_CHECK_FALL].destination = &(s->health_check_fall);
+		cv[PROXY_CORE_OPT_STREAM_REQUEST_CONTENT].destination = &(s->stream_request_content);
+		cv[PROXY_CORE_OPT_CACHE].destination = &(s->cache);
+		cv[PROXY_CORE_OPT_CACHE_MEMORY_SIZE].destination = &(s->cache_memory_size);
+		cv[PROXY_CORE_OPT_CACHE_DIR].destination = s->cache_dir;
+		cv[PROXY_CORE_OPT_CACHE_DISK_SIZE].destination = &(s->cache_disk_size);
+		cv[PROXY_CORE_OPT_BACKLOG_FAIRNESS].destination = p->fairness_buf;       /* parse into a constant */
+		cv[PROXY_CORE_OPT_BACKLOG_PRIORITY].destination = &(s->backlog_priority);
+		cv[PROXY_CORE_OPT_BACKLOG_DEADLINE].destination = &(s->backlog_deadline);
 
 		buffer_reset(p->balance_buf);
 
@@ -348,6 +466,25 @@ SETDEFAULTS_FUNC(mod_proxy_core_set_defaults) {
 			s->protocol = protocol;
 		}
 
+		if (!buffer_is_empty(p->fairness_buf)) {
+			data_integer *di;
+
+			if (NULL != (di = (data_integer *)array_get_element(p->possible_fairness, CONST_BUF_LEN(p->fairness_buf)))) {
+				s->backlog_fairness = di->value;
+			} else {
+				ERROR("%s has to be one of 'none', 'client', 'host': got %s", CONFIG_PROXY_CORE_BACKLOG_FAIRNESS, SAFE_BUF_STR(p->fairness_buf));
+				return HANDLER_ERROR;
+			}
+		}
+
+		if (s->backlog_priority >= PROXY_BACKLOG_PRIORITIES) {
+			ERROR("%s has to be between 0 and %d: got %d", CONFIG_PROXY_CORE_BACKLOG_PRIORITY, PROXY_BACKLOG_PRIORITIES - 1, s->backlog_priority);
+			return HANDLER_ERROR;
+		}
+
+		if (s->health_check_rise == 0) s->health_check_rise = 1;
+		if (s->health_check_fall == 0) s->health_check_fall = 1;
+
 		if (p->backends_arr->used) {
 			/* statistics base name. */
 			buffer_copy_string_len(stat_basename, CONST_STR_LEN(PROXY_CORE "."));
@@ -358,6 +495,8 @@ SETDEFAULTS_FUNC(mod_proxy_core_set_defaults) {
 			buffer_append_string_len(p->tmp_buf, CONST_STR_LEN(".backlogged"));
 			s->backlog_size = status_counter_get_counter(CONST_BUF_LEN(p->tmp_buf));
 
+			proxy_backlog_create_stats(s->backlog, stat_basename, p->tmp_buf);
+
 			/* backends stats base name. */
 			buffer_append_string_len(stat_basename, CONST_STR_LEN(".backends."));
 
@@ -417,8 +556,43 @@ SETDEFAULTS_FUNC(mod_proxy_core_set_defaults) {
 				} else {
 					/* setup stats */
 					mod_proxy_core_create_backend_stats(p, stat_basename, backend);
+
+					/* split backends are named after their address, only this one can follow the DNS */
+					if (s->resolve_interval && 0 != strncmp(BUF_STR(ds->value), "unix:", 5)) {
+						backend->resolve_interval = s->resolve_interval;
+						backend->resolve_ts = srv->cur_ts + s->resolve_interval;
+
+						if (!p->resolver) {
+							p->resolver = helper_process_init();
+
+							if (0 != helper_process_start(p->resolver, PROXY_RESOLVER_NAME_MAX, proxy_resolver_answer)) {
+								return HANDLER_ERROR;
+							}
+						}
+					}
+				}
+			}
+			/* the split backends are all set up now */
+			for (j = 0; j < s->backends->used; j++) {
+				backend = s->backends->ptr[j];
+
+				/* the probes have to know how to talk to the backend */
+				backend->protocol = s->protocol;
+
+				if (s->health_check_interval) {
+					size_t k;
+
+					backend->health_interval = s->health_check_interval;
+					backend->health_rise = s->health_check_rise;
+					backend->health_fall = s->health_check_fall;
+					buffer_copy_string_buffer(backend->health_uri, s->health_check_uri);
+
+					for (k = 0; k < backend->address_pool->used; k++) {
+						proxy_health_check_create_stats(backend, backend->address_pool->ptr[k], p->tmp_buf);
+					}
 				}
 			}
+
 			/* counter number of "proxy-core.backends" groups */
 			proxy_counter++;
 		}
@@ -434,6 +608,29 @@ SETDEFAULTS_FUNC(mod_proxy_core_set_defaults) {
 
 	buffer_free(stat_basename);
 
+	for (i = 0; i < srv->config_context->used; i++) {
+		plugin_config *s = p->config_storage[i];
+
+		if (!s->cache || p->cache) continue;
+
+		/* the limits are global */
+		s = p->config_storage[0];
+
+		p->cache = proxy_cache_init();
+		p->cache->mem_max = (off_t)s->cache_memory_size * 1024 * 1024;
+		p->cache->disk_max = (off_t)s->cache_disk_size * 1024 * 1024;
+		buffer_copy_string_buffer(p->cache->dir, s->cache_dir);
+
+		p->cache_hits = status_counter_get_counter(CONST_STR_LEN(PROXY_CORE ".cache.hits"));
+		p->cache_misses = status_counter_get_counter(CONST_STR_LEN(PROXY_CORE ".cache.misses"));
+		p->cache_revalidated = status_counter_get_counter(CONST_STR_LEN(PROXY_CORE ".cache.revalidated"));
+		p->cache_collapsed = status_counter_get_counter(CONST_STR_LEN(PROXY_CORE ".cache.collapsed"));
+	}
+
+	if (NULL == (p->patch_cache = config_patch_cache_init(srv, cv, sizeof(plugin_config)))) {
+		return HANDLER_ERROR;
+	}
+
 	return HANDLER_GO_ON;
 }
 
@@ -488,12 +685,22 @@ static void proxy_session_reset(proxy_session *sess) {
 	sess->is_closed = 0;
 	sess->is_request_finished = 0;
 	sess->have_response_headers = 0;
+	sess->is_splicing = 0;
+
+	sess->cache_mode = PROXY_CACHE_MODE_UNSET;
+	sess->cache_entry = NULL;
 
 	sess->do_new_session = 0;
 	sess->do_x_rewrite_backend = 0;
 	buffer_free(sess->sticky_session);
 	sess->sticky_session = NULL;
 
+	/* the old request left the backlog with its backend connection,
+	 * the next one starts with a new wait, retry count and deadline */
+	sess->sent_to_backlog = 0;
+	memset(&(sess->backlog_req), 0, sizeof(sess->backlog_req));
+	sess->is_shed = 0;
+
 	sess->remote_con = NULL;
 	sess->proxy_con = NULL;
 	sess->proxy_backend = NULL;
@@ -515,6 +722,350 @@ static void proxy_session_free(proxy_session *sess) {
 	free(sess);
 }
 
+/**
+ * the response doesn't go into the cache, let the waiting requests go to the backend
+ */
+static void proxy_cache_session_pass(server *srv, plugin_data *p, proxy_session *sess) {
+	proxy_cache_entry_pass(p->cache, sess->cache_entry, srv->cur_ts + PROXY_CACHE_PASS_TTL);
+	proxy_cache_entry_wakeup(srv, sess->cache_entry);
+	proxy_cache_entry_release(p->cache, sess->cache_entry);
+
+	sess->cache_entry = NULL;
+	sess->cache_mode = PROXY_CACHE_MODE_BYPASS;
+}
+
+/**
+ * drop the reference on the cache-entry, an unfinished fill is thrown away
+ */
+static void proxy_cache_session_done(server *srv, connection *con, plugin_data *p, proxy_session *sess) {
+	proxy_cache_entry *entry = sess->cache_entry;
+
+	if (!entry) return;
+
+	switch (sess->cache_mode) {
+	case PROXY_CACHE_MODE_FILL:
+		proxy_cache_remove(p->cache, entry);
+		proxy_cache_entry_wakeup(srv, entry);
+		break;
+	case PROXY_CACHE_MODE_REVALIDATE:
+		entry->is_revalidating = 0;
+		proxy_cache_entry_wakeup(srv, entry);
+		break;
+	case PROXY_CACHE_MODE_WAIT:
+		proxy_cache_entry_remove_waiter(entry, con);
+		break;
+	default:
+		break;
+	}
+
+	proxy_cache_entry_release(p->cache, entry);
+
+	sess->cache_entry = NULL;
+	sess->cache_mode = PROXY_CACHE_MODE_UNSET;
+}
+
+static int proxy_cache_request_has_conditionals(connection *con) {
+	return http_request_get_header(con, HTTP_HEADER_IF_NONE_MATCH) != NULL ||
+		http_request_get_header(con, HTTP_HEADER_IF_MODIFIED_SINCE) != NULL;
+}
+
+/**
+ * send the response from the cache
+ */
+static void proxy_cache_serve(server *srv, connection *con, plugin_data *p, proxy_session *sess, proxy_cache_entry *entry) {
+	data_string *ds;
+	int not_modified = 0;
+	size_t i;
+
+	for (i = 0; i < entry->headers->used; i++) {
+		ds = (data_string *)entry->headers->data[i];
+
+		response_header_overwrite(srv, con, CONST_BUF_LEN(ds->key), CONST_BUF_LEN(ds->value));
+	}
+
+	buffer_copy_long(p->tmp_buf, srv->cur_ts - entry->stored_ts);
+	response_header_overwrite(srv, con, CONST_STR_LEN("Age"), CONST_BUF_LEN(p->tmp_buf));
+
+	/* the client might have the response already */
+	if (entry->status == 200) {
+		if (NULL != (ds = http_request_get_header(con, HTTP_HEADER_IF_NONE_MATCH))) {
+			not_modified = !buffer_is_empty(entry->etag) && etag_is_equal(entry->etag, BUF_STR(ds->value));
+		} else if (NULL != (ds = http_request_get_header(con, HTTP_HEADER_IF_MODIFIED_SINCE))) {
+			not_modified = buffer_is_equal(entry->last_modified, ds->value);
+		}
+	}
+
+	con->file_started = 1;
+	con->send->is_closed = 1;
+
+	if (not_modified) {
+		con->http_status = 304;
+
+		return;
+	}
+
+	con->http_status = entry->status;
+	con->response.content_length = entry->size;
+
+	if (con->request.http_method == HTTP_METHOD_HEAD || entry->size == 0) return;
+
+	if (buffer_is_empty(entry->path)) {
+		chunkqueue_append_mem(con->send, entry->content->ptr, entry->size);
+	} else {
+		/* the cache-file has to stay until it is sent */
+		chunkqueue_append_file(con->send, entry->path, 0, entry->size);
+
+		proxy_cache_entry_ref(entry);
+		sess->cache_entry = entry;
+		sess->cache_mode = PROXY_CACHE_MODE_HIT;
+	}
+	con->send->bytes_in += entry->size;
+}
+
+/**
+ * the request for the entry isn't on its way yet, wait for it
+ */
+static handler_t proxy_cache_wait(connection *con, plugin_data *p, proxy_session *sess, proxy_cache_entry *entry) {
+	proxy_cache_entry_ref(entry);
+	proxy_cache_entry_add_waiter(entry, con);
+
+	sess->cache_entry = entry;
+	sess->cache_mode = PROXY_CACHE_MODE_WAIT;
+
+	COUNTER_INC(p->cache_collapsed);
+
+	return HANDLER_WAIT_FOR_EVENT;
+}
+
+/**
+ * serve the request from the cache if we can
+ *
+ * @return HANDLER_FINISHED if the response is served, HANDLER_WAIT_FOR_EVENT if another
+ *         request is fetching it, HANDLER_GO_ON if it goes to the backend
+ */
+static handler_t proxy_cache_handle_request(server *srv, connection *con, plugin_data *p, proxy_session *sess) {
+	proxy_cache_entry *entry = NULL;
+	data_string *ds;
+	int no_cache = 0;
+	long value;
+
+	if (sess->cache_mode == PROXY_CACHE_MODE_WAIT) {
+		/* woken up, the entry changed */
+		proxy_cache_session_done(srv, con, p, sess);
+	} else {
+		if ((con->request.http_method != HTTP_METHOD_GET && con->request.http_method != HTTP_METHOD_HEAD) ||
+		    con->request.content_length > 0 ||
+		    http_request_get_header(con, HTTP_HEADER_AUTHORIZATION) ||
+		    http_request_get_header(con, HTTP_HEADER_RANGE)) {
+			sess->cache_mode = PROXY_CACHE_MODE_BYPASS;
+
+			return HANDLER_GO_ON;
+		}
+
+		if (NULL != (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("Cache-Control")))) {
+			if (proxy_cache_control_get(ds->value, CONST_STR_LEN("no-store"), &value)) {
+				sess->cache_mode = PROXY_CACHE_MODE_BYPASS;
+
+				return HANDLER_GO_ON;
+			}
+
+			no_cache = proxy_cache_control_get(ds->value, CONST_STR_LEN("no-cache"), &value);
+		}
+
+		if (NULL != (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("Pragma")))) {
+			if (strstr(BUF_STR(ds->value), "no-cache")) no_cache = 1;
+		}
+	}
+
+	buffer_copy_string_buffer(p->cache_key, con->uri.scheme);
+	buffer_append_string_len(p->cache_key, CONST_STR_LEN("://"));
+	buffer_append_string_buffer(p->cache_key, con->uri.authority);
+	buffer_append_string_buffer(p->cache_key, con->request.uri);
+
+	/* the client wants a fresh response, it replaces the cached one */
+	if (!no_cache) entry = proxy_cache_lookup(p->cache, p->cache_key, con->request.headers, srv->cur_ts);
+
+	if (entry) {
+		switch (entry->state) {
+		case PROXY_CACHE_ENTRY_FILLING:
+			return proxy_cache_wait(con, p, sess, entry);
+		case PROXY_CACHE_ENTRY_PASS:
+			COUNTER_INC(p->cache_misses);
+			sess->cache_mode = PROXY_CACHE_MODE_BYPASS;
+
+			return HANDLER_GO_ON;
+		case PROXY_CACHE_ENTRY_COMPLETE:
+			if (srv->cur_ts < entry->expires_ts) {
+				COUNTER_INC(p->cache_hits);
+				proxy_cache_serve(srv, con, p, sess, entry);
+
+				sess->state = PROXY_STATE_FINISHED;
+
+				return HANDLER_FINISHED;
+			}
+
+			if (entry->is_revalidating) return proxy_cache_wait(con, p, sess, entry);
+
+			if (con->request.http_method != HTTP_METHOD_GET || proxy_cache_request_has_conditionals(con)) break;
+
+			if (buffer_is_empty(entry->etag) && buffer_is_empty(entry->last_modified)) {
+				/* we can't ask if it is still valid, fetch it again */
+				proxy_cache_remove(p->cache, entry);
+				break;
+			}
+
+			/* ask the backend if the stale entry is still valid */
+			proxy_cache_entry_ref(entry);
+			entry->is_revalidating = 1;
+
+			sess->cache_entry = entry;
+			sess->cache_mode = PROXY_CACHE_MODE_REVALIDATE;
+
+			return HANDLER_GO_ON;
+		}
+	}
+
+	COUNTER_INC(p->cache_misses);
+
+	/* a 304 from the backend can't be cached, HEAD has no content */
+	if (con->request.http_method != HTTP_METHOD_GET || proxy_cache_request_has_conditionals(con)) {
+		sess->cache_mode = PROXY_CACHE_MODE_BYPASS;
+
+		return HANDLER_GO_ON;
+	}
+
+	sess->cache_entry = proxy_cache_insert(p->cache, p->cache_key);
+	sess->cache_mode = PROXY_CACHE_MODE_FILL;
+
+	return HANDLER_GO_ON;
+}
+
+/**
+ * copy the response headers which are stored with the entry
+ */
+static void proxy_cache_store_headers(proxy_cache_entry *entry, array *headers) {
+	size_t i;
+
+	for (i = 0; i < headers->used; i++) {
+		data_string *ds = (data_string *)headers->data[i];
+
+		/* the hop-to-hop headers and the ones we set when we serve the entry */
+		if (buffer_is_empty(ds->value) ||
+		    0 == strcasecmp(ds->key->ptr, "Status") ||
+		    0 == strcasecmp(ds->key->ptr, "Content-Length") ||
+		    0 == strcasecmp(ds->key->ptr, "Transfer-Encoding") ||
+		    0 == strcasecmp(ds->key->ptr, "Connection") ||
+		    0 == strcasecmp(ds->key->ptr, "Keep-Alive") ||
+		    0 == strcasecmp(ds->key->ptr, "Date") ||
+		    0 == strcasecmp(ds->key->ptr, "Age")) {
+			continue;
+		}
+
+		array_set_key_value(entry->headers, CONST_BUF_LEN(ds->key), CONST_BUF_LEN(ds->value));
+
+		if (0 == strcasecmp(ds->key->ptr, "ETag")) {
+			buffer_copy_string_buffer(entry->etag, ds->value);
+		} else if (0 == strcasecmp(ds->key->ptr, "Last-Modified")) {
+			buffer_copy_string_buffer(entry->last_modified, ds->value);
+		}
+	}
+}
+
+/**
+ * the backend says the stale entry is still valid
+ */
+static void proxy_cache_revalidated(server *srv, connection *con, plugin_data *p, proxy_session *sess) {
+	proxy_cache_entry *entry = sess->cache_entry;
+	time_t ttl;
+
+	proxy_cache_store_headers(entry, sess->resp->headers);
+
+	/* keep the old freshness if the 304 doesn't tell us a new one */
+	if (-1 == (ttl = proxy_cache_response_ttl(sess->resp->headers, srv->cur_ts))) {
+		ttl = entry->expires_ts - entry->stored_ts;
+	}
+
+	entry->stored_ts = srv->cur_ts;
+	entry->expires_ts = srv->cur_ts + ttl;
+	entry->is_revalidating = 0;
+
+	proxy_cache_entry_wakeup(srv, entry);
+
+	sess->cache_entry = NULL;
+	sess->cache_mode = PROXY_CACHE_MODE_BYPASS;
+
+	COUNTER_INC(p->cache_revalidated);
+
+	/* the content comes from the cache, the state-engine still has to finish the backend request */
+	sess->send_response_content = 0;
+
+	proxy_cache_serve(srv, con, p, sess, entry);
+
+	proxy_cache_entry_release(p->cache, entry);
+}
+
+/**
+ * the response headers are in, check if the response may be stored
+ */
+static void proxy_cache_fill_start(server *srv, connection *con, plugin_data *p, proxy_session *sess) {
+	proxy_cache_entry *entry = sess->cache_entry;
+	int status = con->http_status ? con->http_status : 200;
+	time_t ttl = -1;
+
+	switch (status) {
+	case 200:
+	case 203:
+	case 301:
+	case 410:
+		if (!sess->send_response_content || sess->do_internal_redirect) break;
+
+		ttl = proxy_cache_response_ttl(sess->resp->headers, srv->cur_ts);
+		break;
+	default:
+		break;
+	}
+
+	if (ttl == -1 || 0 != proxy_cache_entry_set_vary(entry, sess->resp->headers, con->request.headers)) {
+		proxy_cache_session_pass(srv, p, sess);
+
+		return;
+	}
+
+	proxy_cache_store_headers(entry, con->response.headers);
+
+	/* we have to be able to revalidate an entry which is stale right away */
+	if (ttl == 0 && buffer_is_empty(entry->etag) && buffer_is_empty(entry->last_modified)) {
+		proxy_cache_session_pass(srv, p, sess);
+
+		return;
+	}
+
+	entry->status = status;
+	entry->stored_ts = srv->cur_ts;
+	entry->expires_ts = srv->cur_ts + ttl;
+}
+
+/**
+ * the response content is complete
+ */
+static void proxy_cache_fill_done(server *srv, connection *con, plugin_data *p, proxy_session *sess) {
+	proxy_cache_entry *entry = sess->cache_entry;
+
+	/* without a Content-Length a closed connection might have cut the response */
+	if (sess->content_length >= 0 ? entry->size != sess->content_length : sess->is_closed) {
+		proxy_cache_session_done(srv, con, p, sess);
+
+		return;
+	}
+
+	proxy_cache_entry_finish(p->cache, entry);
+	proxy_cache_entry_wakeup(srv, entry);
+	proxy_cache_entry_release(p->cache, entry);
+
+	sess->cache_entry = NULL;
+	sess->cache_mode = PROXY_CACHE_MODE_BYPASS;
+}
+
 /**
  * Copy decoded response content to client connection.
  */
@@ -522,8 +1073,6 @@ static int proxy_copy_response(server *srv, connection *con, proxy_session *sess
 	chunk *c;
 	int we_have = 0;
 
-	UNUSED(srv);
-
 	chunkqueue_remove_finished_chunks(sess->recv);
 	/* copy the content to the next cq */
 	for (c = sess->recv->first; c; c = c->next) {
@@ -532,6 +1081,12 @@ static int proxy_copy_response(server *srv, connection *con, proxy_session *sess
 		we_have = c->mem->used - c->offset - 1;
 		sess->recv->bytes_out += we_have;
 		if (sess->send_response_content) {
+			/* a copy of the content goes into the cache */
+			if (sess->cache_mode == PROXY_CACHE_MODE_FILL &&
+			    0 != proxy_cache_entry_append(sess->p->cache, sess->cache_entry, c->mem->ptr + c->offset, we_have)) {
+				proxy_cache_session_pass(srv, sess->p, sess);
+			}
+
 			con->send->bytes_in += we_have;
 			/* X-Sendfile ignores the content-body */
 			chunkqueue_steal_chunk(con->send, c);
@@ -634,6 +1189,25 @@ static handler_t proxy_handle_response_headers(server *srv, connection *con, plu
 	int do_x_rewrite = 0;
 	size_t i;
 
+	if (sess->cache_mode == PROXY_CACHE_MODE_REVALIDATE) {
+		proxy_cache_entry *entry = sess->cache_entry;
+
+		if (sess->resp->status == 304) {
+			proxy_cache_revalidated(srv, con, p, sess);
+
+			return HANDLER_FINISHED;
+		}
+
+		/* the resource changed, the response replaces the entry */
+		buffer_copy_string_buffer(p->cache_key, entry->key);
+
+		proxy_cache_remove(p->cache, entry);
+		proxy_cache_session_done(srv, con, p, sess);
+
+		sess->cache_entry = proxy_cache_insert(p->cache, p->cache_key);
+		sess->cache_mode = PROXY_CACHE_MODE_FILL;
+	}
+
 	/* finished parsing http response headers from backend, now prepare http response headers
 	 * for client response.
 	 */
@@ -723,7 +1297,7 @@ static handler_t proxy_handle_response_headers(server *srv, connection *con, plu
 				do_x_rewrite = 1;
 				buffer_copy_string_buffer(con->request.http_host, header->value);
 				/* replace Host request header */
-				if (NULL != (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("Host")))) {
+				if (NULL != (ds = http_request_get_header(con, HTTP_HEADER_HOST))) {
 					buffer_copy_string_buffer(ds->value, header->value);
 				} else {
 					/* insert Host request header */
@@ -732,7 +1306,7 @@ static handler_t proxy_handle_response_headers(server *srv, connection *con, plu
 					}
 					buffer_copy_string_len(ds->key, CONST_STR_LEN("Host"));
 					buffer_copy_string_buffer(ds->value, header->value);
-					array_insert_unique(con->request.headers, (data_unset *)ds);
+					http_request_insert_header(con, ds);
 				}
 			}
 
@@ -775,7 +1349,7 @@ static handler_t proxy_handle_response_headers(server *srv, connection *con, plu
 			if (buffer_is_equal(rw->header, header->key)) {
 				int ret;
 
-				if ((ret = pcre_replace(rw->regex, rw->replace, header->value, p->replace_buf)) < 0) {
+				if ((ret = pcre_replace(rw->regex, rw->regex_extra, rw->replace, header->value, p->replace_buf)) < 0) {
 					switch (ret) {
 					case PCRE_ERROR_NOMATCH:
 						/* hmm, ok. no problem */
@@ -830,6 +1404,10 @@ static handler_t proxy_handle_response_headers(server *srv, connection *con, plu
 		}
 	}
 
+	if (sess->cache_mode == PROXY_CACHE_MODE_FILL) {
+		proxy_cache_fill_start(srv, con, p, sess);
+	}
+
 	/* we might have part of the response content too */
 	proxy_copy_response(srv, con, sess);
 
@@ -874,6 +1452,14 @@ static handler_t proxy_stream_encode_decode(server *srv, proxy_session *sess) {
 		}
 	}
 
+	/* don't take more request content than the backend can take, the client has to wait */
+	if (con->stream_request_content &&
+	    sess->proxy_con->send->bytes_in - sess->proxy_con->send->bytes_out >= MAX_REQUEST_CONTENT_STREAM_BUFFER) {
+		if (!sess->is_closed) proxy_connection_enable_events(srv, sess->proxy_con);
+
+		return HANDLER_GO_ON;
+	}
+
 	/* encode request content. */
 	switch(proxy_stream_encoder(srv, sess, con->recv)) {
 	case HANDLER_FINISHED:
@@ -899,6 +1485,99 @@ static handler_t proxy_stream_encode_decode(server *srv, proxy_session *sess) {
 	return HANDLER_GO_ON;
 }
 
+/**
+ * can the rest of the response content be splice()d to the client ?
+ *
+ * the content has to go out unchanged and nothing may be buffered in front of it
+ */
+static int proxy_can_splice(server *srv, connection *con, proxy_session *sess) {
+	proxy_protocol *protocol = (sess->proxy_backend) ? sess->proxy_backend->protocol : NULL;
+	proxy_connection *proxy_con = sess->proxy_con;
+
+	if (!protocol || !protocol->proxy_stream_is_raw) return 0;
+
+	if (!sess->send_response_content ||
+	    sess->do_internal_redirect ||
+	    sess->is_request_finished) return 0;
+
+	/* the cache needs a copy of the content */
+	if (sess->cache_mode == PROXY_CACHE_MODE_FILL) return 0;
+
+	if (con->request.http_method == HTTP_METHOD_HEAD || con->send->is_closed) return 0;
+
+	/* mod_deflate and mod_chunked need the content in memory */
+	if (con->send_filters->first != con->send_filters->last) return 0;
+
+	/* the request content is still on its way to the backend */
+	if (proxy_con->send->bytes_out != proxy_con->send->bytes_in) return 0;
+
+	chunkqueue_remove_finished_chunks(proxy_con->recv);
+	chunkqueue_remove_finished_chunks(sess->recv);
+
+	if (!chunkqueue_is_empty(proxy_con->recv) || !chunkqueue_is_empty(sess->recv)) return 0;
+
+	if (!network_can_write_pipe(srv, con)) return 0;
+
+	return (protocol->proxy_stream_is_raw)(srv, sess);
+}
+
+/**
+ * splice() the response content from the backend into a pipe-chunk for the client
+ *
+ * We only read from the backend when the client took everything we
+ * gave it, a slow client throttles the backend and we never have more
+ * than one pipe in flight.
+ */
+static handler_t proxy_splice_response(server *srv, connection *con, proxy_session *sess) {
+	proxy_connection *proxy_con = sess->proxy_con;
+	off_t max_read = PROXY_SPLICE_MAX;
+	off_t start_bytes_in = con->send->bytes_in;
+
+	/* let the connection write what it has first */
+	if (con->send->bytes_in != con->send->bytes_out ||
+	    con->send_raw->bytes_in != con->send_raw->bytes_out) {
+		return HANDLER_GO_ON;
+	}
+
+	if (sess->content_length >= 0 && sess->content_length - sess->bytes_read < max_read) {
+		max_read = sess->content_length - sess->bytes_read;
+	}
+
+	switch (network_read_to_pipe(srv, con, proxy_con->sock, con->send, max_read)) {
+	case NETWORK_STATUS_SUCCESS:
+		break;
+	case NETWORK_STATUS_WAIT_FOR_EVENT:
+		fdevent_event_add(srv->ev, proxy_con->sock, FDEVENT_IN);
+
+		return HANDLER_WAIT_FOR_EVENT;
+	case NETWORK_STATUS_CONNECTION_CLOSE:
+		/* as in the stream-decoder, a close finishes the content */
+		sess->is_closed = 1;
+		proxy_con->send->is_closed = 1;
+		proxy_con->recv->is_closed = 1;
+		sess->is_request_finished = 1;
+
+		fdevent_event_del(srv->ev, proxy_con->sock);
+
+		return HANDLER_GO_ON;
+	case NETWORK_STATUS_WAIT_FOR_FD:
+		/* no fds left for a pipe, copy the content instead */
+		sess->is_splicing = 0;
+
+		return HANDLER_GO_ON;
+	default:
+		return HANDLER_ERROR;
+	}
+
+	sess->bytes_read += con->send->bytes_in - start_bytes_in;
+
+	if (sess->bytes_read == sess->content_length) {
+		sess->is_request_finished = 1;
+	}
+
+	return HANDLER_GO_ON;
+}
+
 static handler_t proxy_connection_connect(proxy_connection *con) {
 	int fd;
 #ifdef _WIN32
@@ -1023,7 +1702,10 @@ static handler_t proxy_handle_fdevent(void *s, void *ctx, int revents) {
 	proxy_con = sess->proxy_con;
 	con       = sess->remote_con;
 
-	if (revents & FDEVENT_IN) {
+	if ((revents & FDEVENT_IN) && sess->is_splicing) {
+		/* the state-engine splice()s the content as soon as the client took the last pipe */
+		fdevent_event_del(srv->ev, proxy_con->sock);
+	} else if (revents & FDEVENT_IN) {
 		chunkqueue_remove_finished_chunks(proxy_con->recv);
 		switch (srv->network_backend_read(srv, con, proxy_con->sock, proxy_con->recv)) {
 		case NETWORK_STATUS_CONNECTION_CLOSE:
@@ -1204,7 +1886,6 @@ static int proxy_recycle_backend_connection(server *srv, plugin_data *p, proxy_s
 		joblist_append(srv, next_con);
 
 		COUNTER_DEC(p->conf.backlog_size);
-		proxy_request_free(req);
 	}
 
 	return HANDLER_GO_ON;
@@ -1213,26 +1894,65 @@ static int proxy_recycle_backend_connection(server *srv, plugin_data *p, proxy_s
 /**
  * push the session into the backlog
  *
- * @returns HANDLER_ERROR in case we reach the max-connect-retry limit
+ * The request fails with 504 if we reached the max-connect-retry limit,
+ * with 503 if it would wait longer than its deadline.
+ *
+ * @returns HANDLER_WAIT_FOR_EVENT if the request is queued, HANDLER_FINISHED otherwise
  */
 static handler_t mod_proxy_core_backlog_connection(server *srv, connection *con, plugin_data *p, proxy_session *sess) {
-	proxy_request *req;
+	proxy_request *req = &(sess->backlog_req);
+	buffer *key = p->tmp_buf;
 
 	if (sess->sent_to_backlog >= p->conf.max_backlog_size) {
-		return HANDLER_ERROR;
+		con->http_status = 504; /* gateway timeout */
+		con->send->is_closed = 1;
+
+		TRACE("connecting backends timed out, retry limit reached: %d", sess->sent_to_backlog);
+		return HANDLER_FINISHED;
+	}
+
+	switch (p->conf.backlog_fairness) {
+	case PROXY_BACKLOG_FAIR_CLIENT:
+		buffer_copy_string_buffer(key, con->dst_addr_buf);
+		break;
+	case PROXY_BACKLOG_FAIR_HOST:
+		buffer_copy_string_buffer(key, con->uri.authority);
+		break;
+	default:
+		buffer_reset(key);
+		break;
+	}
+
+	/* don't let it wait if it won't make it anyway */
+	if (p->conf.backlog_deadline &&
+	    proxy_backlog_expected_wait(p->conf.backlog, key, p->conf.backlog_priority) > p->conf.backlog_deadline * 1000L) {
+		COUNTER_INC(p->conf.backlog->shed);
+
+		con->http_status = 503; /* service unavailable */
+		con->send->is_closed = 1;
+
+		return HANDLER_FINISHED;
 	}
 
 	/* connection pool is full, queue the request for now */
-	req = proxy_request_init();
-	req->added_ts = srv->cur_ts;
-	req->con = con;
+	if (sess->sent_to_backlog == 0) {
+		req->added_ts = srv->cur_ts;
+		req->deadline_ts = p->conf.backlog_deadline ? srv->cur_ts + p->conf.backlog_deadline : 0;
+		req->con = con;
+	}
 
-	proxy_backlog_push(p->conf.backlog, req);
+	/* we were woken up, but someone else was faster */
+	proxy_backlog_push(p->conf.backlog, req, key, p->conf.backlog_priority, sess->sent_to_backlog > 0);
 
 	COUNTER_INC(p->conf.backlog_size);
 	sess->sent_to_backlog++;
 
-	return HANDLER_GO_ON;
+	/* no, not really an event,
+	 * we just want to block the outer loop from stepping forward
+	 *
+	 * the trigger will bring this connection back into the game
+	 */
+	return HANDLER_WAIT_FOR_EVENT;
 }
 
 /**
@@ -1241,11 +1961,9 @@ static handler_t mod_proxy_core_backlog_connection(server *srv, connection *con,
  */
 static int proxy_get_request_header(server *srv, connection *con, plugin_data *p, proxy_session *sess) {
 	/* request line */
-	const char *remote_ip;
 	size_t i;
 
-	remote_ip = inet_ntop_cache_get_ip(srv, &(con->dst_addr));
-	array_append_key_value(sess->request_headers, CONST_STR_LEN("X-Forwarded-For"), remote_ip, strlen(remote_ip));
+	array_append_key_value(sess->request_headers, CONST_STR_LEN("X-Forwarded-For"), CONST_BUF_LEN(con->dst_addr_buf));
 
 	/* http_host is NOT is just a pointer to a buffer
 	 * which is NULL if it is not set */
@@ -1268,9 +1986,9 @@ static int proxy_get_request_header(server *srv, connection *con, plugin_data *p
 
 		if (buffer_is_empty(ds->value) || buffer_is_empty(ds->key)) continue;
 
-		if (buffer_is_equal_string(ds->key, CONST_STR_LEN("Connection"))) continue;
+		if (ds == http_request_get_header(con, HTTP_HEADER_CONNECTION)) continue;
+		if (ds == http_request_get_header(con, HTTP_HEADER_EXPECT)) continue;
 		if (buffer_is_equal_string(ds->key, CONST_STR_LEN("Keep-Alive"))) continue;
-		if (buffer_is_equal_string(ds->key, CONST_STR_LEN("Expect"))) continue;
 #ifdef HAVE_PCRE_H
 		for (k = 0; k < p->conf.request_rewrites->used; k++) {
 			proxy_rewrite *rw = p->conf.request_rewrites->ptr[k];
@@ -1278,7 +1996,7 @@ static int proxy_get_request_header(server *srv, connection *con, plugin_data *p
 			if (buffer_is_equal(rw->header, ds->key)) {
 				int ret;
 
-				if ((ret = pcre_replace(rw->regex, rw->replace, ds->value, p->replace_buf)) < 0) {
+				if ((ret = pcre_replace(rw->regex, rw->regex_extra, rw->replace, ds->value, p->replace_buf)) < 0) {
 					switch (ret) {
 					case PCRE_ERROR_NOMATCH:
 						/* hmm, ok. no problem */
@@ -1304,6 +2022,18 @@ static int proxy_get_request_header(server *srv, connection *con, plugin_data *p
 #endif
 	}
 
+	/* ask if the stale cache-entry is still valid, the client didn't send conditionals */
+	if (sess->cache_mode == PROXY_CACHE_MODE_REVALIDATE) {
+		proxy_cache_entry *entry = sess->cache_entry;
+
+		if (!buffer_is_empty(entry->etag)) {
+			array_set_key_value(sess->request_headers, CONST_STR_LEN("If-None-Match"), CONST_BUF_LEN(entry->etag));
+		}
+		if (!buffer_is_empty(entry->last_modified)) {
+			array_set_key_value(sess->request_headers, CONST_STR_LEN("If-Modified-Since"), CONST_BUF_LEN(entry->last_modified));
+		}
+	}
+
 	/* populate sess->request_uri with the actually requested path
 	 * (con->request.uri). if we have pcre and there is a _uri request
 	 * rewrite, it will be overwritten later
@@ -1318,7 +2048,7 @@ static int proxy_get_request_header(server *srv, connection *con, plugin_data *p
 		if (buffer_is_equal_string(rw->header, CONST_STR_LEN("_uri"))) {
 			int ret;
 
-			if ((ret = pcre_replace(rw->regex, rw->replace, con->request.uri, p->replace_buf)) < 0) {
+			if ((ret = pcre_replace(rw->regex, rw->regex_extra, rw->replace, con->request.uri, p->replace_buf)) < 0) {
 				switch (ret) {
 				case PCRE_ERROR_NOMATCH:
 					/* hmm, ok. no problem */
@@ -1334,7 +2064,7 @@ static int proxy_get_request_header(server *srv, connection *con, plugin_data *p
 		} else if (buffer_is_equal_string(rw->header, CONST_STR_LEN("_docroot"))) {
 			int ret;
 
-			if ((ret = pcre_replace(rw->regex, rw->replace, con->physical.doc_root, p->replace_buf)) < 0) {
+			if ((ret = pcre_replace(rw->regex, rw->regex_extra, rw->replace, con->physical.doc_root, p->replace_buf)) < 0) {
 				switch (ret) {
 				case PCRE_ERROR_NOMATCH:
 					/* hmm, ok. no problem */
@@ -1354,7 +2084,7 @@ static int proxy_get_request_header(server *srv, connection *con, plugin_data *p
 		} else if (buffer_is_equal_string(rw->header, CONST_STR_LEN("_pathinfo"))) {
 			int ret;
 
-			if ((ret = pcre_replace(rw->regex, rw->replace, con->uri.path, p->replace_buf)) < 0) {
+			if ((ret = pcre_replace(rw->regex, rw->regex_extra, rw->replace, con->uri.path, p->replace_buf)) < 0) {
 				switch (ret) {
 				case PCRE_ERROR_NOMATCH:
 					/* hmm, ok. no problem */
@@ -1370,7 +2100,7 @@ static int proxy_get_request_header(server *srv, connection *con, plugin_data *p
 		} else if (buffer_is_equal_string(rw->header, CONST_STR_LEN("_scriptname"))) {
 			int ret;
 
-			if ((ret = pcre_replace(rw->regex, rw->replace, con->uri.path, p->replace_buf)) < 0) {
+			if ((ret = pcre_replace(rw->regex, rw->regex_extra, rw->replace, con->uri.path, p->replace_buf)) < 0) {
 				switch (ret) {
 				case PCRE_ERROR_NOMATCH:
 					/* hmm, ok. no problem */
@@ -1393,6 +2123,32 @@ static int proxy_get_request_header(server *srv, connection *con, plugin_data *p
 	return 0;
 }
 
+/**
+ * the connect() to the address failed, don't use it for proxy-core.disable-time
+ *
+ * only an ACTIVE address is disabled: a DRAINING or DOWN one would be made
+ * ACTIVE again by the trigger after the disable-time
+ */
+static void proxy_address_disable(server *srv, plugin_data *p, proxy_backend *backend, proxy_address *address) {
+	switch (address->state) {
+	case PROXY_ADDRESS_STATE_ACTIVE:
+		address->state = PROXY_ADDRESS_STATE_DISABLED;
+		backend->disabled_addresses++;
+
+		/* if all addresses in address_pool are disabled, then disable this backend. */
+		if (backend->disabled_addresses == backend->address_pool->used) {
+			backend->state = PROXY_BACKEND_STATE_DISABLED;
+		}
+
+		/* fall through */
+	case PROXY_ADDRESS_STATE_DISABLED:
+		address->disabled_until = srv->cur_ts + p->conf.disable_time;
+		break;
+	default:
+		break;
+	}
+}
+
 /* we are event-driven
  *
  * the first entry is connect() call, if the doesn't need a event
@@ -1454,21 +2210,14 @@ static handler_t proxy_state_engine(server *srv, connection *con, plugin_data *p
 			return HANDLER_WAIT_FOR_FD;
 		case HANDLER_ERROR:
 			/* there is no-one on the other side */
-			sess->proxy_con->address->disabled_until = srv->cur_ts + p->conf.disable_time;
-
 			TRACE("connecting to address %s (%p) failed, disabling for %u sec",
 					SAFE_BUF_STR(sess->proxy_con->address->name),
 					(void*) sess->proxy_con->address,
 					(unsigned int) p->conf.disable_time);
 			COUNTER_INC(sess->proxy_backend->requests_failed);
 
-			sess->proxy_con->address->state = PROXY_ADDRESS_STATE_DISABLED;
-			sess->proxy_backend->disabled_addresses++;
-			/* if all addresses in address_pool are disabled, then disable this backend. */
+			proxy_address_disable(srv, p, sess->proxy_backend, sess->proxy_con->address);
 
-			if (sess->proxy_backend->disabled_addresses == sess->proxy_backend->address_pool->used) {
-				sess->proxy_backend->state = PROXY_BACKEND_STATE_DISABLED;
-			}
 			/* try another backend instead */
 			return HANDLER_COMEBACK;
 		default:
@@ -1497,21 +2246,15 @@ static handler_t proxy_state_engine(server *srv, connection *con, plugin_data *p
 					switch (socket_error) {
 					case ECONNREFUSED:
 						/* there is no-one on the other side */
-						sess->proxy_con->address->disabled_until = srv->cur_ts + p->conf.disable_time;
-	
 						TRACE("address %s refused us, disabling for %u sec", sess->proxy_con->address->name->ptr, (unsigned int) p->conf.disable_time);
 						COUNTER_INC(sess->proxy_backend->requests_failed);
 	
 						break;
 					case EHOSTUNREACH:
 						/* there is no-one on the other side */
-						sess->proxy_con->address->disabled_until = srv->cur_ts + p->conf.disable_time;
-	
 						TRACE("host %s is unreachable, disabling for %u sec", sess->proxy_con->address->name->ptr, (unsigned int) p->conf.disable_time);
 						break;
 					default:
-						sess->proxy_con->address->disabled_until = srv->cur_ts + p->conf.disable_time;
-	
 						TRACE("connected finally failed: %s (%d)", strerror(socket_error), socket_error);
 	
 						TRACE("connect to address %s failed and I don't know why, disabling for %u sec", sess->proxy_con->address->name->ptr, (unsigned int) p->conf.disable_time);
@@ -1519,12 +2262,8 @@ static handler_t proxy_state_engine(server *srv, connection *con, plugin_data *p
 						break;
 					}
 	
-					sess->proxy_con->address->state = PROXY_ADDRESS_STATE_DISABLED;
-					sess->proxy_backend->disabled_addresses++;
-					/* if all addresses in address_pool are disabled, then disable this backend. */
-					if (sess->proxy_backend->disabled_addresses == sess->proxy_backend->address_pool->used) {
-						sess->proxy_backend->state = PROXY_BACKEND_STATE_DISABLED;
-					}
+					proxy_address_disable(srv, p, sess->proxy_backend, sess->proxy_con->address);
+
 					return HANDLER_COMEBACK;
 				}
 	
@@ -1537,18 +2276,11 @@ static handler_t proxy_state_engine(server *srv, connection *con, plugin_data *p
 				break;
 			case PROXY_CONNECTION_STATE_CLOSED:
 				/* looks like the connect() timed out */
-				sess->proxy_con->address->disabled_until = srv->cur_ts + p->conf.disable_time;
-				sess->proxy_con->address->state = PROXY_ADDRESS_STATE_DISABLED;
+				proxy_address_disable(srv, p, sess->proxy_backend, sess->proxy_con->address);
 
 				/* the connection */
 				sess->proxy_con->state = PROXY_CONNECTION_STATE_CLOSED;
 
-				/* if all addresses in address_pool are disabled, then disable this backend. */
-				sess->proxy_backend->disabled_addresses++;
-
-				if (sess->proxy_backend->disabled_addresses == sess->proxy_backend->address_pool->used) {
-					sess->proxy_backend->state = PROXY_BACKEND_STATE_DISABLED;
-				}
 				TRACE("connect(%s) to failed: trying another backed", 
 						SAFE_BUF_STR(sess->proxy_con->address->name));
 				return HANDLER_COMEBACK;
@@ -1584,7 +2316,11 @@ static handler_t proxy_state_engine(server *srv, connection *con, plugin_data *p
 				if (sess->is_closed && !sess->have_response_headers) {
 					if (sess->p->conf.debug) TRACE("%s", "connection to backend closed when sending request headers/content.");
 				}
-				if (con->recv->bytes_out < con->recv->bytes_in) {
+				if (!con->recv->is_closed) {
+					/* the rest of the streamed content is still on the wire */
+					con->keep_alive = 0;
+				}
+				if (con->recv->bytes_out < con->recv->bytes_in || !con->recv->is_closed) {
 					/* we have to consume all the request content data. */
 					for (c = con->recv->first; c; c = c->next) {
 						switch(c->type) {
@@ -1718,26 +2454,48 @@ static handler_t proxy_state_engine(server *srv, connection *con, plugin_data *p
 
 		if (sess->state != PROXY_STATE_READ_RESPONSE_BODY) break;
 	case PROXY_STATE_READ_RESPONSE_BODY:
+		if (!sess->is_splicing && proxy_can_splice(srv, con, sess)) {
+			if (p->conf.debug) TRACE("splicing the response content for %s", SAFE_BUF_STR(con->uri.path));
 
-		switch (proxy_stream_encode_decode(srv, sess)) {
-		case HANDLER_FINISHED:
-		case HANDLER_GO_ON:
-			break;
-		case HANDLER_ERROR:
-			/* error */
-			return HANDLER_ERROR;
-		default:
-			TRACE("stream-decoder: %s", "foo");
-			break;
+			sess->is_splicing = 1;
 		}
 
-		proxy_copy_response(srv, con, sess);
+		if (sess->is_splicing) {
+			switch (proxy_splice_response(srv, con, sess)) {
+			case HANDLER_GO_ON:
+				break;
+			case HANDLER_WAIT_FOR_EVENT:
+				return HANDLER_WAIT_FOR_EVENT;
+			default:
+				return HANDLER_ERROR;
+			}
+		}
 
-		if (!sess->proxy_con->recv->is_closed && !sess->is_request_finished) {
-			return HANDLER_WAIT_FOR_EVENT;
+		if (!sess->is_splicing) {
+			switch (proxy_stream_encode_decode(srv, sess)) {
+			case HANDLER_FINISHED:
+			case HANDLER_GO_ON:
+				break;
+			case HANDLER_ERROR:
+				/* error */
+				return HANDLER_ERROR;
+			default:
+				TRACE("stream-decoder: %s", "foo");
+				break;
+			}
+
+			proxy_copy_response(srv, con, sess);
+
+			if (!sess->proxy_con->recv->is_closed && !sess->is_request_finished) {
+				return HANDLER_WAIT_FOR_EVENT;
+			}
 		}
 
 		if(sess->is_request_finished) {
+			if (sess->cache_mode == PROXY_CACHE_MODE_FILL) {
+				proxy_cache_fill_done(srv, con, p, sess);
+			}
+
 			sess->recv->is_closed = 1;
 			con->send->is_closed = 1;
 			/* recycle proxy connection. */
@@ -1759,8 +2517,10 @@ static handler_t proxy_state_engine(server *srv, connection *con, plugin_data *p
 		}
 
 		/* we wrote something into the the send-buffers,
-		 * call the connection-handler to push it to the client */
-		joblist_append(srv, con);
+		 * call the connection-handler to push it to the client
+		 *
+		 * a spliced response is pushed right away as we return HANDLER_GO_ON */
+		if (!sess->is_splicing) joblist_append(srv, con);
 
 		break;
 	default:
@@ -2036,8 +2796,15 @@ static proxy_address *proxy_address_balancer(server *srv, connection *con, proxy
 }
 
 static int mod_proxy_core_patch_connection(server *srv, connection *con, plugin_data *p) {
-	size_t i, j;
+	config_patch_cache *pc = p->patch_cache;
+	const plugin_config *cached;
 	plugin_config *s = p->config_storage[0];
+	size_t i;
+
+	if (NULL != (cached = config_patch_cache_get(srv, con, pc))) {
+		p->conf = *cached;
+		return 0;
+	}
 
 	/* global defaults */
 	PATCH_OPTION(balancer);
@@ -2056,53 +2823,45 @@ static int mod_proxy_core_patch_connection(server *srv, connection *con, plugin_
 	PATCH_OPTION(max_keep_alive_requests);
 	PATCH_OPTION(disable_time);
 	PATCH_OPTION(max_backlog_size);
-
-	/* skip the first, the global context */
-	for (i = 1; i < srv->config_context->used; i++) {
-		data_config *dc = (data_config *)srv->config_context->data[i];
-		s = p->config_storage[i];
-
-		/* condition didn't match */
-		if (!config_check_cond(srv, con, dc)) continue;
-
-		/* merge config */
-		for (j = 0; j < dc->value->used; j++) {
-			data_unset *du = dc->value->data[j];
-
-			if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_PROXY_CORE_BACKENDS))) {
-				PATCH_OPTION(backends);
-				PATCH_OPTION(backlog);
-				PATCH_OPTION(backlog_size);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_PROXY_CORE_DEBUG))) {
-				PATCH_OPTION(debug);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_PROXY_CORE_BALANCER))) {
-				PATCH_OPTION(balancer);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_PROXY_CORE_PROTOCOL))) {
-				PATCH_OPTION(protocol);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_PROXY_CORE_REWRITE_REQUEST))) {
-				PATCH_OPTION(request_rewrites);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_PROXY_CORE_REWRITE_RESPONSE))) {
-				PATCH_OPTION(response_rewrites);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_PROXY_CORE_ALLOW_X_SENDFILE))) {
-				PATCH_OPTION(allow_x_sendfile);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_PROXY_CORE_ALLOW_X_REWRITE))) {
-				PATCH_OPTION(allow_x_rewrite);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_PROXY_CORE_MAX_POOL_SIZE))) {
-				PATCH_OPTION(max_pool_size);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_PROXY_CORE_CHECK_LOCAL))) {
-				PATCH_OPTION(check_local);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_PROXY_CORE_SPLIT_HOSTNAMES))) {
-				PATCH_OPTION(split_hostnames);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_PROXY_CORE_MAX_KEEP_ALIVE))) {
-				PATCH_OPTION(max_keep_alive_requests);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_PROXY_CORE_DISABLE_TIME))) {
-				PATCH_OPTION(disable_time);
-			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN(CONFIG_PROXY_CORE_MAX_BACKLOG_SIZE))) {
-				PATCH_OPTION(max_backlog_size);
-			}
+	PATCH_OPTION(stream_request_content);
+	PATCH_OPTION(cache);
+	PATCH_OPTION(backlog_fairness);
+	PATCH_OPTION(backlog_priority);
+	PATCH_OPTION(backlog_deadline);
+
+	/* the conditionals which set one of our options */
+	for (i = 0; i < pc->used; i++) {
+		if (!CONFIG_PATCH_MATCHED(con, pc, i)) continue;
+
+		s = p->config_storage[pc->contexts[i].context_ndx];
+
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_BACKENDS)) {
+			PATCH_OPTION(backends);
+			PATCH_OPTION(backlog);
+			PATCH_OPTION(backlog_size);
 		}
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_DEBUG)) PATCH_OPTION(debug);
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_BALANCER)) PATCH_OPTION(balancer);
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_PROTOCOL)) PATCH_OPTION(protocol);
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_REWRITE_REQUEST)) PATCH_OPTION(request_rewrites);
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_REWRITE_RESPONSE)) PATCH_OPTION(response_rewrites);
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_ALLOW_X_SENDFILE)) PATCH_OPTION(allow_x_sendfile);
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_ALLOW_X_REWRITE)) PATCH_OPTION(allow_x_rewrite);
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_MAX_POOL_SIZE)) PATCH_OPTION(max_pool_size);
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_CHECK_LOCAL)) PATCH_OPTION(check_local);
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_MAX_KEEP_ALIVE)) PATCH_OPTION(max_keep_alive_requests);
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_SPLIT_HOSTNAMES)) PATCH_OPTION(split_hostnames);
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_DISABLE_TIME)) PATCH_OPTION(disable_time);
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_MAX_BACKLOG_SIZE)) PATCH_OPTION(max_backlog_size);
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_STREAM_REQUEST_CONTENT)) PATCH_OPTION(stream_request_content);
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_CACHE)) PATCH_OPTION(cache);
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_BACKLOG_FAIRNESS)) PATCH_OPTION(backlog_fairness);
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_BACKLOG_PRIORITY)) PATCH_OPTION(backlog_priority);
+		if (CONFIG_PATCH_OPT(pc, i, PROXY_CORE_OPT_BACKLOG_DEADLINE)) PATCH_OPTION(backlog_deadline);
 	}
 
+	config_patch_cache_insert(con, pc, &p->conf);
+
 	return 0;
 }
 
@@ -2128,6 +2887,9 @@ static int mod_proxy_core_check_match(server *srv, connection *con, plugin_data
 #if 0
 	if (buffer_is_empty(path)) return HANDLER_GO_ON;
 #endif
+	/* the old request is done with the cache */
+	if (sess) proxy_cache_session_done(srv, con, p, sess);
+
 	if (sess && sess->do_x_rewrite_backend) {
 		proxy_backend *backend;
 		buffer *sticky_session = sess->sticky_session;
@@ -2188,6 +2950,7 @@ static int mod_proxy_core_check_match(server *srv, connection *con, plugin_data
 
 	con->plugin_ctx[p->id] = sess;
 	con->mode = p->id;
+	con->stream_request_content = p->conf.stream_request_content;
 
 	if (con->conf.log_request_handling) {
 		TRACE("handling it in mod_proxy_core: %s.path=%s",
@@ -2222,11 +2985,13 @@ REQUESTDONE_FUNC(mod_proxy_connection_close_callback) {
 
 	if (p->conf.debug) TRACE("proxy_connection_reset (%d)", con->sock->fd);
 
+	proxy_cache_session_done(srv, con, p, sess);
+
 	if (sess->proxy_con) {
 		proxy_recycle_backend_connection(srv, p, sess);
 	} else {
 		/* if we have the connection in the backlog, remove it */
-		if (0 == proxy_backlog_remove_connection(p->conf.backlog, con)) {
+		if (0 == proxy_backlog_remove(p->conf.backlog, &(sess->backlog_req))) {
 			COUNTER_DEC(p->conf.backlog_size);
 		}
 	}
@@ -2262,6 +3027,13 @@ CONNECTION_FUNC(mod_proxy_core_start_backend) {
 	 * 8. kill session
 	 * */
 
+	if (sess->is_shed) {
+		con->http_status = 503; /* service unavailable */
+		con->send->is_closed = 1;
+
+		return HANDLER_FINISHED;
+	}
+
 	if (sess->do_internal_redirect) {
 		if (sess->internal_redirect_count > MAX_INTERNAL_REDIRECTS) {
 			/* we already handled this request and sent it to the static file handling */
@@ -2300,6 +3072,18 @@ CONNECTION_FUNC(mod_proxy_core_start_backend) {
 		break;
 	}
 
+	/* the cache is asked before we pick a backend */
+	if (p->conf.cache && sess->proxy_con == NULL && sess->state == PROXY_STATE_UNSET &&
+	    (sess->cache_mode == PROXY_CACHE_MODE_UNSET || sess->cache_mode == PROXY_CACHE_MODE_WAIT)) {
+		switch (proxy_cache_handle_request(srv, con, p, sess)) {
+		case HANDLER_FINISHED:
+			return HANDLER_GO_ON;
+		case HANDLER_WAIT_FOR_EVENT:
+			return HANDLER_WAIT_FOR_EVENT;
+		default:
+			break;
+		}
+	}
 
 	/* if the WRITE fails from the start, restart the connection */
 	while (1) {
@@ -2316,20 +3100,7 @@ CONNECTION_FUNC(mod_proxy_core_start_backend) {
 						SAFE_BUF_STR(con->uri.path), con->sock->fd, sess->sent_to_backlog + 1);
 
 				/* no backends available right now. */
-				if (HANDLER_ERROR == mod_proxy_core_backlog_connection(srv, con, p, sess)) {
-					con->http_status = 504; /* gateway timeout */
-					con->send->is_closed = 1;
-
-					TRACE("connecting backends timed out, retry limit reached: %d", sess->sent_to_backlog);
-					return HANDLER_FINISHED;
-				}
-
-				/* no, not really an event,
-				 * we just want to block the outer loop from stepping forward
-				 *
-				 * the trigger will bring this connection back into the game
-				 */
-				return HANDLER_WAIT_FOR_EVENT;
+				return mod_proxy_core_backlog_connection(srv, con, p, sess);
 			}
 
 			sess->proxy_backend->protocol = p->conf.protocol;
@@ -2350,21 +3121,7 @@ CONNECTION_FUNC(mod_proxy_core_start_backend) {
 				TRACE("backlog: all addresses are down, putting %s (%d) into the backlog, retry = %d", 
 						SAFE_BUF_STR(con->uri.path), con->sock->fd, sess->sent_to_backlog + 1);
 
-				if (HANDLER_ERROR == mod_proxy_core_backlog_connection(srv, con, p, sess)) {
-					con->http_status = 504; /* gateway timeout */
-					con->send->is_closed = 1;
-
-					TRACE("connecting backends timed out, retry limit reached: %d", sess->sent_to_backlog);
-					return HANDLER_FINISHED;
-				}
-
-				/* no, not really an event,
-				 * we just want to block the outer loop from stepping forward
-				 *
-				 * the trigger will bring this connection back into the game
-				 */
-
-				return HANDLER_WAIT_FOR_EVENT;
+				return mod_proxy_core_backlog_connection(srv, con, p, sess);
 			}
 
 			if (PROXY_CONNECTIONPOOL_FULL == proxy_connection_pool_get_connection(
@@ -2373,20 +3130,7 @@ CONNECTION_FUNC(mod_proxy_core_start_backend) {
 				sess->proxy_backend->state = PROXY_BACKEND_STATE_FULL;
 
 				if (p->conf.debug) TRACE("backlog: the con-pool is full, putting %s (%d) into the backlog", SAFE_BUF_STR(con->uri.path), con->sock->fd);
-				if (HANDLER_ERROR == mod_proxy_core_backlog_connection(srv, con, p, sess)) {
-					con->http_status = 504; /* gateway timeout */
-					con->send->is_closed = 1;
-
-					TRACE("connecting backends timed out, retry limit reached: %d", sess->sent_to_backlog);
-					return HANDLER_FINISHED;
-				}
-
-				/* no, not really an event,
-				 * we just want to block the outer loop from stepping forward
-				 *
-				 * the trigger will bring this connection back into the game
-				 */
-				return HANDLER_WAIT_FOR_EVENT;
+				return mod_proxy_core_backlog_connection(srv, con, p, sess);
 			}
 			COUNTER_SET(sess->proxy_backend->pool_size, sess->proxy_backend->pool->used);
 			COUNTER_INC(sess->proxy_backend->load);
@@ -2456,8 +3200,8 @@ CONNECTION_FUNC(mod_proxy_send_request_content) {
 
 	if (p->id != con->mode) return HANDLER_GO_ON;
 
-	/* read all the content before we start our backend */
-	if (!con->recv->is_closed) {
+	/* read all the content before we start our backend, unless we stream it */
+	if (!con->recv->is_closed && !con->stream_request_content) {
 		return HANDLER_GO_ON;
 	}
 
@@ -2465,6 +3209,136 @@ CONNECTION_FUNC(mod_proxy_send_request_content) {
 	return mod_proxy_core_start_backend(srv, con, p_d);
 }
 
+/**
+ * check if a connection of the pool still uses the address
+ *
+ * idling connections to the address are closed, the trigger will clean them up
+ */
+static int proxy_address_is_used(proxy_backend *backend, proxy_address *address) {
+	size_t i;
+	int is_used = 0;
+
+	for (i = 0; i < backend->pool->used; i++) {
+		proxy_connection *proxy_con = backend->pool->ptr[i];
+
+		if (proxy_con->address != address) continue;
+
+		if (proxy_con->state == PROXY_CONNECTION_STATE_IDLE) {
+			proxy_con->state = PROXY_CONNECTION_STATE_CLOSED;
+		}
+
+		is_used = 1;
+	}
+
+	return is_used;
+}
+
+/**
+ * the answer of the resolver for a backend
+ *
+ * the addresses of the backend are replaced in one go as soon as the answer is complete
+ */
+static handler_t proxy_handle_fdevent_resolve(void *s, void *ctx, int revents) {
+	server *srv = (server *)s;
+	proxy_backend *backend = ctx;
+	proxy_address_pool *fresh;
+	char buf[4096];
+	ssize_t r;
+
+	if (!(revents & (FDEVENT_IN | FDEVENT_HUP | FDEVENT_ERR))) return HANDLER_GO_ON;
+
+	while ((r = read(backend->resolve_sock->fd, buf, sizeof(buf))) > 0) {
+		buffer_append_string_len(backend->resolve_buf, buf, r);
+	}
+
+	if (r == -1 && (errno == EAGAIN || errno == EINTR)) return HANDLER_GO_ON;
+
+	/* EOF, the answer is complete */
+	fdevent_event_del(srv->ev, backend->resolve_sock);
+	fdevent_unregister(srv->ev, backend->resolve_sock);
+	iosocket_free(backend->resolve_sock);
+	backend->resolve_sock = NULL;
+
+	fresh = proxy_address_pool_init();
+
+	if (0 == proxy_resolver_parse_answer(backend->resolve_buf, fresh) && fresh->used > 0) {
+		int changed;
+
+		if (0 != (changed = proxy_address_pool_update(backend->address_pool, fresh))) {
+			TRACE("the addresses of %s changed (%d added or draining), %zu in the pool",
+					SAFE_BUF_STR(backend->name), changed, backend->address_pool->used);
+		}
+	} else {
+		/* keep what we have */
+		ERROR("resolving %s failed, keeping the old addresses", SAFE_BUF_STR(backend->name));
+	}
+
+	proxy_address_pool_free(fresh);
+	buffer_reset(backend->resolve_buf);
+
+	backend->resolve_ts = srv->cur_ts + backend->resolve_interval;
+
+	return HANDLER_GO_ON;
+}
+
+/**
+ * start the lookups which are due
+ */
+static void mod_proxy_core_resolve_backends(server *srv, plugin_data *p, plugin_config *p_conf) {
+	size_t i;
+	int fd;
+
+	for (i = 0; i < p_conf->backends->used; i++) {
+		proxy_backend *backend = p_conf->backends->ptr[i];
+
+		if (!backend->resolve_interval) continue;
+		if (srv->cur_ts < backend->resolve_ts) continue;
+
+		if (backend->resolve_sock) {
+			/* the old lookup timed out */
+			ERROR("resolving %s timed out", SAFE_BUF_STR(backend->name));
+
+			fdevent_event_del(srv->ev, backend->resolve_sock);
+			fdevent_unregister(srv->ev, backend->resolve_sock);
+			iosocket_free(backend->resolve_sock);
+			backend->resolve_sock = NULL;
+			buffer_reset(backend->resolve_buf);
+		}
+
+		if (-1 == (fd = helper_process_query(p->resolver, backend->name))) {
+			/* the resolver is busy, keep the addresses we have until the next interval */
+			backend->resolve_ts = srv->cur_ts + backend->resolve_interval;
+			continue;
+		}
+
+		backend->resolve_sock = iosocket_init();
+		backend->resolve_sock->fd = fd;
+		backend->resolve_sock->type = IOSOCKET_TYPE_PIPE;
+
+		fdevent_fcntl_set(srv->ev, backend->resolve_sock);
+		fdevent_register(srv->ev, backend->resolve_sock, proxy_handle_fdevent_resolve, backend);
+		fdevent_event_add(srv->ev, backend->resolve_sock, FDEVENT_IN);
+
+		/* give up if there is no answer until then */
+		backend->resolve_ts = srv->cur_ts + PROXY_RESOLVE_TIMEOUT;
+	}
+}
+
+/**
+ * run the health checks of the backends
+ */
+static void mod_proxy_core_check_backends(server *srv, plugin_config *p_conf) {
+	size_t i;
+
+	for (i = 0; i < p_conf->backends->used; i++) {
+		proxy_backend *backend = p_conf->backends->ptr[i];
+
+		if (!backend->health_interval) continue;
+
+		proxy_health_check_backend(srv, backend, p_conf->debug);
+	}
+}
+
 /**
  * cleanup dead connections once a second
  *
@@ -2537,10 +3411,35 @@ static int mod_proxy_wakeup_connections(server *srv, plugin_data *p, plugin_conf
 			}
 		}
 
+		/* remove the addresses which are gone from DNS as soon as they are unused */
+		for (j = 0; j < address_pool->used; ) {
+			proxy_address *address = address_pool->ptr[j];
+
+			if (address->state != PROXY_ADDRESS_STATE_DRAINING ||
+			    proxy_address_is_used(backend, address)) {
+				j++;
+				continue;
+			}
+
+			/* the health probe still points to the address, wait until it is done */
+			if (address->probe) {
+				j++;
+				continue;
+			}
+
+			if (p_conf->debug) TRACE("%s is drained, removing it from %s", SAFE_BUF_STR(address->name), SAFE_BUF_STR(backend->name));
+
+			proxy_address_pool_remove(address_pool, address);
+		}
+
 		/* active the disabled addresses again */
 		for (j = 0; j < address_pool->used; j++) {
 			proxy_address *address = address_pool->ptr[j];
 
+			/* draining and down addresses don't take new connections either */
+			if (address->state == PROXY_ADDRESS_STATE_DRAINING ||
+			    address->state == PROXY_ADDRESS_STATE_DOWN) addrs_disabled++;
+
 			if (address->state != PROXY_ADDRESS_STATE_DISABLED) continue;
 
 			if (srv->cur_ts > address->disabled_until) {
@@ -2580,12 +3479,33 @@ static int mod_proxy_wakeup_connections(server *srv, plugin_data *p, plugin_conf
 		joblist_append(srv, con);
 
 		COUNTER_DEC(p->conf.backlog_size);
-		proxy_request_free(req);
 	}
 
 	return woken_up;
 }
 
+/**
+ * fail the requests in the backlog which passed their deadline
+ */
+static void mod_proxy_core_shed_backlog(server *srv, plugin_data *p, plugin_config *p_conf) {
+	proxy_request *req, *next;
+
+	for (req = proxy_backlog_shed(p_conf->backlog, srv->cur_ts); req; req = next) {
+		connection *con = req->con;
+		proxy_session *sess = con->plugin_ctx[p->id];
+
+		next = req->next;
+		req->next = NULL;
+
+		if (p_conf->debug) TRACE("shedding a connection from the backlog: con=%d", con->sock->fd);
+
+		sess->is_shed = 1;
+		joblist_append(srv, con);
+
+		COUNTER_DEC(p_conf->backlog_size);
+	}
+}
+
 TRIGGER_FUNC(mod_proxy_trigger) {
 	plugin_data *p = p_d;
 	size_t i;
@@ -2597,6 +3517,12 @@ TRIGGER_FUNC(mod_proxy_trigger) {
 	 */
 	for (i = 0; i < srv->config_context->used; i++) {
 		mod_proxy_wakeup_connections(srv, p, p->config_storage[i]);
+
+		mod_proxy_core_shed_backlog(srv, p, p->config_storage[i]);
+
+		if (p->resolver) mod_proxy_core_resolve_backends(srv, p, p->config_storage[i]);
+
+		mod_proxy_core_check_backends(srv, p->config_storage[i]);
 	}
 
 	return HANDLER_GO_ON;
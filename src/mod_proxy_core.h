@@ -7,6 +7,9 @@
 #include "mod_proxy_core_backend.h"
 #include "mod_proxy_core_backlog.h"
 #include "mod_proxy_core_rewrites.h"
+#include "mod_proxy_core_resolver.h"
+#include "mod_proxy_core_health.h"
+#include "mod_proxy_core_cache.h"
 
 #include "buffer.h"
 #include "http_resp.h"
@@ -16,6 +19,13 @@
 
 struct proxy_protocol;
 
+/* who the backlog is fair to */
+typedef enum {
+	PROXY_BACKLOG_FAIR_NONE,
+	PROXY_BACKLOG_FAIR_CLIENT,
+	PROXY_BACKLOG_FAIR_HOST
+} proxy_backlog_fairness_t;
+
 typedef struct {
 	proxy_backends *backends;
 
@@ -34,6 +44,19 @@ typedef struct {
 	unsigned short max_keep_alive_requests;
 	unsigned short disable_time;
 	unsigned short max_backlog_size;
+	unsigned short resolve_interval;
+	unsigned short health_check_interval;
+	unsigned short health_check_rise;
+	unsigned short health_check_fall;
+	unsigned short stream_request_content;
+	unsigned short cache;
+	unsigned short cache_memory_size; /* in MB */
+	unsigned short cache_disk_size;   /* in MB */
+	unsigned short backlog_fairness;
+	unsigned short backlog_priority;
+	unsigned short backlog_deadline;  /* in seconds, 0 to wait till the retries are used up */
+	buffer *health_check_uri;
+	buffer *cache_dir;
 
 	proxy_balance_t balancer;
 	struct proxy_protocol *protocol;
@@ -43,22 +66,35 @@ typedef struct {
 	PLUGIN_DATA;
 
 	array *possible_balancers;
+	array *possible_fairness;
 	/*array *possible_protocols; */
 	struct proxy_protocol *(*proxy_register_protocol) (const char *name); /* register new protocol */
 
 	/* statistics counters. */
 	data_integer *request_count;
 
+	helper_process *resolver; /* NULL if no backend is re-resolved */
+
+	proxy_cache *cache;       /* NULL if no context caches the responses */
+	buffer *cache_key;
+
+	data_integer *cache_hits;
+	data_integer *cache_misses;
+	data_integer *cache_revalidated;
+	data_integer *cache_collapsed;
+
 	/* for parsing only */
 	array *backends_arr;
 	buffer *protocol_buf;
 	buffer *balance_buf;
+	buffer *fairness_buf;
 
 	buffer *replace_buf;
 
 	buffer *tmp_buf;     /** a temporary buffer, used by mod_proxy_backend_fastcgi */
 
 	plugin_config **config_storage;
+	config_patch_cache *patch_cache;
 
 	plugin_config conf;
 } mod_proxy_core_plugin_data;
@@ -76,6 +112,15 @@ typedef enum {
 	PROXY_STATE_FINISHED
 } proxy_state_t;
 
+typedef enum {
+	PROXY_CACHE_MODE_UNSET,
+	PROXY_CACHE_MODE_BYPASS,     /* the cache isn't involved */
+	PROXY_CACHE_MODE_WAIT,       /* another request fills or revalidates the entry */
+	PROXY_CACHE_MODE_FILL,       /* the response goes into the entry */
+	PROXY_CACHE_MODE_REVALIDATE, /* asking the backend if the stale entry is still valid */
+	PROXY_CACHE_MODE_HIT         /* the cache-file of the entry is sent */
+} proxy_cache_mode_t;
+
 typedef struct proxy_session {
 	proxy_connection *proxy_con;
 	proxy_backend *proxy_backend;
@@ -100,6 +145,7 @@ typedef struct proxy_session {
 	int internal_redirect_count;  /** protection against infinite loops */
 	int do_new_session;        /** 1 if we want a new proxy session can be created. */
 	int do_x_rewrite_backend;  /** 1 if we want to do custom backend balancing */
+	int is_splicing;           /** the response content is splice()d from the backend to the client */
 
 	buffer *sticky_session;    /** holds name of backend for custom balancing or sticky sessions */
 
@@ -117,6 +163,11 @@ typedef struct proxy_session {
 	time_t connect_start_ts;
 
 	int sent_to_backlog;
+	proxy_request backlog_req;  /** our entry in the backlog */
+	int is_shed;                /** dropped from the backlog, it passed its deadline */
+
+	proxy_cache_mode_t cache_mode;
+	proxy_cache_entry *cache_entry; /** we hold a reference on it */
 } proxy_session;
 
 #endif
@@ -65,6 +65,112 @@ void proxy_address_pool_add(proxy_address_pool *address_pool, proxy_address *add
 	address_pool->ptr[address_pool->used++] = address;
 }
 
+int proxy_address_pool_add_sockaddr(proxy_address_pool *address_pool, sock_addr *addr, socklen_t addrlen) {
+	proxy_address *a = proxy_address_init();
+
+	memcpy(&(a->addr), addr, addrlen);
+	a->addrlen = addrlen;
+
+	a->state = PROXY_ADDRESS_STATE_ACTIVE;
+	buffer_prepare_copy(a->name, 128);
+
+	switch (a->addr.plain.sa_family) {
+#ifdef HAVE_IPV6
+	case AF_INET6:
+		a->name->ptr[0] = '[';
+		inet_ntop(AF_INET6, &(a->addr.ipv6.sin6_addr), a->name->ptr + 1, a->name->size - 2);
+		a->name->used = strlen(a->name->ptr) + 1;
+		buffer_append_string_len(a->name, CONST_STR_LEN("]:"));
+		buffer_append_long(a->name, ntohs(a->addr.ipv6.sin6_port));
+		break;
+#endif
+	case AF_INET:
+		inet_ntop(AF_INET, &(a->addr.ipv4.sin_addr), a->name->ptr, a->name->size - 1);
+		a->name->used = strlen(a->name->ptr) + 1;
+
+		buffer_append_string_len(a->name, CONST_STR_LEN(":"));
+		buffer_append_long(a->name, ntohs(a->addr.ipv4.sin_port));
+		break;
+	default:
+		ERROR("unknown address-family: %d", a->addr.plain.sa_family);
+		proxy_address_free(a);
+		return -1;
+	}
+
+	proxy_address_pool_add(address_pool, a);
+
+	return 0;
+}
+
+int proxy_address_pool_update(proxy_address_pool *address_pool, proxy_address_pool *fresh) {
+	size_t i, j;
+	int changed = 0;
+	size_t old_used = address_pool->used;
+
+	/* drain the ones which are gone */
+	for (j = 0; j < old_used; j++) {
+		proxy_address *address = address_pool->ptr[j];
+
+		if (address->state == PROXY_ADDRESS_STATE_DRAINING) continue;
+
+		for (i = 0; i < fresh->used; i++) {
+			if (buffer_is_equal(address->name, fresh->ptr[i]->name)) break;
+		}
+
+		if (i == fresh->used) {
+			address->state = PROXY_ADDRESS_STATE_DRAINING;
+			changed++;
+		}
+	}
+
+	/* add the new ones, revive the draining ones which are back */
+	for (i = 0; i < fresh->used; i++) {
+		proxy_address *address = fresh->ptr[i];
+
+		for (j = 0; j < old_used; j++) {
+			if (buffer_is_equal(address->name, address_pool->ptr[j]->name)) break;
+		}
+
+		if (j < old_used) {
+			if (address_pool->ptr[j]->state == PROXY_ADDRESS_STATE_DRAINING) {
+				address_pool->ptr[j]->state = PROXY_ADDRESS_STATE_ACTIVE;
+				changed++;
+			}
+
+			proxy_address_free(address);
+		} else {
+			ARRAY_STATIC_PREPARE_APPEND(address_pool);
+			address_pool->ptr[address_pool->used++] = address;
+			changed++;
+		}
+	}
+
+	/* all addresses are owned by the address_pool or freed now */
+	fresh->used = 0;
+
+	return changed;
+}
+
+int proxy_address_pool_remove(proxy_address_pool *address_pool, proxy_address *address) {
+	size_t i;
+
+	for (i = 0; i < address_pool->used; i++) {
+		if (address_pool->ptr[i] == address) break;
+	}
+
+	if (i == address_pool->used) return -1; /* not found */
+
+	for (; i < address_pool->used - 1; i++) {
+		address_pool->ptr[i] = address_pool->ptr[i + 1];
+	}
+
+	address_pool->used--;
+
+	proxy_address_free(address);
+
+	return 0;
+}
+
 int  proxy_address_pool_add_string(proxy_address_pool *address_pool, buffer *name) {
 	struct addrinfo *res = NULL, pref, *cur;
 	int ret;
@@ -168,38 +274,11 @@ int  proxy_address_pool_add_string(proxy_address_pool *address_pool, buffer *nam
 	buffer_free(port);
 
 	for (cur = res; cur; cur = cur->ai_next) {
-		proxy_address *a = proxy_address_init();
-
-		memcpy(&(a->addr), cur->ai_addr, cur->ai_addrlen);
-		a->addrlen = cur->ai_addrlen;
+		if (0 != proxy_address_pool_add_sockaddr(address_pool, (sock_addr *)cur->ai_addr, cur->ai_addrlen)) {
+			freeaddrinfo(res);
 
-		a->state = PROXY_ADDRESS_STATE_ACTIVE;
-		buffer_prepare_copy(a->name, 128);
-
-		switch (cur->ai_family) {
-#ifdef HAVE_IPV6
-		case AF_INET6:
-			a->name->ptr[0] = '[';
-			inet_ntop(cur->ai_family, &(a->addr.ipv6.sin6_addr), a->name->ptr + 1, a->name->size - 2);
-			a->name->used = strlen(a->name->ptr) + 1;
-			buffer_append_string_len(a->name, CONST_STR_LEN("]:"));
-			buffer_append_long(a->name, ntohs(a->addr.ipv6.sin6_port));
-			break;
-#endif
-		case AF_INET:
-			inet_ntop(cur->ai_family, &(a->addr.ipv4.sin_addr), a->name->ptr, a->name->size - 1);
-			a->name->used = strlen(a->name->ptr) + 1;
-
-			buffer_append_string_len(a->name, CONST_STR_LEN(":"));
-			buffer_append_long(a->name, ntohs(a->addr.ipv4.sin_port));
-			break;
-		default:
-			ERROR("unknown address-family: %d", cur->ai_family);
 			return -1;
 		}
-
-
-		proxy_address_pool_add(address_pool, a);
 	}
 
 	freeaddrinfo(res);
@@ -5,13 +5,18 @@
 #include "buffer.h"
 #include "sys-socket.h"
 #include "array-static.h"
+#include "array.h"
 
 typedef enum {
 	PROXY_ADDRESS_STATE_UNSET,
 	PROXY_ADDRESS_STATE_ACTIVE,
 	PROXY_ADDRESS_STATE_DISABLED,
+	PROXY_ADDRESS_STATE_DRAINING, /* gone from DNS, removed as soon as no connection uses it */
+	PROXY_ADDRESS_STATE_DOWN,     /* failed the health checks, only the health checks bring it back */
 } proxy_address_state_t;
 
+struct proxy_probe;
+
 typedef struct {
 	sock_addr addr;
 	socklen_t addrlen;
@@ -24,6 +29,16 @@ typedef struct {
 	size_t used; /* count of connections currently using this address */
 
 	proxy_address_state_t state;
+
+	/* active health checks */
+	struct proxy_probe *probe; /* the running probe */
+	time_t probe_ts;           /* when the next probe is due */
+	unsigned short probe_ok;   /* consecutive successful probes */
+	unsigned short probe_fail; /* consecutive failed probes */
+
+	data_integer *healthy;
+	data_integer *probe_ms;
+	data_integer *transitions;
 } proxy_address;
 
 ARRAY_STATIC_DEF(proxy_address_pool, proxy_address, );
@@ -32,5 +47,21 @@ proxy_address_pool *proxy_address_pool_init(void);
 void proxy_address_pool_free(proxy_address_pool *address_pool);
 void proxy_address_pool_add(proxy_address_pool *address_pool, proxy_address *address);
 int proxy_address_pool_add_string(proxy_address_pool *address_pool, buffer *address);
+int proxy_address_pool_add_sockaddr(proxy_address_pool *address_pool, sock_addr *addr, socklen_t addrlen);
+
+/**
+ * merge the result of a new lookup into the pool
+ *
+ * new addresses are added, addresses which are missing in 'fresh' are set to
+ * PROXY_ADDRESS_STATE_DRAINING. 'fresh' is empty afterwards.
+ *
+ * @return number of added + draining addresses
+ */
+int proxy_address_pool_update(proxy_address_pool *address_pool, proxy_address_pool *fresh);
+
+/**
+ * remove the address from the pool and free it
+ */
+int proxy_address_pool_remove(proxy_address_pool *address_pool, proxy_address *address);
 
 #endif
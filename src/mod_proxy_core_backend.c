@@ -13,6 +13,9 @@ proxy_backend *proxy_backend_init(void) {
 	backend->balancer = PROXY_BALANCE_RR;
 	backend->name = buffer_init();
 	backend->state = PROXY_BACKEND_STATE_ACTIVE;
+	backend->resolve_buf = buffer_init();
+	backend->health_uri = buffer_init();
+	backend->stat_basename = buffer_init();
 
 	return backend;
 }
@@ -23,6 +26,10 @@ void proxy_backend_free(proxy_backend *backend) {
 	proxy_connection_pool_free(backend->pool);
 	proxy_address_pool_free(backend->address_pool);
 	buffer_free(backend->name);
+	buffer_free(backend->resolve_buf);
+	iosocket_free(backend->resolve_sock);
+	buffer_free(backend->health_uri);
+	buffer_free(backend->stat_basename);
 
 	free(backend);
 }
@@ -7,6 +7,7 @@
 #include "mod_proxy_core_address.h"
 #include "mod_proxy_core_pool.h"
 #include "sys-socket.h"
+#include "iosocket.h"
 
 /**
  * a single DNS name might explode to several IP addresses
@@ -54,6 +55,20 @@ typedef struct {
 
 	proxy_backend_state_t state;
 
+	/* re-resolving the name */
+	unsigned short resolve_interval; /* 0 = never */
+	time_t resolve_ts;               /* when the next lookup is due */
+	iosocket *resolve_sock;          /* the answer of the running lookup */
+	buffer *resolve_buf;
+
+	/* active health checks */
+	unsigned short health_interval;  /* 0 = no health checks */
+	unsigned short health_rise;      /* successful probes until a down address is used again */
+	unsigned short health_fall;      /* failed probes until an address is taken down */
+	buffer *health_uri;              /* what a HTTP probe requests */
+
+	buffer *stat_basename;           /* prefix of the statistics counters */
+
 	/* statistics counters. */
 	data_integer *request_count;
 	data_integer *load;
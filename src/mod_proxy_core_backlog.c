@@ -1,109 +1,320 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "mod_proxy_core_backlog.h"
 #include "array-static.h"
+#include "status_counter.h"
+
+/* a power of 2 */
+#define PROXY_BACKLOG_BUCKETS 256
+
+static const char *wait_names[PROXY_BACKLOG_WAIT_BUCKETS] = { "0-10ms", "10-100ms", "100ms-1s", "1-10s", "10s-" };
+static const long wait_limits[PROXY_BACKLOG_WAIT_BUCKETS - 1] = { 10, 100, 1000, 10000 };
+
+static const char *depth_names[PROXY_BACKLOG_DEPTH_BUCKETS] = { "0-9", "10-99", "100-999", "1000-" };
+static const size_t depth_limits[PROXY_BACKLOG_DEPTH_BUCKETS - 1] = { 10, 100, 1000 };
 
 proxy_backlog *proxy_backlog_init(void) {
 	STRUCT_INIT(proxy_backlog, backlog);
 
+	backlog->buckets = calloc(PROXY_BACKLOG_BUCKETS, sizeof(*backlog->buckets));
+
 	return backlog;
 }
 
+static void proxy_backlog_flow_free(proxy_backlog_flow *flow) {
+	buffer_free(flow->key);
+
+	free(flow);
+}
+
 void proxy_backlog_free(proxy_backlog *backlog) {
+	size_t i;
+
 	if (!backlog) return;
 
+	for (i = 0; i < PROXY_BACKLOG_BUCKETS; i++) {
+		proxy_backlog_flow *flow, *next;
+
+		for (flow = backlog->buckets[i]; flow; flow = next) {
+			next = flow->next;
+
+			proxy_backlog_flow_free(flow);
+		}
+	}
+
+	free(backlog->buckets);
 	free(backlog);
 }
 
-int proxy_backlog_push(proxy_backlog *backlog, proxy_request *req) {
-	/* first entry */
-	if (NULL == backlog->first) {
-		backlog->first = backlog->last = req;
-	} else {
-		backlog->last->next = req;
-		backlog->last = req;
+void proxy_backlog_create_stats(proxy_backlog *backlog, buffer *basename, buffer *tmp_buf) {
+	size_t i;
+
+	for (i = 0; i < PROXY_BACKLOG_WAIT_BUCKETS; i++) {
+		buffer_copy_string_buffer(tmp_buf, basename);
+		buffer_append_string_len(tmp_buf, CONST_STR_LEN(".backlog.wait."));
+		buffer_append_string(tmp_buf, wait_names[i]);
+
+		backlog->wait_hist[i] = status_counter_get_counter(CONST_BUF_LEN(tmp_buf));
 	}
-	backlog->length++;
 
-	return 0;
+	for (i = 0; i < PROXY_BACKLOG_DEPTH_BUCKETS; i++) {
+		buffer_copy_string_buffer(tmp_buf, basename);
+		buffer_append_string_len(tmp_buf, CONST_STR_LEN(".backlog.depth."));
+		buffer_append_string(tmp_buf, depth_names[i]);
+
+		backlog->depth_hist[i] = status_counter_get_counter(CONST_BUF_LEN(tmp_buf));
+	}
+
+	buffer_copy_string_buffer(tmp_buf, basename);
+	buffer_append_string_len(tmp_buf, CONST_STR_LEN(".backlog.shed"));
+	backlog->shed = status_counter_get_counter(CONST_BUF_LEN(tmp_buf));
+}
+
+static long proxy_backlog_ms_since(struct timeval *now, struct timeval *then) {
+	return (now->tv_sec - then->tv_sec) * 1000 + (now->tv_usec - then->tv_usec) / 1000;
+}
+
+static uint32_t proxy_backlog_hash(buffer *key, int priority) {
+	return generate_crc32c(CONST_BUF_LEN(key)) + priority;
+}
+
+static proxy_backlog_flow *proxy_backlog_get_flow(proxy_backlog *backlog, buffer *key, uint32_t hash, int priority) {
+	proxy_backlog_flow *flow;
+
+	for (flow = backlog->buckets[hash & (PROXY_BACKLOG_BUCKETS - 1)]; flow; flow = flow->next) {
+		if (flow->hash == hash && flow->priority == priority && buffer_is_equal(flow->key, key)) return flow;
+	}
+
+	return NULL;
 }
 
 /**
- * remove the first element from the backlog
+ * the flow has no requests anymore, take it out of the ring and the hash
  */
-proxy_request *proxy_backlog_shift(proxy_backlog *backlog) {
-	proxy_request *req = NULL;
+static void proxy_backlog_flow_remove(proxy_backlog *backlog, proxy_backlog_flow *flow) {
+	proxy_backlog_class *class = &(backlog->classes[flow->priority]);
+	proxy_backlog_flow **pf;
 
-	if (!backlog->first) return req;
+	if (flow->rr_next == flow) {
+		class->current = NULL;
+	} else {
+		flow->rr_prev->rr_next = flow->rr_next;
+		flow->rr_next->rr_prev = flow->rr_prev;
 
-	backlog->length--;
+		if (class->current == flow) class->current = flow->rr_next;
+	}
+	class->flows--;
+
+	for (pf = &(backlog->buckets[flow->hash & (PROXY_BACKLOG_BUCKETS - 1)]); *pf; pf = &((*pf)->next)) {
+		if (*pf == flow) {
+			*pf = flow->next;
+			break;
+		}
+	}
+
+	proxy_backlog_flow_free(flow);
+}
 
-	req = backlog->first;
+int proxy_backlog_push(proxy_backlog *backlog, proxy_request *req, buffer *key, int priority, int at_front) {
+	uint32_t hash;
+	proxy_backlog_flow *flow;
+	proxy_backlog_class *class;
+	size_t i;
+
+	if (priority < 0) priority = 0;
+	if (priority >= PROXY_BACKLOG_PRIORITIES) priority = PROXY_BACKLOG_PRIORITIES - 1;
+
+	class = &(backlog->classes[priority]);
+	hash = proxy_backlog_hash(key, priority);
+
+	if (NULL == (flow = proxy_backlog_get_flow(backlog, key, hash, priority))) {
+		size_t ndx = hash & (PROXY_BACKLOG_BUCKETS - 1);
+
+		flow = calloc(1, sizeof(*flow));
+		flow->key = buffer_init_buffer(key);
+		flow->hash = hash;
+		flow->priority = priority;
+
+		flow->next = backlog->buckets[ndx];
+		backlog->buckets[ndx] = flow;
+
+		/* a new flow gets its turn after the current one */
+		if (class->current) {
+			flow->rr_prev = class->current->rr_prev;
+			flow->rr_next = class->current;
+			flow->rr_prev->rr_next = flow;
+			class->current->rr_prev = flow;
+		} else {
+			flow->rr_prev = flow->rr_next = flow;
+			class->current = flow;
+		}
+		class->flows++;
+	}
 
-	backlog->first = req->next;
+	for (i = 0; i < PROXY_BACKLOG_DEPTH_BUCKETS - 1 && backlog->length >= depth_limits[i]; i++);
+	COUNTER_INC(backlog->depth_hist[i]);
 
-	/* the backlog is empty */
-	if (backlog->first == NULL) backlog->last = NULL;
+	gettimeofday(&(req->added_tv), NULL);
 
-	return req;
-}
+	/* the time till the next shift is measured from now on */
+	if (backlog->length == 0) backlog->last_shift_tv = req->added_tv;
 
-int proxy_backlog_remove_connection(proxy_backlog *backlog, void *con) {
-	proxy_request *req = NULL;
+	req->flow = flow;
 
-	if (!backlog->first) return -1;
-	if (!con) return -1;
+	if (at_front) {
+		req->prev = NULL;
+		req->next = flow->first;
 
-	/* the first element is what we look for */
-	if (backlog->first->con == con) {
-		req = backlog->first;
+		if (flow->first) {
+			flow->first->prev = req;
+		} else {
+			flow->last = req;
+		}
+		flow->first = req;
 
-		backlog->first = req->next;
-		if (backlog->first == NULL) backlog->last = NULL;
+		/* ... and the turn it had */
+		class->current = flow;
+	} else {
+		req->next = NULL;
+		req->prev = flow->last;
 
-		backlog->length--;
+		if (flow->last) {
+			flow->last->next = req;
+		} else {
+			flow->first = req;
+		}
+		flow->last = req;
+	}
 
-		proxy_request_free(req);
+	flow->length++;
+	class->length++;
+	backlog->length++;
 
-		return 0;
+	return 0;
+}
+
+int proxy_backlog_remove(proxy_backlog *backlog, proxy_request *req) {
+	proxy_backlog_flow *flow = req->flow;
+
+	if (!flow) return -1;
+
+	if (req->prev) {
+		req->prev->next = req->next;
+	} else {
+		flow->first = req->next;
 	}
 
+	if (req->next) {
+		req->next->prev = req->prev;
+	} else {
+		flow->last = req->prev;
+	}
 
-	for (req = backlog->first; req && req->next; req = req->next) {
-		proxy_request *cur;
+	req->flow = NULL;
+	req->prev = req->next = NULL;
 
-		if (req->next->con != con) continue;
+	flow->length--;
+	backlog->classes[flow->priority].length--;
+	backlog->length--;
 
-		backlog->length--;
-		/* the next node is our searched connection */
+	if (flow->length == 0) proxy_backlog_flow_remove(backlog, flow);
 
-		cur = req->next;
-		req->next = cur->next;
+	return 0;
+}
 
-		/* the next node is the last one, make the current the new last */
-		if (cur == backlog->last) {
-			backlog->last = req;
+/**
+ * remove the next element from the backlog
+ */
+proxy_request *proxy_backlog_shift(proxy_backlog *backlog) {
+	proxy_backlog_class *class = NULL;
+	proxy_request *req;
+	struct timeval now;
+	long waited;
+	size_t i;
+
+	for (i = 0; i < PROXY_BACKLOG_PRIORITIES; i++) {
+		if (backlog->classes[i].length) {
+			class = &(backlog->classes[i]);
+			break;
 		}
-		cur->next = NULL;
+	}
 
-		proxy_request_free(cur);
+	if (!class) return NULL;
 
-		return 0;
-	}
+	req = class->current->first;
 
-	return -1;
-}
+	/* the next flow has its turn */
+	class->current = class->current->rr_next;
 
-proxy_request *proxy_request_init(void) {
-	STRUCT_INIT(proxy_request, request);
+	proxy_backlog_remove(backlog, req);
 
-	return request;
+	gettimeofday(&now, NULL);
+
+	waited = proxy_backlog_ms_since(&now, &(req->added_tv));
+	for (i = 0; i < PROXY_BACKLOG_WAIT_BUCKETS - 1 && waited >= wait_limits[i]; i++);
+	COUNTER_INC(backlog->wait_hist[i]);
+
+	/* a moving average over the last ~8 shifts */
+	backlog->avg_shift_interval = (backlog->avg_shift_interval * 7 + proxy_backlog_ms_since(&now, &(backlog->last_shift_tv))) / 8;
+	backlog->last_shift_tv = now;
+
+	return req;
 }
 
-void proxy_request_free(proxy_request *request) {
-	if (!request) return;
+long proxy_backlog_expected_wait(proxy_backlog *backlog, buffer *key, int priority) {
+	proxy_backlog_flow *flow;
+	proxy_backlog_class *class;
+	size_t ahead = 0, turns;
+	int i;
+
+	if (priority < 0) priority = 0;
+	if (priority >= PROXY_BACKLOG_PRIORITIES) priority = PROXY_BACKLOG_PRIORITIES - 1;
 
-	free(request);
+	for (i = 0; i < priority; i++) {
+		ahead += backlog->classes[i].length;
+	}
+
+	/* each flow of our class gets a turn before each of our requests */
+	class = &(backlog->classes[priority]);
+	flow = proxy_backlog_get_flow(backlog, key, proxy_backlog_hash(key, priority), priority);
+
+	turns = (flow ? flow->length : 0) + 1;
+	ahead += class->length < class->flows * turns ? class->length : class->flows * turns;
+
+	return ahead * backlog->avg_shift_interval;
 }
 
+proxy_request *proxy_backlog_shed(proxy_backlog *backlog, time_t now) {
+	proxy_request *shed = NULL;
+	size_t i;
+
+	for (i = 0; i < PROXY_BACKLOG_PRIORITIES; i++) {
+		proxy_backlog_class *class = &(backlog->classes[i]);
+		size_t flows;
+
+		/* the flows might go away while we walk the ring */
+		for (flows = class->flows; flows > 0 && class->current; flows--) {
+			proxy_backlog_flow *flow = class->current;
+			proxy_request *req, *next;
+
+			class->current = flow->rr_next;
+
+			for (req = flow->first; req; req = next) {
+				next = req->next;
+
+				if (req->deadline_ts == 0 || req->deadline_ts > now) continue;
+
+				proxy_backlog_remove(backlog, req);
+
+				req->next = shed;
+				shed = req;
+
+				COUNTER_INC(backlog->shed);
+			}
+		}
+	}
+
+	return shed;
+}
 
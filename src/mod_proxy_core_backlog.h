@@ -8,54 +8,128 @@
 #include <time.h>
 #endif
 
+#include "buffer.h"
+#include "array.h"
+#include "crc32.h"
+
+/* 0 is served first */
+#define PROXY_BACKLOG_PRIORITIES 4
+
+#define PROXY_BACKLOG_WAIT_BUCKETS 5
+#define PROXY_BACKLOG_DEPTH_BUCKETS 4
+
+struct _proxy_backlog_flow;
+
+/**
+ * a queued request, it is part of the proxy-session and isn't allocated on its own
+ */
 typedef struct _proxy_request {
 	void *con; /* a pointer to the client-connection, (type: connection) */
 
 	time_t added_ts; /* when was the entry added (for timeout handling) */
+	time_t deadline_ts; /* when we give up on the request, 0 if it waits forever */
+	struct timeval added_tv; /* for the wait-time stats */
 
+	struct _proxy_backlog_flow *flow; /* NULL if the request isn't in the backlog */
+
+	struct _proxy_request *prev;
 	struct _proxy_request *next;
 } proxy_request;
 
 /**
- * a we can't get a connection from the pool, queue the request in the
- * request queue (FIFO)
+ * the requests of a client or a host in a priority class (FIFO)
+ */
+typedef struct _proxy_backlog_flow {
+	buffer *key;
+	uint32_t hash;
+	int priority;
+
+	proxy_request *first;
+	proxy_request *last;
+	size_t length;
+
+	struct _proxy_backlog_flow *next;    /* in the hash-bucket */
+	struct _proxy_backlog_flow *rr_prev; /* the flows of a class form a ring */
+	struct _proxy_backlog_flow *rr_next;
+} proxy_backlog_flow;
+
+typedef struct {
+	proxy_backlog_flow *current; /* the flow which gets the next turn */
+
+	size_t flows;
+	size_t length;
+} proxy_backlog_class;
+
+/**
+ * if we can't get a connection from the pool, queue the request in the
+ * backlog
  *
- * - the queue is infinite
- * - entries are removed after a timeout (status 504)
+ * - the classes are served by priority
+ * - the flows of a class take turns one request at a time (round robin),
+ *   a client with many requests can't starve the others
+ * - a flow is FIFO
+ * - removing a request is O(1)
+ * - entries are removed after a timeout (status 504) or if they would miss
+ *   their deadline (status 503)
  */
 typedef struct {
-	proxy_request *first; /* pull() does q->first = q->first->next */
-	proxy_request *last; /* push() does q->last = r */
+	proxy_backlog_class classes[PROXY_BACKLOG_PRIORITIES];
+	proxy_backlog_flow **buckets;
 
 	size_t length;
+
+	struct timeval last_shift_tv;
+	long avg_shift_interval; /* the ms between two requests leaving the backlog */
+
+	data_integer *wait_hist[PROXY_BACKLOG_WAIT_BUCKETS];
+	data_integer *depth_hist[PROXY_BACKLOG_DEPTH_BUCKETS];
+	data_integer *shed;
 } proxy_backlog;
 
 proxy_backlog *proxy_backlog_init(void);
 void proxy_backlog_free(proxy_backlog *backlog);
 
 /**
- * append a request to the end
+ * register the wait-time and depth histograms as <basename>.backlog.*
+ */
+void proxy_backlog_create_stats(proxy_backlog *backlog, buffer *basename, buffer *tmp_buf);
+
+/**
+ * append a request to the end of its flow
  *
- * @return 0 in success, -1 if full
+ * @param key the client or the host the request is fair to, empty for a plain FIFO
+ * @param at_front a request which was woken up too early keeps its place in the flow
+ * @return 0 in success
  */
-int proxy_backlog_push(proxy_backlog *backlog, proxy_request *req);
+int proxy_backlog_push(proxy_backlog *backlog, proxy_request *req, buffer *key, int priority, int at_front);
 
 /**
- * remove the first request from the backlog
+ * remove the next request from the backlog
  *
  * @return NULL if backlog is empty, the request otherwise
  */
 proxy_request *proxy_backlog_shift(proxy_backlog *backlog);
+
 /**
- * remove the request with the connection 'con' from the backlog
+ * remove the request from the backlog
  *
- * @return -1 if not found, 0 otherwise
+ * @return -1 if it isn't queued, 0 otherwise
  */
-int proxy_backlog_remove_connection(proxy_backlog *backlog, void *con);
+int proxy_backlog_remove(proxy_backlog *backlog, proxy_request *req);
 
-proxy_request *proxy_request_init(void);
-void proxy_request_free(proxy_request *req);
+/**
+ * guess how long a new request for the flow would wait
+ *
+ * @return the wait in ms, 0 if we don't know it yet
+ */
+long proxy_backlog_expected_wait(proxy_backlog *backlog, buffer *key, int priority);
 
-#endif
+/**
+ * remove the requests which passed their deadline
+ *
+ * @return the removed requests linked by ->next
+ */
+proxy_request *proxy_backlog_shed(proxy_backlog *backlog, time_t now);
 
+#endif
 
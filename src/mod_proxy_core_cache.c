@@ -0,0 +1,606 @@
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "log.h"
+#include "crc32.h"
+#include "joblist.h"
+#include "status_counter.h"
+#include "sys-files.h"
+#include "sys-strings.h"
+#include "mod_proxy_core_cache.h"
+
+/* a power of 2 */
+#define PROXY_CACHE_BUCKETS 1024
+
+/* larger responses go to the cache-dir */
+#define PROXY_CACHE_MEM_OBJECT_MAX (64 * 1024)
+
+/* what an entry costs without its content */
+#define PROXY_CACHE_ENTRY_OVERHEAD(e) ((off_t)(sizeof(proxy_cache_entry) + (e)->key->size))
+
+proxy_cache *proxy_cache_init(void) {
+	STRUCT_INIT(proxy_cache, cache);
+
+	cache->buckets = calloc(PROXY_CACHE_BUCKETS, sizeof(*cache->buckets));
+	cache->dir = buffer_init();
+
+	cache->objects_counter = status_counter_get_counter(CONST_STR_LEN("proxy-core.cache.objects"));
+	cache->memory_used_counter = status_counter_get_counter(CONST_STR_LEN("proxy-core.cache.memory_used"));
+	cache->disk_used_counter = status_counter_get_counter(CONST_STR_LEN("proxy-core.cache.disk_used"));
+
+	return cache;
+}
+
+static proxy_cache_entry *proxy_cache_entry_init(void) {
+	STRUCT_INIT(proxy_cache_entry, entry);
+
+	entry->key = buffer_init();
+	entry->headers = array_init();
+	entry->vary = array_init();
+	entry->etag = buffer_init();
+	entry->last_modified = buffer_init();
+	entry->content = buffer_init();
+	entry->path = buffer_init();
+	entry->fd = -1;
+
+	entry->waiters = calloc(1, sizeof(*entry->waiters));
+
+	return entry;
+}
+
+/**
+ * drop the content, the cache-file is unlinked
+ */
+static void proxy_cache_entry_drop_content(proxy_cache_entry *entry) {
+	if (entry->fd != -1) {
+		close(entry->fd);
+		entry->fd = -1;
+	}
+
+	if (!buffer_is_empty(entry->path)) {
+		unlink(entry->path->ptr);
+		buffer_reset(entry->path);
+	}
+
+	/* don't keep the memory of a large response around */
+	buffer_free(entry->content);
+	entry->content = buffer_init();
+
+	entry->size = 0;
+}
+
+static void proxy_cache_entry_free(proxy_cache_entry *entry) {
+	if (!entry) return;
+
+	proxy_cache_entry_drop_content(entry);
+
+	buffer_free(entry->key);
+	array_free(entry->headers);
+	array_free(entry->vary);
+	buffer_free(entry->etag);
+	buffer_free(entry->last_modified);
+	buffer_free(entry->content);
+	buffer_free(entry->path);
+
+	if (entry->waiters->ptr) free(entry->waiters->ptr);
+	free(entry->waiters);
+
+	free(entry);
+}
+
+void proxy_cache_free(proxy_cache *cache) {
+	size_t i;
+
+	if (!cache) return;
+
+	for (i = 0; i < PROXY_CACHE_BUCKETS; i++) {
+		proxy_cache_entry *entry, *next;
+
+		for (entry = cache->buckets[i]; entry; entry = next) {
+			next = entry->next;
+
+			proxy_cache_entry_free(entry);
+		}
+	}
+
+	free(cache->buckets);
+	buffer_free(cache->dir);
+
+	free(cache);
+}
+
+static void proxy_cache_update_counters(proxy_cache *cache) {
+	COUNTER_SET(cache->memory_used_counter, cache->mem_used / 1024);
+	COUNTER_SET(cache->disk_used_counter, cache->disk_used / 1024);
+}
+
+static void proxy_cache_lru_unlink(proxy_cache *cache, proxy_cache_entry *entry) {
+	if (entry->lru_prev) {
+		entry->lru_prev->lru_next = entry->lru_next;
+	} else {
+		cache->lru_first = entry->lru_next;
+	}
+
+	if (entry->lru_next) {
+		entry->lru_next->lru_prev = entry->lru_prev;
+	} else {
+		cache->lru_last = entry->lru_prev;
+	}
+
+	entry->lru_prev = NULL;
+	entry->lru_next = NULL;
+}
+
+static void proxy_cache_lru_push(proxy_cache *cache, proxy_cache_entry *entry) {
+	entry->lru_prev = NULL;
+	entry->lru_next = cache->lru_first;
+
+	if (cache->lru_first) {
+		cache->lru_first->lru_prev = entry;
+	} else {
+		cache->lru_last = entry;
+	}
+
+	cache->lru_first = entry;
+}
+
+void proxy_cache_remove(proxy_cache *cache, proxy_cache_entry *entry) {
+	proxy_cache_entry **pe;
+
+	if (entry->is_dead) return;
+
+	for (pe = &(cache->buckets[entry->hash & (PROXY_CACHE_BUCKETS - 1)]); *pe; pe = &((*pe)->next)) {
+		if (*pe == entry) {
+			*pe = entry->next;
+			break;
+		}
+	}
+	entry->next = NULL;
+
+	proxy_cache_lru_unlink(cache, entry);
+
+	cache->mem_used -= PROXY_CACHE_ENTRY_OVERHEAD(entry);
+
+	/* only complete entries are accounted with their content */
+	if (entry->state == PROXY_CACHE_ENTRY_COMPLETE) {
+		if (buffer_is_empty(entry->path)) {
+			cache->mem_used -= entry->size;
+		} else {
+			cache->disk_used -= entry->size;
+		}
+	}
+
+	COUNTER_DEC(cache->objects_counter);
+	proxy_cache_update_counters(cache);
+
+	entry->is_dead = 1;
+
+	if (entry->refcount == 0) proxy_cache_entry_free(entry);
+}
+
+void proxy_cache_entry_ref(proxy_cache_entry *entry) {
+	entry->refcount++;
+}
+
+void proxy_cache_entry_release(proxy_cache *cache, proxy_cache_entry *entry) {
+	UNUSED(cache);
+
+	if (--entry->refcount > 0) return;
+
+	if (entry->is_dead) proxy_cache_entry_free(entry);
+}
+
+/**
+ * make room, the entries in use stay
+ */
+static void proxy_cache_evict(proxy_cache *cache) {
+	proxy_cache_entry *entry, *prev;
+
+	for (entry = cache->lru_last;
+	     entry && (cache->mem_used > cache->mem_max || cache->disk_used > cache->disk_max);
+	     entry = prev) {
+		prev = entry->lru_prev;
+
+		if (entry->refcount > 0) continue;
+
+		/* the small entries don't help if only the disk is full */
+		if (cache->mem_used > cache->mem_max || !buffer_is_empty(entry->path)) {
+			proxy_cache_remove(cache, entry);
+		}
+	}
+}
+
+static int proxy_cache_entry_matches(proxy_cache_entry *entry, array *request_headers) {
+	size_t i;
+
+	for (i = 0; i < entry->vary->used; i++) {
+		data_string *ds = (data_string *)entry->vary->data[i];
+		data_string *req = (data_string *)array_get_element(request_headers, CONST_BUF_LEN(ds->key));
+
+		if (req == NULL || req->value->used <= 1) {
+			/* the header wasn't set for the stored variant either */
+			if (ds->value->used > 1) return 0;
+		} else if (!buffer_is_equal(req->value, ds->value)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int proxy_cache_vary_is_equal(array *a, array *b) {
+	size_t i;
+
+	if (a->used != b->used) return 0;
+
+	for (i = 0; i < a->used; i++) {
+		data_string *ds_a = (data_string *)a->data[i];
+		data_string *ds_b = (data_string *)array_get_element(b, CONST_BUF_LEN(ds_a->key));
+
+		if (!ds_b || !buffer_is_equal(ds_a->value, ds_b->value)) return 0;
+	}
+
+	return 1;
+}
+
+proxy_cache_entry *proxy_cache_lookup(proxy_cache *cache, buffer *key, array *request_headers, time_t now) {
+	uint32_t hash = generate_crc32c(CONST_BUF_LEN(key));
+	proxy_cache_entry *entry, *pending = NULL;
+
+	for (entry = cache->buckets[hash & (PROXY_CACHE_BUCKETS - 1)]; entry; entry = entry->next) {
+		if (entry->hash != hash || !buffer_is_equal(entry->key, key)) continue;
+
+		switch (entry->state) {
+		case PROXY_CACHE_ENTRY_COMPLETE:
+			if (!proxy_cache_entry_matches(entry, request_headers)) break;
+
+			proxy_cache_lru_unlink(cache, entry);
+			proxy_cache_lru_push(cache, entry);
+
+			return entry;
+		case PROXY_CACHE_ENTRY_PASS:
+			if (entry->expires_ts > now) return entry;
+			break;
+		case PROXY_CACHE_ENTRY_FILLING:
+			/* we don't know the variant yet */
+			pending = entry;
+			break;
+		}
+	}
+
+	return pending;
+}
+
+proxy_cache_entry *proxy_cache_insert(proxy_cache *cache, buffer *key) {
+	proxy_cache_entry *entry = proxy_cache_entry_init();
+	size_t ndx;
+
+	buffer_copy_string_buffer(entry->key, key);
+	entry->hash = generate_crc32c(CONST_BUF_LEN(key));
+	entry->state = PROXY_CACHE_ENTRY_FILLING;
+	entry->refcount = 1;
+
+	ndx = entry->hash & (PROXY_CACHE_BUCKETS - 1);
+	entry->next = cache->buckets[ndx];
+	cache->buckets[ndx] = entry;
+
+	proxy_cache_lru_push(cache, entry);
+
+	cache->mem_used += PROXY_CACHE_ENTRY_OVERHEAD(entry);
+	COUNTER_INC(cache->objects_counter);
+
+	proxy_cache_evict(cache);
+	proxy_cache_update_counters(cache);
+
+	return entry;
+}
+
+void proxy_cache_entry_add_waiter(proxy_cache_entry *entry, void *con) {
+	proxy_cache_waiters *waiters = entry->waiters;
+
+	ARRAY_STATIC_PREPARE_APPEND(waiters);
+
+	waiters->ptr[waiters->used++] = con;
+}
+
+void proxy_cache_entry_remove_waiter(proxy_cache_entry *entry, void *con) {
+	proxy_cache_waiters *waiters = entry->waiters;
+	size_t i;
+
+	for (i = 0; i < waiters->used; i++) {
+		if (waiters->ptr[i] != con) continue;
+
+		waiters->ptr[i] = waiters->ptr[--waiters->used];
+		break;
+	}
+}
+
+void proxy_cache_entry_wakeup(server *srv, proxy_cache_entry *entry) {
+	size_t i;
+
+	for (i = 0; i < entry->waiters->used; i++) {
+		joblist_append(srv, entry->waiters->ptr[i]);
+	}
+
+	entry->waiters->used = 0;
+}
+
+int proxy_cache_control_get(buffer *cc, const char *name, size_t name_len, long *value) {
+	const char *s = BUF_STR(cc);
+
+	while (*s) {
+		size_t len;
+
+		s += strspn(s, " \t,");
+		len = strcspn(s, " \t,=");
+
+		if (len == 0) break;
+
+		if (len == name_len && 0 == strncasecmp(s, name, name_len)) {
+			s += len;
+			s += strspn(s, " \t");
+
+			*value = -1;
+
+			if (*s == '=') {
+				s++;
+				if (*s == '"') s++;
+				if (*s >= '0' && *s <= '9') *value = strtol(s, NULL, 10);
+			}
+
+			return 1;
+		}
+
+		s += len;
+		s += strspn(s, " \t");
+
+		/* a quoted value might contain a , */
+		if (*s == '=') {
+			s++;
+			if (*s == '"' && NULL == (s = strchr(s + 1, '"'))) return 0;
+		}
+
+		s += strcspn(s, ",");
+	}
+
+	return 0;
+}
+
+#ifdef HAVE_STRPTIME
+/**
+ * parse a HTTP date
+ *
+ * mktime() takes the local time, as long as we only take differences
+ * of the results the offset doesn't matter
+ */
+static time_t proxy_cache_parse_date(buffer *date) {
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+
+	if (NULL == strptime(BUF_STR(date), "%a, %d %b %Y %H:%M:%S GMT", &tm)) return -1;
+
+	tm.tm_isdst = 0;
+
+	return mktime(&tm);
+}
+#endif
+
+time_t proxy_cache_response_ttl(array *response_headers, time_t now) {
+	data_string *ds;
+	long value;
+
+	/* a response for someone else */
+	if (array_get_element(response_headers, CONST_STR_LEN("Set-Cookie"))) return -1;
+
+	if (NULL != (ds = (data_string *)array_get_element(response_headers, CONST_STR_LEN("Cache-Control")))) {
+		if (proxy_cache_control_get(ds->value, CONST_STR_LEN("no-store"), &value) ||
+		    proxy_cache_control_get(ds->value, CONST_STR_LEN("no-cache"), &value) ||
+		    proxy_cache_control_get(ds->value, CONST_STR_LEN("private"), &value)) {
+			return -1;
+		}
+
+		if (proxy_cache_control_get(ds->value, CONST_STR_LEN("s-maxage"), &value) ||
+		    proxy_cache_control_get(ds->value, CONST_STR_LEN("max-age"), &value)) {
+			return value;
+		}
+	}
+
+#ifdef HAVE_STRPTIME
+	if (NULL != (ds = (data_string *)array_get_element(response_headers, CONST_STR_LEN("Expires")))) {
+		time_t expires, date = -1;
+		data_string *ds_date;
+
+		/* invalid dates like "0" mean: already expired */
+		if (-1 == (expires = proxy_cache_parse_date(ds->value))) return 0;
+
+		if (NULL != (ds_date = (data_string *)array_get_element(response_headers, CONST_STR_LEN("Date")))) {
+			date = proxy_cache_parse_date(ds_date->value);
+		}
+
+		if (date == -1) {
+			struct tm tm = *gmtime(&now);
+
+			tm.tm_isdst = 0;
+			date = mktime(&tm);
+		}
+
+		return expires > date ? expires - date : 0;
+	}
+#else
+	UNUSED(now);
+#endif
+
+	/* no explicit freshness, we don't guess */
+	return -1;
+}
+
+int proxy_cache_entry_set_vary(proxy_cache_entry *entry, array *response_headers, array *request_headers) {
+	data_string *ds;
+	const char *s;
+
+	array_reset(entry->vary);
+
+	if (NULL == (ds = (data_string *)array_get_element(response_headers, CONST_STR_LEN("Vary")))) return 0;
+
+	for (s = BUF_STR(ds->value); *s; ) {
+		data_string *req;
+		size_t len;
+
+		s += strspn(s, " \t,");
+		len = strcspn(s, " \t,");
+
+		if (len == 0) break;
+
+		if (len == 1 && *s == '*') return -1;
+
+		req = (data_string *)array_get_element(request_headers, s, len);
+
+		if (req) {
+			array_set_key_value(entry->vary, s, len, CONST_BUF_LEN(req->value));
+		} else {
+			array_set_key_value(entry->vary, s, len, CONST_STR_LEN(""));
+		}
+
+		s += len;
+	}
+
+	return 0;
+}
+
+static int proxy_cache_write(int fd, const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t r;
+
+		if (-1 == (r = write(fd, data, len))) {
+			if (errno == EINTR) continue;
+
+			return -1;
+		}
+
+		data += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+int proxy_cache_entry_append(proxy_cache *cache, proxy_cache_entry *entry, const char *data, size_t len) {
+	/* a single response may take an eighth of the disk-cache */
+	off_t max_size = buffer_is_empty(cache->dir) ? PROXY_CACHE_MEM_OBJECT_MAX : cache->disk_max / 8;
+
+	if (entry->size + (off_t)len > max_size) return -1;
+
+	if (entry->fd == -1 && entry->size + len <= PROXY_CACHE_MEM_OBJECT_MAX) {
+		buffer_append_string_len(entry->content, data, len);
+		entry->size += len;
+
+		return 0;
+	}
+
+	if (entry->fd == -1) {
+		/* too large for the memory, move it into a file */
+		buffer_copy_string_buffer(entry->path, cache->dir);
+		PATHNAME_APPEND_SLASH(entry->path);
+		buffer_append_string_len(entry->path, CONST_STR_LEN("lighttpd-cache-XXXXXX"));
+
+		if (-1 == (entry->fd = mkstemp(entry->path->ptr))) {
+			ERROR("creating the cache-file %s failed: %s", SAFE_BUF_STR(entry->path), strerror(errno));
+			buffer_reset(entry->path);
+
+			return -1;
+		}
+#ifdef FD_CLOEXEC
+		fcntl(entry->fd, F_SETFD, FD_CLOEXEC);
+#endif
+
+		if (0 != proxy_cache_write(entry->fd, entry->content->ptr, entry->size)) {
+			ERROR("writing the cache-file %s failed: %s", SAFE_BUF_STR(entry->path), strerror(errno));
+
+			return -1;
+		}
+
+		buffer_free(entry->content);
+		entry->content = buffer_init();
+	}
+
+	if (0 != proxy_cache_write(entry->fd, data, len)) {
+		ERROR("writing the cache-file %s failed: %s", SAFE_BUF_STR(entry->path), strerror(errno));
+
+		return -1;
+	}
+
+	entry->size += len;
+
+	return 0;
+}
+
+/**
+ * remove the other entries of the key which are replaced by the entry
+ *
+ * @param all_variants remove all the variants, not only the one of the entry
+ */
+static void proxy_cache_remove_others(proxy_cache *cache, proxy_cache_entry *entry, int all_variants) {
+	proxy_cache_entry *e, *next;
+
+	for (e = cache->buckets[entry->hash & (PROXY_CACHE_BUCKETS - 1)]; e; e = next) {
+		next = e->next;
+
+		if (e == entry || e->hash != entry->hash || !buffer_is_equal(e->key, entry->key)) continue;
+
+		switch (e->state) {
+		case PROXY_CACHE_ENTRY_PASS:
+			proxy_cache_remove(cache, e);
+			break;
+		case PROXY_CACHE_ENTRY_COMPLETE:
+			if (all_variants || proxy_cache_vary_is_equal(e->vary, entry->vary)) {
+				proxy_cache_remove(cache, e);
+			}
+			break;
+		case PROXY_CACHE_ENTRY_FILLING:
+			break;
+		}
+	}
+}
+
+void proxy_cache_entry_finish(proxy_cache *cache, proxy_cache_entry *entry) {
+	if (entry->fd != -1) {
+		close(entry->fd);
+		entry->fd = -1;
+	}
+
+	entry->state = PROXY_CACHE_ENTRY_COMPLETE;
+
+	if (entry->is_dead) return;
+
+	if (buffer_is_empty(entry->path)) {
+		cache->mem_used += entry->size;
+	} else {
+		cache->disk_used += entry->size;
+	}
+
+	proxy_cache_remove_others(cache, entry, 0);
+
+	proxy_cache_evict(cache);
+	proxy_cache_update_counters(cache);
+}
+
+void proxy_cache_entry_pass(proxy_cache *cache, proxy_cache_entry *entry, time_t until) {
+	proxy_cache_entry_drop_content(entry);
+
+	array_reset(entry->headers);
+	array_reset(entry->vary);
+
+	entry->state = PROXY_CACHE_ENTRY_PASS;
+	entry->expires_ts = until;
+
+	if (entry->is_dead) return;
+
+	/* the resource isn't cacheable anymore */
+	proxy_cache_remove_others(cache, entry, 1);
+}
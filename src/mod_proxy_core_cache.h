@@ -0,0 +1,152 @@
+#ifndef _MOD_PROXY_CORE_CACHE_H_
+#define _MOD_PROXY_CORE_CACHE_H_
+
+#include <sys/types.h>
+
+#include "base.h"
+#include "buffer.h"
+#include "array.h"
+#include "array-static.h"
+
+/**
+ * a cache for the responses of the backends
+ *
+ * The entries are hashed by host and uri, the variants of a resource
+ * (Vary) share the key. Small responses are kept in memory, the large
+ * ones are written to files in the cache-dir and sent with sendfile().
+ *
+ * Each worker has its own cache, the limits apply per worker.
+ */
+
+typedef enum {
+	PROXY_CACHE_ENTRY_FILLING,  /* the first request for it is on its way to the backend */
+	PROXY_CACHE_ENTRY_COMPLETE,
+	PROXY_CACHE_ENTRY_PASS      /* the response wasn't cacheable, don't wait for it for a while */
+} proxy_cache_entry_state_t;
+
+ARRAY_STATIC_DEF(proxy_cache_waiters, void, );
+
+typedef struct proxy_cache_entry {
+	buffer *key;
+	uint32_t hash;
+
+	proxy_cache_entry_state_t state;
+	int is_revalidating;   /* a request asks the backend if the stale entry is still valid */
+	int is_dead;           /* removed from the cache, freed as soon as the last user is done */
+	int refcount;
+
+	int status;
+	array *headers;        /* the response headers */
+	array *vary;           /* the request headers and the values the variant was stored for */
+	buffer *etag;
+	buffer *last_modified;
+
+	buffer *content;       /* small responses */
+	buffer *path;          /* large responses, in the cache-dir */
+	int fd;                /* the file while it is written */
+	off_t size;
+
+	time_t stored_ts;
+	time_t expires_ts;
+
+	proxy_cache_waiters *waiters; /* the connections which wait for the entry (type: connection) */
+
+	struct proxy_cache_entry *next;      /* in the hash-bucket */
+	struct proxy_cache_entry *lru_prev;  /* towards the most recently used */
+	struct proxy_cache_entry *lru_next;
+} proxy_cache_entry;
+
+typedef struct {
+	proxy_cache_entry **buckets;
+	proxy_cache_entry *lru_first;
+	proxy_cache_entry *lru_last;
+
+	off_t mem_used;
+	off_t mem_max;
+	off_t disk_used;
+	off_t disk_max;
+
+	buffer *dir;           /* where the large responses go, empty if they aren't cached */
+
+	data_integer *objects_counter;
+	data_integer *memory_used_counter; /* in kbyte */
+	data_integer *disk_used_counter;   /* in kbyte */
+} proxy_cache;
+
+proxy_cache *proxy_cache_init(void);
+void proxy_cache_free(proxy_cache *cache);
+
+/**
+ * find the entry for the request
+ *
+ * a variant which matches the request headers is preferred, an entry
+ * which is filled or revalidated right now is returned otherwise
+ *
+ * @return NULL if there is no entry for the key
+ */
+proxy_cache_entry *proxy_cache_lookup(proxy_cache *cache, buffer *key, array *request_headers, time_t now);
+
+/**
+ * add a FILLING entry for the key, the caller holds a reference
+ */
+proxy_cache_entry *proxy_cache_insert(proxy_cache *cache, buffer *key);
+
+/**
+ * take the entry out of the cache, it is freed when the last reference is gone
+ */
+void proxy_cache_remove(proxy_cache *cache, proxy_cache_entry *entry);
+
+void proxy_cache_entry_ref(proxy_cache_entry *entry);
+void proxy_cache_entry_release(proxy_cache *cache, proxy_cache_entry *entry);
+
+/**
+ * the request has to wait until the entry is filled or revalidated
+ */
+void proxy_cache_entry_add_waiter(proxy_cache_entry *entry, void *con);
+void proxy_cache_entry_remove_waiter(proxy_cache_entry *entry, void *con);
+
+/**
+ * let the waiting connections look the entry up again
+ */
+void proxy_cache_entry_wakeup(server *srv, proxy_cache_entry *entry);
+
+/**
+ * find a directive in a Cache-Control header like "public, max-age=600"
+ *
+ * @param value the numeric value of the directive, -1 if it has none
+ * @return 1 if the directive is set
+ */
+int proxy_cache_control_get(buffer *cc, const char *name, size_t name_len, long *value);
+
+/**
+ * parse the freshness of a response from Cache-Control, Expires and Date
+ *
+ * @return the seconds the response is fresh, -1 if it may not be cached
+ */
+time_t proxy_cache_response_ttl(array *response_headers, time_t now);
+
+/**
+ * remember the request headers named in Vary
+ *
+ * @return -1 if the response varies on everything (Vary: *)
+ */
+int proxy_cache_entry_set_vary(proxy_cache_entry *entry, array *response_headers, array *request_headers);
+
+/**
+ * append response content to a FILLING entry
+ *
+ * @return -1 if the entry got too large or the cache-file couldn't be written
+ */
+int proxy_cache_entry_append(proxy_cache *cache, proxy_cache_entry *entry, const char *data, size_t len);
+
+/**
+ * the content is complete, replace the older variants and make room for it
+ */
+void proxy_cache_entry_finish(proxy_cache *cache, proxy_cache_entry *entry);
+
+/**
+ * the response isn't cacheable, turn the entry into a marker to not wait for it until 'until'
+ */
+void proxy_cache_entry_pass(proxy_cache *cache, proxy_cache_entry *entry, time_t until);
+
+#endif
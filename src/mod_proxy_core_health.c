@@ -0,0 +1,357 @@
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include "log.h"
+#include "fdevent.h"
+#include "fastcgi.h"
+#include "status_counter.h"
+#include "array-static.h"
+#include "mod_proxy_core.h"
+#include "mod_proxy_core_protocol.h"
+#include "mod_proxy_core_health.h"
+
+#include "sys-files.h"
+#include "sys-socket.h"
+
+/* a probe which takes longer than this failed */
+#define PROXY_PROBE_TIMEOUT 5
+
+typedef enum {
+	PROXY_PROBE_CONNECT, /* connect() is enough */
+	PROXY_PROBE_HTTP,
+	PROXY_PROBE_FASTCGI
+} proxy_probe_t;
+
+static proxy_probe_t proxy_probe_get_type(proxy_backend *backend) {
+	if (!backend->protocol) return PROXY_PROBE_CONNECT;
+
+	if (buffer_is_equal_string(backend->protocol->name, CONST_STR_LEN("http"))) return PROXY_PROBE_HTTP;
+	if (buffer_is_equal_string(backend->protocol->name, CONST_STR_LEN("fastcgi"))) return PROXY_PROBE_FASTCGI;
+
+	return PROXY_PROBE_CONNECT;
+}
+
+static proxy_probe *proxy_probe_init(void) {
+	STRUCT_INIT(proxy_probe, probe);
+
+	probe->sock = iosocket_init();
+	probe->buf = buffer_init();
+
+	return probe;
+}
+
+static void proxy_probe_free(server *srv, proxy_probe *probe) {
+	if (!probe) return;
+
+	if (probe->sock->fd != -1) {
+		fdevent_event_del(srv->ev, probe->sock);
+		fdevent_unregister(srv->ev, probe->sock);
+	}
+
+	iosocket_free(probe->sock);
+	buffer_free(probe->buf);
+
+	free(probe);
+}
+
+void proxy_health_check_create_stats(proxy_backend *backend, proxy_address *address, buffer *tmp_buf) {
+#define COUNTER_NAME(b, x) \
+	buffer_copy_string_buffer(b, backend->stat_basename); \
+	buffer_append_string_len(b, CONST_STR_LEN("addresses.\"")); \
+	buffer_append_string_buffer(b, address->name); \
+	buffer_append_string_len(b, CONST_STR_LEN("\"." x));
+
+	COUNTER_NAME(tmp_buf, "healthy");
+	address->healthy = status_counter_get_counter(CONST_BUF_LEN(tmp_buf));
+
+	COUNTER_NAME(tmp_buf, "probe_ms");
+	address->probe_ms = status_counter_get_counter(CONST_BUF_LEN(tmp_buf));
+
+	COUNTER_NAME(tmp_buf, "transitions");
+	address->transitions = status_counter_get_counter(CONST_BUF_LEN(tmp_buf));
+#undef COUNTER_NAME
+
+	COUNTER_SET(address->healthy, address->state != PROXY_ADDRESS_STATE_DOWN);
+}
+
+/**
+ * count the result of the probe and move the address between ACTIVE and DOWN
+ */
+static void proxy_probe_done(server *srv, proxy_probe *probe, int is_ok) {
+	proxy_backend *backend = probe->backend;
+	proxy_address *address = probe->address;
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	COUNTER_SET(address->probe_ms,
+		(now.tv_sec - probe->start.tv_sec) * 1000 + (now.tv_usec - probe->start.tv_usec) / 1000);
+
+	if (is_ok) {
+		address->probe_fail = 0;
+		if (address->probe_ok < backend->health_rise) address->probe_ok++;
+	} else {
+		address->probe_ok = 0;
+		if (address->probe_fail < backend->health_fall) address->probe_fail++;
+	}
+
+	switch (address->state) {
+	case PROXY_ADDRESS_STATE_DOWN:
+		if (address->probe_ok < backend->health_rise) break;
+
+		TRACE("%s of %s passed %u health checks, enabling it",
+				SAFE_BUF_STR(address->name), SAFE_BUF_STR(backend->name), address->probe_ok);
+
+		address->state = PROXY_ADDRESS_STATE_ACTIVE;
+		if (backend->disabled_addresses) backend->disabled_addresses--;
+		if (backend->state == PROXY_BACKEND_STATE_DISABLED) backend->state = PROXY_BACKEND_STATE_ACTIVE;
+
+		COUNTER_SET(address->healthy, 1);
+		COUNTER_INC(address->transitions);
+		break;
+	case PROXY_ADDRESS_STATE_ACTIVE:
+	case PROXY_ADDRESS_STATE_DISABLED:
+		if (address->probe_fail < backend->health_fall) break;
+
+		ERROR("%s of %s failed %u health checks, disabling it",
+				SAFE_BUF_STR(address->name), SAFE_BUF_STR(backend->name), address->probe_fail);
+
+		if (address->state == PROXY_ADDRESS_STATE_ACTIVE) backend->disabled_addresses++;
+		address->state = PROXY_ADDRESS_STATE_DOWN;
+		address->disabled_until = 0;
+
+		if (backend->disabled_addresses == backend->address_pool->used) {
+			backend->state = PROXY_BACKEND_STATE_DISABLED;
+		}
+
+		COUNTER_SET(address->healthy, 0);
+		COUNTER_INC(address->transitions);
+		break;
+	default:
+		break;
+	}
+
+	address->probe = NULL;
+	address->probe_ts = srv->cur_ts + backend->health_interval;
+
+	proxy_probe_free(srv, probe);
+}
+
+/**
+ * the request of the probe, it is small enough to fit into the socket-buffer
+ */
+static void proxy_probe_prepare(proxy_probe *probe, proxy_probe_t type) {
+	proxy_backend *backend = probe->backend;
+	buffer *b = probe->buf;
+
+	buffer_reset(b);
+
+	switch (type) {
+	case PROXY_PROBE_HTTP:
+		buffer_copy_string_len(b, CONST_STR_LEN("GET "));
+		buffer_append_string_buffer(b, backend->health_uri);
+		buffer_append_string_len(b, CONST_STR_LEN(" HTTP/1.0\r\nHost: "));
+		buffer_append_string_buffer(b, backend->name);
+		buffer_append_string_len(b, CONST_STR_LEN("\r\nUser-Agent: lighttpd health-check\r\n\r\n"));
+		break;
+	case PROXY_PROBE_FASTCGI: {
+		/* ask for FCGI_MPXS_CONNS, every FastCGI app has to answer that */
+		FCGI_Header header;
+		const char nv[] = { 15, 0, 'F', 'C', 'G', 'I', '_', 'M', 'P', 'X', 'S', '_', 'C', 'O', 'N', 'N', 'S' };
+		const char padding[7] = { 0 };
+
+		memset(&header, 0, sizeof(header));
+		header.version = FCGI_VERSION_1;
+		header.type = FCGI_GET_VALUES;
+		header.contentLengthB0 = sizeof(nv);
+		header.paddingLength = sizeof(padding);
+
+		buffer_copy_string_len(b, (char *)&header, sizeof(header));
+		buffer_append_string_len(b, nv, sizeof(nv));
+		buffer_append_string_len(b, padding, sizeof(padding));
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+/**
+ * @return 1 if the response is complete and good, 0 if it is complete and bad, -1 if we need more
+ */
+static int proxy_probe_parse_response(buffer *b, proxy_probe_t type) {
+	size_t len = b->used ? b->used - 1 : 0;
+	int status;
+
+	switch (type) {
+	case PROXY_PROBE_HTTP:
+		/* HTTP/1.x 200 */
+		if (len < sizeof("HTTP/1.x 200") - 1) return -1;
+
+		if (0 != strncmp(b->ptr, "HTTP/1.", sizeof("HTTP/1.") - 1) || b->ptr[8] != ' ') return 0;
+
+		status = strtol(b->ptr + 9, NULL, 10);
+
+		return status >= 200 && status < 400;
+	case PROXY_PROBE_FASTCGI:
+		if (len < sizeof(FCGI_Header)) return -1;
+
+		return ((FCGI_Header *)b->ptr)->type == FCGI_GET_VALUES_RESULT;
+	default:
+		return 1;
+	}
+}
+
+static handler_t proxy_probe_handle_fdevent(void *s, void *ctx, int revents) {
+	server *srv = (server *)s;
+	proxy_probe *probe = ctx;
+	proxy_probe_t type = proxy_probe_get_type(probe->backend);
+
+	if (revents & FDEVENT_OUT) {
+		int socket_error;
+		socklen_t socket_error_len = sizeof(socket_error);
+		ssize_t r;
+
+		/* the connect() finished */
+		if (0 != getsockopt(probe->sock->fd, SOL_SOCKET, SO_ERROR, (void *)&socket_error, &socket_error_len) ||
+		    socket_error != 0) {
+			proxy_probe_done(srv, probe, 0);
+			return HANDLER_GO_ON;
+		}
+
+		if (type == PROXY_PROBE_CONNECT) {
+			proxy_probe_done(srv, probe, 1);
+			return HANDLER_GO_ON;
+		}
+
+		proxy_probe_prepare(probe, type);
+
+		r = send(probe->sock->fd, probe->buf->ptr, probe->buf->used - 1, 0);
+
+		if (r != (ssize_t)(probe->buf->used - 1)) {
+			proxy_probe_done(srv, probe, 0);
+			return HANDLER_GO_ON;
+		}
+
+		buffer_reset(probe->buf);
+
+		fdevent_event_del(srv->ev, probe->sock);
+		fdevent_event_add(srv->ev, probe->sock, FDEVENT_IN);
+
+		return HANDLER_GO_ON;
+	}
+
+	if (revents & (FDEVENT_IN | FDEVENT_HUP | FDEVENT_ERR)) {
+		char buf[256];
+		ssize_t r;
+		int res;
+
+		/* the first few bytes of the response are all we need */
+		r = recv(probe->sock->fd, buf, sizeof(buf), 0);
+
+		if (r == -1 && (light_sock_errno() == EAGAIN || light_sock_errno() == EINTR)) return HANDLER_GO_ON;
+
+		if (r > 0) buffer_append_string_len(probe->buf, buf, r);
+
+		if (-1 != (res = proxy_probe_parse_response(probe->buf, type))) {
+			proxy_probe_done(srv, probe, res);
+		} else if (r <= 0) {
+			/* closed before the response was complete */
+			proxy_probe_done(srv, probe, 0);
+		}
+	}
+
+	return HANDLER_GO_ON;
+}
+
+static void proxy_probe_start(server *srv, proxy_backend *backend, proxy_address *address) {
+	proxy_probe *probe;
+	int fd;
+#ifdef _WIN32
+	int io_ctl = 1;
+#endif
+
+	if (-1 == (fd = socket(address->addr.plain.sa_family, SOCK_STREAM, 0))) {
+		/* out of fds, that isn't the fault of the backend */
+		address->probe_ts = srv->cur_ts + backend->health_interval;
+		return;
+	}
+
+#ifdef O_NONBLOCK
+	fcntl(fd, F_SETFL, O_NONBLOCK | O_RDWR);
+#elif defined _WIN32
+	ioctlsocket(fd, FIONBIO, &io_ctl);
+#endif
+
+	probe = proxy_probe_init();
+	probe->backend = backend;
+	probe->address = address;
+	probe->sock->fd = fd;
+	probe->sock->type = IOSOCKET_TYPE_SOCKET;
+	probe->timeout_ts = srv->cur_ts + PROXY_PROBE_TIMEOUT;
+
+	gettimeofday(&(probe->start), NULL);
+
+	address->probe = probe;
+
+	fdevent_fcntl_set(srv->ev, probe->sock);
+	fdevent_register(srv->ev, probe->sock, proxy_probe_handle_fdevent, probe);
+
+	if (-1 == connect(fd, &(address->addr.plain), address->addrlen)) {
+		switch (light_sock_errno()) {
+		case EINPROGRESS:
+		case EALREADY:
+		case EINTR:
+#ifdef _WIN32
+		case EWOULDBLOCK:
+#endif
+			break;
+		default:
+			proxy_probe_done(srv, probe, 0);
+			return;
+		}
+	}
+
+	/* the result of the connect() is reported as FDEVENT_OUT */
+	fdevent_event_add(srv->ev, probe->sock, FDEVENT_OUT);
+}
+
+void proxy_health_check_backend(server *srv, proxy_backend *backend, int debug) {
+	size_t i;
+
+	for (i = 0; i < backend->address_pool->used; i++) {
+		proxy_address *address = backend->address_pool->ptr[i];
+
+		if (address->probe) {
+			if (srv->cur_ts < address->probe->timeout_ts) continue;
+
+			if (debug) TRACE("the health check of %s timed out", SAFE_BUF_STR(address->name));
+
+			proxy_probe_done(srv, address->probe, 0);
+			continue;
+		}
+
+		/* the resolver added it, it has no counters yet */
+		if (!address->healthy) proxy_health_check_create_stats(backend, address, srv->tmp_buf);
+
+		if (address->state == PROXY_ADDRESS_STATE_DRAINING) continue;
+		if (srv->cur_ts < address->probe_ts) continue;
+
+		proxy_probe_start(srv, backend, address);
+	}
+}
+
+void proxy_health_check_stop(server *srv, proxy_backend *backend) {
+	size_t i;
+
+	for (i = 0; i < backend->address_pool->used; i++) {
+		proxy_address *address = backend->address_pool->ptr[i];
+
+		proxy_probe_free(srv, address->probe);
+		address->probe = NULL;
+	}
+}
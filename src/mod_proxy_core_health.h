@@ -0,0 +1,50 @@
+#ifndef _MOD_PROXY_CORE_HEALTH_H_
+#define _MOD_PROXY_CORE_HEALTH_H_
+
+#include <sys/time.h>
+
+#include "base.h"
+#include "buffer.h"
+#include "iosocket.h"
+#include "mod_proxy_core_address.h"
+#include "mod_proxy_core_backend.h"
+
+/**
+ * active health checks
+ *
+ * every health-check-interval seconds each address of a backend gets a
+ * probe: a GET for HTTP backends, a FCGI_GET_VALUES for FastCGI backends
+ * and a plain connect() for the others. The probes are non-blocking and
+ * handled by the event-loop like any other connection.
+ *
+ * after health-check-fall failed probes in a row the address is DOWN and the
+ * balancers skip it, after health-check-rise successful probes it is ACTIVE
+ * again.
+ */
+typedef struct proxy_probe {
+	proxy_backend *backend;
+	proxy_address *address;
+
+	iosocket *sock;
+	buffer *buf;           /* the response */
+
+	struct timeval start;  /* for the latency */
+	time_t timeout_ts;
+} proxy_probe;
+
+/**
+ * start the probes which are due and time out the hanging ones
+ */
+void proxy_health_check_backend(server *srv, proxy_backend *backend, int debug);
+
+/**
+ * setup the statistics counters of the address
+ */
+void proxy_health_check_create_stats(proxy_backend *backend, proxy_address *address, buffer *tmp_buf);
+
+/**
+ * stop the running probes of the backend
+ */
+void proxy_health_check_stop(server *srv, proxy_backend *backend);
+
+#endif
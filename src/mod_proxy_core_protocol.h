@@ -14,6 +14,9 @@
 #define PROXY_STREAM_ENCODER_FUNC(x) \
 		static handler_t x(server *srv, proxy_session *sess, chunkqueue *in)
 
+#define PROXY_STREAM_IS_RAW_FUNC(x) \
+		static int x(server *srv, proxy_session *sess)
+
 typedef struct proxy_protocol {
 	buffer *name;
 
@@ -22,6 +25,7 @@ typedef struct proxy_protocol {
 	handler_t (*proxy_stream_decoder)          (server *srv, proxy_session *sess, chunkqueue *out);
 	handler_t (*proxy_stream_encoder)          (server *srv, proxy_session *sess, chunkqueue *in);
 	handler_t (*proxy_encode_request_headers)  (server *srv, proxy_session *sess, chunkqueue *in);
+	int (*proxy_stream_is_raw)                 (server *srv, proxy_session *sess); /** the rest of the response content doesn't need decoding */
 
 } proxy_protocol;
 
@@ -0,0 +1,60 @@
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mod_proxy_core_resolver.h"
+
+#include "sys-files.h"
+#include "sys-socket.h"
+
+/* one record per address in the answer */
+typedef struct {
+	socklen_t addrlen;
+	sock_addr addr;
+} proxy_resolver_record;
+
+int proxy_resolver_parse_answer(buffer *answer, proxy_address_pool *address_pool) {
+	size_t len = answer->used ? answer->used - 1 : 0;
+	size_t i;
+
+	if (len % sizeof(proxy_resolver_record)) return -1;
+
+	for (i = 0; i < len; i += sizeof(proxy_resolver_record)) {
+		proxy_resolver_record rec;
+
+		memcpy(&rec, answer->ptr + i, sizeof(rec));
+
+		if (rec.addrlen > sizeof(rec.addr)) return -1;
+
+		if (0 != proxy_address_pool_add_sockaddr(address_pool, &(rec.addr), rec.addrlen)) return -1;
+	}
+
+	return 0;
+}
+
+void proxy_resolver_answer(char *name, size_t name_len, int *fds, int fd) {
+	proxy_address_pool *address_pool = proxy_address_pool_init();
+	buffer *b = buffer_init_string(name);
+	size_t i;
+
+	UNUSED(name_len);
+	UNUSED(fds);
+
+	/* an empty answer tells the server that the lookup failed */
+	if (0 == proxy_address_pool_add_string(address_pool, b)) {
+		for (i = 0; i < address_pool->used; i++) {
+			proxy_address *address = address_pool->ptr[i];
+			proxy_resolver_record rec;
+
+			memset(&rec, 0, sizeof(rec));
+			memcpy(&(rec.addr), &(address->addr), address->addrlen);
+			rec.addrlen = address->addrlen;
+
+			if (sizeof(rec) != write(fd, &rec, sizeof(rec))) break;
+		}
+	}
+
+	proxy_address_pool_free(address_pool);
+	buffer_free(b);
+}
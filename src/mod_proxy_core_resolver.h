@@ -0,0 +1,31 @@
+#ifndef _MOD_PROXY_CORE_RESOLVER_H_
+#define _MOD_PROXY_CORE_RESOLVER_H_
+
+#include "buffer.h"
+#include "helper_process.h"
+#include "mod_proxy_core_address.h"
+
+/**
+ * resolve backend names without blocking the server
+ *
+ * getaddrinfo() blocks, so it runs in a helper process (see
+ * helper_process.h) which is forked at startup.
+ */
+
+/* max. length of a backend name */
+#define PROXY_RESOLVER_NAME_MAX 1024
+
+/**
+ * resolve a backend name like "www.example.org:80" and write the addresses to fd,
+ * called in the helper
+ */
+void proxy_resolver_answer(char *name, size_t name_len, int *fds, int fd);
+
+/**
+ * turn the answer into addresses
+ *
+ * @return -1 if the answer is incomplete
+ */
+int proxy_resolver_parse_answer(buffer *answer, proxy_address_pool *address_pool);
+
+#endif
@@ -18,7 +18,7 @@ proxy_rewrite *proxy_rewrite_init(void) {
 void proxy_rewrite_free(proxy_rewrite *rewrite) {
 	if (!rewrite) return;
 #ifdef HAVE_PCRE_H
-	if (rewrite->regex) pcre_free(rewrite->regex);
+	pcre_glue_free(rewrite->regex, rewrite->regex_extra);
 #endif
 
 	buffer_free(rewrite->header);
@@ -33,8 +33,8 @@ int proxy_rewrite_set_regex(proxy_rewrite *rewrite, buffer *regex) {
 	int erroff;
 
 #ifdef HAVE_PCRE_H
-	if (NULL == (rewrite->regex = pcre_compile(BUF_STR(regex),
-		  0, &errptr, &erroff, NULL))) {
+	if (NULL == (rewrite->regex = pcre_glue_compile(BUF_STR(regex),
+		  0, &(rewrite->regex_extra), &errptr, &erroff))) {
 
 		TRACE("regex compilation for %s failed at %s", SAFE_BUF_STR(regex), errptr);
 
@@ -66,7 +66,7 @@ void proxy_rewrites_free(proxy_rewrites *rewrites) {
 	free(rewrites);
 }
 
-int pcre_replace(pcre *match, buffer *replace, buffer *match_buf, buffer *result) {
+int pcre_replace(pcre *match, pcre_extra *extra, buffer *replace, buffer *match_buf, buffer *result) {
 #ifdef HAVE_PCRE_H
 	const char *pattern = replace->ptr;
 	size_t pattern_len = replace->used - 1;
@@ -75,7 +75,7 @@ int pcre_replace(pcre *match, buffer *replace, buffer *match_buf, buffer *result
 	int ovec[N * 3];
 	int n;
 
-	if ((n = pcre_exec(match, NULL, match_buf->ptr, match_buf->used - 1, 0, 0, ovec, 3 * N)) < 0) {
+	if ((n = pcre_exec(match, extra, match_buf->ptr, match_buf->used - 1, 0, 0, ovec, 3 * N)) < 0) {
 		if (n != PCRE_ERROR_NOMATCH) {
 			return n;
 		}
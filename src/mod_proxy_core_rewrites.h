@@ -6,19 +6,21 @@
 #endif
 
 #ifdef HAVE_PCRE_H
-#include <pcre.h>
+#include "pcre-glue.h"
 #endif
 #include "array-static.h"
 #include "buffer.h"
 
 #ifndef HAVE_PCRE_H
 #define pcre void
+#define pcre_extra void
 #endif
 
 typedef struct {
 	buffer *header;
 
 	pcre *regex; /* regex compiled from the <match> */
+	pcre_extra *regex_extra;
 
 	buffer *match;
 	buffer *replace;
@@ -34,7 +36,7 @@ proxy_rewrites *proxy_rewrites_init(void);
 void proxy_rewrites_add(proxy_rewrites *rewrites, proxy_rewrite *rewrite);
 void proxy_rewrites_free(proxy_rewrites *rewrites);
 
-int pcre_replace(pcre *match, buffer *replace, buffer *match_buf, buffer *result);
+int pcre_replace(pcre *match, pcre_extra *extra, buffer *replace, buffer *match_buf, buffer *result);
 
 #endif
 
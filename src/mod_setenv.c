@@ -193,7 +193,7 @@ URIHANDLER_FUNC(mod_setenv_uri_handler) {
 		buffer_copy_string_buffer(ds_dst->key, ds->key);
 		buffer_copy_string_buffer(ds_dst->value, ds->value);
 
-		array_insert_unique(con->request.headers, (data_unset *)ds_dst);
+		http_request_insert_header(con, ds_dst);
 	}
 
 	for (k = 0; k < p->conf.environment->used; k++) {
@@ -13,13 +13,13 @@
 #include "stat_cache.h"
 
 #include "plugin.h"
-#include "stream.h"
 
 #include "response.h"
+#include "joblist.h"
+#include "fdevent.h"
 
 #include "mod_ssi.h"
 
-#include "inet_ntop_cache.h"
 
 #include "sys-socket.h"
 #include "sys-strings.h"
@@ -33,6 +33,8 @@
 #include <sys/wait.h>
 #endif
 
+#include <signal.h>
+
 #ifdef HAVE_SYS_FILIO_H
 #include <sys/filio.h>
 #endif
@@ -51,6 +53,9 @@ INIT_FUNC(mod_ssi_init) {
 	p->ssi_vars = array_init();
 	p->ssi_cgi_env = array_init();
 
+	p->templates = ssi_template_cache_init();
+	p->exec_cache = ssi_exec_cache_init();
+
 	return p;
 }
 
@@ -76,8 +81,11 @@ FREE_FUNC(mod_ssi_free) {
 
 	array_free(p->ssi_vars);
 	array_free(p->ssi_cgi_env);
+	ssi_template_cache_free(p->templates);
+	ssi_exec_cache_free(p->exec_cache);
+	if (p->exec_pids.ptr) free(p->exec_pids.ptr);
 #ifdef HAVE_PCRE_H
-	pcre_free(p->ssi_regex);
+	pcre_glue_free(p->ssi_regex, p->ssi_regex_extra);
 #endif
 	buffer_free(p->timefmt);
 	buffer_free(p->stat_fn);
@@ -100,6 +108,7 @@ SETDEFAULTS_FUNC(mod_ssi_set_defaults) {
 	config_values_t cv[] = {
 		{ "ssi.extension",              NULL, T_CONFIG_ARRAY, T_CONFIG_SCOPE_CONNECTION },       /* 0 */
 		{ "ssi.content-type",           NULL, T_CONFIG_STRING, T_CONFIG_SCOPE_CONNECTION },      /* 1 */
+		{ "ssi.exec-cache-ttl",         NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },       /* 2 */
 		{ NULL,                         NULL, T_CONFIG_UNSET, T_CONFIG_SCOPE_UNSET }
 	};
 
@@ -113,9 +122,11 @@ SETDEFAULTS_FUNC(mod_ssi_set_defaults) {
 		s = calloc(1, sizeof(plugin_config));
 		s->ssi_extension  = array_init();
 		s->content_type = buffer_init();
+		s->exec_cache_ttl = 0;
 
 		cv[0].destination = s->ssi_extension;
 		cv[1].destination = s->content_type;
+		cv[2].destination = &(s->exec_cache_ttl);
 
 		p->config_storage[i] = s;
 
@@ -126,7 +137,7 @@ SETDEFAULTS_FUNC(mod_ssi_set_defaults) {
 
 #ifdef HAVE_PCRE_H
 	/* allow 2 params */
-	if (NULL == (p->ssi_regex = pcre_compile("<!--#([a-z]+)\\s+(?:([a-z]+)=\"(.*?)(?<!\\\\)\"\\s*)?(?:([a-z]+)=\"(.*?)(?<!\\\\)\"\\s*)?-->", 0, &errptr, &erroff, NULL))) {
+	if (NULL == (p->ssi_regex = pcre_glue_compile("<!--#([a-z]+)\\s+(?:([a-z]+)=\"(.*?)(?<!\\\\)\"\\s*)?(?:([a-z]+)=\"(.*?)(?<!\\\\)\"\\s*)?-->", 0, &(p->ssi_regex_extra), &errptr, &erroff))) {
 		log_error_write(srv, __FILE__, __LINE__, "sds",
 				"ssi: pcre ",
 				erroff, errptr);
@@ -242,8 +253,7 @@ static int build_ssi_cgi_vars(server *srv, connection *con, plugin_data *p) {
 
 	ssi_env_add(p->ssi_cgi_env, CONST_STRING("SERVER_PORT"), buf);
 
-	ssi_env_add(p->ssi_cgi_env, CONST_STRING("REMOTE_ADDR"),
-		    inet_ntop_cache_get_ip(srv, &(con->dst_addr)));
+	ssi_env_add(p->ssi_cgi_env, CONST_STRING("REMOTE_ADDR"), BUF_STR(con->dst_addr_buf));
 
 	if (con->authed_user->used) {
 		ssi_env_add(p->ssi_cgi_env, CONST_STRING("REMOTE_USER"),
@@ -293,6 +303,227 @@ static int build_ssi_cgi_vars(server *srv, connection *con, plugin_data *p) {
 	return 0;
 }
 
+static ssi_part *ssi_part_init(void) {
+	STRUCT_INIT(ssi_part, part);
+
+	part->cq = chunkqueue_init();
+	part->cmd = buffer_init();
+
+	return part;
+}
+
+static void ssi_part_close(server *srv, ssi_part *part) {
+	if (!part->sock) return;
+
+	fdevent_event_del(srv->ev, part->sock);
+	fdevent_unregister(srv->ev, part->sock);
+	iosocket_free(part->sock);
+	part->sock = NULL;
+}
+
+static void ssi_part_free(server *srv, ssi_part *part) {
+	if (!part) return;
+
+	ssi_part_close(srv, part);
+
+	chunkqueue_free(part->cq);
+	buffer_free(part->cmd);
+
+	free(part);
+}
+
+static handler_ctx *handler_ctx_init(void) {
+	STRUCT_INIT(handler_ctx, hctx);
+
+	hctx->parts = calloc(1, sizeof(*hctx->parts));
+
+	return hctx;
+}
+
+static void handler_ctx_free(server *srv, handler_ctx *hctx) {
+	if (!hctx) return;
+
+	ARRAY_STATIC_FREE(hctx->parts, ssi_part, part, ssi_part_free(srv, part));
+	free(hctx->parts);
+
+	free(hctx);
+}
+
+static void ssi_pid_add(plugin_data *p, pid_t pid) {
+	ssi_pids *r = &(p->exec_pids);
+
+	if (r->size == 0) {
+		r->size = 16;
+		r->ptr = malloc(sizeof(*r->ptr) * r->size);
+	} else if (r->used == r->size) {
+		r->size += 16;
+		r->ptr = realloc(r->ptr, sizeof(*r->ptr) * r->size);
+	}
+
+	r->ptr[r->used++] = pid;
+}
+
+/**
+ * get the queue the output of the current statement goes to
+ *
+ * as long as no command is running it is con->send
+ */
+static chunkqueue *ssi_get_output(connection *con, plugin_data *p) {
+	handler_ctx *hctx = con->plugin_ctx[p->id];
+	ssi_part *part;
+
+	if (!hctx) return con->send;
+
+	part = hctx->parts->ptr[hctx->parts->used - 1];
+
+	if (part->is_exec) {
+		/* the last part is a command, start a new static part behind it */
+		part = ssi_part_init();
+		part->remote_con = con;
+		part->is_done = 1;
+
+		ARRAY_STATIC_PREPARE_APPEND(hctx->parts);
+		hctx->parts->ptr[hctx->parts->used++] = part;
+	}
+
+	return part->cq;
+}
+
+#ifndef _WIN32
+static handler_t ssi_handle_fdevent(void *s, void *ctx, int revents) {
+	server   *srv  = (server *)s;
+	ssi_part *part = ctx;
+	connection *con = part->remote_con;
+
+	if (revents & (FDEVENT_IN | FDEVENT_HUP)) {
+		switch (srv->network_backend_read(srv, con, part->sock, part->cq)) {
+		case NETWORK_STATUS_SUCCESS:
+		case NETWORK_STATUS_WAIT_FOR_EVENT:
+			break;
+		case NETWORK_STATUS_CONNECTION_CLOSE:
+			part->is_done = 1;
+			break;
+		default:
+			ERROR("reading the output of '%s' failed", SAFE_BUF_STR(part->cmd));
+			part->is_done = 1;
+			break;
+		}
+
+		if (!part->is_done && part->cq->bytes_in > SSI_EXEC_OUTPUT_MAX) {
+			ERROR("the output of '%s' is larger than %d bytes, the command is stopped",
+				SAFE_BUF_STR(part->cmd), SSI_EXEC_OUTPUT_MAX);
+
+			/* it is reaped with the others when the part is forwarded */
+			kill(part->pid, SIGTERM);
+
+			part->is_truncated = 1;
+			part->is_done = 1;
+		}
+	} else if (revents & FDEVENT_ERR) {
+		part->is_done = 1;
+	}
+
+	if (part->is_done) {
+		ssi_part_close(srv, part);
+
+		joblist_append(srv, con);
+	}
+
+	return HANDLER_FINISHED;
+}
+
+/**
+ * start a exec cmd="..." in the background
+ *
+ * the output is collected in its own part and forwarded by
+ * mod_ssi_read_response_content() when the command is done
+ */
+static int ssi_exec_start(server *srv, connection *con, plugin_data *p, const char *cmd) {
+	handler_ctx *hctx;
+	ssi_part *part;
+	pid_t pid;
+	int from_exec_fds[2];
+
+	if (pipe(from_exec_fds)) {
+		log_error_write(srv, __FILE__, __LINE__, "ss",
+				"pipe failed: ", strerror(errno));
+		return -1;
+	}
+
+	/* fork, execve */
+	switch (pid = fork()) {
+	case 0: {
+		int i;
+
+		/* move stdout to from_exec_fds[1] */
+		close(STDOUT_FILENO);
+		dup2(from_exec_fds[1], STDOUT_FILENO);
+		close(from_exec_fds[1]);
+		/* not needed */
+		close(from_exec_fds[0]);
+
+		/* close stdin */
+		close(STDIN_FILENO);
+
+		/* we don't need the client socket */
+		for (i = 3; i < 256; i++) {
+			close(i);
+		}
+
+		execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+
+		/* */
+		SEGFAULT("spawing '%s' failed: %s", cmd, strerror(errno));
+		break;
+	}
+	case -1:
+		/* error */
+		log_error_write(srv, __FILE__, __LINE__, "ss", "fork failed:", strerror(errno));
+		close(from_exec_fds[0]);
+		close(from_exec_fds[1]);
+		return -1;
+	default:
+		/* father */
+		close(from_exec_fds[1]);
+		break;
+	}
+
+	if (NULL == (hctx = con->plugin_ctx[p->id])) {
+		hctx = handler_ctx_init();
+		con->plugin_ctx[p->id] = hctx;
+	}
+
+	part = ssi_part_init();
+	part->remote_con = con;
+	part->is_exec = 1;
+	part->pid = pid;
+	buffer_copy_string(part->cmd, cmd);
+
+	part->sock = iosocket_init();
+	part->sock->fd = from_exec_fds[0];
+	part->sock->type = IOSOCKET_TYPE_PIPE;
+
+	ARRAY_STATIC_PREPARE_APPEND(hctx->parts);
+	hctx->parts->ptr[hctx->parts->used++] = part;
+
+	if (-1 == fdevent_fcntl_set(srv->ev, part->sock)) {
+		log_error_write(srv, __FILE__, __LINE__, "ss", "fcntl failed: ", strerror(errno));
+
+		/* the part stays empty, the pid is reaped later */
+		iosocket_free(part->sock);
+		part->sock = NULL;
+		part->is_done = 1;
+
+		return -1;
+	}
+
+	fdevent_register(srv->ev, part->sock, ssi_handle_fdevent, part);
+	fdevent_event_add(srv->ev, part->sock, FDEVENT_IN);
+
+	return 0;
+}
+#endif
+
 static int process_ssi_stmt(server *srv, connection *con, plugin_data *p,
 			    const char **l, size_t n) {
 	size_t i, ssicmd = 0;
@@ -404,7 +635,7 @@ static int process_ssi_stmt(server *srv, connection *con, plugin_data *p,
 		case SSI_ECHO_USER_NAME: {
 			struct passwd *pw;
 
-			b = chunkqueue_get_append_buffer(con->send);
+			b = chunkqueue_get_append_buffer(ssi_get_output(con, p));
 #ifdef HAVE_PWD_H
 			if (NULL == (pw = getpwuid(sce->st.st_uid))) {
 				buffer_copy_long(b, sce->st.st_uid);
@@ -419,7 +650,7 @@ static int process_ssi_stmt(server *srv, connection *con, plugin_data *p,
 		case SSI_ECHO_LAST_MODIFIED:	{
 			time_t t = sce->st.st_mtime;
 
-			b = chunkqueue_get_append_buffer(con->send);
+			b = chunkqueue_get_append_buffer(ssi_get_output(con, p));
 			if (0 == strftime(buf, sizeof(buf), p->timefmt->ptr, localtime(&t))) {
 				buffer_copy_string_len(b, CONST_STR_LEN("(none)"));
 			} else {
@@ -430,7 +661,7 @@ static int process_ssi_stmt(server *srv, connection *con, plugin_data *p,
 		case SSI_ECHO_DATE_LOCAL: {
 			time_t t = time(NULL);
 
-			b = chunkqueue_get_append_buffer(con->send);
+			b = chunkqueue_get_append_buffer(ssi_get_output(con, p));
 			if (0 == strftime(buf, sizeof(buf), p->timefmt->ptr, localtime(&t))) {
 				buffer_copy_string_len(b, CONST_STR_LEN("(none)"));
 			} else {
@@ -441,7 +672,7 @@ static int process_ssi_stmt(server *srv, connection *con, plugin_data *p,
 		case SSI_ECHO_DATE_GMT: {
 			time_t t = time(NULL);
 
-			b = chunkqueue_get_append_buffer(con->send);
+			b = chunkqueue_get_append_buffer(ssi_get_output(con, p));
 			if (0 == strftime(buf, sizeof(buf), p->timefmt->ptr, gmtime(&t))) {
 				buffer_copy_string_len(b, CONST_STR_LEN("(none)"));
 			} else {
@@ -452,7 +683,7 @@ static int process_ssi_stmt(server *srv, connection *con, plugin_data *p,
 		case SSI_ECHO_DOCUMENT_NAME: {
 			char *sl;
 
-			b = chunkqueue_get_append_buffer(con->send);
+			b = chunkqueue_get_append_buffer(ssi_get_output(con, p));
 			if (NULL == (sl = strrchr(con->physical.path->ptr, '/'))) {
 				buffer_copy_string_buffer(b, con->physical.path);
 			} else {
@@ -461,7 +692,7 @@ static int process_ssi_stmt(server *srv, connection *con, plugin_data *p,
 			break;
 		}
 		case SSI_ECHO_DOCUMENT_URI: {
-			b = chunkqueue_get_append_buffer(con->send);
+			b = chunkqueue_get_append_buffer(ssi_get_output(con, p));
 			buffer_copy_string_buffer(b, con->uri.path);
 			break;
 		}
@@ -469,7 +700,7 @@ static int process_ssi_stmt(server *srv, connection *con, plugin_data *p,
 			data_string *ds;
 			/* check if it is a cgi-var */
 
-			b = chunkqueue_get_append_buffer(con->send);
+			b = chunkqueue_get_append_buffer(ssi_get_output(con, p));
 
 			if (NULL != (ds = (data_string *)array_get_element(p->ssi_cgi_env, var_val, strlen(var_val)))) {
 				buffer_copy_string_buffer(b, ds->value);
@@ -486,7 +717,7 @@ static int process_ssi_stmt(server *srv, connection *con, plugin_data *p,
 	case SSI_FLASTMOD:
 	case SSI_FSIZE: {
 		const char * file_path = NULL, *virt_path = NULL;
-		struct stat st;
+		stat_cache_entry *sce = NULL;
 		char *sl;
 
 		for (i = 2; i < n; i += 2) {
@@ -552,28 +783,28 @@ static int process_ssi_stmt(server *srv, connection *con, plugin_data *p,
 			buffer_append_string_buffer(p->stat_fn, srv->tmp_buf);
 		}
 
-		if (0 == stat(p->stat_fn->ptr, &st)) {
-			time_t t = st.st_mtime;
+		if (HANDLER_ERROR != stat_cache_get_entry(srv, con, p->stat_fn, &sce)) {
+			time_t t = sce->st.st_mtime;
 
 			switch (ssicmd) {
 			case SSI_FSIZE:
-				b = chunkqueue_get_append_buffer(con->send);
+				b = chunkqueue_get_append_buffer(ssi_get_output(con, p));
 				if (p->sizefmt) {
 					int j = 0;
 					const char *abr[] = { " B", " kB", " MB", " GB", " TB", NULL };
 
-					off_t s = st.st_size;
+					off_t s = sce->st.st_size;
 
 					for (j = 0; s > 1024 && abr[j+1]; s /= 1024, j++);
 
 					buffer_copy_off_t(b, s);
 					buffer_append_string(b, abr[j]);
 				} else {
-					buffer_copy_off_t(b, st.st_size);
+					buffer_copy_off_t(b, sce->st.st_size);
 				}
 				break;
 			case SSI_FLASTMOD:
-				b = chunkqueue_get_append_buffer(con->send);
+				b = chunkqueue_get_append_buffer(ssi_get_output(con, p));
 				if (0 == strftime(buf, sizeof(buf), p->timefmt->ptr, localtime(&t))) {
 					buffer_copy_string_len(b, CONST_STR_LEN("(none)"));
 				} else {
@@ -581,7 +812,7 @@ static int process_ssi_stmt(server *srv, connection *con, plugin_data *p,
 				}
 				break;
 			case SSI_INCLUDE:
-				chunkqueue_append_file(con->send, p->stat_fn, 0, st.st_size);
+				chunkqueue_append_file(ssi_get_output(con, p), p->stat_fn, 0, sce->st.st_size);
 				break;
 			}
 		} else {
@@ -652,7 +883,7 @@ static int process_ssi_stmt(server *srv, connection *con, plugin_data *p,
 	case SSI_PRINTENV:
 		if (p->if_is_false) break;
 
-		b = chunkqueue_get_append_buffer(con->send);
+		b = chunkqueue_get_append_buffer(ssi_get_output(con, p));
 		buffer_copy_string_len(b, CONST_STR_LEN("<pre>"));
 		for (i = 0; i < p->ssi_vars->used; i++) {
 			data_string *ds = (data_string *)p->ssi_vars->data[p->ssi_vars->sorted[i]];
@@ -670,8 +901,6 @@ static int process_ssi_stmt(server *srv, connection *con, plugin_data *p,
 #ifndef _WIN32
 
 		const char *cmd = NULL;
-		pid_t pid;
-		int from_exec_fds[2];
 
 		for (i = 2; i < n; i += 2) {
 			if (0 == strcmp(l[i], "cmd")) {
@@ -685,87 +914,17 @@ static int process_ssi_stmt(server *srv, connection *con, plugin_data *p,
 
 		if (p->if_is_false) break;
 
-		/* create a return pipe and send output to the html-page
-		 *
-		 * as exec is assumed evil it is implemented synchronously
-		 */
-
 		if (!cmd) break;
 
-		if (pipe(from_exec_fds)) {
-			log_error_write(srv, __FILE__, __LINE__, "ss",
-					"pipe failed: ", strerror(errno));
-			return -1;
-		}
-
-		/* fork, execve */
-		switch (pid = fork()) {
-		case 0: {
-			/* move stdout to from_rrdtool_fd[1] */
-			close(STDOUT_FILENO);
-			dup2(from_exec_fds[1], STDOUT_FILENO);
-			close(from_exec_fds[1]);
-			/* not needed */
-			close(from_exec_fds[0]);
-
-			/* close stdin */
-			close(STDIN_FILENO);
-
-			execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
-
-			/* */
-			SEGFAULT("spawing '%s' failed: %s", cmd, strerror(errno));
+		if (p->conf.exec_cache_ttl &&
+		    NULL != (b = ssi_exec_cache_get(p->exec_cache, cmd, srv->cur_ts, p->conf.exec_cache_ttl))) {
+			chunkqueue_append_mem(ssi_get_output(con, p), CONST_BUF_LEN(b));
 			break;
 		}
-		case -1:
-			/* error */
-			log_error_write(srv, __FILE__, __LINE__, "ss", "fork failed:", strerror(errno));
-			break;
-		default: {
-			/* father */
-			int status;
-			ssize_t r;
-
-			close(from_exec_fds[1]);
-
-			/* wait for the client to end */
-			if (-1 == waitpid(pid, &status, 0)) {
-				log_error_write(srv, __FILE__, __LINE__, "ss", "waitpid failed:", strerror(errno));
-			} else if (WIFEXITED(status)) {
-				int toread;
-				/* read everything from client and paste it into the output */
-
-				while(1) {
-					if (ioctl(from_exec_fds[0], FIONREAD, &toread)) {
-						log_error_write(srv, __FILE__, __LINE__, "s",
-							"unexpected end-of-file (perhaps the ssi-exec process died)");
-						return -1;
-					}
-
-					if (toread > 0) {
-						b = chunkqueue_get_append_buffer(con->send);
-
-						buffer_prepare_copy(b, toread + 1);
 
-						if ((r = read(from_exec_fds[0], b->ptr, b->size - 1)) < 0) {
-							/* read failed */
-							break;
-						} else {
-							b->used = r;
-							b->ptr[b->used++] = '\0';
-						}
-					} else {
-						break;
-					}
-				}
-			} else {
-				log_error_write(srv, __FILE__, __LINE__, "s", "process exited abnormally");
-			}
-			close(from_exec_fds[0]);
-
-			break;
-		}
-		}
+		/* the command runs in parallel to the rest of the document,
+		 * its output is inserted when it is done */
+		if (0 != ssi_exec_start(srv, con, p, cmd)) return -1;
 #else
 		return -1;
 #endif
@@ -893,16 +1052,11 @@ static int process_ssi_stmt(server *srv, connection *con, plugin_data *p,
 }
 
 static int mod_ssi_handle_request(server *srv, connection *con, plugin_data *p) {
-	stream s;
-#ifdef  HAVE_PCRE_H
-	int i, n;
-
-#define N 10
-	int ovec[N * 3];
+#ifdef HAVE_PCRE_H
+	ssi_template *tpl;
+	size_t i;
 #endif
 
-	/* get a stream to the file */
-
 	array_reset(p->ssi_vars);
 	array_reset(p->ssi_cgi_env);
 	buffer_copy_string_len(p->timefmt, CONST_STR_LEN("%a, %d %b %Y %H:%M:%S %Z"));
@@ -910,13 +1064,6 @@ static int mod_ssi_handle_request(server *srv, connection *con, plugin_data *p)
 	build_ssi_cgi_vars(srv, con, p);
 	p->if_is_false = 0;
 
-	if (-1 == stream_open(&s, con->physical.path)) {
-		log_error_write(srv, __FILE__, __LINE__, "sb",
-				"stream-open: ", con->physical.path);
-		return -1;
-	}
-
-
 	/**
 	 * <!--#element attribute=value attribute=value ... -->
 	 *
@@ -976,35 +1123,36 @@ static int mod_ssi_handle_request(server *srv, connection *con, plugin_data *p)
 	 *
 	 */
 #ifdef HAVE_PCRE_H
-	for (i = 0; (n = pcre_exec(p->ssi_regex, NULL, s.start, s.size, i, 0, ovec, N * 3)) > 0; i = ovec[1]) {
-		const char **l;
-		/* take everything from last offset to current match pos */
-
-		if (!p->if_is_false) chunkqueue_append_file(con->send, con->physical.path, i, ovec[0] - i);
-
-		pcre_get_substring_list(s.start, ovec, n, &l);
-		process_ssi_stmt(srv, con, p, l, n);
-		pcre_free_substring_list(l);
+	/* the document is only parsed if it changed since the last request,
+	 * the text between the statements is sent straight from the file */
+	if (NULL == (tpl = ssi_template_cache_get(srv, con, p->templates, p->ssi_regex, p->ssi_regex_extra, con->physical.path))) {
+		return -1;
 	}
 
-	switch(n) {
-	case PCRE_ERROR_NOMATCH:
-		/* copy everything/the rest */
-		chunkqueue_append_file(con->send, con->physical.path, i, s.size - i);
+	for (i = 0; i < tpl->nodes->used; i++) {
+		ssi_node *node = tpl->nodes->ptr[i];
 
-		break;
-	default:
-		log_error_write(srv, __FILE__, __LINE__, "sd",
-				"execution error while matching: ", n);
-		break;
+		switch (node->type) {
+		case SSI_NODE_TEXT:
+			/* behind the output of a running exec, not in front of it */
+			if (!p->if_is_false) chunkqueue_append_file(ssi_get_output(con, p), con->physical.path, node->offset, node->length);
+			break;
+		case SSI_NODE_STMT:
+			process_ssi_stmt(srv, con, p, node->argv, node->argc);
+			break;
+		}
 	}
 #endif
 
-
-	stream_close(&s);
-
 	con->file_started  = 1;
-	con->send->is_closed = 1;
+	con->send->bytes_in += chunkqueue_length(con->send);
+
+	if (con->plugin_ctx[p->id]) {
+		/* some commands are still running, mod_ssi_read_response_content() finishes the response */
+		con->mode = p->id;
+	} else {
+		con->send->is_closed = 1;
+	}
 
 	if (p->conf.content_type->used <= 1) {
 		response_header_overwrite(srv, con, CONST_STR_LEN("Content-Type"), CONST_STR_LEN("text/html"));
@@ -1024,6 +1172,7 @@ static int mod_ssi_patch_connection(server *srv, connection *con, plugin_data *p
 
 	PATCH_OPTION(ssi_extension);
 	PATCH_OPTION(content_type);
+	PATCH_OPTION(exec_cache_ttl);
 
 	/* skip the first, the global context */
 	for (i = 1; i < srv->config_context->used; i++) {
@@ -1041,6 +1190,8 @@ static int mod_ssi_patch_connection(server *srv, connection *con, plugin_data *p
 				PATCH_OPTION(ssi_extension);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("ssi.content-type"))) {
 				PATCH_OPTION(content_type);
+			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("ssi.exec-cache-ttl"))) {
+				PATCH_OPTION(exec_cache_ttl);
 			}
 		}
 	}
@@ -1077,6 +1228,124 @@ URIHANDLER_FUNC(mod_ssi_physical_path) {
 	return HANDLER_GO_ON;
 }
 
+/**
+ * forward the parts to con->send in order as long as they are done
+ */
+SUBREQUEST_FUNC(mod_ssi_read_response_content) {
+	plugin_data *p = p_d;
+	handler_ctx *hctx = con->plugin_ctx[p->id];
+
+	if (con->mode != p->id) return HANDLER_GO_ON;
+	if (NULL == hctx) return HANDLER_GO_ON;
+
+	for (; hctx->ndx < hctx->parts->used; hctx->ndx++) {
+		ssi_part *part = hctx->parts->ptr[hctx->ndx];
+
+		if (!part->is_done) return HANDLER_WAIT_FOR_EVENT;
+
+#ifndef _WIN32
+		if (part->is_exec) {
+			int status;
+
+			switch (waitpid(part->pid, &status, WNOHANG)) {
+			case 0:
+				/* closed stdout but still running, reap it later */
+				ssi_pid_add(p, part->pid);
+				break;
+			case -1:
+				if (errno == EINTR) {
+					ssi_pid_add(p, part->pid);
+				} else {
+					log_error_write(srv, __FILE__, __LINE__, "ss", "waitpid failed: ", strerror(errno));
+				}
+				break;
+			default:
+				if (!WIFEXITED(status)) {
+					log_error_write(srv, __FILE__, __LINE__, "ss", "exec didn't exit cleanly: ", SAFE_BUF_STR(part->cmd));
+				}
+				break;
+			}
+			part->pid = 0;
+
+			if (p->conf.exec_cache_ttl && !part->is_truncated) {
+				ssi_exec_cache_insert(p->exec_cache, part->cmd, part->cq, srv->cur_ts);
+			}
+		}
+#endif
+
+		con->send->bytes_in += chunkqueue_steal_all_chunks(con->send, part->cq);
+	}
+
+	con->send->is_closed = 1;
+
+	return HANDLER_FINISHED;
+}
+
+static handler_t mod_ssi_connection_reset(server *srv, connection *con, void *p_d) {
+	plugin_data *p = p_d;
+	handler_ctx *hctx = con->plugin_ctx[p->id];
+	size_t i;
+
+	if (NULL == hctx) return HANDLER_GO_ON;
+
+#ifndef _WIN32
+	/* the client went away before all commands finished */
+	for (i = 0; i < hctx->parts->used; i++) {
+		ssi_part *part = hctx->parts->ptr[i];
+
+		if (!part->pid) continue;
+
+		if (0 == waitpid(part->pid, NULL, WNOHANG)) {
+			kill(part->pid, SIGTERM);
+			ssi_pid_add(p, part->pid);
+		}
+	}
+#else
+	UNUSED(i);
+#endif
+
+	handler_ctx_free(srv, hctx);
+	con->plugin_ctx[p->id] = NULL;
+
+	return HANDLER_GO_ON;
+}
+
+TRIGGER_FUNC(mod_ssi_trigger) {
+	plugin_data *p = p_d;
+	size_t ndx;
+	/* reap the commands which outlived their request */
+#ifndef _WIN32
+
+	for (ndx = 0; ndx < p->exec_pids.used; ndx++) {
+		int status;
+
+		switch (waitpid(p->exec_pids.ptr[ndx], &status, WNOHANG)) {
+		case 0:
+			/* not finished yet */
+			break;
+		case -1:
+			if (errno == EINTR) break;
+
+			log_error_write(srv, __FILE__, __LINE__, "ss", "waitpid failed: ", strerror(errno));
+
+			/* the pid is gone, move the last entry into this slot and recheck it */
+			p->exec_pids.ptr[ndx] = p->exec_pids.ptr[--p->exec_pids.used];
+			ndx--;
+			break;
+		default:
+			p->exec_pids.ptr[ndx] = p->exec_pids.ptr[--p->exec_pids.used];
+			ndx--;
+			break;
+		}
+	}
+#else
+	UNUSED(srv);
+	UNUSED(p);
+	UNUSED(ndx);
+#endif
+	return HANDLER_GO_ON;
+}
+
 /* this function is called at dlopen() time and inits the callbacks */
 
 LI_EXPORT int mod_ssi_plugin_init(plugin *p);
@@ -1086,6 +1355,9 @@ LI_EXPORT int mod_ssi_plugin_init(plugin *p) {
 
 	p->init        = mod_ssi_init;
 	p->handle_start_backend = mod_ssi_physical_path;
+	p->handle_read_response_content = mod_ssi_read_response_content;
+	p->connection_reset = mod_ssi_connection_reset;
+	p->handle_trigger = mod_ssi_trigger;
 	p->set_defaults  = mod_ssi_set_defaults;
 	p->cleanup     = mod_ssi_free;
 
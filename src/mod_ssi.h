@@ -7,8 +7,10 @@
 
 #include "plugin.h"
 
+#include "mod_ssi_cache.h"
+
 #ifdef HAVE_PCRE_H
-#include <pcre.h>
+#include "pcre-glue.h"
 #endif
 
 /* plugin config for all request/connections */
@@ -16,13 +18,54 @@
 typedef struct {
 	array *ssi_extension;
 	buffer *content_type;
+	unsigned short exec_cache_ttl;
 } plugin_config;
 
+/* the output of a exec cmd="..." is kept in memory until the parts before it are sent,
+ * a command which writes more is stopped */
+#define SSI_EXEC_OUTPUT_MAX (1024 * 1024)
+
+/**
+ * the output of a request is split into parts as soon as the first
+ * exec cmd="..." is started
+ *
+ * the commands run in parallel, the parts are forwarded in order
+ * to con->send as soon as they are done
+ */
+typedef struct {
+	chunkqueue *cq;  /* the content of this part */
+	int is_done;     /* cq is complete */
+
+	/* exec cmd="..." */
+	int is_exec;
+	pid_t pid;
+	iosocket *sock;
+	buffer *cmd;     /* key for the exec-cache */
+	int is_truncated; /* stopped at SSI_EXEC_OUTPUT_MAX, not cached */
+
+	connection *remote_con; /* dumb pointer */
+} ssi_part;
+
+ARRAY_STATIC_DEF(ssi_parts, ssi_part, );
+
+typedef struct {
+	ssi_parts *parts;
+
+	size_t ndx; /* the first part which isn't forwarded yet */
+} handler_ctx;
+
+typedef struct {
+	pid_t *ptr;
+	size_t used;
+	size_t size;
+} ssi_pids;
+
 typedef struct {
 	PLUGIN_DATA;
 
 #ifdef HAVE_PCRE_H
 	pcre *ssi_regex;
+	pcre_extra *ssi_regex_extra;
 #endif
 	buffer *timefmt;
 	int sizefmt;
@@ -32,6 +75,11 @@ typedef struct {
 	array *ssi_vars;
 	array *ssi_cgi_env;
 
+	ssi_template_cache *templates; /* parsed documents */
+	ssi_exec_cache *exec_cache;    /* output of exec cmd="..." */
+
+	ssi_pids exec_pids; /* finished commands which havn't exited yet */
+
 	int if_level, if_is_false_level, if_is_false, if_is_false_endif;
 
 	plugin_config **config_storage;
@@ -0,0 +1,297 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "stream.h"
+#include "stat_cache.h"
+#include "mod_ssi_cache.h"
+
+static void ssi_node_free(ssi_node *node) {
+	if (!node) return;
+
+#ifdef HAVE_PCRE_H
+	if (node->argv) pcre_free_substring_list(node->argv);
+#endif
+
+	free(node);
+}
+
+static void ssi_template_reset(ssi_template *tpl) {
+	ARRAY_STATIC_FREE(tpl->nodes, ssi_node, node, ssi_node_free(node));
+	tpl->nodes->used = 0;
+	tpl->nodes->size = 0;
+
+	buffer_reset(tpl->etag);
+	tpl->mtime = 0;
+	tpl->size = 0;
+}
+
+static void ssi_template_free(ssi_template *tpl) {
+	if (!tpl) return;
+
+	ssi_template_reset(tpl);
+	free(tpl->nodes);
+
+	buffer_free(tpl->name);
+	buffer_free(tpl->etag);
+
+	free(tpl);
+}
+
+ssi_template_cache *ssi_template_cache_init(void) {
+	STRUCT_INIT(ssi_template_cache, cache);
+
+	cache->max_size = SSI_TEMPLATE_CACHE_MAX;
+
+	return cache;
+}
+
+void ssi_template_cache_free(ssi_template_cache *cache) {
+	if (!cache) return;
+
+	ARRAY_STATIC_FREE(cache, ssi_template, tpl, ssi_template_free(tpl));
+
+	free(cache);
+}
+
+static ssi_exec_entry *ssi_exec_entry_init(void) {
+	STRUCT_INIT(ssi_exec_entry, entry);
+
+	entry->cmd = buffer_init();
+	entry->output = buffer_init();
+
+	return entry;
+}
+
+static void ssi_exec_entry_free(ssi_exec_entry *entry) {
+	if (!entry) return;
+
+	buffer_free(entry->cmd);
+	buffer_free(entry->output);
+
+	free(entry);
+}
+
+ssi_exec_cache *ssi_exec_cache_init(void) {
+	STRUCT_INIT(ssi_exec_cache, cache);
+
+	cache->max_size = SSI_EXEC_CACHE_MAX;
+
+	return cache;
+}
+
+void ssi_exec_cache_free(ssi_exec_cache *cache) {
+	if (!cache) return;
+
+	ARRAY_STATIC_FREE(cache, ssi_exec_entry, entry, ssi_exec_entry_free(entry));
+
+	free(cache);
+}
+
+buffer *ssi_exec_cache_get(ssi_exec_cache *cache, const char *cmd, time_t cur_ts, unsigned short ttl) {
+	size_t i;
+
+	for (i = 0; i < cache->used; i++) {
+		ssi_exec_entry *entry = cache->ptr[i];
+
+		if (0 != strcmp(entry->cmd->ptr, cmd)) continue;
+
+		if (cur_ts - entry->ts >= ttl) return NULL;
+
+		return entry->output;
+	}
+
+	return NULL;
+}
+
+void ssi_exec_cache_insert(ssi_exec_cache *cache, buffer *cmd, chunkqueue *cq, time_t cur_ts) {
+	ssi_exec_entry *entry = NULL;
+	chunk *c;
+	size_t i;
+
+	for (i = 0; i < cache->used; i++) {
+		if (buffer_is_equal(cache->ptr[i]->cmd, cmd)) {
+			entry = cache->ptr[i];
+			break;
+		}
+	}
+
+	if (!entry) {
+		if (cache->used < cache->max_size) {
+			entry = ssi_exec_entry_init();
+
+			ARRAY_STATIC_PREPARE_APPEND(cache);
+			cache->ptr[cache->used++] = entry;
+		} else {
+			/* replace the oldest entry */
+			size_t oldest = 0;
+
+			for (i = 1; i < cache->used; i++) {
+				if (cache->ptr[i]->ts < cache->ptr[oldest]->ts) oldest = i;
+			}
+
+			entry = cache->ptr[oldest];
+		}
+
+		buffer_copy_string_buffer(entry->cmd, cmd);
+	}
+
+	buffer_reset(entry->output);
+
+	/* the command output is read into mem-chunks */
+	for (c = cq->first; c; c = c->next) {
+		if (c->type != MEM_CHUNK || c->mem->used == 0) continue;
+
+		buffer_append_string_len(entry->output, c->mem->ptr + c->offset, c->mem->used - 1 - c->offset);
+	}
+
+	entry->ts = cur_ts;
+}
+
+#ifdef HAVE_PCRE_H
+static ssi_node *ssi_node_init(void) {
+	STRUCT_INIT(ssi_node, node);
+
+	return node;
+}
+
+static ssi_template *ssi_template_init(void) {
+	STRUCT_INIT(ssi_template, tpl);
+
+	tpl->name = buffer_init();
+	tpl->etag = buffer_init();
+	tpl->nodes = calloc(1, sizeof(*tpl->nodes));
+
+	return tpl;
+}
+
+static void ssi_template_append_text(ssi_template *tpl, off_t offset, off_t length) {
+	ssi_node *node;
+
+	if (length <= 0) return;
+
+	node = ssi_node_init();
+	node->type = SSI_NODE_TEXT;
+	node->offset = offset;
+	node->length = length;
+
+	ARRAY_STATIC_PREPARE_APPEND(tpl->nodes);
+	tpl->nodes->ptr[tpl->nodes->used++] = node;
+}
+
+/**
+ * run the ssi-regex once over the whole file and remember where the
+ * statements are
+ */
+static int ssi_template_parse(server *srv, ssi_template *tpl, pcre *regex, pcre_extra *regex_extra) {
+	stream s;
+	int i, n;
+#define N 10
+	int ovec[N * 3];
+
+	if (-1 == stream_open(&s, tpl->name)) {
+		log_error_write(srv, __FILE__, __LINE__, "sb",
+				"stream-open: ", tpl->name);
+		return -1;
+	}
+
+	for (i = 0; (n = pcre_exec(regex, regex_extra, s.start, s.size, i, 0, ovec, N * 3)) > 0; i = ovec[1]) {
+		ssi_node *node;
+
+		/* take everything from last offset to current match pos */
+		ssi_template_append_text(tpl, i, ovec[0] - i);
+
+		node = ssi_node_init();
+		node->type = SSI_NODE_STMT;
+		node->argc = n;
+		pcre_get_substring_list(s.start, ovec, n, &(node->argv));
+
+		ARRAY_STATIC_PREPARE_APPEND(tpl->nodes);
+		tpl->nodes->ptr[tpl->nodes->used++] = node;
+	}
+#undef N
+
+	switch(n) {
+	case PCRE_ERROR_NOMATCH:
+		/* copy everything/the rest */
+		ssi_template_append_text(tpl, i, s.size - i);
+
+		break;
+	default:
+		log_error_write(srv, __FILE__, __LINE__, "sd",
+				"execution error while matching: ", n);
+		break;
+	}
+
+	stream_close(&s);
+
+	return 0;
+}
+
+ssi_template *ssi_template_cache_get(server *srv, connection *con, ssi_template_cache *cache, pcre *regex, pcre_extra *regex_extra, buffer *name) {
+	size_t i;
+	ssi_template *tpl = NULL;
+	stat_cache_entry *sce;
+
+	if (HANDLER_ERROR == stat_cache_get_entry(srv, con, name, &sce)) {
+		return NULL;
+	}
+
+	for (i = 0; i < cache->used; i++) {
+		tpl = cache->ptr[i];
+
+		if (buffer_is_equal(name, tpl->name)) break;
+
+		tpl = NULL;
+	}
+
+	if (tpl) {
+		tpl->last_used = srv->cur_ts;
+
+		if (buffer_is_equal(sce->etag, tpl->etag) &&
+		    sce->st.st_mtime == tpl->mtime &&
+		    sce->st.st_size == tpl->size) {
+			return tpl;
+		}
+
+		/* the file changed, parse it again */
+		ssi_template_reset(tpl);
+	} else if (cache->used < cache->max_size) {
+		tpl = ssi_template_init();
+
+		ARRAY_STATIC_PREPARE_APPEND(cache);
+		cache->ptr[cache->used++] = tpl;
+
+		buffer_copy_string_buffer(tpl->name, name);
+	} else {
+		/* cache is full, recycle the least recently used template */
+		size_t lru = 0;
+
+		for (i = 1; i < cache->used; i++) {
+			if (cache->ptr[i]->last_used < cache->ptr[lru]->last_used) lru = i;
+		}
+
+		tpl = cache->ptr[lru];
+
+		ssi_template_reset(tpl);
+		buffer_copy_string_buffer(tpl->name, name);
+	}
+
+	tpl->last_used = srv->cur_ts;
+
+	if (0 != ssi_template_parse(srv, tpl, regex, regex_extra)) {
+		/* forget the name, the next request has to try again */
+		buffer_reset(tpl->name);
+		tpl->last_used = 0;
+
+		return NULL;
+	}
+
+	buffer_copy_string_buffer(tpl->etag, sce->etag);
+	tpl->mtime = sce->st.st_mtime;
+	tpl->size = sce->st.st_size;
+
+	return tpl;
+}
+#endif
@@ -0,0 +1,94 @@
+#ifndef _MOD_SSI_CACHE_H_
+#define _MOD_SSI_CACHE_H_
+
+#include <time.h>
+
+#include "base.h"
+#include "buffer.h"
+#include "array-static.h"
+
+#ifdef HAVE_PCRE_H
+#include "pcre-glue.h"
+#endif
+
+/**
+ * a parsed .shtml document
+ *
+ * the document is split into literal text (a file-range which is sent
+ * with chunkqueue_append_file()) and the ssi-statements in between
+ */
+typedef struct {
+	enum { SSI_NODE_TEXT, SSI_NODE_STMT } type;
+
+	/* SSI_NODE_TEXT */
+	off_t offset;
+	off_t length;
+
+	/* SSI_NODE_STMT: the substring list as returned by pcre_get_substring_list() */
+	const char **argv;
+	int argc;
+} ssi_node;
+
+ARRAY_STATIC_DEF(ssi_nodes, ssi_node, );
+
+typedef struct {
+	buffer *name;
+	buffer *etag;
+
+	/* etag might be disabled by config, keep the raw values too */
+	time_t mtime;
+	off_t size;
+
+	ssi_nodes *nodes;
+
+	time_t last_used; /* LRU */
+} ssi_template;
+
+ARRAY_STATIC_DEF(ssi_template_cache, ssi_template, size_t max_size;);
+
+#define SSI_TEMPLATE_CACHE_MAX 256
+
+/**
+ * the output of exec cmd="..." if ssi.exec-cache-ttl is set
+ */
+typedef struct {
+	buffer *cmd;
+	buffer *output;
+
+	time_t ts; /* when the command finished */
+} ssi_exec_entry;
+
+ARRAY_STATIC_DEF(ssi_exec_cache, ssi_exec_entry, size_t max_size;);
+
+#define SSI_EXEC_CACHE_MAX 64
+
+ssi_template_cache *ssi_template_cache_init(void);
+void ssi_template_cache_free(ssi_template_cache *cache);
+
+ssi_exec_cache *ssi_exec_cache_init(void);
+void ssi_exec_cache_free(ssi_exec_cache *cache);
+
+/**
+ * @return the cached output of cmd or NULL if it is unknown or older than ttl seconds
+ */
+buffer *ssi_exec_cache_get(ssi_exec_cache *cache, const char *cmd, time_t cur_ts, unsigned short ttl);
+
+/**
+ * remember the content of cq as output of cmd
+ */
+void ssi_exec_cache_insert(ssi_exec_cache *cache, buffer *cmd, chunkqueue *cq, time_t cur_ts);
+
+#ifdef HAVE_PCRE_H
+/**
+ * get the parsed template for the file 'name'
+ *
+ * the file is only parsed if it isn't known yet or if the stat-cache
+ * reports a different etag/mtime/size
+ *
+ * @return NULL if the file can't be opened
+ */
+ssi_template *ssi_template_cache_get(server *srv, connection *con,
+		ssi_template_cache *cache, pcre *regex, pcre_extra *regex_extra, buffer *name);
+#endif
+
+#endif
@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 
 #include "base.h"
 #include "log.h"
@@ -12,6 +14,10 @@
 #include "stat_cache.h"
 #include "etag.h"
 #include "response.h"
+#include "strftime_cache.h"
+#include "network.h"
+#include "status_counter.h"
+#include "crc32.h"
 
 #include "sys-files.h"
 #include "sys-strings.h"
@@ -24,10 +30,60 @@
 
 
 
+/**
+ * the memory-cache for small files
+ *
+ * The content is kept in shared mem-chunks, all the connections which send
+ * a file use the same buffer and the response-header and the content go out
+ * in one writev(). The entries are evicted with CLOCK: a hit sets the
+ * referenced bit, the hand clears it and removes the entries which weren't
+ * used since its last round.
+ */
+#define STATICFILE_CACHE_BUCKETS 1024
+
+typedef struct staticfile_cache_entry {
+	buffer *path;
+	uint32_t hash;
+
+	/* the entry is only valid for this version of the file */
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	off_t size;
+
+	chunk_buffer *content;
+
+	int referenced;
+	size_t clock_ndx;
+
+	struct staticfile_cache_entry *next; /* in the hash-bucket */
+} staticfile_cache_entry;
+
+typedef struct {
+	staticfile_cache_entry *buckets[STATICFILE_CACHE_BUCKETS];
+
+	staticfile_cache_entry **clock; /* the hand walks over it */
+	size_t used;
+	size_t size;
+	size_t hand;
+
+	off_t mem_used;
+	off_t mem_max;
+	off_t max_file_size;
+
+	data_integer *hits;
+	data_integer *misses;
+	data_integer *objects;
+	data_integer *memory_used; /* in kbyte */
+} staticfile_cache;
+
 /* plugin config for all request/connections */
 
 typedef struct {
 	array *exclude_ext;
+
+	unsigned short cache_size;          /* MByte, 0 disables the cache */
+	unsigned short cache_max_file_size; /* kByte */
 } plugin_config;
 
 typedef struct {
@@ -35,13 +91,206 @@ typedef struct {
 
 	buffer *range_buf;
 
+	staticfile_cache *cache;
+
 	http_req_range *ranges;
 
 	plugin_config **config_storage;
+	config_patch_cache *patch_cache;
 
 	plugin_config conf;
 } plugin_data;
 
+static staticfile_cache *staticfile_cache_init(void) {
+	STRUCT_INIT(staticfile_cache, cache);
+
+	cache->hits = status_counter_get_counter(CONST_STR_LEN("staticfile.cache.hits"));
+	cache->misses = status_counter_get_counter(CONST_STR_LEN("staticfile.cache.misses"));
+	cache->objects = status_counter_get_counter(CONST_STR_LEN("staticfile.cache.objects"));
+	cache->memory_used = status_counter_get_counter(CONST_STR_LEN("staticfile.cache.memory_used"));
+
+	return cache;
+}
+
+static void staticfile_cache_entry_free(staticfile_cache_entry *e) {
+	buffer_free(e->path);
+	chunk_buffer_release(e->content);
+
+	free(e);
+}
+
+static void staticfile_cache_free(staticfile_cache *cache) {
+	size_t i;
+
+	if (!cache) return;
+
+	for (i = 0; i < cache->used; i++) {
+		staticfile_cache_entry_free(cache->clock[i]);
+	}
+
+	free(cache->clock);
+	free(cache);
+}
+
+static void staticfile_cache_remove(staticfile_cache *cache, staticfile_cache_entry *e) {
+	staticfile_cache_entry **pe;
+
+	for (pe = &(cache->buckets[e->hash % STATICFILE_CACHE_BUCKETS]); *pe; pe = &((*pe)->next)) {
+		if (*pe == e) {
+			*pe = e->next;
+			break;
+		}
+	}
+
+	/* the last entry takes the free slot */
+	cache->clock[e->clock_ndx] = cache->clock[--cache->used];
+	cache->clock[e->clock_ndx]->clock_ndx = e->clock_ndx;
+
+	if (cache->hand >= cache->used) cache->hand = 0;
+
+	cache->mem_used -= e->size;
+
+	COUNTER_SET(cache->objects, cache->used);
+	COUNTER_SET(cache->memory_used, cache->mem_used / 1024);
+
+	/* the connections which still send it keep the content */
+	staticfile_cache_entry_free(e);
+}
+
+/**
+ * make room for 'size' bytes
+ */
+static void staticfile_cache_evict(staticfile_cache *cache, off_t size) {
+	while (cache->used > 0 && cache->mem_used + size > cache->mem_max) {
+		staticfile_cache_entry *e = cache->clock[cache->hand];
+
+		if (e->referenced) {
+			/* a second chance */
+			e->referenced = 0;
+			cache->hand = (cache->hand + 1) % cache->used;
+		} else {
+			staticfile_cache_remove(cache, e);
+		}
+	}
+}
+
+/**
+ * read the small file into a buffer
+ */
+static chunk_buffer *staticfile_cache_read(server *srv, buffer *path, stat_cache_entry *sce) {
+	chunk_buffer *cb;
+	off_t done = 0;
+	int fd;
+
+	/* the stat-cache might have the file open already */
+	if (sce->fd) {
+		fd = sce->fd->fd;
+	} else if (-1 == (fd = open(path->ptr, O_RDONLY | (srv->srvconf.use_noatime ? O_NOATIME : 0)))) {
+		return NULL;
+	}
+
+	cb = chunk_buffer_init();
+	buffer_prepare_copy(cb->mem, sce->st.st_size + 1);
+
+	while (done < sce->st.st_size) {
+		ssize_t r;
+
+		if (-1 == (r = pread(fd, cb->mem->ptr + done, sce->st.st_size - done, done))) {
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		if (r == 0) break;
+
+		done += r;
+	}
+
+	if (!sce->fd) close(fd);
+
+	if (done != sce->st.st_size) {
+		/* truncated while we read it or a read error */
+		chunk_buffer_release(cb);
+
+		return NULL;
+	}
+
+	cb->mem->ptr[done] = '\0';
+	cb->mem->used = done + 1;
+
+	return cb;
+}
+
+/**
+ * get the content of the file from the cache, read it on a miss
+ *
+ * @return NULL if the file isn't cacheable
+ */
+static chunk_buffer *staticfile_cache_get(server *srv, staticfile_cache *cache, buffer *path, stat_cache_entry *sce) {
+	staticfile_cache_entry *e;
+	uint32_t hash;
+	size_t ndx;
+
+	if (sce->st.st_size == 0 || sce->st.st_size > cache->max_file_size) return NULL;
+
+	hash = generate_crc32c(CONST_BUF_LEN(path));
+	ndx = hash % STATICFILE_CACHE_BUCKETS;
+
+	for (e = cache->buckets[ndx]; e; e = e->next) {
+		if (e->hash == hash && buffer_is_equal(e->path, path)) break;
+	}
+
+	if (e) {
+		if (e->dev == sce->st.st_dev && e->ino == sce->st.st_ino &&
+		    e->mtime == sce->st.st_mtime && e->size == sce->st.st_size) {
+			e->referenced = 1;
+			COUNTER_INC(cache->hits);
+
+			return e->content;
+		}
+
+		/* the file changed */
+		staticfile_cache_remove(cache, e);
+	}
+
+	COUNTER_INC(cache->misses);
+
+	staticfile_cache_evict(cache, sce->st.st_size);
+
+	if (cache->mem_used + sce->st.st_size > cache->mem_max) return NULL;
+
+	e = calloc(1, sizeof(*e));
+
+	if (NULL == (e->content = staticfile_cache_read(srv, path, sce))) {
+		free(e);
+
+		return NULL;
+	}
+
+	e->path = buffer_init_buffer(path);
+	e->hash = hash;
+	e->dev = sce->st.st_dev;
+	e->ino = sce->st.st_ino;
+	e->mtime = sce->st.st_mtime;
+	e->size = sce->st.st_size;
+
+	e->next = cache->buckets[ndx];
+	cache->buckets[ndx] = e;
+
+	if (cache->used == cache->size) {
+		cache->size += 64;
+		cache->clock = realloc(cache->clock, cache->size * sizeof(*cache->clock));
+	}
+	e->clock_ndx = cache->used;
+	cache->clock[cache->used++] = e;
+
+	cache->mem_used += e->size;
+
+	COUNTER_SET(cache->objects, cache->used);
+	COUNTER_SET(cache->memory_used, cache->mem_used / 1024);
+
+	return e->content;
+}
+
 /* init the plugin data */
 INIT_FUNC(mod_staticfile_init) {
 	plugin_data *p;
@@ -76,8 +325,11 @@ FREE_FUNC(mod_staticfile_free) {
 		}
 		free(p->config_storage);
 	}
+	config_patch_cache_free(p->patch_cache);
 	buffer_free(p->range_buf);
 
+	staticfile_cache_free(p->cache);
+
 	http_request_range_free(p->ranges);
 
 	free(p);
@@ -93,6 +345,8 @@ SETDEFAULTS_FUNC(mod_staticfile_set_defaults) {
 
 	config_values_t cv[] = {
 		{ "static-file.exclude-extensions", NULL, T_CONFIG_ARRAY, T_CONFIG_SCOPE_CONNECTION },       /* 0 */
+		{ "static-file.memory-cache-size", NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },            /* 1 */
+		{ "static-file.memory-cache-max-file-size", NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_SERVER },   /* 2 */
 		{ NULL,                         NULL, T_CONFIG_UNSET, T_CONFIG_SCOPE_UNSET }
 	};
 
@@ -105,8 +359,12 @@ SETDEFAULTS_FUNC(mod_staticfile_set_defaults) {
 
 		s = calloc(1, sizeof(plugin_config));
 		s->exclude_ext    = array_init();
+		s->cache_size     = 0;
+		s->cache_max_file_size = 64;
 
 		cv[0].destination = s->exclude_ext;
+		cv[1].destination = &(s->cache_size);
+		cv[2].destination = &(s->cache_max_file_size);
 
 		p->config_storage[i] = s;
 
@@ -115,36 +373,58 @@ SETDEFAULTS_FUNC(mod_staticfile_set_defaults) {
 		}
 	}
 
+	if (NULL == (p->patch_cache = config_patch_cache_init(srv, cv, sizeof(plugin_config)))) {
+		return HANDLER_ERROR;
+	}
+
+	/* the memory-cache is global */
+	if (p->config_storage[0]->cache_size) {
+		p->cache = staticfile_cache_init();
+		p->cache->mem_max = (off_t)p->config_storage[0]->cache_size * 1024 * 1024;
+		p->cache->max_file_size = (off_t)p->config_storage[0]->cache_max_file_size * 1024;
+	}
+
 	return HANDLER_GO_ON;
 }
 
 static int mod_staticfile_patch_connection(server *srv, connection *con, plugin_data *p) {
-	size_t i, j;
+	config_patch_cache *pc = p->patch_cache;
+	const plugin_config *cached;
 	plugin_config *s = p->config_storage[0];
+	size_t i;
 
-	PATCH_OPTION(exclude_ext);
+	if (NULL != (cached = config_patch_cache_get(srv, con, pc))) {
+		p->conf = *cached;
+		return 0;
+	}
 
-	/* skip the first, the global context */
-	for (i = 1; i < srv->config_context->used; i++) {
-		data_config *dc = (data_config *)srv->config_context->data[i];
-		s = p->config_storage[i];
+	PATCH_OPTION(exclude_ext);
 
-		/* condition didn't match */
-		if (!config_check_cond(srv, con, dc)) continue;
+	/* the conditionals which set one of our options */
+	for (i = 0; i < pc->used; i++) {
+		if (!CONFIG_PATCH_MATCHED(con, pc, i)) continue;
 
-		/* merge config */
-		for (j = 0; j < dc->value->used; j++) {
-			data_unset *du = dc->value->data[j];
+		s = p->config_storage[pc->contexts[i].context_ndx];
 
-			if (buffer_is_equal_string(du->key, CONST_STR_LEN("static-file.exclude-extensions"))) {
-				PATCH_OPTION(exclude_ext);
-			}
-		}
+		if (CONFIG_PATCH_OPT(pc, i, 0)) PATCH_OPTION(exclude_ext);
 	}
 
+	config_patch_cache_insert(con, pc, &p->conf);
+
 	return 0;
 }
 
+/**
+ * send the file with the fd of the stat-cache if the network-backend can share it
+ */
+static void mod_staticfile_append_file(server *srv, connection *con, stat_cache_entry *sce, off_t offset, off_t len) {
+	chunk_fd *cfd = NULL;
+
+	if (sce->fd && network_can_share_fd(srv, con)) cfd = sce->fd;
+
+	chunkqueue_append_shared_file(con->send, con->physical.path, cfd, offset, len);
+}
+
 static int http_response_parse_range(server *srv, connection *con, plugin_data *p) {
 	int multipart = 0;
 	char *boundary = "fkj49sn38dcn3";
@@ -154,7 +434,7 @@ static int http_response_parse_range(server *srv, connection *con, plugin_data *
 	buffer *range = NULL;
 	http_req_range *ranges, *r;
 
-	if (NULL != (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("Range")))) {
+	if (NULL != (ds = http_request_get_header(con, HTTP_HEADER_RANGE))) {
 		range = ds->value;
 	} else {
 		/* we don't have a Range header */
@@ -271,7 +551,7 @@ static int http_response_parse_range(server *srv, connection *con, plugin_data *
 			con->response.content_length += b->used - 1;
 			con->send->bytes_in += b->used - 1;
 
-			chunkqueue_append_file(con->send, con->physical.path, r->start, r->end - r->start + 1);
+			mod_staticfile_append_file(srv, con, sce, r->start, r->end - r->start + 1);
 			con->response.content_length += r->end - r->start + 1;
 			con->send->bytes_in += r->end - r->start + 1;
 		}
@@ -297,7 +577,7 @@ static int http_response_parse_range(server *srv, connection *con, plugin_data *
 	} else {
 		r = ranges;
 
-		chunkqueue_append_file(con->send, con->physical.path, r->start, r->end - r->start + 1);
+		mod_staticfile_append_file(srv, con, sce, r->start, r->end - r->start + 1);
 		con->response.content_length += r->end - r->start + 1;
 		con->send->bytes_in += r->end - r->start + 1;
 
@@ -320,6 +600,7 @@ URIHANDLER_FUNC(mod_staticfile_subrequest) {
 	size_t k;
 	int s_len;
 	stat_cache_entry *sce = NULL;
+	chunk_buffer *content;
 	buffer *mtime;
 	data_string *ds;
 
@@ -413,21 +694,26 @@ URIHANDLER_FUNC(mod_staticfile_subrequest) {
 
 	/* mod_compress might set several parameters directly; don't overwrite them */
 
-	/* set response content-type, if not set already */
+	/* set response content-type, if not set already
+	 *
+	 * the values are kept in the stat-cache entry, they are only built again if the file changes */
 
 	if (NULL == array_get_element(con->response.headers, CONST_STR_LEN("Content-Type"))) {
 		if (buffer_is_empty(sce->content_type)) {
-			response_header_overwrite(srv, con, CONST_STR_LEN("Content-Type"), CONST_STR_LEN("application/octet-stream"));
+			response_header_insert(srv, con, CONST_STR_LEN("Content-Type"), CONST_STR_LEN("application/octet-stream"));
 		} else {
-			response_header_overwrite(srv, con, CONST_STR_LEN("Content-Type"), CONST_BUF_LEN(sce->content_type));
+			response_header_insert(srv, con, CONST_STR_LEN("Content-Type"), CONST_BUF_LEN(sce->content_type));
 		}
 	}
 
 	if (NULL == array_get_element(con->response.headers, CONST_STR_LEN("ETag"))) {
 		/* generate e-tag */
-		etag_mutate(con->physical.etag, sce->etag);
+		if (buffer_is_empty(sce->response_etag)) {
+			etag_mutate(sce->response_etag, sce->etag);
+		}
+		buffer_copy_string_buffer(con->physical.etag, sce->response_etag);
 
-		response_header_overwrite(srv, con, CONST_STR_LEN("ETag"), CONST_BUF_LEN(con->physical.etag));
+		response_header_insert(srv, con, CONST_STR_LEN("ETag"), CONST_BUF_LEN(con->physical.etag));
 	}
 	if (con->conf.range_requests) {
 		response_header_overwrite(srv, con, CONST_STR_LEN("Accept-Ranges"), CONST_STR_LEN("bytes"));
@@ -435,8 +721,11 @@ URIHANDLER_FUNC(mod_staticfile_subrequest) {
 
 	/* prepare header */
 	if (NULL == (ds = (data_string *)array_get_element(con->response.headers, CONST_STR_LEN("Last-Modified")))) {
-		mtime = strftime_cache_get(srv, sce->st.st_mtime);
-		response_header_overwrite(srv, con, CONST_STR_LEN("Last-Modified"), CONST_BUF_LEN(mtime));
+		if (buffer_is_empty(sce->last_modified)) {
+			buffer_copy_string_buffer(sce->last_modified, strftime_cache_get(srv, sce->st.st_mtime));
+		}
+		mtime = sce->last_modified;
+		response_header_insert(srv, con, CONST_STR_LEN("Last-Modified"), CONST_BUF_LEN(mtime));
 	} else {
 		mtime = ds->value;
 	}
@@ -444,11 +733,11 @@ URIHANDLER_FUNC(mod_staticfile_subrequest) {
 	if (HANDLER_FINISHED == http_response_handle_cachable(srv, con, mtime)) {
 		return HANDLER_FINISHED;
 	} else if (con->conf.range_requests &&
-	           NULL != array_get_element(con->request.headers, CONST_STR_LEN("Range"))) {
+	           NULL != http_request_get_header(con, HTTP_HEADER_RANGE)) {
 		int do_range_request = 1;
 		/* check if we have a conditional GET */
 
-		if (NULL != (ds = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("If-Range")))) {
+		if (NULL != (ds = http_request_get_header(con, HTTP_HEADER_IF_RANGE))) {
 			/* if the value is the same as our ETag, we do a Range-request,
 			 * otherwise a full 200 */
 
@@ -473,7 +762,12 @@ URIHANDLER_FUNC(mod_staticfile_subrequest) {
 	/* we add it here for all requests
 	 * the HEAD request will drop it afterwards again
 	 */
-	chunkqueue_append_file(con->send, con->physical.path, 0, sce->st.st_size);
+	if (p->cache && con->request.http_method != HTTP_METHOD_HEAD &&
+	    NULL != (content = staticfile_cache_get(srv, p->cache, con->physical.path, sce))) {
+		chunkqueue_append_shared_mem(con->send, content, 0);
+	} else {
+		mod_staticfile_append_file(srv, con, sce, 0, sce->st.st_size);
+	}
 
 	con->send->is_closed = 1;
 	con->send->bytes_in = sce->st.st_size;
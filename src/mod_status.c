@@ -23,7 +23,6 @@
 
 #include "plugin.h"
 
-#include "inet_ntop_cache.h"
 
 typedef struct {
 	buffer *config_url;
@@ -483,7 +482,7 @@ static handler_t mod_status_handle_server_status_html(server *srv, connection *c
 
 		buffer_append_string_len(b, CONST_STR_LEN("<tr><td class=\"string ip\">"));
 
-		buffer_append_string(b, inet_ntop_cache_get_ip(srv, &(c->dst_addr)));
+		buffer_append_string_buffer(b, c->dst_addr_buf);
 
 		buffer_append_string_len(b, CONST_STR_LEN("</td><td class=\"int bytes_read\">"));
 
@@ -646,16 +645,36 @@ static handler_t mod_status_handle_server_statistics(server *srv, connection *co
 
 	b = chunkqueue_get_append_buffer(con->send);
 
-	for (i = 0; i < st->used; i++) {
-		size_t ndx = st->sorted[i];
+	if (buffer_is_equal_string(con->uri.query, CONST_STR_LEN("json"))) {
+		buffer_append_string_len(b, CONST_STR_LEN("{\n"));
 
-		buffer_append_string_buffer(b, st->data[ndx]->key);
-		buffer_append_string_len(b, CONST_STR_LEN(": "));
-		buffer_append_long(b, ((data_integer *)(st->data[ndx]))->value);
-		buffer_append_string_len(b, CONST_STR_LEN("\n"));
-	}
+		for (i = 0; i < st->used; i++) {
+			size_t ndx = st->sorted[i];
 
-	response_header_overwrite(srv, con, CONST_STR_LEN("Content-Type"), CONST_STR_LEN("text/plain"));
+			/* the names can carry backend and host names from the config */
+			buffer_append_string_len(b, CONST_STR_LEN("  \""));
+			buffer_append_string_encoded(b, CONST_BUF_LEN(st->data[ndx]->key), ENCODING_JSON);
+			buffer_append_string_len(b, CONST_STR_LEN("\": "));
+			buffer_append_long(b, ((data_integer *)(st->data[ndx]))->value);
+			if (i + 1 < st->used) buffer_append_string_len(b, CONST_STR_LEN(","));
+			buffer_append_string_len(b, CONST_STR_LEN("\n"));
+		}
+
+		buffer_append_string_len(b, CONST_STR_LEN("}\n"));
+
+		response_header_overwrite(srv, con, CONST_STR_LEN("Content-Type"), CONST_STR_LEN("application/json"));
+	} else {
+		for (i = 0; i < st->used; i++) {
+			size_t ndx = st->sorted[i];
+
+			buffer_append_string_buffer(b, st->data[ndx]->key);
+			buffer_append_string_len(b, CONST_STR_LEN(": "));
+			buffer_append_long(b, ((data_integer *)(st->data[ndx]))->value);
+			buffer_append_string_len(b, CONST_STR_LEN("\n"));
+		}
+
+		response_header_overwrite(srv, con, CONST_STR_LEN("Content-Type"), CONST_STR_LEN("text/plain"));
+	}
 
 	con->http_status = 200;
 	con->send->bytes_in += b->used-1;
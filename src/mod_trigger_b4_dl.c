@@ -8,14 +8,13 @@
 
 #include "plugin.h"
 #include "response.h"
-#include "inet_ntop_cache.h"
 
 #if defined(HAVE_GDBM_H)
 #include <gdbm.h>
 #endif
 
 #if defined(HAVE_PCRE_H)
-#include <pcre.h>
+#include "pcre-glue.h"
 #endif
 
 #if defined(HAVE_MEMCACHE_H)
@@ -40,7 +39,9 @@ typedef struct {
 	buffer *mc_namespace;
 #if defined(HAVE_PCRE_H)
 	pcre *trigger_regex;
+	pcre_extra *trigger_regex_extra;
 	pcre *download_regex;
+	pcre_extra *download_regex_extra;
 #endif
 #if defined(HAVE_GDBM_H)
 	GDBM_FILE db;
@@ -101,8 +102,8 @@ FREE_FUNC(mod_trigger_b4_dl_free) {
 			array_free(s->mc_hosts);
 
 #if defined(HAVE_PCRE_H)
-			if (s->trigger_regex) pcre_free(s->trigger_regex);
-			if (s->download_regex) pcre_free(s->download_regex);
+			pcre_glue_free(s->trigger_regex, s->trigger_regex_extra);
+			pcre_glue_free(s->download_regex, s->download_regex_extra);
 #endif
 #if defined(HAVE_GDBM_H)
 			if (s->db) gdbm_close(s->db);
@@ -186,8 +187,8 @@ SETDEFAULTS_FUNC(mod_trigger_b4_dl_set_defaults) {
 #endif
 #if defined(HAVE_PCRE_H)
 		if (!buffer_is_empty(s->download_url)) {
-			if (NULL == (s->download_regex = pcre_compile(s->download_url->ptr,
-								      0, &errptr, &erroff, NULL))) {
+			if (NULL == (s->download_regex = pcre_glue_compile(s->download_url->ptr,
+								      0, &(s->download_regex_extra), &errptr, &erroff))) {
 
 				log_error_write(srv, __FILE__, __LINE__, "sbss",
 						"compiling regex for download-url failed:",
@@ -197,8 +198,8 @@ SETDEFAULTS_FUNC(mod_trigger_b4_dl_set_defaults) {
 		}
 
 		if (!buffer_is_empty(s->trigger_url)) {
-			if (NULL == (s->trigger_regex = pcre_compile(s->trigger_url->ptr,
-								     0, &errptr, &erroff, NULL))) {
+			if (NULL == (s->trigger_regex = pcre_glue_compile(s->trigger_url->ptr,
+								     0, &(s->trigger_regex_extra), &errptr, &erroff))) {
 
 				log_error_write(srv, __FILE__, __LINE__, "sbss",
 						"compiling regex for trigger-url failed:",
@@ -252,7 +253,9 @@ static int mod_trigger_b4_dl_patch_connection(server *srv, connection *con, plug
 #endif
 #if defined(HAVE_PCRE_H)
 	PATCH_OPTION(download_regex);
+	PATCH_OPTION(download_regex_extra);
 	PATCH_OPTION(trigger_regex);
+	PATCH_OPTION(trigger_regex_extra);
 #endif
 	PATCH_OPTION(trigger_timeout);
 	PATCH_OPTION(deny_url);
@@ -277,10 +280,12 @@ static int mod_trigger_b4_dl_patch_connection(server *srv, connection *con, plug
 			if (buffer_is_equal_string(du->key, CONST_STR_LEN("trigger-before-download.download-url"))) {
 #if defined(HAVE_PCRE_H)
 				PATCH_OPTION(download_regex);
+				PATCH_OPTION(download_regex_extra);
 #endif
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("trigger-before-download.trigger-url"))) {
 # if defined(HAVE_PCRE_H)
 				PATCH_OPTION(trigger_regex);
+				PATCH_OPTION(trigger_regex_extra);
 # endif
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("trigger-before-download.gdbm-filename"))) {
 #if defined(HAVE_GDBM_H)
@@ -312,8 +317,6 @@ URIHANDLER_FUNC(mod_trigger_b4_dl_uri_handler) {
 
 #if defined(HAVE_PCRE_H)
 	int n;
-# define N 10
-	int ovec[N * 3];
 
 	if (con->uri.path->used == 0) return HANDLER_GO_ON;
 
@@ -343,7 +346,7 @@ URIHANDLER_FUNC(mod_trigger_b4_dl_uri_handler) {
 
 		/* memcache can't handle spaces */
 	} else {
-		remote_ip = inet_ntop_cache_get_ip(srv, &(con->dst_addr));
+		remote_ip = BUF_STR(con->dst_addr_buf);
 	}
 
 	if (p->conf.debug) {
@@ -351,7 +354,7 @@ URIHANDLER_FUNC(mod_trigger_b4_dl_uri_handler) {
 	}
 
 	/* check if URL is a trigger -> insert IP into DB */
-	if ((n = pcre_exec(p->conf.trigger_regex, NULL, con->uri.path->ptr, con->uri.path->used - 1, 0, 0, ovec, 3 * N)) < 0) {
+	if ((n = pcre_exec(p->conf.trigger_regex, p->conf.trigger_regex_extra, con->uri.path->ptr, con->uri.path->used - 1, 0, 0, NULL, 0)) < 0) {
 		if (n != PCRE_ERROR_NOMATCH) {
 			log_error_write(srv, __FILE__, __LINE__, "sd",
 					"execution error while matching:", n);
@@ -402,7 +405,7 @@ URIHANDLER_FUNC(mod_trigger_b4_dl_uri_handler) {
 	}
 
 	/* check if URL is a download -> check IP in DB, update timestamp */
-	if ((n = pcre_exec(p->conf.download_regex, NULL, con->uri.path->ptr, con->uri.path->used - 1, 0, 0, ovec, 3 * N)) < 0) {
+	if ((n = pcre_exec(p->conf.download_regex, p->conf.download_regex_extra, con->uri.path->ptr, con->uri.path->used - 1, 0, 0, NULL, 0)) < 0) {
 		if (n != PCRE_ERROR_NOMATCH) {
 			log_error_write(srv, __FILE__, __LINE__, "sd",
 					"execution error while matching: ", n);
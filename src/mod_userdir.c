@@ -2,6 +2,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include "base.h"
 #include "log.h"
@@ -10,12 +11,84 @@
 #include "response.h"
 
 #include "plugin.h"
+#include "joblist.h"
+#include "crc32.h"
+#include "stat_cache.h"
 #include "sys-files.h"
+#include "sys-socket.h"
+#include "sys-process.h"
+#include "helper_process.h"
 
 #ifdef HAVE_PWD_H
 #include <pwd.h>
 #endif
 
+#if defined(HAVE_PWD_H) && defined(HAVE_HELPER_PROCESS)
+# define USE_USERDIR_HELPER
+#endif
+
+/**
+ * getpwnam() might ask LDAP or sssd and block for a while, the lookups
+ * run in a helper process (see helper_process.h) which is forked at
+ * startup, like the resolver of mod_proxy_core. If the helper falls behind
+ * or too many lookups run already, the lookup fails and the next request
+ * tries again.
+ *
+ * The answers, also "no such user", are cached for userdir.cache-ttl
+ * seconds. After that the old answer is used until the new one is there.
+ * A full cache drops the expired entries, or the least recently used one
+ * if none expired, before it takes a new user: requests for random names
+ * don't make it grow without bounds.
+ */
+
+#define USERDIR_CACHE_BUCKETS 1024 /* power of 2 */
+
+/* max. number of users in the cache */
+#define USERDIR_CACHE_MAX 4096
+
+/* give up on a lookup after ... seconds */
+#define USERDIR_LOOKUP_TIMEOUT 10
+
+/* max. number of lookups which run at the same time */
+#define USERDIR_LOOKUPS_MAX 64
+
+/* max. length of a username */
+#define USERDIR_NAME_MAX 256
+
+struct userdir_cache;
+
+typedef struct userdir_entry {
+	struct userdir_cache *cache;
+
+	buffer *name;
+	uint32_t hash;
+
+	buffer *home;        /* empty if there is no such user */
+	int is_known;        /* we got an answer once */
+
+	time_t expires;
+	time_t last_used;
+
+	iosocket *lookup_sock; /* the answer of the helper, NULL if no lookup runs */
+	buffer *answer;
+	time_t lookup_ts;
+	unsigned short ttl;    /* of the answer */
+
+	connections *waiting; /* for the first answer */
+
+	struct userdir_entry *next; /* in the hash-bucket */
+} userdir_entry;
+
+typedef struct userdir_cache {
+	userdir_entry **buckets;
+	size_t used;
+
+	size_t plugin_id; /* the waiting connections point to their entry in plugin_ctx */
+
+	helper_process *helper; /* NULL if getpwnam() is called directly */
+	size_t lookups;         /* entries with a running lookup */
+} userdir_cache;
+
 /* plugin config for all request/connections */
 typedef struct {
 	array *exclude_user;
@@ -23,6 +96,7 @@ typedef struct {
 	buffer *path;
 	buffer *basepath;
 	unsigned short letterhomes;
+	unsigned short cache_ttl;
 } plugin_config;
 
 typedef struct {
@@ -31,11 +105,269 @@ typedef struct {
 	buffer *username;
 	buffer *temp_path;
 
+	userdir_cache *cache;
+
 	plugin_config **config_storage;
 
 	plugin_config conf;
 } plugin_data;
 
+static userdir_entry *userdir_entry_init(void) {
+	STRUCT_INIT(userdir_entry, entry);
+
+	entry->name = buffer_init();
+	entry->home = buffer_init();
+	entry->answer = buffer_init();
+	entry->waiting = calloc(1, sizeof(*entry->waiting));
+
+	return entry;
+}
+
+static void userdir_entry_free(userdir_entry *entry) {
+	if (!entry) return;
+
+	buffer_free(entry->name);
+	buffer_free(entry->home);
+	buffer_free(entry->answer);
+	iosocket_free(entry->lookup_sock);
+	free(entry->waiting->ptr);
+	free(entry->waiting);
+
+	free(entry);
+}
+
+static userdir_cache *userdir_cache_init(void) {
+	STRUCT_INIT(userdir_cache, cache);
+
+	cache->buckets = calloc(USERDIR_CACHE_BUCKETS, sizeof(*cache->buckets));
+
+	return cache;
+}
+
+static void userdir_cache_free(userdir_cache *cache) {
+	size_t i;
+
+	if (!cache) return;
+
+	for (i = 0; i < USERDIR_CACHE_BUCKETS; i++) {
+		userdir_entry *entry, *next;
+
+		for (entry = cache->buckets[i]; entry; entry = next) {
+			next = entry->next;
+
+			userdir_entry_free(entry);
+		}
+	}
+	free(cache->buckets);
+
+	helper_process_free(cache->helper);
+
+	free(cache);
+}
+
+/**
+ * make room for a new entry
+ *
+ * drops all expired entries, the least recently used one if none expired.
+ * Entries with a running lookup have connections waiting for them and stay.
+ */
+static void userdir_cache_evict(userdir_cache *cache, time_t cur_ts) {
+	userdir_entry **lru = NULL;
+	size_t i, used = cache->used;
+
+	for (i = 0; i < USERDIR_CACHE_BUCKETS; i++) {
+		userdir_entry **pe = &(cache->buckets[i]);
+
+		while (*pe) {
+			userdir_entry *entry = *pe;
+
+			if (entry->lookup_sock) {
+				pe = &(entry->next);
+				continue;
+			}
+
+			if (entry->expires <= cur_ts) {
+				*pe = entry->next;
+				cache->used--;
+
+				userdir_entry_free(entry);
+				continue;
+			}
+
+			if (!lru || entry->last_used < (*lru)->last_used) lru = pe;
+
+			pe = &(entry->next);
+		}
+	}
+
+	if (cache->used == used && lru) {
+		userdir_entry *entry = *lru;
+
+		*lru = entry->next;
+		cache->used--;
+
+		userdir_entry_free(entry);
+	}
+}
+
+static userdir_entry *userdir_cache_get(userdir_cache *cache, buffer *name, time_t cur_ts) {
+	uint32_t hash = generate_crc32c(CONST_BUF_LEN(name));
+	userdir_entry *entry;
+	size_t ndx = hash & (USERDIR_CACHE_BUCKETS - 1);
+
+	for (entry = cache->buckets[ndx]; entry; entry = entry->next) {
+		if (entry->hash == hash && buffer_is_equal(entry->name, name)) return entry;
+	}
+
+	if (cache->used >= USERDIR_CACHE_MAX) userdir_cache_evict(cache, cur_ts);
+
+	entry = userdir_entry_init();
+	entry->cache = cache;
+	buffer_copy_string_buffer(entry->name, name);
+	entry->hash = hash;
+
+	entry->next = cache->buckets[ndx];
+	cache->buckets[ndx] = entry;
+	cache->used++;
+
+	return entry;
+}
+
+#ifdef USE_USERDIR_HELPER
+/* write the home of the user to fd, called in the helper */
+static void userdir_helper_answer(char *name, size_t name_len, int *fds, int fd) {
+	struct passwd *pwd;
+
+	UNUSED(name_len);
+	UNUSED(fds);
+
+	/* an empty answer: no such user */
+	if (NULL != (pwd = getpwnam(name)) && pwd->pw_dir) {
+		size_t len = strlen(pwd->pw_dir);
+
+		if (len != (size_t)write(fd, pwd->pw_dir, len)) {
+			/* the server gets an incomplete answer, it checks the dir anyway */
+		}
+	}
+}
+#endif
+
+/**
+ * fork the helper process
+ *
+ * @return 0 on success, -1 if fork() failed
+ */
+static int userdir_cache_start_helper(userdir_cache *cache) {
+#ifdef USE_USERDIR_HELPER
+	cache->helper = helper_process_init();
+
+	return helper_process_start(cache->helper, USERDIR_NAME_MAX, userdir_helper_answer);
+#else
+	UNUSED(cache);
+
+	return 0;
+#endif
+}
+
+/**
+ * the lookup is done, wake up the connections which waited for it
+ *
+ * @param home NULL if the lookup failed
+ */
+static void userdir_entry_set_answer(server *srv, userdir_entry *entry, buffer *home) {
+	size_t i;
+
+	if (entry->lookup_sock) {
+		fdevent_event_del(srv->ev, entry->lookup_sock);
+		fdevent_unregister(srv->ev, entry->lookup_sock);
+		iosocket_free(entry->lookup_sock);
+		entry->lookup_sock = NULL;
+
+		entry->cache->lookups--;
+	}
+
+	/* no answer, keep the old one */
+	if (home) buffer_copy_string_buffer(entry->home, home);
+
+	entry->is_known = 1;
+	entry->expires = srv->cur_ts + entry->ttl;
+
+	for (i = 0; i < entry->waiting->used; i++) {
+		connection *con = entry->waiting->ptr[i];
+
+		con->plugin_ctx[entry->cache->plugin_id] = NULL;
+		joblist_append(srv, con);
+	}
+	entry->waiting->used = 0;
+}
+
+static handler_t userdir_handle_fdevent(void *s, void *ctx, int revents) {
+	server *srv = (server *)s;
+	userdir_entry *entry = ctx;
+	char buf[1024];
+	ssize_t r;
+
+	if (!(revents & (FDEVENT_IN | FDEVENT_HUP | FDEVENT_ERR))) return HANDLER_GO_ON;
+
+	while ((r = read(entry->lookup_sock->fd, buf, sizeof(buf))) > 0) {
+		buffer_append_string_len(entry->answer, buf, r);
+	}
+
+	if (r == -1 && (errno == EAGAIN || errno == EINTR)) return HANDLER_GO_ON;
+
+	/* EOF, the answer is complete */
+	userdir_entry_set_answer(srv, entry, entry->answer);
+	buffer_reset(entry->answer);
+
+	return HANDLER_GO_ON;
+}
+
+/**
+ * start the lookup of the entry
+ *
+ * without the helper getpwnam() is called right away
+ */
+static void userdir_entry_lookup(server *srv, userdir_entry *entry, unsigned short ttl) {
+	userdir_cache *cache = entry->cache;
+	int fd;
+
+	entry->ttl = ttl;
+
+	if (!cache->helper) {
+#ifdef HAVE_PWD_H
+		struct passwd *pwd;
+
+		if (NULL != (pwd = getpwnam(entry->name->ptr)) && pwd->pw_dir) {
+			buffer_copy_string(entry->answer, pwd->pw_dir);
+		}
+#endif
+		userdir_entry_set_answer(srv, entry, entry->answer);
+		buffer_reset(entry->answer);
+
+		return;
+	}
+
+	if (cache->lookups >= USERDIR_LOOKUPS_MAX ||
+	    -1 == (fd = helper_process_query(cache->helper, entry->name))) {
+		/* the helper is busy: keep the old answer, the next request tries again */
+		entry->ttl = 0;
+		userdir_entry_set_answer(srv, entry, NULL);
+
+		return;
+	}
+
+	entry->lookup_sock = iosocket_init();
+	entry->lookup_sock->fd = fd;
+	entry->lookup_sock->type = IOSOCKET_TYPE_PIPE;
+	entry->lookup_ts = srv->cur_ts;
+
+	fdevent_fcntl_set(srv->ev, entry->lookup_sock);
+	fdevent_register(srv->ev, entry->lookup_sock, userdir_handle_fdevent, entry);
+	fdevent_event_add(srv->ev, entry->lookup_sock, FDEVENT_IN);
+
+	cache->lookups++;
+}
+
 /* init the plugin data */
 INIT_FUNC(mod_userdir_init) {
 	plugin_data *p;
@@ -75,6 +407,8 @@ FREE_FUNC(mod_userdir_free) {
 	buffer_free(p->username);
 	buffer_free(p->temp_path);
 
+	userdir_cache_free(p->cache);
+
 	free(p);
 
 	return HANDLER_GO_ON;
@@ -92,6 +426,7 @@ SETDEFAULTS_FUNC(mod_userdir_set_defaults) {
 		{ "userdir.include-user",       NULL, T_CONFIG_ARRAY,  T_CONFIG_SCOPE_CONNECTION },       /* 2 */
 		{ "userdir.basepath",           NULL, T_CONFIG_STRING, T_CONFIG_SCOPE_CONNECTION },       /* 3 */
 		{ "userdir.letterhomes",	NULL, T_CONFIG_BOOLEAN,T_CONFIG_SCOPE_CONNECTION },	  /* 4 */
+		{ "userdir.cache-ttl",          NULL, T_CONFIG_SHORT,  T_CONFIG_SCOPE_CONNECTION },       /* 5 */
 		{ NULL,                         NULL, T_CONFIG_UNSET,  T_CONFIG_SCOPE_UNSET }
 	};
 
@@ -108,12 +443,14 @@ SETDEFAULTS_FUNC(mod_userdir_set_defaults) {
 		s->path = buffer_init();
 		s->basepath = buffer_init();
 		s->letterhomes = 0;
+		s->cache_ttl = 60;
 
 		cv[0].destination = s->path;
 		cv[1].destination = s->exclude_user;
 		cv[2].destination = s->include_user;
 		cv[3].destination = s->basepath;
 		cv[4].destination = &(s->letterhomes);
+		cv[5].destination = &(s->cache_ttl);
 
 		p->config_storage[i] = s;
 
@@ -122,6 +459,15 @@ SETDEFAULTS_FUNC(mod_userdir_set_defaults) {
 		}
 	}
 
+	p->cache = userdir_cache_init();
+	p->cache->plugin_id = p->id;
+
+	/* with a global basepath we don't need /etc/passwd */
+	if (buffer_is_empty(p->config_storage[0]->basepath) &&
+	    0 != userdir_cache_start_helper(p->cache)) {
+		return HANDLER_ERROR;
+	}
+
 	return HANDLER_GO_ON;
 }
 
@@ -134,6 +480,7 @@ static int mod_userdir_patch_connection(server *srv, connection *con, plugin_dat
 	PATCH_OPTION(include_user);
 	PATCH_OPTION(basepath);
 	PATCH_OPTION(letterhomes);
+	PATCH_OPTION(cache_ttl);
 
 	/* skip the first, the global context */
 	for (i = 1; i < srv->config_context->used; i++) {
@@ -157,6 +504,8 @@ static int mod_userdir_patch_connection(server *srv, connection *con, plugin_dat
 				PATCH_OPTION(basepath);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("userdir.letterhomes"))) {
 				PATCH_OPTION(letterhomes);
+			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("userdir.cache-ttl"))) {
+				PATCH_OPTION(cache_ttl);
 			}
 		}
 	}
@@ -164,14 +513,41 @@ static int mod_userdir_patch_connection(server *srv, connection *con, plugin_dat
 	return 0;
 }
 
+/**
+ * get the home of the user from the cache
+ *
+ * @return HANDLER_WAIT_FOR_EVENT if the connection has to wait for the first lookup
+ */
+static handler_t mod_userdir_get_home(server *srv, connection *con, plugin_data *p, userdir_entry **entry_p) {
+	userdir_entry *entry = userdir_cache_get(p->cache, p->username, srv->cur_ts);
+
+	*entry_p = entry;
+	entry->last_used = srv->cur_ts;
+
+	if (entry->is_known && entry->expires > srv->cur_ts) return HANDLER_GO_ON;
+
+	if (!entry->lookup_sock) userdir_entry_lookup(srv, entry, p->conf.cache_ttl);
+
+	/* the old answer is good enough until the new one is there */
+	if (entry->is_known && (p->conf.cache_ttl || !entry->lookup_sock)) return HANDLER_GO_ON;
+
+	if (entry->waiting->size == entry->waiting->used) {
+		entry->waiting->size += 4;
+		entry->waiting->ptr = realloc(entry->waiting->ptr, entry->waiting->size * sizeof(*entry->waiting->ptr));
+	}
+	entry->waiting->ptr[entry->waiting->used++] = con;
+
+	con->plugin_ctx[p->id] = entry;
+
+	return HANDLER_WAIT_FOR_EVENT;
+}
+
 URIHANDLER_FUNC(mod_userdir_docroot_handler) {
 	plugin_data *p = p_d;
 	int uri_len;
 	size_t k;
 	char *rel_url;
-#ifdef HAVE_PWD_H
-	struct passwd *pwd = NULL;
-#endif
+	userdir_entry *entry = NULL;
 
 	if (con->uri.path->used == 0) return HANDLER_GO_ON;
 
@@ -196,17 +572,12 @@ URIHANDLER_FUNC(mod_userdir_docroot_handler) {
 		return HANDLER_GO_ON;
 	}
 
-	buffer_copy_string_len(p->username, con->uri.path->ptr + 2, rel_url - (con->uri.path->ptr + 2));
-
-	if (buffer_is_empty(p->conf.basepath)
-#ifdef HAVE_PWD_H
-	    && NULL == (pwd = getpwnam(p->username->ptr))
-#endif
-	    ) {
-		/* user not found */
+	/* no such user */
+	if (rel_url - (con->uri.path->ptr + 2) > USERDIR_NAME_MAX) {
 		return HANDLER_GO_ON;
 	}
 
+	buffer_copy_string_len(p->username, con->uri.path->ptr + 2, rel_url - (con->uri.path->ptr + 2));
 
 	for (k = 0; k < p->conf.exclude_user->used; k++) {
 		data_string *ds = (data_string *)p->conf.exclude_user->data[k];
@@ -236,7 +607,23 @@ URIHANDLER_FUNC(mod_userdir_docroot_handler) {
 
 	if (buffer_is_empty(p->conf.basepath)) {
 #ifdef HAVE_PWD_H
-		buffer_copy_string(p->temp_path, pwd->pw_dir);
+		switch (mod_userdir_get_home(srv, con, p, &entry)) {
+		case HANDLER_WAIT_FOR_EVENT:
+			/* start again with the uri when the answer is there */
+			buffer_reset(con->physical.path);
+
+			return HANDLER_WAIT_FOR_EVENT;
+		default:
+			break;
+		}
+
+		/* user not found */
+		if (buffer_is_empty(entry->home)) return HANDLER_GO_ON;
+
+		buffer_copy_string_buffer(p->temp_path, entry->home);
+#else
+		/* user not found */
+		return HANDLER_GO_ON;
 #endif
 	} else {
 		char *cp;
@@ -273,11 +660,21 @@ URIHANDLER_FUNC(mod_userdir_docroot_handler) {
 	buffer_append_string_buffer(p->temp_path, p->conf.path);
 
 	if (buffer_is_empty(p->conf.basepath)) {
-		struct stat st;
-		int ret;
+		stat_cache_entry *sce = NULL;
+
+		switch (stat_cache_get_entry_async(srv, con, p->temp_path, &sce)) {
+		case HANDLER_GO_ON:
+			if (S_ISDIR(sce->st.st_mode)) break;
 
-		ret = stat(p->temp_path->ptr, &st);
-		if (ret < 0 || S_ISDIR(st.st_mode) != 1) {
+			return HANDLER_GO_ON;
+		case HANDLER_WAIT_FOR_EVENT:
+			/* start again with the uri when the stat() is done */
+			buffer_reset(con->physical.path);
+			buffer_reset(p->temp_path);
+
+			return HANDLER_WAIT_FOR_EVENT;
+		default:
+			/* no public_html */
 			return HANDLER_GO_ON;
 		}
 	}
@@ -307,6 +704,72 @@ URIHANDLER_FUNC(mod_userdir_docroot_handler) {
 	return HANDLER_GO_ON;
 }
 
+/* the connection doesn't wait for a lookup anymore */
+CONNECTION_FUNC(mod_userdir_connection_reset) {
+	plugin_data *p = p_d;
+	userdir_entry *entry = con->plugin_ctx[p->id];
+	size_t i;
+
+	UNUSED(srv);
+
+	if (!entry) return HANDLER_GO_ON;
+
+	for (i = 0; i < entry->waiting->used; i++) {
+		if (entry->waiting->ptr[i] != con) continue;
+
+		entry->waiting->ptr[i] = entry->waiting->ptr[--entry->waiting->used];
+		break;
+	}
+
+	con->plugin_ctx[p->id] = NULL;
+
+	return HANDLER_GO_ON;
+}
+
+/* drop the lookups which hang and the users we didn't see for a ttl */
+TRIGGER_FUNC(mod_userdir_trigger) {
+	plugin_data *p = p_d;
+	size_t i;
+
+	if (!p->cache) return HANDLER_GO_ON;
+
+	for (i = 0; i < USERDIR_CACHE_BUCKETS; i++) {
+		userdir_entry **pe = &(p->cache->buckets[i]);
+
+		while (*pe) {
+			userdir_entry *entry = *pe;
+
+			if (entry->lookup_sock &&
+			    srv->cur_ts - entry->lookup_ts > USERDIR_LOOKUP_TIMEOUT) {
+				ERROR("looking up the user %s timed out", SAFE_BUF_STR(entry->name));
+
+				/* try again with the next request */
+				entry->ttl = 0;
+				userdir_entry_set_answer(srv, entry, NULL);
+				buffer_reset(entry->answer);
+
+				/* the waiting connections still need the entry */
+				pe = &(entry->next);
+				continue;
+			}
+
+			if (!entry->lookup_sock &&
+			    entry->expires <= srv->cur_ts &&
+			    srv->cur_ts - entry->last_used >= entry->ttl) {
+				*pe = entry->next;
+				p->cache->used--;
+
+				userdir_entry_free(entry);
+				continue;
+			}
+
+			pe = &(entry->next);
+		}
+	}
+
+	return HANDLER_GO_ON;
+}
+
 /* this function is called at dlopen() time and inits the callbacks */
 
 LI_EXPORT int mod_userdir_plugin_init(plugin *p);
@@ -316,6 +779,8 @@ LI_EXPORT int mod_userdir_plugin_init(plugin *p) {
 
 	p->init           = mod_userdir_init;
 	p->handle_physical = mod_userdir_docroot_handler;
+	p->handle_trigger = mod_userdir_trigger;
+	p->connection_reset = mod_userdir_connection_reset;
 	p->set_defaults   = mod_userdir_set_defaults;
 	p->cleanup        = mod_userdir_free;
 
@@ -1894,6 +1894,11 @@ URIHANDLER_FUNC(mod_webdav_subrequest_handler) {
 					}
 				}
 				break;
+			case PIPE_CHUNK:
+				/* the request content never sits in a pipe */
+				log_error_write(srv, __FILE__, __LINE__, "s", "pipe-chunks are not supported");
+				con->http_status = 500;
+				break;
 			case UNUSED_CHUNK:
 				break;
 			}
@@ -15,6 +15,7 @@
 #include "connections.h"
 #include "plugin.h"
 #include "joblist.h"
+#include "traffic_shaper.h"
 
 #include "network_backends.h"
 #include "sys-mmap.h"
@@ -817,6 +818,108 @@ network_status_t network_read(server *srv, connection *con, iosocket *sock, chun
 	return ret;
 }
 
+/**
+ * can pipe-chunks be written to the client of this connection ?
+ *
+ * only the linux-sendfile backend knows how to splice() them, SSL needs the data in userspace
+ */
+int network_can_write_pipe(server *srv, connection *con) {
+#ifdef USE_LINUX_SPLICE
+	server_socket *srv_socket = con->srv_socket;
+
+	return !srv_socket->is_ssl && srv->network_backend == NETWORK_BACKEND_LINUX_SENDFILE;
+#else
+	UNUSED(srv);
+	UNUSED(con);
+
+	return 0;
+#endif
+}
+
+/**
+ * can the file-chunks of this connection borrow a shared fd ?
+ *
+ * the backends which send with an explicit offset (sendfile(), mmap()) leave
+ * the file-position alone, the others seek around in the fd
+ */
+int network_can_share_fd(server *srv, connection *con) {
+	server_socket *srv_socket = con->srv_socket;
+
+	if (srv_socket->is_ssl) return 0;
+
+	switch (srv->network_backend) {
+	case NETWORK_BACKEND_LINUX_SENDFILE:
+	case NETWORK_BACKEND_FREEBSD_SENDFILE:
+	case NETWORK_BACKEND_GTHREAD_SENDFILE:
+	case NETWORK_BACKEND_GTHREAD_FREEBSD_SENDFILE:
+	case NETWORK_BACKEND_WRITEV:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * read from a socket into a pipe-chunk, the data isn't copied to userspace
+ *
+ * @see network_can_write_pipe
+ */
+network_status_t network_read_to_pipe(server *srv, connection *con, iosocket *sock, chunkqueue *cq, off_t max_read) {
+#ifdef USE_LINUX_SPLICE
+	return network_read_chunkqueue_splice(srv, con, sock, cq, max_read);
+#else
+	UNUSED(srv);
+	UNUSED(con);
+	UNUSED(sock);
+	UNUSED(cq);
+	UNUSED(max_read);
+
+	return NETWORK_STATUS_FATAL_ERROR;
+#endif
+}
+
+/**
+ * tell the kernel to pace the packets of the connection with its rate
+ *
+ * the rate of SO_MAX_PACING_RATE includes the TCP/IP headers, leave some
+ * room to not undercut the traffic-shaper
+ */
+static void network_set_pacing_rate(server *srv, connection *con, off_t rate) {
+#ifdef SO_MAX_PACING_RATE
+	unsigned int pacing_rate;
+
+	if (rate == 0 && con->pacing_rate == 0) return;
+
+	pacing_rate = rate ? (unsigned int)(rate + rate / 16) : ~0U;
+
+	if (pacing_rate == con->pacing_rate) return;
+
+	if (-1 == setsockopt(con->sock->fd, SOL_SOCKET, SO_MAX_PACING_RATE, &pacing_rate, sizeof(pacing_rate))) {
+		if (srv->srvconf.log_state_handling) {
+			TRACE("setsockopt(SO_MAX_PACING_RATE) failed: %s", strerror(errno));
+		}
+	}
+
+	con->pacing_rate = rate ? pacing_rate : 0;
+#else
+	UNUSED(srv);
+	UNUSED(con);
+	UNUSED(rate);
+#endif
+}
+
+/**
+ * wake the connection up again when all its buckets have tokens
+ */
+static void network_wait_for_tokens(server *srv, connection *con, traffic_bucket *traffic, traffic_bucket *global_traffic, uint64_t now) {
+	uint64_t wait = 0, global_wait;
+
+	if (traffic) wait = traffic_bucket_wait(traffic);
+	if (global_traffic && (global_wait = traffic_bucket_wait(global_traffic)) > wait) wait = global_wait;
+
+	traffic_shaper_wait(srv, con, now + (wait ? wait : 1));
+}
+
 network_status_t network_write_chunkqueue(server *srv, connection *con, chunkqueue *cq) {
 	network_status_t ret = NETWORK_STATUS_UNSET;
 	off_t written = 0;
@@ -824,17 +927,44 @@ network_status_t network_write_chunkqueue(server *srv, connection *con, chunkque
 	int corked = 0;
 #endif
 	server_socket *srv_socket = con->srv_socket;
+	traffic_bucket *global_traffic = NULL, *traffic = NULL;
+	uint64_t now = 0;
 
-	if (con->conf.global_kbytes_per_second &&
-	    *(con->conf.global_bytes_per_second_cnt_ptr) > con->conf.global_kbytes_per_second * 1024) {
-		/* we reached the global traffic limit */
+	network_set_pacing_rate(srv, con, (off_t)con->conf.kbytes_per_second * 1024);
 
-		con->traffic_limit_reached = 1;
-		joblist_append(srv, con);
+	if (con->conf.kbytes_per_second || con->conf.global_kbytes_per_second) {
+		now = traffic_shaper_now();
+	}
+
+	if (con->conf.kbytes_per_second) {
+		traffic = &(con->traffic);
+		traffic_bucket_refill(traffic, (off_t)con->conf.kbytes_per_second * 1024, now);
+	}
+
+	if (con->conf.global_kbytes_per_second) {
+		global_traffic = con->conf.global_traffic_ptr;
+		traffic_bucket_refill(global_traffic, (off_t)con->conf.global_kbytes_per_second * 1024, now);
+	}
+
+	if ((traffic && traffic->tokens <= 0) ||
+	    (global_traffic && global_traffic->tokens <= 0)) {
+		/* we reached the traffic limit, come back when the buckets are filled again */
+
+		network_wait_for_tokens(srv, con, traffic, global_traffic, now);
 
 		return NETWORK_STATUS_WAIT_FOR_AIO_EVENT;
 	}
 
+	/* let the backend write no more than we have tokens for */
+	if (traffic) con->sock->max_write = traffic->tokens;
+	if (global_traffic) {
+		off_t share = global_traffic->burst / TRAFFIC_BUCKET_SHARES;
+
+		if (share > global_traffic->tokens) share = global_traffic->tokens;
+
+		if (con->sock->max_write == -1 || share < con->sock->max_write) con->sock->max_write = share;
+	}
+
 	written = cq->bytes_out;
 
 #ifdef TCP_CORK
@@ -855,6 +985,8 @@ network_status_t network_write_chunkqueue(server *srv, connection *con, chunkque
 		ret = srv->network_backend_write(srv, con, con->sock, cq);
 	}
 
+	con->sock->max_write = -1;
+
 	switch (ret) {
 	case NETWORK_STATUS_WAIT_FOR_FD:
 	case NETWORK_STATUS_WAIT_FOR_AIO_EVENT:
@@ -878,14 +1010,20 @@ network_status_t network_write_chunkqueue(server *srv, connection *con, chunkque
 	con->bytes_written += written;
 	con->bytes_written_cur_second += written;
 
-	*(con->conf.global_bytes_per_second_cnt_ptr) += written;
+	/* the ssl-backend might write more than we allowed, the bucket goes negative then */
+	if (traffic) traffic->tokens -= written;
+	if (global_traffic) global_traffic->tokens -= written;
 
-	if (con->conf.kbytes_per_second &&
-	    (con->bytes_written_cur_second > con->conf.kbytes_per_second * 1024)) {
-		/* we reached the traffic limit */
+	if (ret == NETWORK_STATUS_WAIT_FOR_EVENT &&
+	    ((traffic && traffic->tokens <= 0) ||
+	     (global_traffic && global_traffic->tokens <= 0))) {
+		/* we stopped as the bucket ran empty, not as the socket is full.
+		 * Don't wait for the writable socket, wait for the tokens */
 
-		con->traffic_limit_reached = 1;
-		joblist_append(srv, con);
+		network_wait_for_tokens(srv, con, traffic, global_traffic, now);
+
+		ret = NETWORK_STATUS_WAIT_FOR_AIO_EVENT;
 	}
+
 	return ret;
 }
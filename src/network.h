@@ -7,6 +7,10 @@
 LI_API network_status_t network_write_chunkqueue(server *srv, connection *con, chunkqueue *c);
 LI_API network_status_t network_read(server *srv, connection *con, iosocket *sock, chunkqueue *c);
 
+LI_API int network_can_write_pipe(server *srv, connection *con);
+LI_API int network_can_share_fd(server *srv, connection *con);
+LI_API network_status_t network_read_to_pipe(server *srv, connection *con, iosocket *sock, chunkqueue *cq, off_t max_read);
+
 LI_API int network_init(server *srv);
 LI_API int network_close(server *srv);
 
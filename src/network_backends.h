@@ -21,6 +21,11 @@
 
 LI_API NETWORK_BACKEND_WRITE_CHUNK(writev_mem);
 
+#ifdef USE_LINUX_SPLICE
+LI_API NETWORK_BACKEND_WRITE_CHUNK(splice);
+LI_API network_status_t network_read_chunkqueue_splice(server *srv, connection *con, iosocket *sock, chunkqueue *cq, off_t max_read);
+#endif
+
 LI_API NETWORK_BACKEND_WRITE(write);
 LI_API NETWORK_BACKEND_WRITE(writev);
 LI_API NETWORK_BACKEND_WRITE(linuxsendfile);
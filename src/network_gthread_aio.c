@@ -453,10 +453,7 @@ NETWORK_BACKEND_WRITE(gthreadaio) {
 					c->file.copy.fd = -1;
 				}
 
-				if (c->file.fd != -1) {
-					close(c->file.fd);
-					c->file.fd = -1;
-				}
+				chunk_file_close(c);
 			}
 
 			break;
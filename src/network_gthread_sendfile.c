@@ -226,10 +226,7 @@ NETWORK_BACKEND_WRITE(gthreadsendfile) {
 			if (c->offset == c->file.length) {
 				chunk_finished = 1;
 
-				if (c->file.fd != -1) {
-					close(c->file.fd);
-					c->file.fd = -1;
-				}
+				chunk_file_close(c);
 			} else {
 				/* start this write */
 				write_job *wj;
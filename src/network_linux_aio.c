@@ -346,10 +346,7 @@ NETWORK_BACKEND_WRITE(linuxaiosendfile) {
 						c->file.copy.fd = -1;
 					}
 
-					if (c->file.fd != -1) {
-						close(c->file.fd);
-						c->file.fd = -1;
-					}
+					chunk_file_close(c);
 				}
 
 				/* the chunk is larger and the current snippet is finished */
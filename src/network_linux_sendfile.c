@@ -39,6 +39,9 @@ NETWORK_BACKEND_WRITE(linuxsendfile) {
 		int chunk_finished = 0;
 		network_status_t ret;
 
+		/* the traffic-shaper has no more tokens */
+		if (sock->max_write == 0) return NETWORK_STATUS_WAIT_FOR_EVENT;
+
 		switch(c->type) {
 		case MEM_CHUNK:
 			ret = network_write_chunkqueue_writev_mem(srv, con, sock, cq, c);
@@ -69,6 +72,9 @@ NETWORK_BACKEND_WRITE(linuxsendfile) {
 			toSend = c->file.length - c->offset > ((1 << 30) - 1) ?
 				((1 << 30) - 1) : c->file.length - c->offset;
 
+			/* ... and to the tokens of the traffic-shaper */
+			if (sock->max_write != -1 && (off_t)toSend > sock->max_write) toSend = sock->max_write;
+
 			/* open file if not already opened */
 			if (-1 == c->file.fd) {
 				if (-1 == (c->file.fd = open(c->file.name->ptr, O_RDONLY | (srv->srvconf.use_noatime ? O_NOATIME : 0)))) {
@@ -153,20 +159,30 @@ NETWORK_BACKEND_WRITE(linuxsendfile) {
 
 			c->offset += r;
 			cq->bytes_out += r;
+			if (sock->max_write != -1) sock->max_write -= r;
 
 			if (c->offset == c->file.length) {
 				chunk_finished = 1;
 
 				/* chunk_free() / chunk_reset() will cleanup for us but it is a ok to be faster :) */
 
-				if (c->file.fd != -1) {
-					close(c->file.fd);
-					c->file.fd = -1;
-				}
+				chunk_file_close(c);
 			}
 
 			break;
 		}
+#ifdef USE_LINUX_SPLICE
+		case PIPE_CHUNK:
+			ret = network_write_chunkqueue_splice(srv, con, sock, cq, c);
+
+			if (ret != NETWORK_STATUS_SUCCESS) {
+				return ret;
+			}
+
+			chunk_finished = 1;
+
+			break;
+#endif
 		default:
 
 			log_error_write(srv, __FILE__, __LINE__, "ds", c, "type not known");
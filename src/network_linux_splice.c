@@ -0,0 +1,103 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* we need splice() */
+#endif
+
+#include "network_backends.h"
+
+#ifdef USE_LINUX_SPLICE
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+
+#include "network.h"
+#include "log.h"
+
+/**
+ * move the content of a pipe-chunk to the socket
+ *
+ * the data never leaves the kernel, the pages are handed from the pipe to the socket
+ */
+NETWORK_BACKEND_WRITE_CHUNK(splice) {
+	ssize_t r;
+	off_t toSend;
+
+	UNUSED(srv);
+	UNUSED(con);
+
+	toSend = c->pipe.length - c->offset;
+	if (sock->max_write != -1 && toSend > sock->max_write) toSend = sock->max_write;
+
+	if (-1 == (r = splice(c->pipe.fd[0], NULL, sock->fd, NULL,
+			toSend, SPLICE_F_MOVE | SPLICE_F_NONBLOCK))) {
+		switch (errno) {
+		case EAGAIN:
+		case EINTR:
+			return NETWORK_STATUS_WAIT_FOR_EVENT;
+		case EPIPE:
+		case ECONNRESET:
+			return NETWORK_STATUS_CONNECTION_CLOSE;
+		default:
+			ERROR("splice() to fd=%d failed: %s (%d)", sock->fd, strerror(errno), errno);
+			return NETWORK_STATUS_FATAL_ERROR;
+		}
+	}
+
+	c->offset += r;
+	cq->bytes_out += r;
+	if (sock->max_write != -1) sock->max_write -= r;
+
+	return chunk_is_done(c) ? NETWORK_STATUS_SUCCESS : NETWORK_STATUS_WAIT_FOR_EVENT;
+}
+
+/**
+ * move up to max_read bytes from the socket into a new pipe-chunk
+ *
+ * the pipe takes what fits into it, usually 64kb
+ */
+network_status_t network_read_chunkqueue_splice(server *srv, connection *con, iosocket *sock, chunkqueue *cq, off_t max_read) {
+	chunk *c;
+	ssize_t r;
+
+	UNUSED(srv);
+	UNUSED(con);
+
+	if (NULL == (c = chunkqueue_get_append_pipe(cq))) {
+		switch (errno) {
+		case EMFILE:
+		case ENFILE:
+			return NETWORK_STATUS_WAIT_FOR_FD;
+		default:
+			ERROR("pipe() failed: %s (%d)", strerror(errno), errno);
+			return NETWORK_STATUS_FATAL_ERROR;
+		}
+	}
+
+	r = splice(sock->fd, NULL, c->pipe.fd[1], NULL, max_read, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+	if (r > 0) {
+		c->pipe.length = r;
+		cq->bytes_in += r;
+
+		return NETWORK_STATUS_SUCCESS;
+	}
+
+	/* the pipe goes back into the pool */
+	chunkqueue_remove_empty_last_chunk(cq);
+
+	if (r == 0) return NETWORK_STATUS_CONNECTION_CLOSE;
+
+	switch (errno) {
+	case EAGAIN:
+	case EINTR:
+		return NETWORK_STATUS_WAIT_FOR_EVENT;
+	case ECONNRESET:
+		return NETWORK_STATUS_CONNECTION_CLOSE;
+	default:
+		ERROR("splice() from fd=%d failed: %s (%d)", sock->fd, strerror(errno), errno);
+		return NETWORK_STATUS_FATAL_ERROR;
+	}
+}
+
+#endif
@@ -435,10 +435,7 @@ NETWORK_BACKEND_WRITE(posixaio) {
 						c->file.copy.fd = -1;
 					}
 
-					if (c->file.fd != -1) {
-						close(c->file.fd);
-						c->file.fd = -1;
-					}
+					chunk_file_close(c);
 				}
 
 				/* the chunk is larger and the current snippet is finished */
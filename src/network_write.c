@@ -28,17 +28,33 @@
 #endif
 
 
+#ifdef HAVE_SYS_UIO_H
+# include <sys/uio.h>
+#endif
+
+/* the read buffer shared by all connections of this process */
+#define NETWORK_READ_BUF_SIZE (64 * 1024)
+static char network_read_buf[NETWORK_READ_BUF_SIZE];
+
+/* append to the last chunk if it has at least this much room left */
+#define NETWORK_READ_MIN_ROOM 1024
+
 /**
 * fill the chunkqueue will all the data that we can get
 *
-* this might be optimized into a readv() which uses the chunks
-* as vectors
+* Small reads go into the free room of the last chunk and into a buffer
+* shared by all connections, only what arrived is copied into a chunk of
+* the right size. If a read filled the shared buffer and the kernel tells
+* us (FIONREAD) that more is waiting than fits into it, we read directly
+* into a chunk which is large enough. A connection which waits for data
+* holds no buffer at all.
 */
 NETWORK_BACKEND_READ(read) {
-	int toread, read_offset;
 	buffer *b;
 	off_t r, start_bytes_in;
 	off_t max_read = 256 * 1024;
+	size_t toread, room;
+	int avail;
 
 	/**
 	 * a EAGAIN is a successful read if we already read something to the chunkqueue
@@ -50,25 +66,74 @@ NETWORK_BACKEND_READ(read) {
 
 	start_bytes_in = cq->bytes_in;
 
-	/* use a chunk-size of 4k, append to last buffer if it has >= 1kb free */
-#define TOREAD 4096
-
 	do {
-		b = (cq->last) ? cq->last->mem : NULL;
+		avail = 0;
+#ifdef FIONREAD
+		/* we only get here again if the last read filled the buffers,
+		 * most reads are small and don't need the extra syscall */
+		if (read_something && 0 != ioctl(sock->fd, FIONREAD, &avail)) avail = 0;
+#endif
+
+		b = (cq->last && cq->last->type == MEM_CHUNK) ? cq->last->mem : NULL;
+		room = (b && b->used > 0 && b->size - b->used >= NETWORK_READ_MIN_ROOM) ? b->size - b->used : 0;
+
+		if ((size_t)avail > room + NETWORK_READ_BUF_SIZE) {
+			/* a large request body: one read into a chunk of the right size */
+			toread = avail;
+			if ((off_t)toread > max_read) toread = max_read;
 
-		if (NULL == b || b->size - b->used < 1024) {
 			b = chunkqueue_get_append_buffer(cq);
-			buffer_prepare_copy(b, TOREAD+1);
-		}
+			buffer_prepare_copy(b, toread + 1);
+
+			r = read(sock->fd, b->ptr, toread);
+
+			if (r > 0) {
+				b->used = r;
+				b->ptr[b->used++] = '\0';
+			} else {
+				chunkqueue_remove_empty_last_chunk(cq);
+			}
+		} else {
+#ifdef HAVE_SYS_UIO_H
+			struct iovec iov[2];
+			int iovcnt = 0;
+
+			if (room) {
+				iov[iovcnt].iov_base = b->ptr + b->used - 1;
+				iov[iovcnt].iov_len = room;
+				iovcnt++;
+			}
+
+			iov[iovcnt].iov_base = network_read_buf;
+			iov[iovcnt].iov_len = NETWORK_READ_BUF_SIZE;
+			iovcnt++;
+
+			toread = room + NETWORK_READ_BUF_SIZE;
+
+			r = readv(sock->fd, iov, iovcnt);
+#else
+			room = 0;
+			toread = NETWORK_READ_BUF_SIZE;
+
+			r = read(sock->fd, network_read_buf, toread);
+#endif
 
-		read_offset = (b->used == 0) ? 0 : b->used - 1;
-		toread = b->size - 1 - read_offset;
+			if (r > 0) {
+				size_t in_room = ((size_t)r > room) ? room : (size_t)r;
 
-		if (-1 == (r = read(sock->fd, b->ptr + read_offset, toread))) {
+				if (in_room) {
+					b->used += in_room;
+					b->ptr[b->used - 1] = '\0';
+				}
+
+				/* the rest landed in the shared buffer */
+				chunkqueue_append_mem(cq, network_read_buf, r - in_room);
+			}
+		}
+
+		if (-1 == r) {
 			switch (errno) {
 			case EAGAIN:
-				/* remove the last chunk from the chunkqueue */
-				chunkqueue_remove_empty_last_chunk(cq);
 				return read_something ? NETWORK_STATUS_SUCCESS : NETWORK_STATUS_WAIT_FOR_EVENT;
 			case ECONNRESET:
 				return NETWORK_STATUS_CONNECTION_CLOSE;
@@ -80,20 +145,15 @@ NETWORK_BACKEND_READ(read) {
 		}
 
 		if (r == 0) {
-			chunkqueue_remove_empty_last_chunk(cq);
 			return read_something ? NETWORK_STATUS_SUCCESS : NETWORK_STATUS_CONNECTION_CLOSE;
 		}
 
 		read_something = 1;
 
-		if (b->used > 0) b->used--;
-		b->used += r;
-		b->ptr[b->used++] = '\0';
-
 		cq->bytes_in += r;
 
 		if (cq->bytes_in - start_bytes_in > max_read) break;
-	} while (r == toread);
+	} while ((size_t)r == toread);
 
 	return NETWORK_STATUS_SUCCESS;
 }
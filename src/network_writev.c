@@ -91,6 +91,13 @@ NETWORK_BACKEND_WRITE_CHUNK(writev_mem) {
 			    num_bytes + toSend > SSIZE_MAX) {
 				chunks[i].iov_len = SSIZE_MAX - num_bytes;
 
+				num_chunks = i + 1;
+				break;
+			} else if (sock->max_write != -1 &&
+			           (off_t)(num_bytes + toSend) > sock->max_write) {
+				/* the traffic-shaper has no more tokens */
+				chunks[i].iov_len = sock->max_write - num_bytes;
+
 				num_chunks = i + 1;
 				break;
 			} else {
@@ -119,6 +126,7 @@ NETWORK_BACKEND_WRITE_CHUNK(writev_mem) {
 	}
 
 	cq->bytes_out += r;
+	if (sock->max_write != -1) sock->max_write -= r;
 
 	/* check which chunks have been written */
 
@@ -147,6 +155,9 @@ NETWORK_BACKEND_WRITE(writev) {
 		int chunk_finished = 0;
 		network_status_t ret;
 
+		/* the traffic-shaper has no more tokens */
+		if (sock->max_write == 0) return NETWORK_STATUS_WAIT_FOR_EVENT;
+
 		switch(c->type) {
 		case MEM_CHUNK:
 			ret = network_write_chunkqueue_writev_mem(srv, con, sock, cq, c);
@@ -299,6 +310,8 @@ NETWORK_BACKEND_WRITE(writev) {
 				assert(toSend < 0);
 			}
 
+			if (sock->max_write != -1 && toSend > sock->max_write) toSend = sock->max_write;
+
 #ifdef LOCAL_BUFFERING
 			start = c->mem->ptr;
 #else
@@ -323,6 +336,7 @@ NETWORK_BACKEND_WRITE(writev) {
 
 			c->offset += r;
 			cq->bytes_out += r;
+			if (sock->max_write != -1) sock->max_write -= r;
 
 			if (c->offset == c->file.length) {
 				chunk_finished = 1;
@@ -0,0 +1,66 @@
+#include <stdlib.h>
+
+#include "pcre-glue.h"
+
+#ifdef HAVE_PCRE_H
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+/* the 32k the JIT uses by default are too small for long subjects like the files of mod_ssi */
+#define PCRE_GLUE_JIT_STACK_MIN (32 * 1024)
+#define PCRE_GLUE_JIT_STACK_MAX (1024 * 1024)
+
+static pcre_jit_stack *jit_stack = NULL;
+#endif
+
+pcre *pcre_glue_compile(const char *pattern, int options, pcre_extra **extra, const char **errptr, int *erroff) {
+	pcre *regex;
+	int study_options = 0;
+
+	*extra = NULL;
+
+	if (NULL == (regex = pcre_compile(pattern, options, errptr, erroff, NULL))) {
+		return NULL;
+	}
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+	study_options |= PCRE_STUDY_JIT_COMPILE;
+#endif
+
+	if (NULL == (*extra = pcre_study(regex, study_options, errptr)) && *errptr != NULL) {
+		*erroff = 0;
+		pcre_free(regex);
+
+		return NULL;
+	}
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+	if (*extra) {
+		int is_jit = 0;
+
+		/* without JIT support in the lib the pattern is just studied */
+		if (0 == pcre_fullinfo(regex, *extra, PCRE_INFO_JIT, &is_jit) && is_jit) {
+			if (NULL == jit_stack) {
+				jit_stack = pcre_jit_stack_alloc(PCRE_GLUE_JIT_STACK_MIN, PCRE_GLUE_JIT_STACK_MAX);
+			}
+
+			if (jit_stack) pcre_assign_jit_stack(*extra, NULL, jit_stack);
+		}
+	}
+#endif
+
+	return regex;
+}
+
+void pcre_glue_free(pcre *regex, pcre_extra *extra) {
+	if (extra) {
+#ifdef PCRE_STUDY_JIT_COMPILE
+		pcre_free_study(extra);
+#else
+		pcre_free(extra);
+#endif
+	}
+
+	if (regex) pcre_free(regex);
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef _PCRE_GLUE_H_
+#define _PCRE_GLUE_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+
+#include "settings.h"
+
+#ifdef HAVE_PCRE_H
+# include <pcre.h>
+
+/**
+ * compile and study a regex the same way for all its users
+ *
+ * If the libpcre supports it the pattern is JIT compiled and shares one
+ * JIT stack with the others. A worker only runs one match at a time, the
+ * stack is allocated on the first use and never freed.
+ *
+ * @param extra the study data, NULL if the pattern doesn't need any
+ * @return NULL if the pattern doesn't compile, errptr and erroff tell why
+ */
+LI_API pcre *pcre_glue_compile(const char *pattern, int options, pcre_extra **extra, const char **errptr, int *erroff);
+
+/**
+ * free the regex and the study data (including the JIT code)
+ */
+LI_API void pcre_glue_free(pcre *regex, pcre_extra *extra);
+
+#endif
+
+#endif
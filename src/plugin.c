@@ -5,10 +5,16 @@
 
 #include "plugin.h"
 #include "log.h"
+#include "status_counter.h"
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
+#ifdef HAVE_SYS_TIME_H
+/* gettimeofday() for the hook timing */
+#include <sys/time.h>
+#endif
+
 #include "sys-files.h"
 
 #ifndef _WIN32
@@ -52,6 +58,25 @@ typedef enum {
 		PLUGIN_FUNC_SIZEOF
 } plugin_t;
 
+/**
+ * debug.plugin-timing = "enable"
+ *
+ * the time each hook of a plugin takes is measured and shows up in the
+ * statistics as plugin.<name>.<hook>.{calls,msec,latency.*}
+ */
+#define PLUGIN_TIMING_BUCKETS 5
+
+static const char *timing_names[PLUGIN_TIMING_BUCKETS] = { "0-10us", "10-100us", "100us-1ms", "1-10ms", "10ms-" };
+static const long timing_limits[PLUGIN_TIMING_BUCKETS - 1] = { 10, 100, 1000, 10000 };
+
+typedef struct {
+	data_integer *calls;
+	data_integer *msec;
+	data_integer *hist[PLUGIN_TIMING_BUCKETS];
+
+	unsigned long long usec; /* msec would lose the short calls */
+} plugin_timing;
+
 static plugin *plugin_init(void) {
 	plugin *p;
 
@@ -66,6 +91,7 @@ static void plugin_free(plugin *p) {
 	int use_dlclose = 1;
 
 	if (p->name) buffer_free(p->name);
+	if (p->timing) free(p->timing);
 
 	array_free(p->required_plugins);
 
@@ -343,6 +369,74 @@ int plugins_load(server *srv) {
 	return 0;
 }
 
+/* the counter <prefix><suffix> */
+static data_integer *plugin_timing_counter(server *srv, buffer *prefix, const char *suffix) {
+	buffer_copy_string_buffer(srv->tmp_buf, prefix);
+	buffer_append_string(srv->tmp_buf, suffix);
+
+	return status_counter_get_counter(CONST_BUF_LEN(srv->tmp_buf));
+}
+
+static void plugin_timing_create(server *srv, plugin *p, plugin_t slot, const char *hook) {
+	plugin_timing *t;
+	buffer *prefix;
+	size_t i;
+
+	if (!p->timing) p->timing = calloc(PLUGIN_FUNC_SIZEOF, sizeof(plugin_timing));
+
+	t = &(((plugin_timing *)p->timing)[slot]);
+
+	/* plugin.<name>.<hook>. */
+	prefix = buffer_init_string("plugin.");
+	buffer_append_string_buffer(prefix, p->name);
+	buffer_append_string_len(prefix, CONST_STR_LEN("."));
+	buffer_append_string(prefix, hook);
+	buffer_append_string_len(prefix, CONST_STR_LEN("."));
+
+	t->calls = plugin_timing_counter(srv, prefix, "calls");
+	t->msec = plugin_timing_counter(srv, prefix, "msec");
+
+	buffer_append_string_len(prefix, CONST_STR_LEN("latency."));
+
+	for (i = 0; i < PLUGIN_TIMING_BUCKETS; i++) {
+		t->hist[i] = plugin_timing_counter(srv, prefix, timing_names[i]);
+	}
+
+	buffer_free(prefix);
+}
+
+static void plugin_timing_add(plugin_timing *t, struct timeval *start) {
+	struct timeval now;
+	long usec;
+	size_t i;
+
+	gettimeofday(&now, NULL);
+
+	usec = (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_usec - start->tv_usec);
+	if (usec < 0) usec = 0; /* the clock was set back */
+
+	t->usec += usec;
+
+	COUNTER_INC(t->calls);
+	COUNTER_SET(t->msec, t->usec / 1000);
+
+	for (i = 0; i < PLUGIN_TIMING_BUCKETS - 1 && usec >= timing_limits[i]; i++);
+	COUNTER_INC(t->hist[i]);
+}
+
+/**
+ * call the hook and measure its time if debug.plugin-timing is set
+ */
+#define PLUGIN_TIMED_CALL(r, p, x, call) \
+	if (p->timing) {\
+		struct timeval start;\
+		gettimeofday(&start, NULL);\
+		r = call;\
+		plugin_timing_add(&(((plugin_timing *)p->timing)[x]), &start);\
+	} else {\
+		r = call;\
+	}
+
 #define PLUGIN_TO_SLOT(x, y) \
 	handler_t plugins_call_##y(server *srv, connection *con) {\
 		plugin **slot;\
@@ -353,7 +447,8 @@ int plugins_load(server *srv) {
 		for (j = 0; j < srv->plugins.used && slot[j]; j++) { \
 			plugin *p = slot[j];\
 			handler_t r;\
-			switch(r = p->y(srv, con, p->data)) {\
+			PLUGIN_TIMED_CALL(r, p, x, p->y(srv, con, p->data));\
+			switch(r) {\
 			case HANDLER_GO_ON:\
 				break;\
 			case HANDLER_FINISHED:\
@@ -405,7 +500,8 @@ PLUGIN_TO_SLOT(PLUGIN_FUNC_CONNECTION_RESET, connection_reset)
 		for (j = 0; j < srv->plugins.used && slot[j]; j++) { \
 			plugin *p = slot[j];\
 			handler_t r;\
-			switch(r = p->y(srv, p->data)) {\
+			PLUGIN_TIMED_CALL(r, p, x, p->y(srv, p->data));\
+			switch(r) {\
 			case HANDLER_GO_ON:\
 				break;\
 			case HANDLER_FINISHED:\
@@ -506,6 +602,9 @@ handler_t plugins_call_init(server *srv) {
 			slot[j] = p;\
 			break;\
 		}\
+		if (srv->srvconf.plugin_timing && x != PLUGIN_FUNC_CLEANUP && x != PLUGIN_FUNC_SET_DEFAULTS) { \
+			plugin_timing_create(srv, p, x, #y); \
+		} \
 	}
 
 
@@ -74,6 +74,9 @@ typedef struct {
 	/* dlopen handle */
 	void *lib;
 
+	/* the latency of the hooks, NULL if debug.plugin-timing is disabled */
+	void *timing;
+
 	array *required_plugins;
 } plugin;
 
@@ -106,9 +109,60 @@ LI_EXPORT int config_insert_values_internal(server *srv, array *ca, const config
 LI_EXPORT int config_setup_connection(server *srv, connection *con);
 LI_EXPORT int config_patch_connection(server *srv, connection *con, comp_key_t comp);
 LI_EXPORT int config_check_cond(server *srv, connection *con, data_config *dc);
+LI_EXPORT int config_check_cond_matched(server *srv, connection *con, data_config *dc);
 LI_EXPORT int config_append_cond_match_buffer(connection *con, data_config *dc, buffer *buf, int n);
 LI_EXPORT int config_exec_pcre_keyvalue_buffer(connection *con, pcre_keyvalue_buffer *kvb, data_config *context, buffer *match_buf, buffer *result);
 
 LI_EXPORT void* plugin_get_config(server *srv, const char *name);
 
+/**
+ * memoized patch_connection()
+ *
+ * the config of a plugin for a request only depends on which conditionals
+ * are true. The results of all conditionals are kept as a bitmap in the
+ * connection, it is only rebuilt if a conditional might have changed. The
+ * merged config of a plugin is kept for each bitmap, the next request with
+ * the same bitmap just copies it.
+ *
+ * the keys of the options are resolved at startup, bit n of the opts is
+ * the n-th key of the config_values_t of set_defaults().
+ */
+typedef struct {
+	size_t context_ndx;  /* the index in srv->config_context */
+	unsigned int opts;   /* the options the conditional sets */
+} config_patch_context;
+
+struct config_patch_entry;
+
+typedef struct {
+	config_patch_context *contexts; /* the conditionals which set at least one of our options */
+	size_t used;
+
+	size_t conf_size;               /* sizeof(plugin_config) */
+	size_t key_len;                 /* length of con->cond_matched */
+
+	struct config_patch_entry **hash;
+	size_t entries;
+} config_patch_cache;
+
+#define CONFIG_PATCH_MATCHED(con, pc, i) \
+		((con)->cond_matched[(pc)->contexts[i].context_ndx >> 3] & (1 << ((pc)->contexts[i].context_ndx & 7)))
+#define CONFIG_PATCH_OPT(pc, i, n) \
+		((pc)->contexts[i].opts & (1U << (n)))
+
+LI_EXPORT config_patch_cache *config_patch_cache_init(server *srv, const config_values_t *cv, size_t conf_size);
+LI_EXPORT void config_patch_cache_free(config_patch_cache *pc);
+
+/**
+ * look up the merged config for the conditionals of the current request
+ *
+ * @return the merged config if the combination was seen before, NULL otherwise
+ */
+LI_EXPORT const void *config_patch_cache_get(server *srv, connection *con, config_patch_cache *pc);
+
+/**
+ * remember the merged config for the conditionals of the current request
+ */
+LI_EXPORT void config_patch_cache_insert(connection *con, config_patch_cache *pc, const void *conf);
+
 #endif
@@ -8,6 +8,7 @@
 #include <errno.h>
 
 #include "request.h"
+#include "response.h"
 #include "keyvalue.h"
 #include "log.h"
 #include "http_req.h"
@@ -339,10 +340,9 @@ int http_request_parse(server *srv, connection *con, http_req *req) {
 	for (i = 0; i < req->headers->used; i++) {
 		data_string *ds = (data_string *)req->headers->data[i];
 		data_string *hdr;
-		int cmp;
 
-		/* this list is sorted */
-		if (0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("Connection")))) {
+		switch (get_http_header_key(CONST_BUF_LEN(ds->key))) {
+		case HTTP_HEADER_CONNECTION: {
 			array *vals;
 			size_t vi;
 			/* Connection: Keep-Alive, ... */
@@ -365,7 +365,9 @@ int http_request_parse(server *srv, connection *con, http_req *req) {
 					break;
 				}
 			}
-		} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("Content-Length")))) {
+			break;
+		}
+		case HTTP_HEADER_CONTENT_LENGTH: {
 			char *err;
 			off_t r;
 
@@ -414,7 +416,9 @@ int http_request_parse(server *srv, connection *con, http_req *req) {
 			}
 
 			con->request.content_length = r;
-		} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("Expect")))) {
+			break;
+		}
+		case HTTP_HEADER_EXPECT:
 			/* HTTP 2616 8.2.3
 			 * Expect: 100-continue
 			 *
@@ -435,7 +439,8 @@ int http_request_parse(server *srv, connection *con, http_req *req) {
 				con->http_status = 417;
 				return 0;
 			}
-		} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("Host")))) {
+			break;
+		case HTTP_HEADER_HOST:
 			if (request_check_hostname(ds->value)) {
 				TRACE("Host header is invalid (Status: 400), was %s", SAFE_BUF_STR(ds->value));
 				con->http_status = 400;
@@ -452,10 +457,11 @@ int http_request_parse(server *srv, connection *con, http_req *req) {
 			}
 
 			buffer_copy_string_buffer(con->request.http_host, ds->value);
-		} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("If-Modified-Since")))) {
+			break;
+		case HTTP_HEADER_IF_MODIFIED_SINCE: {
 			data_string *old;
 
-			if (NULL != (old = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("If-Modified-Since")))) {
+			if (NULL != (old = http_request_get_header(con, HTTP_HEADER_IF_MODIFIED_SINCE))) {
 				if (0 != buffer_caseless_compare(CONST_BUF_LEN(old->value), CONST_BUF_LEN(ds->value))) {
 					/* duplicate header and different timestamps */
 					con->http_status = 400;
@@ -465,14 +471,16 @@ int http_request_parse(server *srv, connection *con, http_req *req) {
 					return 0;
 				}
 			}
-		} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("If-None-Match")))) {
-			data_string *old;
+			break;
+		}
+		case HTTP_HEADER_IF_NONE_MATCH:
 			/* if dup, only the first one will survive */
-			if (NULL != (old = (data_string *)array_get_element(con->request.headers, CONST_STR_LEN("If-None-Match")))) {
+			if (NULL != http_request_get_header(con, HTTP_HEADER_IF_NONE_MATCH)) {
 				continue;
 			}
-		} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("Range")))) {
-			if (NULL != array_get_element(con->request.headers, CONST_STR_LEN("Range"))) { 
+			break;
+		case HTTP_HEADER_RANGE:
+			if (NULL != http_request_get_header(con, HTTP_HEADER_RANGE)) {
 				/* duplicate Range header */
 
 				TRACE("%s", "Range: header is duplicate (Status: 400)");
@@ -482,6 +490,9 @@ int http_request_parse(server *srv, connection *con, http_req *req) {
 
 				return 0;
 			}
+			break;
+		default:
+			break;
 		}
 
 		if (NULL == (hdr = (data_string *)array_get_unused_element(con->request.headers, TYPE_STRING))) {
@@ -491,7 +502,7 @@ int http_request_parse(server *srv, connection *con, http_req *req) {
 		buffer_copy_string_buffer(hdr->key, ds->key);
 		buffer_copy_string_buffer(hdr->value, ds->value);
 
-		array_insert_unique(con->request.headers, (data_unset *)hdr);
+		http_request_insert_header(con, hdr);
 	}
 
 
@@ -13,9 +13,16 @@ LI_API int http_response_write_header(server *srv, connection *con, chunkqueue *
 LI_API int response_header_insert(server *srv, connection *con, const char *key, size_t keylen, const char *value, size_t vallen);
 LI_API int response_header_overwrite(server *srv, connection *con, const char *key, size_t keylen, const char *value, size_t vallen);
 
+/**
+ * the well-known request headers without a lookup by name
+ *
+ * all request headers have to be added with http_request_insert_header(),
+ * otherwise they are missing in the index
+ */
+LI_API data_string *http_request_get_header(connection *con, http_header_t id);
+LI_API void http_request_insert_header(connection *con, data_string *ds);
+
 LI_API handler_t handle_get_backend(server *srv, connection *con);
 LI_API int http_response_redirect_to_directory(server *srv, connection *con);
 LI_API int http_response_handle_cachable(server *srv, connection *con, buffer * mtime);
-
-LI_API buffer * strftime_cache_get(server *srv, time_t last_mod);
 #endif
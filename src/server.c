@@ -35,6 +35,7 @@
 #include "stat_cache.h"
 #include "plugin.h"
 #include "joblist.h"
+#include "traffic_shaper.h"
 #include "status_counter.h"
 
 /**
@@ -254,6 +255,9 @@ static server *server_init(void) {
 	srv->fdwaitqueue = calloc(1, sizeof(*srv->fdwaitqueue));
 	assert(srv->fdwaitqueue);
 
+	srv->pacing = calloc(1, sizeof(*srv->pacing));
+	assert(srv->pacing);
+
 	srv->srvconf.modules = array_init();
 	srv->srvconf.modules_dir = buffer_init_string(LIBRARY_DIR);
 	srv->srvconf.network_backend = buffer_init();
@@ -349,6 +353,8 @@ static void server_free(server *srv) {
 		srv->config_storage = NULL;
 	}
 
+	config_cond_index_free(srv);
+
 #define CLEAN(x) \
 	array_free(srv->x);
 
@@ -360,6 +366,7 @@ static void server_free(server *srv) {
 	joblist_free(srv, srv->joblist);
 	joblist_free(srv, srv->joblist_prev);
 	fdwaitqueue_free(srv, srv->fdwaitqueue);
+	traffic_shaper_free(srv, srv->pacing);
 
 	if (srv->stat_cache) {
 		stat_cache_free(srv->stat_cache);
@@ -655,7 +662,6 @@ static int lighty_mainloop(server *srv) {
 				for (ndx = 0; ndx < conns->used; ndx++) {
 					int changed = 0;
 					connection *con;
-					int t_diff;
 
 					con = conns->ptr[ndx];
 
@@ -718,23 +724,10 @@ static int lighty_mainloop(server *srv) {
 						/* the other ones are uninteresting */
 						break;
 					}
-					/* we don't like div by zero */
-					if (0 == (t_diff = srv->cur_ts - con->connection_start)) t_diff = 1;
-
-					if (con->traffic_limit_reached &&
-					    (con->conf.kbytes_per_second == 0 ||
-					     ((con->bytes_written / t_diff) < con->conf.kbytes_per_second * 1024))) {
-						/* enable connection again */
-						con->traffic_limit_reached = 0;
-
-						changed = 1;
-					}
-
 					if (changed) {
 						connection_state_machine(srv, con);
 					}
 					con->bytes_written_cur_second = 0;
-					*(con->conf.global_bytes_per_second_cnt_ptr) = 0;
 
 #if 0
 					if (cs == 0) {
@@ -866,7 +859,7 @@ static int lighty_mainloop(server *srv) {
 				connection_state_machine(srv, con);
 			}
 		}
-		n = fdevent_poll(srv->ev, 1000);
+		n = fdevent_poll(srv->ev, traffic_shaper_get_timeout(srv, 1000));
 		poll_errno = errno;
 #ifdef USE_GTHREAD
 		g_atomic_int_set(&srv->did_wakeup, 0);
@@ -939,6 +932,9 @@ static int lighty_mainloop(server *srv) {
 			ERROR("fdevent_poll failed: %s", strerror(poll_errno));
 		}
 
+		/* the connections which have tokens again */
+		traffic_shaper_wakeup(srv);
+
 		/*
 		 * Note: Two joblist's are needed so a connection can be added back into the joblist
 		 * without getting stuck inside the for loop.
@@ -1427,6 +1423,8 @@ int main (int argc, char **argv, char **envp) {
 		return -1;
 	}
 
+	config_cond_index_build(srv);
+
 	/* dump unused config-keys */
 	for (i = 0; i < srv->config_context->used; i++) {
 		array *config = ((data_config *)srv->config_context->data[i])->value;
@@ -8,6 +8,8 @@ typedef enum { CONFIG_UNSET, CONFIG_DOCUMENT_ROOT } config_var_t;
 LI_EXPORT int config_read(server *srv, const char *fn);
 LI_EXPORT int config_set_defaults(server *srv);
 LI_EXPORT buffer * config_get_value_buffer(server *srv, connection *con, config_var_t field);
+LI_EXPORT void config_cond_index_build(server *srv);
+LI_EXPORT void config_cond_index_free(server *srv);
 
 #ifdef USE_GTHREAD
 gpointer stat_cache_thread(gpointer );
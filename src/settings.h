@@ -7,8 +7,9 @@
 
 #define BV(x) (1 << x)
 
-#define INET_NTOP_CACHE_MAX 4
-#define FILE_CACHE_MAX      16
+/* the slots of the hashed caches of address and date strings */
+#define INET_NTOP_CACHE_MAX 1024
+#define FILE_CACHE_MAX      1024
 
 /**
  * max size of a buffer which will just be reset
@@ -26,6 +27,13 @@
  */
 #define MAX_HTTP_REQUEST_HEADER  (32 * 1024)
 
+/**
+ * max request-content we buffer for a handler which streams it
+ *
+ * reading from the client stops until the handler took the content
+ */
+#define MAX_REQUEST_CONTENT_STREAM_BUFFER  (64 * 1024)
+
 #ifdef HAVE_GLIB_H
 #include <glib.h>
 #endif
@@ -47,6 +55,11 @@
 # include <sys/uio.h>
 #endif
 
+/* splice() moves data between a socket and a pipe without copying it to userspace */
+#if defined HAVE_SPLICE && defined USE_LINUX_SENDFILE
+# define USE_LINUX_SPLICE
+#endif
+
 /* all the Async IO backends need GTHREAD support */
 #if defined(USE_GTHREAD)
 # if defined(USE_LINUX_SENDFILE)
@@ -172,17 +172,37 @@ static stat_cache_entry * stat_cache_entry_init(void) {
 	sce->name = buffer_init();
 	sce->etag = buffer_init();
 	sce->content_type = buffer_init();
+	sce->response_etag = buffer_init();
+	sce->last_modified = buffer_init();
 
 	return sce;
 }
 
-static void stat_cache_entry_free(void *data) {
-	stat_cache_entry *sce = data;
+/**
+ * forget what we know about the file, the connections which still send it keep the fd
+ */
+static void stat_cache_entry_reset(stat_cache *sc, stat_cache_entry *sce) {
+	if (sce->fd) {
+		chunk_fd_release(sce->fd);
+		sce->fd = NULL;
+
+		sc->open_fds--;
+	}
+
+	buffer_reset(sce->response_etag);
+	buffer_reset(sce->last_modified);
+}
+
+static void stat_cache_entry_free(stat_cache *sc, stat_cache_entry *sce) {
 	if (!sce) return;
 
+	stat_cache_entry_reset(sc, sce);
+
 	buffer_free(sce->etag);
 	buffer_free(sce->name);
 	buffer_free(sce->content_type);
+	buffer_free(sce->response_etag);
+	buffer_free(sce->last_modified);
 
 	free(sce);
 }
@@ -191,10 +211,10 @@ static void stat_cache_entry_free(void *data) {
 static gboolean stat_cache_free_hrfunc(gpointer _key, gpointer _value, gpointer _user_data) {
 	stat_cache_entry *sce = _value;
 	buffer *b = _key;
-	UNUSED(_user_data);
+	stat_cache *sc = _user_data;
 
 	buffer_free(b);
-	stat_cache_entry_free(sce);
+	stat_cache_entry_free(sc, sce);
 
 	return TRUE;
 }
@@ -202,7 +222,7 @@ static gboolean stat_cache_free_hrfunc(gpointer _key, gpointer _value, gpointer
 
 void stat_cache_free(stat_cache *sc) {
 #ifdef HAVE_GLIB_H
-	g_hash_table_foreach_remove(sc->files, stat_cache_free_hrfunc, NULL);
+	g_hash_table_foreach_remove(sc->files, stat_cache_free_hrfunc, sc);
 	g_hash_table_destroy(sc->files);
 #endif
 
@@ -274,6 +294,10 @@ static int stat_cache_entry_is_current(server *srv, stat_cache_entry *sce) {
 		return 0; /* different file */
 	}
 
+	if (st.st_mtime != sce->st.st_mtime || st.st_size != sce->st.st_size) {
+		return 0; /* changed in place, the etag and the cached headers are outdated */
+	}
+
 	/* same file, still existing: update other stats: */
 	sce->st = st;
 	/* need to check other properties before this: sce->stat_ts = srv->cur_ts; */
@@ -286,10 +310,10 @@ static void stat_cache_remove_entry(stat_cache *sc, buffer *hash_key, stat_cache
 	if (!g_hash_table_lookup_extended(sc->files, hash_key, &orig_key, NULL))
 		return;
 	g_hash_table_remove(sc->files, hash_key);
-	stat_cache_entry_free(sce);
+	stat_cache_entry_free(sc, sce);
 	buffer_free((buffer*) orig_key);
 #else
-	stat_cache_entry_free(sce);
+	stat_cache_entry_free(sc, sce);
 #endif
 }
 
@@ -407,7 +431,25 @@ static handler_t stat_cache_get_entry_internal(server *srv, connection *con, buf
 		return HANDLER_ERROR;
 	}
 
+	stat_cache_entry_reset(sc, sce);
+
+#ifdef HAVE_GLIB_H
+	/* keep regular files open for the network-backends, a cache-hit doesn't have to open() them again
+	 *
+	 * leave most of the fds to the connections */
+	if (S_ISREG(st.st_mode) && sc->open_fds < (size_t)srv->max_fds / 4) {
+#ifdef FD_CLOEXEC
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+		sce->fd = chunk_fd_init(fd);
+		sc->open_fds++;
+	} else {
+		close(fd);
+	}
+#else
+	/* without glib the entry isn't cached */
 	close(fd);
+#endif
 
 	sce->st = st;
 	sce->stat_ts = srv->cur_ts;
@@ -539,7 +581,7 @@ static gboolean stat_cache_remove_old_entry(gpointer _key, gpointer _value, gpoi
 	if (sce->state == STAT_CACHE_ENTRY_STAT_FINISHED && 
 	    srv->cur_ts - sce->stat_ts > 10) {
 		buffer_free(key);
-		stat_cache_entry_free(sce);
+		stat_cache_entry_free(srv->stat_cache, sce);
 		
 		return TRUE;
 	}
@@ -0,0 +1,37 @@
+#include <time.h>
+
+#include "base.h"
+#include "buffer.h"
+#include "strftime_cache.h"
+
+/* the slot of a mtime, the cache is direct mapped */
+static size_t strftime_cache_ndx(time_t last_mod) {
+	uint32_t h = (uint32_t)last_mod;
+
+	/* the files of a deployment differ in a few seconds, spread them over all bits */
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+
+	return h % FILE_CACHE_MAX;
+}
+
+buffer * strftime_cache_get(server *srv, time_t last_mod) {
+	mtime_cache_type *e = &(srv->mtime_cache[strftime_cache_ndx(last_mod)]);
+	struct tm *tm;
+
+	/* found cache-entry */
+	if (e->mtime == last_mod && e->str->used) return e->str;
+
+	e->mtime = last_mod;
+	buffer_prepare_copy(e->str, 32); /* "Thu, 01 Jan 1970 00:00:00 GMT" */
+	tm = gmtime(&(e->mtime));
+	e->str->used = strftime(e->str->ptr,
+				e->str->size - 1,
+				"%a, %d %b %Y %H:%M:%S GMT", tm);
+	e->str->used++;
+
+	return e->str;
+}
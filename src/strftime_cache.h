@@ -0,0 +1,15 @@
+#ifndef _STRFTIME_CACHE_H_
+#define _STRFTIME_CACHE_H_
+
+#include <time.h>
+
+#include "base.h"
+
+/**
+ * the HTTP-date of a mtime, for Last-Modified
+ *
+ * @return a buffer which is valid until another mtime takes its slot
+ */
+LI_API buffer * strftime_cache_get(server *srv, time_t last_mod);
+
+#endif
@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+#include "base.h"
+#include "joblist.h"
+#include "traffic_shaper.h"
+
+uint64_t traffic_shaper_now(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+void traffic_bucket_refill(traffic_bucket *b, off_t rate, uint64_t now) {
+	off_t add;
+
+	if (b->rate != rate) {
+		b->rate = rate;
+		b->burst = rate * TRAFFIC_BUCKET_BURST_MS / 1000;
+		if (b->burst < TRAFFIC_BUCKET_BURST_MIN) b->burst = TRAFFIC_BUCKET_BURST_MIN;
+
+		b->tokens = b->burst;
+		b->ts = now;
+
+		return;
+	}
+
+	/* the clock went backwards */
+	if (now < b->ts) b->ts = now;
+
+	/* keep the fraction of a token for the next refill */
+	if (0 == (add = (now - b->ts) * rate / 1000)) return;
+
+	b->ts = now;
+	b->tokens += add;
+	if (b->tokens > b->burst) b->tokens = b->burst;
+}
+
+uint64_t traffic_bucket_wait(traffic_bucket *b) {
+	off_t need = b->burst / 2 - b->tokens;
+
+	if (need <= 0) return 0;
+
+	return (need * 1000 + b->rate - 1) / b->rate;
+}
+
+/* the connections which are due at the same ms are woken up in the order
+ * they started to wait, they take turns at the tokens of a shared bucket */
+static int traffic_shaper_before(connection *a, connection *b) {
+	if (a->pacing_wakeup != b->pacing_wakeup) return a->pacing_wakeup < b->pacing_wakeup;
+
+	return (int)(a->pacing_seq - b->pacing_seq) < 0;
+}
+
+/* the heap is ordered by pacing_wakeup, each connection knows its position */
+static void traffic_shaper_set(connections *pacing, size_t ndx, connection *con) {
+	pacing->ptr[ndx] = con;
+	con->pacing_ndx = ndx;
+}
+
+static void traffic_shaper_up(connections *pacing, size_t ndx) {
+	connection *con = pacing->ptr[ndx];
+
+	while (ndx > 0) {
+		size_t parent = (ndx - 1) / 2;
+
+		if (!traffic_shaper_before(con, pacing->ptr[parent])) break;
+
+		traffic_shaper_set(pacing, ndx, pacing->ptr[parent]);
+		ndx = parent;
+	}
+
+	traffic_shaper_set(pacing, ndx, con);
+}
+
+static void traffic_shaper_down(connections *pacing, size_t ndx) {
+	connection *con = pacing->ptr[ndx];
+
+	for (;;) {
+		size_t child = 2 * ndx + 1;
+
+		if (child >= pacing->used) break;
+
+		if (child + 1 < pacing->used &&
+		    traffic_shaper_before(pacing->ptr[child + 1], pacing->ptr[child])) {
+			child++;
+		}
+
+		if (!traffic_shaper_before(pacing->ptr[child], con)) break;
+
+		traffic_shaper_set(pacing, ndx, pacing->ptr[child]);
+		ndx = child;
+	}
+
+	traffic_shaper_set(pacing, ndx, con);
+}
+
+void traffic_shaper_wait(server *srv, connection *con, uint64_t wakeup) {
+	static unsigned int seq = 0;
+	connections *pacing = srv->pacing;
+
+	con->traffic_limit_reached = 1;
+	con->pacing_wakeup = wakeup;
+	con->pacing_seq = seq++;
+
+	if (con->pacing_ndx != -1) {
+		/* already waiting, move it */
+		traffic_shaper_up(pacing, con->pacing_ndx);
+		traffic_shaper_down(pacing, con->pacing_ndx);
+
+		return;
+	}
+
+	if (pacing->size == 0) {
+		pacing->size = 16;
+		pacing->ptr = malloc(sizeof(*pacing->ptr) * pacing->size);
+	} else if (pacing->used == pacing->size) {
+		pacing->size += 16;
+		pacing->ptr = realloc(pacing->ptr, sizeof(*pacing->ptr) * pacing->size);
+	}
+
+	traffic_shaper_set(pacing, pacing->used++, con);
+	traffic_shaper_up(pacing, con->pacing_ndx);
+}
+
+void traffic_shaper_remove(server *srv, connection *con) {
+	connections *pacing = srv->pacing;
+	connection *last;
+	size_t ndx;
+
+	con->traffic_limit_reached = 0;
+
+	if (con->pacing_ndx == -1) return;
+
+	ndx = con->pacing_ndx;
+	con->pacing_ndx = -1;
+
+	if (ndx == --pacing->used) return;
+
+	/* fill the hole with the last one */
+	last = pacing->ptr[pacing->used];
+	traffic_shaper_set(pacing, ndx, last);
+	traffic_shaper_up(pacing, ndx);
+	traffic_shaper_down(pacing, last->pacing_ndx);
+}
+
+int traffic_shaper_get_timeout(server *srv, int max_ms) {
+	connections *pacing = srv->pacing;
+	uint64_t now;
+
+	if (pacing->used == 0) return max_ms;
+
+	now = traffic_shaper_now();
+
+	if (pacing->ptr[0]->pacing_wakeup <= now) return 0;
+	if (pacing->ptr[0]->pacing_wakeup - now >= (uint64_t)max_ms) return max_ms;
+
+	return pacing->ptr[0]->pacing_wakeup - now;
+}
+
+void traffic_shaper_wakeup(server *srv) {
+	connections *pacing = srv->pacing;
+	uint64_t now;
+
+	if (pacing->used == 0) return;
+
+	now = traffic_shaper_now();
+
+	while (pacing->used > 0 && pacing->ptr[0]->pacing_wakeup <= now) {
+		connection *con = pacing->ptr[0];
+
+		traffic_shaper_remove(srv, con);
+
+		joblist_append(srv, con);
+	}
+}
+
+void traffic_shaper_free(server *srv, connections *pacing) {
+	UNUSED(srv);
+
+	free(pacing->ptr);
+	free(pacing);
+}
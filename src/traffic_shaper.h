@@ -0,0 +1,72 @@
+#ifndef _TRAFFIC_SHAPER_H_
+#define _TRAFFIC_SHAPER_H_
+
+#include "base.h"
+
+/**
+ * the traffic-shaper for connection.kbytes-per-second and
+ * server.kbytes-per-second
+ *
+ * each connection and each config-context has a token bucket which is
+ * refilled with the rate every ms. A write takes the tokens it wrote,
+ * the writev and linux-sendfile backends don't write more than the bucket
+ * holds (see iosocket->max_write). The other backends might write more,
+ * the bucket goes negative then.
+ *
+ * If a bucket is empty the connection doesn't wait for the next second
+ * like before, it is put into srv->pacing until the bucket has half of
+ * its burst again. The main-loop shortens the timeout of the poll to the
+ * next wakeup and moves the connections which are due to the joblist.
+ */
+
+/* a bucket holds the bytes of 100ms ... */
+#define TRAFFIC_BUCKET_BURST_MS 100
+/* ... but at least a full segment */
+#define TRAFFIC_BUCKET_BURST_MIN 1460
+
+/* a write takes at most 1/8 of the burst of the bucket of a context, the
+ * other connections of the context get their turn in between */
+#define TRAFFIC_BUCKET_SHARES 8
+
+/**
+ * the ms since the epoch
+ */
+LI_API uint64_t traffic_shaper_now(void);
+
+/**
+ * set the rate of the bucket and add the tokens since the last refill
+ *
+ * a bucket which gets a new rate starts full
+ */
+LI_API void traffic_bucket_refill(traffic_bucket *b, off_t rate, uint64_t now);
+
+/**
+ * the ms until the bucket has half of its burst again
+ */
+LI_API uint64_t traffic_bucket_wait(traffic_bucket *b);
+
+/**
+ * wake up the connection at 'wakeup' (ms)
+ *
+ * the connection must not be registered for events while it waits
+ */
+LI_API void traffic_shaper_wait(server *srv, connection *con, uint64_t wakeup);
+
+/**
+ * the connection is closed or reset before it was woken up
+ */
+LI_API void traffic_shaper_remove(server *srv, connection *con);
+
+/**
+ * @return the ms until the next connection is due, max_ms if none is waiting
+ */
+LI_API int traffic_shaper_get_timeout(server *srv, int max_ms);
+
+/**
+ * move the connections which are due to the joblist
+ */
+LI_API void traffic_shaper_wakeup(server *srv);
+
+LI_API void traffic_shaper_free(server *srv, connections *pacing);
+
+#endif
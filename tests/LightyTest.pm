@@ -337,6 +337,60 @@ sub handle_http {
 	return 0;
 }
 
+# send a request as it is and read the response, for the tests which
+# need the content itself: large, binary or chunked content
+#
+# returns { 'status' => ..., 'headers' => { lowercased name => value }, 'content' => ... }
+# or undef if the connection failed
+sub request {
+	my ($self, $request, $port) = @_;
+	my $r = { 'headers' => {} };
+
+	my $remote =
+	  IO::Socket::INET->new(Proto    => "tcp",
+				PeerAddr => "127.0.0.1",
+				PeerPort => defined $port ? $port : $self->{PORT}) or return undef;
+
+	binmode($remote);
+	print $remote $request;
+	shutdown($remote, 1);
+
+	my $response = "";
+	while (read($remote, my $buf, 65536)) {
+		$response .= $buf;
+	}
+	close $remote;
+
+	my ($header, $content) = split(/\r\n\r\n/, $response, 2);
+	return undef unless defined $content;
+
+	my @lines = split(/\r\n/, $header);
+	(shift @lines) =~ /^HTTP\/1\.[01] ([0-9]{3})/;
+	$r->{'status'} = $1;
+
+	foreach (@lines) {
+		next unless /^([^:]+):\s*(.*)$/;
+		$r->{'headers'}->{lc($1)} = $2;
+	}
+
+	if (defined $r->{'headers'}->{'transfer-encoding'} &&
+	    $r->{'headers'}->{'transfer-encoding'} eq 'chunked') {
+		my $decoded = "";
+
+		while ($content =~ s/^([0-9a-fA-F]+)\r\n//) {
+			my $len = hex($1);
+			last if $len == 0;
+			$decoded .= substr($content, 0, $len);
+			$content = substr($content, $len + 2);
+		}
+		$content = $decoded;
+	}
+
+	$r->{'content'} = $content;
+
+	return $r;
+}
+
 sub spawnfcgi {
 	my ($self, $binary, $port) = @_;
 	my $child = fork();
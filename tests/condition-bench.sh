@@ -0,0 +1,12 @@
+#!/bin/sh
+#
+# prints the 1000 $HTTP["host"] conditionals of condition-bench.conf
+
+i=0
+while [ $i -lt 1000 ]; do
+	echo "\$HTTP[\"host\"] == \"host$i.example.org\" {"
+	echo "  server.name = \"host$i.example.org\""
+	echo "  server.document-root = env.SRCDIR + \"/tmp/lighttpd/servers/www.example.org/pages/\""
+	echo "}"
+	i=`expr $i + 1`
+done
@@ -0,0 +1,111 @@
+#!/usr/bin/perl
+
+# the backend of mod-proxy-core.t
+#
+#   raw=<n>   send n bytes of content without a Content-Length, the
+#             second half a moment after the first one
+#
+#   id=<name>      count the requests for <name>, the count is the content
+#   count=<name>   the count of <name>, not cacheable
+#   cc=<directive> Cache-Control: <directive>
+#   maxage=<n>     Cache-Control: max-age=<n>
+#   vary=<header>  Vary: <header>, its value is appended to the content
+#   etag=<tag>     a matching If-None-Match gets a 304
+#   sleep=<s>      take a while for the answer
+#
+# the md5 of the request content is the answer to a POST
+
+use strict;
+use Digest::MD5;
+use Fcntl qw(:flock);
+
+my %q;
+foreach (split(/&/, $ENV{"QUERY_STRING"})) {
+	my ($k, $v) = split(/=/, $_, 2);
+	$q{$k} = $v;
+}
+
+$| = 1;
+
+if ($ENV{"REQUEST_METHOD"} eq "POST") {
+	my $md5 = Digest::MD5->new;
+
+	binmode(STDIN);
+	$md5->addfile(*STDIN);
+
+	print "Content-Type: text/plain\r\n\r\n";
+	print $md5->hexdigest;
+	exit 0;
+}
+
+if (defined $q{"raw"}) {
+	my $content = substr("0123456789abcdef" x (($q{"raw"} >> 4) + 1), 0, $q{"raw"});
+	my $half = length($content) >> 1;
+
+	print "Content-Type: text/plain\r\n\r\n";
+	print substr($content, 0, $half);
+	select(undef, undef, undef, 0.2);
+	print substr($content, $half);
+	exit 0;
+}
+
+## the counters are next to the script
+
+sub counter {
+	my ($name, $inc) = @_;
+	my $file = $ENV{"SCRIPT_FILENAME"};
+	my $n;
+
+	$file =~ s,[^/]+$,proxy-backend-$name.count,;
+
+	open(my $fh, "+>>", $file) or die;
+	flock($fh, LOCK_EX);
+	seek($fh, 0, 0);
+	$n = <$fh> || 0;
+	if ($inc) {
+		$n++;
+		truncate($fh, 0);
+		print $fh $n;
+	}
+	close($fh);
+
+	return $n;
+}
+
+if (defined $q{"count"}) {
+	my $n = counter($q{"count"}, 0);
+
+	print "Content-Type: text/plain\r\nCache-Control: no-store\r\n\r\n";
+	print $n;
+	exit 0;
+}
+
+if (defined $q{"id"}) {
+	my $content = counter($q{"id"}, 1);
+	my $header = "Content-Type: text/plain\r\n";
+
+	select(undef, undef, undef, $q{"sleep"}) if defined $q{"sleep"};
+
+	$header .= "Cache-Control: ".$q{"cc"}."\r\n" if defined $q{"cc"};
+	$header .= "Cache-Control: max-age=".$q{"maxage"}."\r\n" if defined $q{"maxage"};
+	$header .= "ETag: \"".$q{"etag"}."\"\r\n" if defined $q{"etag"};
+
+	if (defined $q{"vary"}) {
+		my $env = "HTTP_".uc($q{"vary"});
+
+		$env =~ s/-/_/g;
+		$header .= "Vary: ".$q{"vary"}."\r\n";
+		$content .= " ".$ENV{$env};
+	}
+
+	if (defined $q{"etag"} && $ENV{"HTTP_IF_NONE_MATCH"} eq "\"".$q{"etag"}."\"") {
+		print "Status: 304\r\n".$header."\r\n";
+		exit 0;
+	}
+
+	print $header."Content-Length: ".length($content)."\r\n\r\n";
+	print $content;
+	exit 0;
+}
+
+print "Content-Type: text/plain\r\n\r\n";
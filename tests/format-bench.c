@@ -0,0 +1,117 @@
+/**
+ * benchmark for the formatting of client addresses and Last-Modified dates,
+ * not run by the testsuite
+ *
+ * $ cc -O2 -DHAVE_CONFIG_H -I../build -I../src -o format-bench format-bench.c \
+ *      ../src/inet_ntop_cache.c ../src/strftime_cache.c ../src/buffer.c
+ * $ ./format-bench 1000
+ *
+ * each "request" needs the address of one of <clients> clients and the
+ * date of one of <clients> mtimes, like the accesslog and the
+ * Last-Modified header of a static file. It prints the ns per request of
+ *
+ * - inet_ntop() and gmtime() + strftime() for each request
+ * - the hashed caches
+ * - the address string of the connection (con->dst_addr_buf), formatted
+ *   once per connection with <requests per connection> keep-alive requests
+ */
+
+#include <sys/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "base.h"
+#include "inet_ntop_cache.h"
+#include "strftime_cache.h"
+
+#define REQUESTS 2000000
+#define REQUESTS_PER_CONNECTION 10
+
+static double now_ns(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec * 1e9 + tv.tv_usec * 1e3;
+}
+
+int main(int argc, char **argv) {
+	static server srv;
+	sock_addr *addrs;
+	time_t *mtimes;
+	size_t *picks;
+	size_t clients = 1000, i;
+	size_t sum = 0;
+	char b2[INET6_ADDRSTRLEN + 1];
+	char date[64];
+	buffer *dst_addr_buf;
+	double start;
+
+	if (argc > 1) clients = strtoul(argv[1], NULL, 10);
+	if (clients == 0) clients = 1;
+
+	srv.cur_ts = time(NULL);
+	for (i = 0; i < FILE_CACHE_MAX; i++) {
+		srv.mtime_cache[i].mtime = (time_t)-1;
+		srv.mtime_cache[i].str = buffer_init();
+	}
+
+	addrs = calloc(clients, sizeof(*addrs));
+	mtimes = calloc(clients, sizeof(*mtimes));
+	picks = malloc(REQUESTS * sizeof(*picks));
+
+	for (i = 0; i < clients; i++) {
+		/* the clients of a few networks, the files of a few deployments */
+		addrs[i].ipv4.sin_family = AF_INET;
+		addrs[i].ipv4.sin_addr.s_addr = htonl(0xc0000200 + (i % 4) * 0x10000 + i / 4);
+		mtimes[i] = srv.cur_ts - 86400 * (i % 8) - i / 8;
+	}
+
+	srand(1);
+	for (i = 0; i < REQUESTS; i++) {
+		picks[i] = rand() % clients;
+	}
+
+	start = now_ns();
+	for (i = 0; i < REQUESTS; i++) {
+		sock_addr *addr = &(addrs[picks[i]]);
+		struct tm *tm;
+
+		inet_ntop(AF_INET, &(addr->ipv4.sin_addr), b2, sizeof(b2));
+		tm = gmtime(&(mtimes[picks[i]]));
+		sum += strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", tm);
+		sum += b2[0];
+	}
+	printf("%6zu clients: inet_ntop + strftime: %6.1f ns/request\n", clients, (now_ns() - start) / REQUESTS);
+
+	start = now_ns();
+	for (i = 0; i < REQUESTS; i++) {
+		sum += inet_ntop_cache_get_ip(&srv, &(addrs[picks[i]]))[0];
+		sum += strftime_cache_get(&srv, mtimes[picks[i]])->used;
+	}
+	printf("%6zu clients: hashed caches:        %6.1f ns/request\n", clients, (now_ns() - start) / REQUESTS);
+
+	dst_addr_buf = buffer_init();
+	start = now_ns();
+	for (i = 0; i < REQUESTS; i++) {
+		if (i % REQUESTS_PER_CONNECTION == 0) {
+			buffer_copy_string(dst_addr_buf, inet_ntop_cache_get_ip(&srv, &(addrs[picks[i]])));
+		}
+		sum += dst_addr_buf->ptr[0];
+		sum += strftime_cache_get(&srv, mtimes[picks[i]])->used;
+	}
+	printf("%6zu clients: per connection:       %6.1f ns/request\n", clients, (now_ns() - start) / REQUESTS);
+
+	buffer_free(dst_addr_buf);
+	for (i = 0; i < FILE_CACHE_MAX; i++) {
+		buffer_free(srv.mtime_cache[i].str);
+	}
+	free(picks);
+	free(mtimes);
+	free(addrs);
+
+	return sum == 0;
+}
@@ -0,0 +1,121 @@
+#!/usr/bin/env perl
+BEGIN {
+	# add current source dir to the include-path
+	# we need this for make distcheck
+	(my $srcdir = $0) =~ s,/[^/]+$,/,;
+	unshift @INC, $srcdir;
+}
+
+use strict;
+use IO::Socket;
+use Test::More tests => 12;
+use LightyTest;
+
+my $tf = LightyTest->new();
+my $t;
+
+$tf->{CONFIGFILE} = 'mod-extforward.conf';
+
+ok($tf->start_proc == 0, "Starting lighttpd") or die();
+
+## CIDR
+
+$t->{REQUEST}  = ( <<EOF
+GET /get-header.pl?REMOTE_ADDR HTTP/1.0
+Host: cidr-32
+X-Forwarded-For: 192.0.2.1
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '192.0.2.1' } ];
+ok($tf->handle_http($t) == 0, 'trusted by a /32');
+
+$t->{REQUEST}  = ( <<EOF
+GET /get-header.pl?REMOTE_ADDR HTTP/1.0
+Host: cidr-32-miss
+X-Forwarded-For: 192.0.2.1
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '127.0.0.1' } ];
+ok($tf->handle_http($t) == 0, 'not trusted by the /32 of another address');
+
+$t->{REQUEST}  = ( <<EOF
+GET /get-header.pl?REMOTE_ADDR HTTP/1.0
+Host: cidr-8
+X-Forwarded-For: 192.0.2.1, 198.51.100.7, 10.1.2.3
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '198.51.100.7' } ];
+ok($tf->handle_http($t) == 0, 'the chain stops at the untrusted middle hop');
+
+$t->{REQUEST}  = ( <<EOF
+GET /get-header.pl?REMOTE_ADDR HTTP/1.0
+Host: cidr-0
+X-Forwarded-For: 2001:db8::1, 192.0.2.1
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '2001:db8::1' } ];
+ok($tf->handle_http($t) == 0, '0.0.0.0/0 trusts all of IPv4, but no IPv6');
+
+$t->{REQUEST}  = ( <<EOF
+GET /get-header.pl?REMOTE_ADDR HTTP/1.0
+Host: cidr-v6
+X-Forwarded-For: 2001:db9::2, 2001:db9::1, 2001:db8:ffff::1
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '2001:db9::2' } ];
+ok($tf->handle_http($t) == 0, 'IPv6 /32 and /128');
+
+$t->{REQUEST}  = ( <<EOF
+GET /get-header.pl?REMOTE_ADDR HTTP/1.0
+Host: cidr-v6-0
+X-Forwarded-For: 2001:db8::1, 192.0.2.1
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '127.0.0.1' } ];
+ok($tf->handle_http($t) == 0, '::/0 trusts every hop, no client to patch in');
+
+## the dual-stack socket sees us as ::ffff:127.0.0.1
+
+$tf->{PORT} = 2052;
+
+$t->{REQUEST}  = ( <<EOF
+GET /get-header.pl?REMOTE_ADDR HTTP/1.0
+Host: cidr-32
+X-Forwarded-For: 192.0.2.1
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '192.0.2.1' } ];
+ok($tf->handle_http($t) == 0, 'v4-mapped peer on a dual-stack socket');
+
+$tf->{PORT} = 2048;
+
+## Forwarded
+
+$t->{REQUEST}  = ( <<EOF
+GET /get-header.pl?REMOTE_ADDR HTTP/1.0
+Host: forwarded
+Forwarded: for="[2001:db8:cafe::17]:4711";proto=https
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '2001:db8:cafe::17', 'X-Scheme' => 'https' } ];
+ok($tf->handle_http($t) == 0, 'Forwarded: quoted [v6]:port and proto=https');
+
+$t->{REQUEST}  = ( <<EOF
+GET /get-header.pl?REMOTE_ADDR HTTP/1.0
+Host: forwarded
+Forwarded: for=192.0.2.60;proto=http
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '192.0.2.60', '-X-Scheme' => '' } ];
+ok($tf->handle_http($t) == 0, 'Forwarded: proto=http');
+
+$t->{REQUEST}  = ( <<EOF
+GET /get-header.pl?REMOTE_ADDR HTTP/1.0
+Host: forwarded
+X-Forwarded-For: 192.0.2.1
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '127.0.0.1' } ];
+ok($tf->handle_http($t) == 0, 'X-Forwarded-For is ignored if only Forwarded is configured');
+
+ok($tf->stop_proc == 0, "Stopping lighttpd");
@@ -0,0 +1,163 @@
+#!/usr/bin/env perl
+BEGIN {
+	# add current source dir to the include-path
+	# we need this for make distcheck
+	(my $srcdir = $0) =~ s,/[^/]+$,/,;
+	unshift @INC, $srcdir;
+}
+
+use strict;
+use IO::Socket;
+use Test::More tests => 12;
+use LightyTest;
+
+my $tf = LightyTest->new();
+my $t;
+my $docroot = "$tf->{'TESTDIR'}/tmp/lighttpd/servers/www.example.org/pages/";
+
+sub atom {
+	my ($type, @children) = @_;
+	my $payload = join('', @children);
+
+	return pack("N", 8 + length($payload)).$type.$payload;
+}
+
+# a version 0 full atom
+sub full {
+	my ($type, @fields) = @_;
+
+	return atom($type, pack("N", 0), @fields);
+}
+
+# 10 video samples of 1s and 100 bytes each, a chunk per sample, sync samples 1, 5 and 9
+sub moov {
+	my ($mdat_start, %opts) = @_;
+	my $stts = $opts{'stts'} || full('stts', pack("N*", 1, 10, 1000));
+
+	return atom('moov',
+		full('mvhd', pack("N*", 0, 0, 1000, 10000), "\0" x 80),
+		atom('trak',
+			full('tkhd', pack("N*", 0, 0, 1, 0, 10000), "\0" x 60),
+			atom('mdia',
+				full('mdhd', pack("N*", 0, 0, 1000, 10000, 0)),
+				full('hdlr', pack("N", 0), 'vide', "\0" x 12, "\0"),
+				atom('minf',
+					atom('stbl',
+						$stts,
+						full('stss', pack("N*", 3, 1, 5, 9)),
+						full('stsc', pack("N*", 1, 1, 1, 1)),
+						full('stsz', pack("N*", 0, 10), pack("N", 100) x 10),
+						full('stco', pack("N", 10), map { pack("N", $mdat_start + $_ * 100) } 0 .. 9))))));
+}
+
+sub write_mp4 {
+	my ($name, %opts) = @_;
+	my $ftyp = atom('ftyp', 'isom', pack("N", 0), 'isom');
+	my $mdat = join('', map { chr(ord('a') + $_) x 100 } 0 .. 9);
+	my $moov = $opts{'moov'};
+
+	# the chunk offsets depend on the size of the moov
+	$moov = moov(length($ftyp) + length(moov(0, %opts)) + 8, %opts) unless defined $moov;
+
+	open(my $fh, '>', $docroot.$name) or die "$name: $!";
+	binmode($fh);
+	print $fh $ftyp.$moov.atom('mdat', $mdat);
+	close($fh);
+
+	return -s $docroot.$name;
+}
+
+my $good = write_mp4('seek.mp4');
+
+# a stts which claims more entries than it has
+my $truncated_table = write_mp4('truncated-table.mp4', 'stts' => full('stts', pack("N*", 1000, 10, 1000)));
+
+# a trak which claims to be larger than the moov
+my $truncated_atom = write_mp4('truncated-atom.mp4',
+	'moov' => atom('moov', full('mvhd', pack("N*", 0, 0, 1000, 10000), "\0" x 80), pack("N", 4096).'trak'));
+
+# containers nested much deeper than the stack would allow, each one only holds the next
+sub nested {
+	my ($type, $depth) = @_;
+
+	return join('', map { pack("N", 8 * ($depth - $_)).$type } 0 .. $depth - 1);
+}
+my $nested_trak = nested('trak', 100000);
+my $nested_mdia = nested('mdia', 100000);
+my $nested = write_mp4('nested.mp4', 'moov' => atom('moov', full('mvhd', pack("N*", 0, 0, 1000, 10000), "\0" x 80), $nested_trak));
+my $nested_in_trak = write_mp4('nested-in-trak.mp4', 'moov' => atom('moov', full('mvhd', pack("N*", 0, 0, 1000, 10000), "\0" x 80), atom('trak', $nested_mdia)));
+
+ok($tf->start_proc == 0, "Starting lighttpd") or die();
+
+$t->{REQUEST}  = ( <<EOF
+GET /seek.mp4?start=5.5 HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'video/mp4' } ];
+ok($tf->handle_http($t) == 0, 'seek to a sync sample');
+
+$t->{REQUEST}  = ( <<EOF
+GET /seek.mp4?start=100 HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Length' => $good } ];
+ok($tf->handle_http($t) == 0, 'start behind the end sends the full file');
+
+$t->{REQUEST}  = ( <<EOF
+GET /seek.mp4?start=inf HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Length' => $good } ];
+ok($tf->handle_http($t) == 0, 'start=inf sends the full file');
+
+$t->{REQUEST}  = ( <<EOF
+GET /seek.mp4?start=nan HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Length' => $good } ];
+ok($tf->handle_http($t) == 0, 'start=nan sends the full file');
+
+$t->{REQUEST}  = ( <<EOF
+GET /seek.mp4?start=1e300 HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Length' => $good } ];
+ok($tf->handle_http($t) == 0, 'a huge start sends the full file');
+
+$t->{REQUEST}  = ( <<EOF
+GET /truncated-table.mp4?start=5.5 HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Length' => $truncated_table } ];
+ok($tf->handle_http($t) == 0, 'a truncated sample table sends the full file');
+
+$t->{REQUEST}  = ( <<EOF
+GET /truncated-atom.mp4?start=5.5 HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Length' => $truncated_atom } ];
+ok($tf->handle_http($t) == 0, 'a truncated atom sends the full file');
+
+$t->{REQUEST}  = ( <<EOF
+GET /nested.mp4?start=5.5 HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Length' => $nested } ];
+ok($tf->handle_http($t) == 0, 'nested traks are not walked into');
+
+$t->{REQUEST}  = ( <<EOF
+GET /nested-in-trak.mp4?start=5.5 HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Length' => $nested_in_trak } ];
+ok($tf->handle_http($t) == 0, 'nested mdias are not walked into');
+
+$t->{REQUEST}  = ( <<EOF
+GET /seek.mp4?start=5.5 HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'video/mp4' } ];
+ok($tf->handle_http($t) == 0, 'still seeking');
+
+ok($tf->stop_proc == 0, "Stopping lighttpd");
+
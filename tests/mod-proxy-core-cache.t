@@ -0,0 +1,102 @@
+#!/usr/bin/env perl
+BEGIN {
+	# add current source dir to the include-path
+	# we need this for make distcheck
+	(my $srcdir = $0) =~ s,/[^/]+$,/,;
+	unshift @INC, $srcdir;
+}
+
+use strict;
+use IO::Socket;
+use Test::More tests => 17;
+use LightyTest;
+
+my $tf = LightyTest->new();
+my $r;
+
+$tf->{CONFIGFILE} = 'mod-proxy-core.conf';
+
+## the backend counts the requests per id, the count is the content
+
+my $docroot = $tf->{TESTDIR}."/tmp/lighttpd/servers/www.example.org/pages";
+
+unlink(glob("$docroot/proxy-backend-*.count"));
+
+sub get {
+	my ($query, $headers) = @_;
+
+	return $tf->request("GET /proxy-backend.pl?$query HTTP/1.0\r\nHost: cache\r\n".($headers || "")."\r\n");
+}
+
+sub content {
+	my ($r) = @_;
+
+	return defined $r && $r->{'status'} == 200 ? $r->{'content'} : undef;
+}
+
+sub backend_count {
+	my ($id) = @_;
+
+	return content(get("count=$id"));
+}
+
+ok($tf->start_proc == 0, "Starting lighttpd") or die();
+
+## a hit after a miss
+
+ok(content(get("id=hit&maxage=60")) eq '1', 'miss, fetched from the backend');
+ok(content(get("id=hit&maxage=60")) eq '1', 'hit, the backend wasn\'t asked again');
+ok(backend_count("hit") eq '1', 'one backend request for the miss and the hit');
+
+## the variants of a resource don't mix
+
+ok(content(get("id=vary&maxage=60&vary=Accept-Language", "Accept-Language: en\r\n")) eq '1 en', 'Vary, first variant');
+ok(content(get("id=vary&maxage=60&vary=Accept-Language", "Accept-Language: de\r\n")) eq '2 de', 'Vary, the second variant is fetched');
+ok(content(get("id=vary&maxage=60&vary=Accept-Language", "Accept-Language: en\r\n")) eq '1 en', 'Vary, first variant from the cache');
+ok(content(get("id=vary&maxage=60&vary=Accept-Language", "Accept-Language: de\r\n")) eq '2 de', 'Vary, second variant from the cache');
+
+## responses which may not be stored
+
+get("id=no-store&cc=no-store");
+ok(content(get("id=no-store&cc=no-store")) eq '2', 'Cache-Control: no-store isn\'t cached');
+
+get("id=private&cc=private");
+ok(content(get("id=private&cc=private")) eq '2', 'Cache-Control: private isn\'t cached');
+
+get("id=req-no-store&maxage=60", "Cache-Control: no-store\r\n");
+ok(content(get("id=req-no-store&maxage=60")) eq '2', 'a request with Cache-Control: no-store bypasses the cache');
+
+## an expired entry is revalidated, the 304 makes it fresh again
+
+ok(content(get("id=etag&maxage=2&etag=v1")) eq '1', 'revalidation, stored');
+
+select(undef, undef, undef, 3);
+
+ok(content(get("id=etag&maxage=2&etag=v1")) eq '1', 'revalidation, the 304 is answered from the stale entry');
+ok(backend_count("etag") eq '2', 'revalidation, the backend was asked');
+ok(content(get("id=etag&maxage=2&etag=v1")) eq '1' && backend_count("etag") eq '2', 'revalidation, the entry is fresh again');
+
+## concurrent misses wait for the first one
+
+my @pids;
+for (my $i = 0; $i < 5; $i++) {
+	my $pid = fork();
+
+	die "fork failed" unless defined $pid;
+	if ($pid == 0) {
+		exit(content(get("id=collapse&maxage=60&sleep=1")) eq '1' ? 0 : 1);
+	}
+	push @pids, $pid;
+}
+
+my $failed = 0;
+foreach my $pid (@pids) {
+	waitpid($pid, 0);
+	$failed++ if $? != 0;
+}
+
+ok($failed == 0 && backend_count("collapse") eq '1', '5 concurrent misses, one backend request');
+
+ok($tf->stop_proc == 0, "Stopping lighttpd");
+
+unlink(glob("$docroot/proxy-backend-*.count"));
@@ -0,0 +1,156 @@
+#!/usr/bin/env perl
+BEGIN {
+	# add current source dir to the include-path
+	# we need this for make distcheck
+	(my $srcdir = $0) =~ s,/[^/]+$,/,;
+	unshift @INC, $srcdir;
+}
+
+use strict;
+use IO::Socket;
+use IO::Uncompress::Gunzip qw(gunzip);
+use Digest::MD5 qw(md5_hex);
+use Time::HiRes qw(time);
+use Test::More tests => 17;
+use LightyTest;
+
+my $tf = LightyTest->new();
+my $r;
+
+$tf->{CONFIGFILE} = 'mod-proxy-core.conf';
+
+## a large file for the backend, more than a pipe holds
+my $large = "0123456789abcdef" x 65536;
+my $docroot = $tf->{TESTDIR}."/tmp/lighttpd/servers/www.example.org/pages";
+
+open(my $fh, ">", "$docroot/proxy-large.txt") or die;
+print $fh $large;
+close($fh);
+
+ok($tf->start_proc == 0, "Starting lighttpd") or die();
+
+## the content goes out as the backend sent it: splice()d
+
+$r = $tf->request("GET /proxy-large.txt HTTP/1.0\r\n\r\n");
+ok(defined $r && $r->{'status'} == 200 && $r->{'headers'}->{'content-length'} == length($large), 'large response, status and length');
+ok(defined $r && $r->{'content'} eq $large, 'large response, content');
+
+## 1Mbyte at 512kbyte/s takes about 2 seconds, a bucket holds 100ms of it.
+## Past the start no 10ms get more than a bucket, the pipe-chunks are
+## splice()d in portions and not in one go
+
+my $paced = IO::Socket::INET->new(Proto    => "tcp",
+				  PeerAddr => "127.0.0.1",
+				  PeerPort => $tf->{PORT});
+print $paced "GET /proxy-large.txt HTTP/1.0\r\nHost: paced\r\n\r\n";
+
+my ($start, $response, $buf, @reads) = (time(), "");
+while (sysread($paced, $buf, 1048576) > 0) {
+	$response .= $buf;
+	push @reads, [ time() - $start, length($buf) ];
+}
+close($paced);
+
+my ($burst, $window, $first) = (0, 0, 0);
+foreach my $read (@reads) {
+	$window += $read->[1];
+	while ($read->[0] - $reads[$first]->[0] > 0.01) {
+		$window -= $reads[$first++]->[1];
+	}
+	$burst = $window if $read->[0] > 0.3 && $window > $burst;
+}
+
+ok(substr($response, index($response, "\r\n\r\n") + 4) eq $large, 'rate-limited response, content');
+ok(@reads && $reads[-1]->[0] >= 1.5 && $burst <= 52428,
+   sprintf('rate-limited response, paced (%.2fs, at most %d bytes in 10ms)', @reads ? $reads[-1]->[0] : 0, $burst));
+
+## mod_deflate has to see the content, it is copied
+
+$r = $tf->request("GET /proxy-large.txt HTTP/1.0\r\nAccept-Encoding: gzip\r\n\r\n");
+my $inflated;
+ok(defined $r && $r->{'headers'}->{'content-encoding'} eq 'gzip' &&
+   gunzip(\$r->{'content'} => \$inflated) && $inflated eq $large, 'large response through mod_deflate');
+
+## no length from the backend: the content ends with the connection to it
+
+my $raw = substr("0123456789abcdef" x 2048, 0, 32000);
+
+$r = $tf->request("GET /proxy-backend.pl?raw=32000 HTTP/1.0\r\n\r\n");
+ok(defined $r && $r->{'status'} == 200 && $r->{'content'} eq $raw, 'content without a length');
+
+## ... and a HTTP/1.1 client gets it through mod_chunked
+
+$r = $tf->request("GET /proxy-backend.pl?raw=32000 HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n");
+ok(defined $r && $r->{'headers'}->{'transfer-encoding'} eq 'chunked', 'content without a length, chunked for HTTP/1.1');
+ok(defined $r && $r->{'content'} eq $raw, 'content without a length, content through mod_chunked');
+
+## the request content is streamed to the backend, more of it than
+## MAX_REQUEST_CONTENT_STREAM_BUFFER
+
+my $post = "0123456789abcdef" x 65536;
+my $post_request = "POST /proxy-backend.pl HTTP/1.0\r\nHost: stream\r\nContent-Length: ".length($post)."\r\n\r\n";
+
+$r = $tf->request($post_request.$post);
+ok(defined $r && $r->{'status'} == 200 && $r->{'content'} eq md5_hex($post), 'streamed request content');
+
+## a client going away in the middle of the content releases the
+## backend connection, the pool of this host has only one
+
+my $remote = IO::Socket::INET->new(Proto    => "tcp",
+				   PeerAddr => "127.0.0.1",
+				   PeerPort => $tf->{PORT});
+print $remote $post_request.substr($post, 0, 200000);
+select(undef, undef, undef, 0.5);
+close($remote);
+
+ok(1, 'closed the connection in the middle of the content');
+
+$r = undef;
+eval {
+	local $SIG{ALRM} = sub { die "timeout\n" };
+	alarm(10);
+	$r = $tf->request($post_request.$post);
+	alarm(0);
+};
+ok(defined $r && $r->{'status'} == 200 && $r->{'content'} eq md5_hex($post), 'the next request gets the backend connection');
+
+## the backend connection is taken by a slow request, the next one has to
+## go to the backlog
+
+sub while_busy {
+	my ($host, $sleep, $request) = @_;
+	my ($pid, $busy, $r);
+
+	die "fork failed" unless defined ($pid = open($busy, "-|"));
+	if ($pid == 0) {
+		$r = $tf->request("GET /proxy-backend.pl?id=$host&sleep=$sleep HTTP/1.0\r\nHost: $host\r\n\r\n");
+		print defined $r ? $r->{'status'} : 0;
+		exit 0;
+	}
+
+	## let the slow one get the connection first
+	select(undef, undef, undef, 0.5);
+
+	my $start = time();
+	$r = $tf->request($request);
+	my $elapsed = time() - $start;
+
+	my $busy_status = <$busy>;
+	close($busy);
+
+	return ($r, $elapsed, $busy_status);
+}
+
+my ($busy_status, $wait);
+
+($r, $wait, $busy_status) = while_busy("backlog-full", 2, "GET /proxy-backend.pl?id=backlog-full-2 HTTP/1.0\r\nHost: backlog-full\r\n\r\n");
+ok(defined $r && $r->{'status'} == 504 && $wait < 1.5, 'no room in the backlog, 504 right away');
+ok($busy_status == 200, 'no room in the backlog, the busy request is done');
+
+($r, $wait, $busy_status) = while_busy("backlog-deadline", 4, "GET /proxy-backend.pl?id=backlog-deadline-2 HTTP/1.0\r\nHost: backlog-deadline\r\n\r\n");
+ok(defined $r && $r->{'status'} == 503 && $wait > 0.5 && $wait < 3.5, 'past the backlog-deadline, shed with 503');
+ok($busy_status == 200, 'past the backlog-deadline, the busy request is done');
+
+ok($tf->stop_proc == 0, "Stopping lighttpd");
+
+unlink("$docroot/proxy-large.txt", glob("$docroot/proxy-backend-backlog-*.count"));
@@ -8,7 +8,7 @@ BEGIN {
 
 use strict;
 use IO::Socket;
-use Test::More tests => 7;
+use Test::More tests => 19;
 use LightyTest;
 
 my $tf = LightyTest->new();
@@ -60,6 +60,82 @@ SKIP: {
 	ok(0 == $tf->endspawnfcgi($php_child), "Stopping php");
 }
 
+## which rules are tried depends on their literal prefix, the result may not
+
+ok($tf->start_proc == 0, "Starting lighttpd") or goto cleanup;
+
+$t->{REQUEST}  = ( <<EOF
+GET /rewrite/order/c HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'text/html' } ];
+ok($tf->handle_http($t) == 0, 'an anchored rule before an unanchored one');
+
+$t->{REQUEST}  = ( <<EOF
+GET /rewrite/order/b HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'image/jpeg' } ];
+ok($tf->handle_http($t) == 0, 'an unanchored rule before an anchored one');
+
+$t->{REQUEST}  = ( <<EOF
+GET /rewrite/order/a HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'text/plain' } ];
+ok($tf->handle_http($t) == 0, 'the anchored rule after the unanchored one');
+
+$t->{REQUEST}  = ( <<EOF
+GET /rewrite/alt-y HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'text/html' } ];
+ok($tf->handle_http($t) == 0, 'the second branch of a top-level |');
+
+$t->{REQUEST}  = ( <<EOF
+GET /rewrite/qx HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'text/html' } ];
+ok($tf->handle_http($t) == 0, 'the prefix ends before an optional char');
+
+$t->{REQUEST}  = ( <<EOF
+GET /rewrite/qsx HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'text/html' } ];
+ok($tf->handle_http($t) == 0, 'the optional char is there');
+
+$t->{REQUEST}  = ( <<EOF
+GET /rewrite/cls5 HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'text/html' } ];
+ok($tf->handle_http($t) == 0, 'the prefix ends at a class');
+
+$t->{REQUEST}  = ( <<EOF
+GET /rewrite/clsx HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 404 } ];
+ok($tf->handle_http($t) == 0, 'the class doesn\'t match');
+
+$t->{REQUEST}  = ( <<EOF
+GET /quoted HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'text/html' } ];
+ok($tf->handle_http($t) == 0, 'a | behind a quoted (');
+
+$t->{REQUEST}  = ( <<EOF
+GET /rewrite/( HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'text/html' } ];
+ok($tf->handle_http($t) == 0, 'the quoted ( is a literal');
+
+ok($tf->stop_proc == 0, "Stopping lighttpd");
+
 
 exit 0;
 
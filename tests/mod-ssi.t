@@ -8,7 +8,7 @@ BEGIN {
 
 use strict;
 use IO::Socket;
-use Test::More tests => 4;
+use Test::More tests => 5;
 use LightyTest;
 
 my $tf = LightyTest->new();
@@ -34,6 +34,14 @@ EOF
 $t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => "2\n\n" } ];
 ok($tf->handle_http($t) == 0, 'ssi - echo ');
 
+## the text around an exec stays in order
+$t->{REQUEST}  = ( <<EOF
+GET /exec-order.shtml HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => "before\nexec\n\nafter\n" } ];
+ok($tf->handle_http($t) == 0, 'ssi - text before and after an exec');
+
 
 ok($tf->stop_proc == 0, "Stopping lighttpd");
 
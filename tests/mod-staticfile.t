@@ -0,0 +1,109 @@
+#!/usr/bin/env perl
+BEGIN {
+	# add current source dir to the include-path
+	# we need this for make distcheck
+	(my $srcdir = $0) =~ s,/[^/]+$,/,;
+	unshift @INC, $srcdir;
+}
+
+use strict;
+use IO::Socket;
+use Test::More tests => 14;
+use LightyTest;
+
+my $tf = LightyTest->new();
+my $r;
+
+$tf->{CONFIGFILE} = 'mod-staticfile.conf';
+
+my $docroot = $tf->{TESTDIR}."/tmp/lighttpd/servers/www.example.org/pages";
+
+sub write_file {
+	my ($name, $content, $mtime) = @_;
+
+	open(my $fh, ">", "$docroot/$name") or die;
+	binmode($fh);
+	print $fh $content;
+	close($fh);
+
+	utime($mtime, $mtime, "$docroot/$name") or die;
+}
+
+## the counters of the memory-cache
+sub cache_counters {
+	my %c;
+
+	$r = $tf->request("GET /server-statistics HTTP/1.0\r\n\r\n");
+	foreach (split(/\n/, $r->{'content'})) {
+		$c{$1} = $2 if /^staticfile\.cache\.(\w+): (\d+)$/;
+	}
+
+	return \%c;
+}
+
+## all 256 byte values, the content must not be touched on the way
+my $small = join("", map { chr($_ & 0xff) } (0 .. 3999));
+my $changed = join("", map { chr(($_ * 7) & 0xff) } (0 .. 2999));
+my $large = "0123456789abcdef" x 1024;
+my $mtime = time() - 3600;
+
+write_file("memcache.txt", $small, $mtime);
+write_file("memcache-large.txt", $large, $mtime);
+
+ok($tf->start_proc == 0, "Starting lighttpd") or die();
+
+## a miss reads the file into the cache, the hit sends the same bytes
+
+$r = $tf->request("GET /memcache.txt HTTP/1.0\r\n\r\n");
+ok(defined $r && $r->{'status'} == 200 && $r->{'content'} eq $small, 'miss, content');
+
+my $before = cache_counters();
+
+$r = $tf->request("GET /memcache.txt HTTP/1.0\r\n\r\n");
+ok(defined $r && $r->{'status'} == 200 && $r->{'headers'}->{'content-length'} == length($small), 'hit, status and length');
+ok(defined $r && $r->{'content'} eq $small, 'hit, the content is byte-identical');
+
+my $after = cache_counters();
+ok($after->{'hits'} == $before->{'hits'} + 1 && $after->{'misses'} == $before->{'misses'}, 'hit, counted');
+
+## HEAD and Range requests don't take the content from the cache
+
+$before = $after;
+
+$r = $tf->request("HEAD /memcache.txt HTTP/1.0\r\n\r\n");
+ok(defined $r && $r->{'status'} == 200 && $r->{'headers'}->{'content-length'} == length($small) && $r->{'content'} eq '', 'HEAD');
+
+$r = $tf->request("GET /memcache.txt HTTP/1.0\r\nRange: bytes=100-199\r\n\r\n");
+ok(defined $r && $r->{'status'} == 206 && $r->{'content'} eq substr($small, 100, 100), 'Range, content');
+
+$after = cache_counters();
+ok($after->{'hits'} == $before->{'hits'} && $after->{'misses'} == $before->{'misses'}, 'HEAD and Range use the file');
+
+## a new mtime and size invalidate the entry
+
+write_file("memcache.txt", $changed, $mtime + 60);
+
+$before = $after;
+
+$r = $tf->request("GET /memcache.txt HTTP/1.0\r\n\r\n");
+ok(defined $r && $r->{'status'} == 200 && $r->{'content'} eq $changed, 'changed file, new content');
+
+$after = cache_counters();
+ok($after->{'misses'} == $before->{'misses'} + 1, 'changed file, read again');
+
+$r = $tf->request("GET /memcache.txt HTTP/1.0\r\n\r\n");
+ok(defined $r && $r->{'status'} == 200 && $r->{'content'} eq $changed, 'changed file, new content from the cache');
+
+## a file above memory-cache-max-file-size is sent from the file
+
+$before = cache_counters();
+
+$r = $tf->request("GET /memcache-large.txt HTTP/1.0\r\n\r\n");
+ok(defined $r && $r->{'status'} == 200 && $r->{'content'} eq $large, 'large file, content');
+
+$after = cache_counters();
+ok($after->{'objects'} == $before->{'objects'} && $after->{'misses'} == $before->{'misses'}, 'large file, not cached');
+
+ok($tf->stop_proc == 0, "Stopping lighttpd");
+
+unlink("$docroot/memcache.txt", "$docroot/memcache-large.txt");
@@ -8,7 +8,7 @@ BEGIN {
 
 use strict;
 use IO::Socket;
-use Test::More tests => 5;
+use Test::More tests => 9;
 use LightyTest;
 
 my $tf = LightyTest->new();
@@ -40,5 +40,24 @@ EOF
 $t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 301, 'Location' => 'http://www.example.org/~jan/' } ];
 ok($tf->handle_http($t) == 0, 'valid user + redirect');
 
+## userdir.example.org takes every user, the home is looked up by the
+## helper process: the home of the user running the test is a directory
+## and gets listed, a unknown user falls through to the document-root
+
+my $user = getpwuid($<);
+my $r;
+
+$r = $tf->request("GET /~$user/ HTTP/1.0\r\nHost: userdir.example.org\r\n\r\n");
+ok(defined $r && $r->{'status'} == 200 && $r->{'content'} =~ /Index of \/~\Q$user\E\//, 'the home of the user from the lookup');
+
+$r = $tf->request("GET /~$user/ HTTP/1.0\r\nHost: userdir.example.org\r\n\r\n");
+ok(defined $r && $r->{'status'} == 200 && $r->{'content'} =~ /Index of \/~\Q$user\E\//, 'the home of the user from the cache');
+
+$r = $tf->request("GET /~lighttpd-no-such-user/ HTTP/1.0\r\nHost: userdir.example.org\r\n\r\n");
+ok(defined $r && $r->{'status'} == 404, 'unknown user');
+
+$r = $tf->request("GET /~lighttpd-no-such-user/ HTTP/1.0\r\nHost: userdir.example.org\r\n\r\n");
+ok(defined $r && $r->{'status'} == 404, 'unknown user from the cache');
+
 ok($tf->stop_proc == 0, "Stopping lighttpd");
 